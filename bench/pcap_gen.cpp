@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES, ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of NVIDIA CORPORATION &
+ * AFFILIATES (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ *
+ */
+
+/*
+ * Writes a pcap trace of IPv4 TCP packets for the benchmarks. Packet i belongs
+ * to flow (first_flow + i % flows); flow n is 10.x.y.z:<1024 + n % 256> ->
+ * 192.168.0.1:80 with x.y.z = n / 256, the same 5-tuples the replay benchmark
+ * offloads.
+ */
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ETH_HDR_LEN 14
+#define IPV4_HDR_LEN 20
+#define TCP_HDR_LEN 20
+#define MIN_PKT_SIZE (ETH_HDR_LEN + IPV4_HDR_LEN + TCP_HDR_LEN)
+#define MAX_PKT_SIZE 9000
+
+struct pcap_file_hdr {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcap_pkt_hdr {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+};
+
+/*
+ * Internet checksum of a header
+ *
+ * @data [in]: header
+ * @len [in]: header length, even
+ * @return: checksum in network byte order
+ */
+static uint16_t
+ip_checksum(const uint8_t* data, size_t len)
+{
+    uint32_t sum = 0;
+
+    for (size_t i = 0; i < len; i += 2)
+        sum += (data[i] << 8) | data[i + 1];
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return htons(~sum & 0xffff);
+}
+
+/*
+ * Build a packet of a flow
+ *
+ * @pkt [out]: packet buffer, pkt_size bytes
+ * @pkt_size [in]: frame size without FCS
+ * @flow [in]: flow number
+ */
+static void
+build_packet(uint8_t* pkt, uint32_t pkt_size, uint32_t flow)
+{
+    static const uint8_t dst_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+    static const uint8_t src_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    uint8_t* ip = pkt + ETH_HDR_LEN;
+    uint8_t* tcp = ip + IPV4_HDR_LEN;
+    uint32_t src_ip = htonl((10u << 24) | (flow >> 8));
+    uint32_t dst_ip = htonl((192u << 24) | (168u << 16) | 1);
+    uint16_t src_port = htons(1024 + (flow & 0xff));
+    uint16_t dst_port = htons(80);
+    uint16_t value;
+
+    memset(pkt, 0, pkt_size);
+    memcpy(pkt, dst_mac, sizeof(dst_mac));
+    memcpy(pkt + 6, src_mac, sizeof(src_mac));
+    pkt[12] = 0x08;
+    pkt[13] = 0x00;
+
+    ip[0] = 0x45;
+    value = htons(pkt_size - ETH_HDR_LEN);
+    memcpy(ip + 2, &value, sizeof(value));
+    ip[8] = 64;
+    ip[9] = IPPROTO_TCP;
+    memcpy(ip + 12, &src_ip, sizeof(src_ip));
+    memcpy(ip + 16, &dst_ip, sizeof(dst_ip));
+    value = ip_checksum(ip, IPV4_HDR_LEN);
+    memcpy(ip + 10, &value, sizeof(value));
+
+    memcpy(tcp, &src_port, sizeof(src_port));
+    memcpy(tcp + 2, &dst_port, sizeof(dst_port));
+    tcp[12] = (TCP_HDR_LEN / 4) << 4;
+    tcp[13] = 0x10; /* ACK */
+    value = htons(65535);
+    memcpy(tcp + 14, &value, sizeof(value));
+}
+
+static void
+usage(const char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s -o <file> [-f flows] [-s pkt_size] [-n packets] [-b first_flow]\n"
+            "  -f  distinct 5-tuples (default 1000)\n"
+            "  -s  frame size without FCS, %d to %d (default 64)\n"
+            "  -n  packets in the trace (default 100000)\n"
+            "  -b  number of the first flow, to keep traces disjoint (default 0)\n",
+            prog, MIN_PKT_SIZE, MAX_PKT_SIZE);
+}
+
+int
+main(int argc, char** argv)
+{
+    const char* path = NULL;
+    uint32_t nb_flows = 1000, pkt_size = 64, nb_packets = 100000, first_flow = 0;
+    struct pcap_file_hdr file_hdr = { 0xa1b2c3d4, 2, 4, 0, 0, MAX_PKT_SIZE, 1 /* Ethernet */ };
+    struct pcap_pkt_hdr pkt_hdr = {};
+    uint8_t pkt[MAX_PKT_SIZE];
+    FILE* file;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:f:s:n:b:h")) != -1) {
+        switch (opt) {
+            case 'o':
+                path = optarg;
+                break;
+            case 'f':
+                nb_flows = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                pkt_size = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                nb_packets = strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                first_flow = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (path == NULL || nb_flows == 0 || pkt_size < MIN_PKT_SIZE || pkt_size > MAX_PKT_SIZE) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    fwrite(&file_hdr, sizeof(file_hdr), 1, file);
+    pkt_hdr.incl_len = pkt_size;
+    pkt_hdr.orig_len = pkt_size;
+    for (uint32_t i = 0; i < nb_packets; i++) {
+        build_packet(pkt, pkt_size, first_flow + i % nb_flows);
+        pkt_hdr.ts_usec = i % 1000000;
+        pkt_hdr.ts_sec = i / 1000000;
+        fwrite(&pkt_hdr, sizeof(pkt_hdr), 1, file);
+        fwrite(pkt, pkt_size, 1, file);
+    }
+    if (fclose(file) != 0) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# Slow path benchmark: runs the application with the simulated flow backend on
+# two net_pcap virtual devices replaying generated traces in a loop, so it only
+# needs hugepages, no NIC. Each PMD queue of each port gets its own trace with
+# disjoint flows, as RSS would spread them.
+#
+# Usage: run_bench.sh <doca-selective-fwd> <pcap_gen>
+#
+# Tunables, from the environment:
+#   BENCH_FLOWS     distinct 5-tuples per queue trace (default 1000)
+#   BENCH_PKT_SIZE  frame size without FCS (default 64)
+#   BENCH_PACKETS   packets per queue trace (default 100000)
+#   BENCH_LCORES    PMD lcores, lcore 0 runs the main thread (default 1)
+#   BENCH_DURATION  seconds of forwarding (default 10)
+#   BENCH_RESULTS   JSON results path (default bench_results.json)
+#   BENCH_DIR       where to write the traces (default a temporary directory)
+#   BENCH_ARGS      extra application flags, e.g. --sim-latency-us 50
+#
+
+set -e
+
+if [ $# -ne 2 ]; then
+    echo "Usage: $0 <doca-selective-fwd> <pcap_gen>" >&2
+    exit 1
+fi
+APP=$1
+PCAP_GEN=$2
+
+FLOWS=${BENCH_FLOWS:-1000}
+PKT_SIZE=${BENCH_PKT_SIZE:-64}
+PACKETS=${BENCH_PACKETS:-100000}
+LCORES=${BENCH_LCORES:-1}
+DURATION=${BENCH_DURATION:-10}
+RESULTS=${BENCH_RESULTS:-bench_results.json}
+
+if [ -n "$BENCH_DIR" ]; then
+    WORKDIR=$BENCH_DIR
+    mkdir -p "$WORKDIR"
+else
+    WORKDIR=$(mktemp -d)
+    trap 'rm -rf "$WORKDIR"' EXIT
+fi
+
+VDEVS=""
+for port in 0 1; do
+    dev="net_pcap$port"
+    queue=0
+    while [ $queue -lt "$LCORES" ]; do
+        trace="$WORKDIR/port${port}_queue${queue}.pcap"
+        "$PCAP_GEN" -o "$trace" -f "$FLOWS" -s "$PKT_SIZE" -n "$PACKETS" \
+            -b $(((port * LCORES + queue) * FLOWS))
+        # one rx_pcap per queue; without a tx_pcap the Tx queues drop
+        dev="$dev,rx_pcap=$trace"
+        queue=$((queue + 1))
+    done
+    VDEVS="$VDEVS --vdev $dev,infinite_rx=1"
+done
+
+echo "bench: $LCORES lcores, $FLOWS flows and $PACKETS packets of $PKT_SIZE bytes per queue, ${DURATION}s"
+# shellcheck disable=SC2086
+"$APP" --no-pci $VDEVS -l 0-"$LCORES" -- \
+    --flow-backend sim --duration "$DURATION" --results-json "$RESULTS" $BENCH_ARGS
+echo "bench: results in $RESULTS"
@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES, ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of NVIDIA CORPORATION &
+ * AFFILIATES (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ *
+ */
+
+#include "selective_fwd.h"
+
+DOCA_LOG_REGISTER(SELECTIVE_FWD_AGGREGATE);
+
+/*
+ * Aggregate offload. Trusted aggregates (source and destination prefixes, L4
+ * port ranges, ingress and egress port) are configured at startup. When a new
+ * flow gets an offload verdict, the pmd looks for the widest aggregate which
+ * contains the flow and forwards it like the verdict does, unmetered, and
+ * installs a single masked rule for it in the ACL pipe of its ingress port
+ * instead of an exact entry for the flow. The later flows of the aggregate
+ * never reach software.
+ *
+ * The ACL pipe sits on the miss path of the hairpin pipe, so exact entries,
+ * metered ones included, keep precedence over the aggregates. Aggregate rules
+ * do not age, they stay installed until the pipes are flushed.
+ */
+
+enum aggregate_state {
+    AGGREGATE_IDLE,
+    // a pmd is adding the rule
+    AGGREGATE_INSTALLING,
+    AGGREGATE_INSTALLED,
+    // the rule could not be added, its flows are offloaded one by one
+    AGGREGATE_FAILED,
+};
+
+static struct selective_fwd_cfg* aggregate_cfg;
+static std::atomic<uint8_t> aggregate_states[MAX_AGGREGATES];
+// user context of each rule, for the entry process callback
+static struct flow_ctx* aggregate_ctxs[MAX_AGGREGATES];
+static struct doca_flow_pipe* acl_pipes[MAX_PORTS];
+
+/*
+ * Mask of an IPv4 prefix, in network order
+ *
+ * @prefix [in]: prefix length
+ * @return: the mask
+ */
+doca_be32_t
+aggregate_prefix_mask(uint8_t prefix)
+{
+    return prefix == 0 ? 0 : rte_cpu_to_be_32(UINT32_MAX << (32 - prefix));
+}
+
+/*
+ * Number of wildcarded bits of a port range, rounded down
+ *
+ * @min [in]: first port of the range
+ * @max [in]: last port of the range
+ * @return: log2 of the range size
+ */
+static uint16_t
+range_bits(uint16_t min, uint16_t max)
+{
+    return 31 - __builtin_clz((uint32_t)max - min + 1);
+}
+
+doca_error_t
+aggregate_init(struct selective_fwd_cfg* cfg, uint16_t nb_ports)
+{
+    aggregate_cfg = cfg;
+    for (uint16_t i = 0; i < cfg->nb_aggregates; i++) {
+        struct aggregate_rule* rule = &cfg->aggregates[i];
+
+        if (rule->port_in >= nb_ports || rule->port_out >= nb_ports) {
+            DOCA_LOG_ERR("Aggregate %u forwards from port %u to port %u, only %u ports",
+                         i, rule->port_in, rule->port_out, nb_ports);
+            return DOCA_ERROR_INVALID_VALUE;
+        }
+        rule->src_ip &= aggregate_prefix_mask(rule->src_prefix);
+        rule->dst_ip &= aggregate_prefix_mask(rule->dst_prefix);
+        rule->priority = (32 - rule->src_prefix) + (32 - rule->dst_prefix) +
+                         range_bits(rule->src_port_min, rule->src_port_max) +
+                         range_bits(rule->dst_port_min, rule->dst_port_max);
+        aggregate_states[i] = AGGREGATE_IDLE;
+    }
+    if (cfg->nb_aggregates > 0)
+        DOCA_LOG_INFO("%u trusted aggregates", cfg->nb_aggregates);
+    return DOCA_SUCCESS;
+}
+
+uint16_t
+aggregate_count(void)
+{
+    return aggregate_cfg != NULL ? aggregate_cfg->nb_aggregates : 0;
+}
+
+bool
+aggregate_contains(const struct aggregate_rule* rule, const struct flow_key* key)
+{
+    uint16_t src_port = rte_be_to_cpu_16(key->src_port);
+    uint16_t dst_port = rte_be_to_cpu_16(key->dst_port);
+
+    return (key->src_ip & aggregate_prefix_mask(rule->src_prefix)) == rule->src_ip &&
+           (key->dst_ip & aggregate_prefix_mask(rule->dst_prefix)) == rule->dst_ip &&
+           src_port >= rule->src_port_min && src_port <= rule->src_port_max &&
+           dst_port >= rule->dst_port_min && dst_port <= rule->dst_port_max;
+}
+
+/*
+ * Create the ACL pipe of a port, only when aggregates are configured
+ *
+ * @port [in]: port of the pipe
+ * @port_id [in]: port ID of the pipe
+ * @pipe_fwd_miss [in]: pipe the packets matching no aggregate go to
+ * @pipe [out]: created pipe, or pipe_fwd_miss without aggregates
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+doca_error_t
+aggregate_pipe_create(struct doca_flow_port* port,
+                      int port_id,
+                      struct doca_flow_pipe* pipe_fwd_miss,
+                      struct doca_flow_pipe** pipe)
+{
+    doca_error_t result;
+
+    if (aggregate_count() == 0) {
+        *pipe = pipe_fwd_miss;
+        return DOCA_SUCCESS;
+    }
+
+    result = flow_backend->create_acl_pipe(port, pipe_fwd_miss, MAX_AGGREGATES, &acl_pipes[port_id]);
+    if (result != DOCA_SUCCESS)
+        return result;
+    *pipe = acl_pipes[port_id];
+    return DOCA_SUCCESS;
+}
+
+/*
+ * Widest aggregate containing a flow which forwards it as its verdict does;
+ * aggregate rules are not metered, so metered flows have none
+ *
+ * @port_id_in [in]: port the flow is received on
+ * @port_id_out [in]: port the verdict forwards the flow to
+ * @meter_profile [in]: meter profile given by the verdict
+ * @key [in]: 5-tuple of the flow
+ * @return: index of the aggregate, -1 when there is none
+ */
+static int
+aggregate_find(int port_id_in, int port_id_out, uint8_t meter_profile, const struct flow_key* key)
+{
+    int widest = -1;
+
+    if (meter_profile != 0)
+        return -1;
+    for (uint16_t i = 0; i < aggregate_count(); i++) {
+        const struct aggregate_rule* rule = &aggregate_cfg->aggregates[i];
+
+        if (rule->port_in != port_id_in || rule->port_out != port_id_out || !aggregate_contains(rule, key))
+            continue;
+        if (widest < 0 || rule->priority > aggregate_cfg->aggregates[widest].priority)
+            widest = i;
+    }
+    return widest;
+}
+
+/*
+ * Add the rule of an aggregate on the pipe queue of the pmd and wait for its
+ * completion, one pmd at a time
+ *
+ * @params [in]: pmd parameters
+ * @index [in]: index of the aggregate
+ * @return: DOCA_SUCCESS once the rule is installed, DOCA_ERROR_AGAIN while
+ *          another pmd adds it and DOCA_ERROR otherwise
+ */
+static doca_error_t
+aggregate_install(struct pmd_params_t* params, int index)
+{
+    const struct aggregate_rule* rule = &aggregate_cfg->aggregates[index];
+    uint8_t state = AGGREGATE_IDLE;
+    struct hairpin_fwd fwd;
+    struct flow_ctx* ctx;
+    doca_error_t result;
+
+    if (!aggregate_states[index].compare_exchange_strong(state, AGGREGATE_INSTALLING)) {
+        if (state == AGGREGATE_INSTALLED)
+            return DOCA_SUCCESS;
+        return state == AGGREGATE_FAILED ? DOCA_ERROR_BAD_STATE : DOCA_ERROR_AGAIN;
+    }
+
+    ctx = new flow_ctx();
+    ctx->owner = params;
+    ctx->key.src_ip = rule->src_ip;
+    ctx->key.dst_ip = rule->dst_ip;
+    ctx->port_in = rule->port_in;
+    ctx->port_out = rule->port_out;
+    fwd.port_id_out = rule->port_out;
+    fwd.base_hairpin_q = params->app_cfg->hairpin_queues[rule->port_in][rule->port_out];
+    fwd.hairpin_q_len = params->app_cfg->hairpin_q_count;
+    fwd.meter_id = 0;
+    fwd.color_pipe = NULL;
+    fwd.sample_pipe = NULL;
+
+    result = flow_backend->add_acl_entry(params->queue_id, acl_pipes[rule->port_in], rule, &fwd,
+                                         DOCA_FLOW_NO_WAIT, ctx, &ctx->entry);
+    // the queue also carries the pmd's own removals, wait for this rule's completion
+    if (result == DOCA_SUCCESS)
+        result = wait_entry_processed(params->ports[rule->port_in], params->queue_id, &ctx->status);
+    if (result == DOCA_SUCCESS && ctx->status.failure)
+        result = DOCA_ERROR_BAD_STATE;
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_WARN("Failed to add the rule of aggregate %d, offloading its flows one by one: %s",
+                      index, doca_error_get_descr(result));
+        // a completion still pending releases the context
+        if (ctx->entry == NULL || ctx->status.nb_processed != 0)
+            flow_ctx_free(ctx);
+        else
+            ctx->orphaned = true;
+        aggregate_states[index] = AGGREGATE_FAILED;
+        return result;
+    }
+
+    aggregate_ctxs[index] = ctx;
+    aggregate_states[index] = AGGREGATE_INSTALLED;
+    DOCA_LOG_INFO("Offloaded aggregate %d from port %u to port %u", index, rule->port_in, rule->port_out);
+    return DOCA_SUCCESS;
+}
+
+/*
+ * Offload a new flow through the widest safe aggregate containing it, adding
+ * the aggregate's rule on first use
+ *
+ * @params [in]: pmd parameters
+ * @port_id_in [in]: port the flow is received on
+ * @port_id_out [in]: port the verdict forwards the flow to
+ * @meter_profile [in]: meter profile given by the verdict
+ * @key [in]: 5-tuple of the flow
+ * @return: true when an installed aggregate rule covers the flow, false when
+ *          the flow needs an entry of its own
+ */
+bool
+aggregate_offload(struct pmd_params_t* params,
+                  int port_id_in,
+                  int port_id_out,
+                  uint8_t meter_profile,
+                  const struct flow_key* key)
+{
+    int index = aggregate_find(port_id_in, port_id_out, meter_profile, key);
+
+    return index >= 0 && aggregate_install(params, index) == DOCA_SUCCESS;
+}
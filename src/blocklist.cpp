@@ -0,0 +1,396 @@
+/*
+ * Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES, ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of NVIDIA CORPORATION &
+ * AFFILIATES (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ *
+ */
+
+#include <unordered_set>
+
+#include "selective_fwd.h"
+
+DOCA_LOG_REGISTER(SELECTIVE_FWD_BLOCKLIST);
+
+/*
+ * Source blocklist. The prefixes of an IP reputation feed are loaded from a
+ * file into an LPM pipe in front of the hairpin pipe of every port, which
+ * drops the packets whose source falls in one of them before they reach the
+ * hairpin pipe or software. On SIGHUP the file is read again and only the
+ * difference is applied: prefixes gone from the file are removed, new ones
+ * added, the others stay in place.
+ *
+ * The prefixes are added and removed by the main thread on its pipe queue, in
+ * batches of HAIRPIN_BATCH_SZ whose completions are collected at once, so
+ * large feeds load at the rate of the pipe queue rather than of single
+ * entries.
+ */
+
+// Per-prefix context, passed as the user context of blocklist entries
+struct blocklist_entry {
+    // must be first, like in flow_ctx
+    struct entries_status status;
+    enum entry_kind kind;
+    uint8_t port_id;
+    // see blocklist_prefix_key()
+    uint64_t prefix;
+    struct doca_flow_pipe_entry* entry;
+};
+
+static struct {
+    const struct selective_fwd_cfg* cfg;
+    struct application_dpdk_config* app_cfg;
+    struct doca_flow_port** ports;
+    struct doca_flow_pipe* pipes[MAX_PORTS];
+    // prefixes of each port, only touched by the main thread
+    std::unordered_map<uint64_t, struct blocklist_entry*> entries[MAX_PORTS];
+    // operations submitted and not completed yet, and failed additions
+    uint32_t nb_pending;
+    uint32_t nb_failed;
+} blocklist;
+
+// Set by SIGHUP, the main thread reloads the file
+static std::atomic<bool> reload_requested(false);
+
+doca_error_t
+blocklist_init(const struct selective_fwd_cfg* cfg,
+               struct application_dpdk_config* app_cfg,
+               struct doca_flow_port* ports[MAX_PORTS])
+{
+    blocklist.cfg = cfg;
+    blocklist.app_cfg = app_cfg;
+    blocklist.ports = ports;
+    blocklist.nb_pending = 0;
+    blocklist.nb_failed = 0;
+    return DOCA_SUCCESS;
+}
+
+bool
+blocklist_enabled(void)
+{
+    return blocklist.cfg != NULL &&
+           (blocklist.cfg->blocklist[0] != '\0' || blocklist.cfg->blocklist_bench_prefixes > 0);
+}
+
+/*
+ * Create the blocklist pipe of a port in front of its hairpin pipe, only when
+ * a blocklist is configured
+ *
+ * @port [in]: port of the pipe
+ * @port_id [in]: port ID of the pipe
+ * @pipe_queue [in]: pipe queue the root entry is added on
+ * @pipe_fwd_miss [in]: pipe the packets of sources not blocklisted go to
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+doca_error_t
+blocklist_pipe_create(struct doca_flow_port* port, int port_id, uint16_t pipe_queue,
+                      struct doca_flow_pipe* pipe_fwd_miss)
+{
+    if (!blocklist_enabled())
+        return DOCA_SUCCESS;
+    return flow_backend->create_blocklist_pipe(port,
+                                               pipe_queue,
+                                               pipe_fwd_miss,
+                                               BLOCKLIST_MAX_PREFIXES,
+                                               &blocklist.pipes[port_id]);
+}
+
+/*
+ * Read the prefixes of the blocklist file, one a.b.c.d[/len] per line; blank
+ * lines and # comments are skipped, invalid lines are skipped with a warning
+ *
+ * @path [in]: blocklist file
+ * @prefixes [out]: distinct prefixes, see blocklist_prefix_key()
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+static doca_error_t
+blocklist_read(const char* path, std::vector<uint64_t>& prefixes)
+{
+    std::unordered_set<uint64_t> seen;
+    uint32_t line_nb = 0, nb_invalid = 0;
+    size_t line_size = 0;
+    char* line = NULL;
+    FILE* file;
+
+    file = fopen(path, "r");
+    if (file == NULL) {
+        DOCA_LOG_ERR("Failed to open blocklist %s: %s", path, strerror(errno));
+        return DOCA_ERROR_IO_FAILED;
+    }
+
+    while (getline(&line, &line_size, file) >= 0) {
+        char* str = line + strspn(line, " \t");
+        doca_be32_t addr;
+        uint8_t prefix;
+
+        line_nb++;
+        str[strcspn(str, "# \t\r\n")] = '\0';
+        if (*str == '\0')
+            continue;
+        if (!parse_ipv4_prefix(str, &addr, &prefix)) {
+            if (nb_invalid++ < 10)
+                DOCA_LOG_WARN("Skipping invalid prefix on line %u of %s", line_nb, path);
+            continue;
+        }
+        if (seen.insert(blocklist_prefix_key(addr, prefix)).second)
+            prefixes.push_back(blocklist_prefix_key(addr, prefix));
+    }
+    free(line);
+    fclose(file);
+
+    if (nb_invalid > 0)
+        DOCA_LOG_WARN("Skipped %u invalid prefixes of %s", nb_invalid, path);
+    if (prefixes.size() > BLOCKLIST_MAX_PREFIXES) {
+        DOCA_LOG_ERR("Blocklist %s holds %zu prefixes, max %d", path, prefixes.size(), BLOCKLIST_MAX_PREFIXES);
+        return DOCA_ERROR_TOO_BIG;
+    }
+    return DOCA_SUCCESS;
+}
+
+/*
+ * Entry process callback of the blocklist entries, runs on the main thread
+ *
+ * @entry [in]: DOCA Flow entry
+ * @status [in]: operation status
+ * @op [in]: operation
+ * @user_ctx [in]: blocklist entry
+ */
+void
+blocklist_entry_process(struct doca_flow_pipe_entry* entry,
+                        enum doca_flow_entry_status status,
+                        enum doca_flow_entry_op op,
+                        void* user_ctx)
+{
+    struct blocklist_entry* ble = (struct blocklist_entry*)user_ctx;
+
+    (void)entry;
+    switch (op) {
+        case DOCA_FLOW_ENTRY_OP_ADD:
+            blocklist.nb_pending--;
+            if (status == DOCA_FLOW_ENTRY_STATUS_SUCCESS)
+                break;
+            blocklist.nb_failed++;
+            blocklist.entries[ble->port_id].erase(ble->prefix);
+            delete ble;
+            break;
+        case DOCA_FLOW_ENTRY_OP_DEL:
+            blocklist.nb_pending--;
+            delete ble;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Collect the completions of the operations submitted on a port
+ *
+ * @port_id [in]: port the operations were submitted on
+ */
+static void
+blocklist_complete(int port_id)
+{
+    for (int retry = 0; retry < BATCH_PROCESS_RETRIES && blocklist.nb_pending > 0; retry++)
+        flow_backend->entries_process(blocklist.ports[port_id], main_pipe_queue(blocklist.app_cfg),
+                                      DEFAULT_TIMEOUT_US, blocklist.nb_pending);
+}
+
+/*
+ * Submit the addition of a prefix, or its removal
+ *
+ * @port_id [in]: port of the blocklist pipe
+ * @prefix [in]: prefix, see blocklist_prefix_key()
+ * @add [in]: whether to add or remove the prefix
+ * @flags [in]: DOCA_FLOW_WAIT_FOR_BATCH or DOCA_FLOW_NO_WAIT
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+static doca_error_t
+blocklist_submit(int port_id, uint64_t prefix, bool add, uint32_t flags)
+{
+    uint16_t pipe_queue = main_pipe_queue(blocklist.app_cfg);
+    struct blocklist_entry* ble;
+    doca_error_t result;
+
+    if (!add) {
+        ble = blocklist.entries[port_id][prefix];
+        result = flow_backend->remove_entry(pipe_queue, flags, ble->entry);
+        if (result != DOCA_SUCCESS)
+            return result;
+        blocklist.entries[port_id].erase(prefix);
+        blocklist.nb_pending++;
+        return DOCA_SUCCESS;
+    }
+
+    ble = new blocklist_entry();
+    ble->kind = ENTRY_BLOCKLIST;
+    ble->port_id = port_id;
+    ble->prefix = prefix;
+    result = flow_backend->add_blocklist_entry(pipe_queue, blocklist.pipes[port_id],
+                                               rte_cpu_to_be_32((uint32_t)prefix), prefix >> 32,
+                                               flags, ble, &ble->entry);
+    if (result != DOCA_SUCCESS) {
+        delete ble;
+        return result;
+    }
+    blocklist.entries[port_id][prefix] = ble;
+    blocklist.nb_pending++;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * Bring the blocklist pipe of a port to a set of prefixes: remove the ones
+ * not in it, then add the missing ones, in batches of HAIRPIN_BATCH_SZ
+ *
+ * @port_id [in]: port of the blocklist pipe
+ * @wanted [in]: prefixes the pipe should hold
+ * @nb_added [out]: prefixes submitted for addition
+ * @nb_removed [out]: prefixes removed
+ * @return: number of operations which could not be submitted
+ */
+static uint32_t
+blocklist_update_port(int port_id, const std::unordered_set<uint64_t>& wanted, uint32_t* nb_added,
+                      uint32_t* nb_removed)
+{
+    std::vector<std::pair<uint64_t, bool>> ops;
+    uint32_t batch_len = 0, nb_errors = 0;
+
+    for (const auto& it : blocklist.entries[port_id])
+        if (wanted.count(it.first) == 0)
+            ops.emplace_back(it.first, false);
+    *nb_removed = ops.size();
+    for (uint64_t prefix : wanted)
+        if (blocklist.entries[port_id].count(prefix) == 0)
+            ops.emplace_back(prefix, true);
+    *nb_added = ops.size() - *nb_removed;
+
+    for (size_t i = 0; i < ops.size(); i++) {
+        // the last operation of a batch pushes the batch to the NIC
+        bool last = ++batch_len == HAIRPIN_BATCH_SZ || i == ops.size() - 1;
+        doca_error_t result = blocklist_submit(port_id, ops[i].first, ops[i].second,
+                                               last ? DOCA_FLOW_NO_WAIT : DOCA_FLOW_WAIT_FOR_BATCH);
+
+        if (result != DOCA_SUCCESS && nb_errors++ == 0)
+            DOCA_LOG_WARN("Failed to update the blocklist of port %d: %s", port_id, doca_error_get_descr(result));
+        if (last) {
+            blocklist_complete(port_id);
+            batch_len = 0;
+        }
+    }
+    return nb_errors;
+}
+
+/*
+ * Bring the blocklist pipes of every port to a set of prefixes, and report
+ * the time it took
+ *
+ * @prefixes [in]: prefixes the pipes should hold
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+static doca_error_t
+blocklist_apply(const std::vector<uint64_t>& prefixes)
+{
+    std::unordered_set<uint64_t> wanted(prefixes.begin(), prefixes.end());
+    uint32_t nb_added = 0, nb_removed = 0, nb_errors = 0;
+    uint64_t start = rte_get_tsc_cycles();
+    double elapsed_sec;
+
+    blocklist.nb_failed = 0;
+    for (int port_id = 0; port_id < blocklist.app_cfg->port_config.nb_ports; port_id++) {
+        uint32_t port_added, port_removed;
+
+        nb_errors += blocklist_update_port(port_id, wanted, &port_added, &port_removed);
+        nb_added += port_added;
+        nb_removed += port_removed;
+    }
+    elapsed_sec = (double)(rte_get_tsc_cycles() - start) / rte_get_tsc_hz();
+
+    DOCA_LOG_INFO("Blocklist of %zu prefixes: added %u and removed %u entries in %.1f ms, %.0f entries/s",
+                  prefixes.size(), nb_added, nb_removed, elapsed_sec * 1000,
+                  elapsed_sec > 0 ? (nb_added + nb_removed) / elapsed_sec : 0);
+    if (nb_errors + blocklist.nb_failed > 0)
+        DOCA_LOG_WARN("%u blocklist updates failed, %u completions still pending",
+                      nb_errors + blocklist.nb_failed, blocklist.nb_pending);
+    return nb_errors + blocklist.nb_failed == nb_added + nb_removed && nb_added + nb_removed > 0 ?
+           DOCA_ERROR_BAD_STATE : DOCA_SUCCESS;
+}
+
+/*
+ * Load the blocklist file, or apply its changes when already loaded
+ *
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+doca_error_t
+blocklist_load(void)
+{
+    std::vector<uint64_t> prefixes;
+    doca_error_t result;
+
+    result = blocklist_read(blocklist.cfg->blocklist, prefixes);
+    if (result != DOCA_SUCCESS)
+        return result;
+    return blocklist_apply(prefixes);
+}
+
+/*
+ * Ask the main thread to reload the blocklist file, safe in a signal handler
+ */
+void
+blocklist_request_reload(void)
+{
+    reload_requested = true;
+}
+
+/*
+ * Reload the blocklist file when asked to, keeping the current prefixes when
+ * it cannot be read. Must run on the main thread.
+ */
+void
+blocklist_poll(void)
+{
+    doca_error_t result;
+
+    if (!reload_requested.exchange(false))
+        return;
+    DOCA_LOG_INFO("Reloading blocklist %s", blocklist.cfg->blocklist);
+    result = blocklist_load();
+    if (result != DOCA_SUCCESS)
+        DOCA_LOG_ERR("Failed to reload blocklist: %s", doca_error_get_descr(result));
+}
+
+/*
+ * Load synthetic prefixes into the blocklist pipes and report the time to
+ * load them
+ *
+ * @nb_prefixes [in]: number of prefixes, distinct /24s from 1.0.0.0
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+doca_error_t
+blocklist_bench(uint32_t nb_prefixes)
+{
+    std::vector<uint64_t> prefixes(nb_prefixes);
+
+    for (uint32_t i = 0; i < nb_prefixes; i++)
+        prefixes[i] = blocklist_prefix_key(rte_cpu_to_be_32((1u << 24) + (i << 8)), 24);
+
+    DOCA_LOG_INFO("Blocklist benchmark: loading %u synthetic prefixes on %u ports", nb_prefixes,
+                  blocklist.app_cfg->port_config.nb_ports);
+    return blocklist_apply(prefixes);
+}
+
+/*
+ * Release the contexts of the blocklist entries, once the pipes are flushed
+ */
+void
+blocklist_fini(void)
+{
+    for (int port_id = 0; port_id < MAX_PORTS; port_id++) {
+        for (const auto& it : blocklist.entries[port_id])
+            delete it.second;
+        blocklist.entries[port_id].clear();
+    }
+}
@@ -0,0 +1,604 @@
+/*
+ * Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES, ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of NVIDIA CORPORATION &
+ * AFFILIATES (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ *
+ */
+
+#include "selective_fwd.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+
+DOCA_LOG_REGISTER(SELECTIVE_FWD_CAPTURE);
+
+/*
+ * On-demand capture of the slow path into pcapng, controlled at runtime over
+ * a UNIX socket, one text command per connection:
+ *
+ *   start <file> [snaplen <bytes>] [src <prefix>] [dst <prefix>] [port <l4 port>] [in <port id>]
+ *   filter [snaplen <bytes>] [src <prefix>] [dst <prefix>] [port <l4 port>] [in <port id>]
+ *   stop
+ *   status
+ *
+ * While no capture runs a pmd only reads capture_on. While one runs, the pmd
+ * matches each slow path packet against the filter, a handful of atomics it
+ * reads without locking, copies up to snaplen bytes of the matching ones into
+ * the capture pool and queues the copy on its own single producer, single
+ * consumer ring, once it knows what it did with the packet. A full ring or an
+ * empty pool drops the copy, never the packet. The writer thread drains the
+ * rings into the file, each packet with a comment naming its lcore, queue and
+ * verdict.
+ */
+
+// pcapng block types and options
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_LINKTYPE_ETHERNET 1
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_OPT_IF_TSRESOL 9
+// nanosecond timestamps
+#define PCAPNG_TSRESOL_NS 9
+#define PCAPNG_COMMENT_MAX 64
+
+// What the pmd knew about a copy, in the private area of its mbuf
+struct capture_meta {
+    uint64_t rx_tsc;
+    uint32_t orig_len;
+    uint16_t lcore_id;
+    uint16_t queue_id;
+    uint8_t verdict;
+};
+
+// indexed by enum capture_verdict
+static const char* const verdict_names[] = {
+    "parse error",
+    "denied",
+    "held for a verdict",
+    "offloaded",
+    "offload failed",
+    "offload deferred",
+};
+
+std::atomic<bool> capture_on;
+
+static struct {
+    // filter, each field updated on its own; a packet racing an update may
+    // be matched against a mix of the old and new filters
+    // masked address above its mask, network order, both 0 for any
+    std::atomic<uint64_t> src;
+    std::atomic<uint64_t> dst;
+    // L4 port on either side, host order, 0 for any
+    std::atomic<uint16_t> l4_port;
+    // ingress port, -1 for any
+    std::atomic<int> port_in;
+    std::atomic<uint32_t> snaplen;
+
+    const struct application_dpdk_config* app_cfg;
+    struct rte_mempool* pool;
+    // one per pmd, indexed by queue
+    struct rte_ring* rings[RTE_MAX_LCORE];
+    pthread_t thread;
+    bool thread_started;
+    std::atomic<bool> stop;
+    // held by the writer thread while writing, by the main thread while opening or closing
+    std::mutex lock;
+    FILE* file;
+    char path[PATH_MAX];
+    uint64_t nb_written;
+    // wall clock of a TSC value, to timestamp the packets
+    uint64_t epoch_ns;
+    uint64_t epoch_tsc;
+} capture;
+static int capture_fd = -1;
+
+static inline struct capture_meta*
+capture_meta_get(struct rte_mbuf* copy)
+{
+    return (struct capture_meta*)rte_mbuf_to_priv(copy);
+}
+
+/*
+ * Filter key of a prefix, its masked address above its mask
+ *
+ * @addr [in]: address, network order
+ * @prefix [in]: prefix length
+ * @return: the key
+ */
+static uint64_t
+capture_prefix_key(doca_be32_t addr, uint8_t prefix)
+{
+    doca_be32_t mask = aggregate_prefix_mask(prefix);
+
+    return (uint64_t)(addr & mask) << 32 | mask;
+}
+
+/*
+ * Match an address against a prefix of the filter
+ *
+ * @key [in]: filter key of the prefix
+ * @addr [in]: address, network order
+ * @return: true when the address is in the prefix
+ */
+static inline bool
+capture_prefix_match(uint64_t key, doca_be32_t addr)
+{
+    return (addr & (uint32_t)key) == key >> 32;
+}
+
+struct rte_mbuf*
+capture_copy(struct pmd_params_t* params,
+             struct rte_mbuf* pkt,
+             int port_id_in,
+             const struct flow_key* key,
+             uint64_t rx_tsc)
+{
+    uint64_t src = capture.src.load(std::memory_order_relaxed);
+    uint64_t dst = capture.dst.load(std::memory_order_relaxed);
+    uint16_t l4_port = capture.l4_port.load(std::memory_order_relaxed);
+    int port_in = capture.port_in.load(std::memory_order_relaxed);
+    struct capture_meta* meta;
+    struct rte_mbuf* copy;
+
+    if (port_in >= 0 && port_in != port_id_in)
+        return NULL;
+    if (key == NULL) {
+        // not IPv4 TCP, only matched by a filter on the ingress port alone
+        if (src != 0 || dst != 0 || l4_port != 0)
+            return NULL;
+    } else if (!capture_prefix_match(src, key->src_ip) || !capture_prefix_match(dst, key->dst_ip) ||
+               (l4_port != 0 && rte_be_to_cpu_16(key->src_port) != l4_port &&
+                rte_be_to_cpu_16(key->dst_port) != l4_port)) {
+        return NULL;
+    }
+
+    copy = rte_pktmbuf_copy(pkt, capture.pool, 0, capture.snaplen.load(std::memory_order_relaxed));
+    if (copy == NULL) {
+        params->metrics->capture_drops++;
+        return NULL;
+    }
+    meta = capture_meta_get(copy);
+    meta->rx_tsc = rx_tsc;
+    meta->orig_len = rte_pktmbuf_pkt_len(pkt);
+    meta->lcore_id = rte_lcore_id();
+    meta->queue_id = params->queue_id;
+    copy->port = port_id_in;
+    return copy;
+}
+
+void
+capture_commit(struct pmd_params_t* params, struct rte_mbuf* copy, enum capture_verdict verdict)
+{
+    if (copy == NULL)
+        return;
+    capture_meta_get(copy)->verdict = verdict;
+    if (rte_ring_sp_enqueue(capture.rings[params->queue_id], copy) != 0) {
+        params->metrics->capture_drops++;
+        rte_pktmbuf_free(copy);
+        return;
+    }
+    params->metrics->captured_pkts++;
+}
+
+void
+capture_packet(struct pmd_params_t* params,
+               struct rte_mbuf* pkt,
+               int port_id_in,
+               const struct flow_key* key,
+               uint64_t rx_tsc,
+               enum capture_verdict verdict)
+{
+    capture_commit(params, capture_copy(params, pkt, port_id_in, key, rx_tsc), verdict);
+}
+
+/*
+ * Write a pcapng block header or trailer field
+ *
+ * @file [in]: capture file
+ * @value [in]: 32-bit value, host order as announced by the section header
+ */
+static inline void
+pcapng_put32(FILE* file, uint32_t value)
+{
+    fwrite(&value, sizeof(value), 1, file);
+}
+
+/*
+ * Start a pcapng section with one Ethernet interface per port, interface i
+ * being port i
+ *
+ * @file [in]: capture file
+ * @nb_ports [in]: number of ports
+ * @return: true on success
+ */
+static bool
+pcapng_write_header(FILE* file, uint16_t nb_ports)
+{
+    const uint64_t section_len = UINT64_MAX;
+    const uint16_t version[2] = { 1, 0 };
+    const uint16_t linktype[2] = { PCAPNG_LINKTYPE_ETHERNET, 0 };
+    const uint16_t tsresol_opt[2] = { PCAPNG_OPT_IF_TSRESOL, 1 };
+    const uint8_t tsresol[4] = { PCAPNG_TSRESOL_NS, 0, 0, 0 };
+
+    // section header block, without options
+    pcapng_put32(file, PCAPNG_SHB);
+    pcapng_put32(file, 28);
+    pcapng_put32(file, PCAPNG_BYTE_ORDER_MAGIC);
+    fwrite(version, sizeof(version), 1, file);
+    fwrite(&section_len, sizeof(section_len), 1, file);
+    pcapng_put32(file, 28);
+
+    // interface description blocks, with nanosecond timestamps
+    for (uint16_t port_id = 0; port_id < nb_ports; port_id++) {
+        pcapng_put32(file, PCAPNG_IDB);
+        pcapng_put32(file, 32);
+        fwrite(linktype, sizeof(linktype), 1, file);
+        pcapng_put32(file, CAPTURE_SNAPLEN_MAX);
+        fwrite(tsresol_opt, sizeof(tsresol_opt), 1, file);
+        fwrite(tsresol, sizeof(tsresol), 1, file);
+        pcapng_put32(file, PCAPNG_OPT_END);
+        pcapng_put32(file, 32);
+    }
+    return ferror(file) == 0;
+}
+
+/*
+ * Write a copy as an enhanced packet block, commented with its lcore, queue
+ * and verdict
+ *
+ * @file [in]: capture file
+ * @copy [in]: copy of the packet
+ */
+static void
+pcapng_write_packet(FILE* file, struct rte_mbuf* copy)
+{
+    static const uint8_t padding[4] = {};
+    const struct capture_meta* meta = capture_meta_get(copy);
+    const int64_t hz = rte_get_tsc_hz();
+    int64_t delta = (int64_t)(meta->rx_tsc - capture.epoch_tsc);
+    uint64_t ts_ns = capture.epoch_ns + delta / hz * 1000000000 + delta % hz * 1000000000 / hz;
+    uint32_t cap_len = rte_pktmbuf_data_len(copy);
+    uint32_t cap_pad = RTE_ALIGN_CEIL(cap_len, 4) - cap_len;
+    char comment[PCAPNG_COMMENT_MAX];
+    uint16_t comment_opt[2];
+    uint32_t comment_len, comment_pad, block_len;
+
+    comment_len = snprintf(comment, sizeof(comment), "lcore %u queue %u: %s", meta->lcore_id, meta->queue_id,
+                           verdict_names[meta->verdict]);
+    comment_len = RTE_MIN(comment_len, sizeof(comment) - 1);
+    comment_pad = RTE_ALIGN_CEIL(comment_len, 4) - comment_len;
+    comment_opt[0] = PCAPNG_OPT_COMMENT;
+    comment_opt[1] = comment_len;
+    block_len = 32 + cap_len + cap_pad + 4 + comment_len + comment_pad + 4;
+
+    pcapng_put32(file, PCAPNG_EPB);
+    pcapng_put32(file, block_len);
+    pcapng_put32(file, copy->port);
+    pcapng_put32(file, ts_ns >> 32);
+    pcapng_put32(file, (uint32_t)ts_ns);
+    pcapng_put32(file, cap_len);
+    pcapng_put32(file, meta->orig_len);
+    fwrite(rte_pktmbuf_mtod(copy, void*), cap_len, 1, file);
+    fwrite(padding, cap_pad, 1, file);
+    fwrite(comment_opt, sizeof(comment_opt), 1, file);
+    fwrite(comment, comment_len, 1, file);
+    fwrite(padding, comment_pad, 1, file);
+    pcapng_put32(file, PCAPNG_OPT_END);
+    pcapng_put32(file, block_len);
+}
+
+/*
+ * Write the copies queued by the pmds, or release them when no file is open
+ *
+ * @return: number of copies drained
+ */
+static uint32_t
+capture_drain(void)
+{
+    struct rte_mbuf* copies[PACKET_BURST_SZ];
+    uint32_t nb_drained = 0;
+    unsigned int nb_copies;
+
+    for (uint16_t queue_id = 0; queue_id < capture.app_cfg->port_config.nb_queues; queue_id++) {
+        nb_copies = rte_ring_sc_dequeue_burst(capture.rings[queue_id], (void**)copies, PACKET_BURST_SZ, NULL);
+        for (unsigned int i = 0; i < nb_copies && capture.file != NULL; i++)
+            pcapng_write_packet(capture.file, copies[i]);
+        if (capture.file != NULL)
+            capture.nb_written += nb_copies;
+        rte_pktmbuf_free_bulk(copies, nb_copies);
+        nb_drained += nb_copies;
+    }
+    return nb_drained;
+}
+
+/*
+ * Writer thread: drain the rings of the pmds into the capture file, napping
+ * when they are empty
+ *
+ * @arg [in]: unused
+ * @return: NULL
+ */
+static void*
+capture_writer(void* arg)
+{
+    uint32_t nb_drained;
+
+    (void)arg;
+    while (!capture.stop) {
+        {
+            std::lock_guard<std::mutex> guard(capture.lock);
+            nb_drained = capture_drain();
+            if (nb_drained == 0 && capture.file != NULL)
+                fflush(capture.file);
+        }
+        if (nb_drained == 0)
+            rte_delay_us_sleep(CAPTURE_IDLE_SLEEP_US);
+    }
+    return NULL;
+}
+
+/*
+ * Close the capture file, once the pmds stopped capturing
+ */
+static void
+capture_close(void)
+{
+    std::lock_guard<std::mutex> guard(capture.lock);
+
+    capture_drain();
+    if (capture.file == NULL)
+        return;
+    fclose(capture.file);
+    capture.file = NULL;
+    DOCA_LOG_INFO("Captured %lu packets to %s", capture.nb_written, capture.path);
+}
+
+/*
+ * Parse the filter options of a command into the filter, all of them or none
+ *
+ * @saveptr [in]: tokenizer state, after the command and its file
+ * @reply [out]: error message on failure
+ * @reply_len [in]: size of reply
+ * @return: true on success
+ */
+static bool
+capture_parse_filter(char** saveptr, char* reply, size_t reply_len)
+{
+    uint64_t src = 0, dst = 0;
+    uint32_t snaplen = CAPTURE_DEFAULT_SNAPLEN;
+    uint16_t l4_port = 0;
+    int port_in = -1;
+    doca_be32_t addr;
+    uint8_t prefix;
+    char *option, *value, *end;
+    long number;
+
+    while ((option = strtok_r(NULL, " \t\r\n", saveptr)) != NULL) {
+        value = strtok_r(NULL, " \t\r\n", saveptr);
+        if (value == NULL) {
+            snprintf(reply, reply_len, "error: %s needs a value\n", option);
+            return false;
+        }
+        if (strcmp(option, "src") == 0 || strcmp(option, "dst") == 0) {
+            if (!parse_ipv4_prefix(value, &addr, &prefix)) {
+                snprintf(reply, reply_len, "error: invalid prefix %s\n", value);
+                return false;
+            }
+            (option[0] == 's' ? src : dst) = capture_prefix_key(addr, prefix);
+            continue;
+        }
+        number = strtol(value, &end, 10);
+        if (*end != '\0' || number < 0) {
+            snprintf(reply, reply_len, "error: invalid %s %s\n", option, value);
+            return false;
+        }
+        if (strcmp(option, "snaplen") == 0 && number > 0 && number <= CAPTURE_SNAPLEN_MAX)
+            snaplen = number;
+        else if (strcmp(option, "port") == 0 && number > 0 && number <= UINT16_MAX)
+            l4_port = number;
+        else if (strcmp(option, "in") == 0 && number < capture.app_cfg->port_config.nb_ports)
+            port_in = number;
+        else {
+            snprintf(reply, reply_len, "error: invalid %s %s\n", option, value);
+            return false;
+        }
+    }
+
+    capture.src = src;
+    capture.dst = dst;
+    capture.l4_port = l4_port;
+    capture.port_in = port_in;
+    capture.snaplen = snaplen;
+    return true;
+}
+
+/*
+ * Run a control command
+ *
+ * @request [in]: command line, modified
+ * @reply [out]: reply line
+ * @reply_len [in]: size of reply
+ */
+static void
+capture_command(char* request, char* reply, size_t reply_len)
+{
+    char* saveptr = NULL;
+    char* command = strtok_r(request, " \t\r\n", &saveptr);
+    char* path;
+    FILE* file;
+
+    if (command == NULL) {
+        snprintf(reply, reply_len, "error: empty command\n");
+    } else if (strcmp(command, "start") == 0) {
+        path = strtok_r(NULL, " \t\r\n", &saveptr);
+        if (path == NULL || strlen(path) >= PATH_MAX) {
+            snprintf(reply, reply_len, "error: start needs a file\n");
+            return;
+        }
+        if (capture_enabled()) {
+            snprintf(reply, reply_len, "error: already capturing to %s\n", capture.path);
+            return;
+        }
+        if (!capture_parse_filter(&saveptr, reply, reply_len))
+            return;
+        file = fopen(path, "wb");
+        if (file == NULL) {
+            snprintf(reply, reply_len, "error: failed to open %s: %s\n", path, strerror(errno));
+            return;
+        }
+        if (!pcapng_write_header(file, capture.app_cfg->port_config.nb_ports)) {
+            snprintf(reply, reply_len, "error: failed to write %s\n", path);
+            fclose(file);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> guard(capture.lock);
+            // copies left over from the last capture go nowhere
+            capture_drain();
+            capture.file = file;
+            strcpy(capture.path, path);
+            capture.nb_written = 0;
+        }
+        capture_on = true;
+        DOCA_LOG_INFO("Capturing the slow path to %s, snaplen %u", path, capture.snaplen.load());
+        snprintf(reply, reply_len, "ok: capturing to %s\n", path);
+    } else if (strcmp(command, "filter") == 0) {
+        if (capture_parse_filter(&saveptr, reply, reply_len))
+            snprintf(reply, reply_len, "ok: filter updated\n");
+    } else if (strcmp(command, "stop") == 0) {
+        capture_on = false;
+        capture_close();
+        snprintf(reply, reply_len, "ok: %lu packets written\n", capture.nb_written);
+    } else if (strcmp(command, "status") == 0) {
+        struct lcore_metrics total;
+
+        metrics_aggregate(&total);
+        snprintf(reply, reply_len, "%s %s, %lu packets written, %lu copied, %lu dropped\n",
+                 capture_enabled() ? "capturing to" : "stopped, last capture", capture.path[0] ? capture.path : "none",
+                 capture.nb_written, total.captured_pkts, total.capture_drops);
+    } else {
+        snprintf(reply, reply_len, "error: unknown command %s, expected start, filter, stop or status\n",
+                 command);
+    }
+}
+
+doca_error_t
+capture_init(const struct selective_fwd_cfg* cfg, const struct application_dpdk_config* app_cfg)
+{
+    char name[RTE_RING_NAMESIZE];
+    struct sockaddr_un addr = {};
+    struct timespec ts;
+    int ret;
+
+    if (cfg->capture_sock[0] == '\0')
+        return DOCA_SUCCESS;
+    capture.app_cfg = app_cfg;
+
+    // the copies never share the pools of the Rx queues, a slow writer cannot starve them
+    capture.pool = rte_pktmbuf_pool_create("CAPTURE_POOL", CAPTURE_POOL_SIZE, PACKET_BURST_SZ,
+                                           RTE_ALIGN_CEIL(sizeof(struct capture_meta), RTE_MBUF_PRIV_ALIGN),
+                                           RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+    if (capture.pool == NULL) {
+        DOCA_LOG_ERR("Failed to create the capture pool: %s", rte_strerror(rte_errno));
+        return DOCA_ERROR_NO_MEMORY;
+    }
+    for (uint16_t queue_id = 0; queue_id < app_cfg->port_config.nb_queues; queue_id++) {
+        snprintf(name, sizeof(name), "capture_%u", queue_id);
+        capture.rings[queue_id] = rte_ring_create(name, CAPTURE_RING_SIZE, rte_socket_id(),
+                                                  RING_F_SP_ENQ | RING_F_SC_DEQ);
+        if (capture.rings[queue_id] == NULL) {
+            DOCA_LOG_ERR("Failed to create capture rings: %s", rte_strerror(rte_errno));
+            return DOCA_ERROR_NO_MEMORY;
+        }
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    capture.epoch_tsc = rte_rdtsc();
+    capture.epoch_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    capture.port_in = -1;
+    capture.snaplen = CAPTURE_DEFAULT_SNAPLEN;
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, cfg->capture_sock);
+    unlink(cfg->capture_sock);
+    capture_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (capture_fd < 0 ||
+        bind(capture_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(capture_fd, 8) < 0) {
+        DOCA_LOG_ERR("Failed to listen on capture socket %s: %s", cfg->capture_sock, strerror(errno));
+        return DOCA_ERROR_IO_FAILED;
+    }
+
+    ret = rte_ctrl_thread_create(&capture.thread, "capture", NULL, capture_writer, NULL);
+    if (ret != 0) {
+        DOCA_LOG_ERR("Failed to start the capture writer: %s", strerror(-ret));
+        return DOCA_ERROR_OPERATING_SYSTEM;
+    }
+    capture.thread_started = true;
+    DOCA_LOG_INFO("Accepting capture commands on unix:%s", cfg->capture_sock);
+    return DOCA_SUCCESS;
+}
+
+int
+capture_server_fd(void)
+{
+    return capture_fd;
+}
+
+void
+capture_server_accept(void)
+{
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+    char request[PATH_MAX + 256];
+    char reply[PATH_MAX + 256];
+    ssize_t len;
+    int fd;
+
+    fd = accept(capture_fd, NULL, NULL);
+    if (fd < 0)
+        return;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    len = recv(fd, request, sizeof(request) - 1, 0);
+    if (len > 0) {
+        request[len] = '\0';
+        capture_command(request, reply, sizeof(reply));
+        send(fd, reply, strlen(reply), MSG_NOSIGNAL);
+    }
+    close(fd);
+}
+
+void
+capture_fini(void)
+{
+    capture_on = false;
+    if (capture.thread_started) {
+        capture.stop = true;
+        pthread_join(capture.thread, NULL);
+        capture.thread_started = false;
+    }
+    if (capture.app_cfg != NULL)
+        capture_close();
+    if (capture_fd >= 0) {
+        close(capture_fd);
+        capture_fd = -1;
+    }
+    for (uint16_t queue_id = 0; capture.app_cfg != NULL && queue_id < capture.app_cfg->port_config.nb_queues;
+         queue_id++) {
+        rte_ring_free(capture.rings[queue_id]);
+        capture.rings[queue_id] = NULL;
+    }
+    rte_mempool_free(capture.pool);
+    capture.pool = NULL;
+}
@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES, ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of NVIDIA CORPORATION &
+ * AFFILIATES (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ *
+ */
+
+#include <queue>
+#include <random>
+
+#include <rte_eth_ring.h>
+#include <rte_ring.h>
+
+#include "selective_fwd.h"
+
+DOCA_LOG_REGISTER(SELECTIVE_FWD_CHURN);
+
+/*
+ * Flow churn generator. The ports are ring backed ethdevs: the main thread
+ * synthesizes the packets of short lived flows straight into the Rx rings of
+ * the pmd queues, and drains and frees whatever the pmds transmit. New flows
+ * arrive as a Poisson process, live for an exponentially distributed time and
+ * send their packets evenly spread over it. Every CHURN_STEP_SEC the offered
+ * flow rate is compared to the insertions the pmds achieved; when ramping,
+ * the rate then grows by the step until a step is not sustained.
+ */
+
+#define CHURN_RING_SIZE 4096
+#define CHURN_PKT_SIZE 64
+#define CHURN_BURST_SZ 32
+#define CHURN_POOL_CACHE 256
+#define CHURN_STEP_SEC 2
+// share of the offered flows which must be inserted for a step to be sustained
+#define CHURN_SUSTAINED_RATIO 0.95
+
+struct churn_flow {
+    uint64_t next_pkt_tsc;
+    uint64_t pkt_interval_tsc;
+    uint32_t id;
+    uint32_t pkts_left;
+
+    bool operator>(const struct churn_flow& other) const
+    {
+        return next_pkt_tsc > other.next_pkt_tsc;
+    }
+};
+
+// Generator state, only touched by the main thread
+static struct {
+    struct churn_cfg cfg;
+    uint16_t nb_ports;
+    uint16_t nb_queues;
+    struct rte_mempool* pool;
+    struct rte_ring* rx_rings[MAX_PORTS][RTE_MAX_LCORE];
+    struct rte_ring* tx_rings[MAX_PORTS][RTE_MAX_LCORE];
+
+    // flows with packets left to send, by time of their next packet
+    std::priority_queue<struct churn_flow, std::vector<struct churn_flow>, std::greater<struct churn_flow>> flows;
+    std::mt19937_64 rng;
+    double rate;
+    uint64_t next_arrival_tsc;
+    uint32_t next_flow_id;
+
+    // current step
+    uint64_t step_start_tsc;
+    uint64_t step_offered;
+    uint64_t step_gen_drops;
+    uint32_t step_max_backlog;
+    struct lcore_metrics step_start;
+
+    double max_sustained_rate;
+    bool started;
+} churn;
+
+doca_error_t
+churn_ports_create(const struct churn_cfg* cfg, uint16_t nb_ports, uint16_t nb_queues)
+{
+    char name[RTE_RING_NAMESIZE];
+    int socket_id = rte_socket_id();
+    unsigned int nb_mbufs;
+
+    churn.cfg = *cfg;
+    churn.nb_ports = nb_ports;
+    churn.nb_queues = nb_queues;
+
+    for (int port_id = 0; port_id < nb_ports; port_id++) {
+        for (uint16_t queue = 0; queue < nb_queues; queue++) {
+            snprintf(name, sizeof(name), "churn_rx_%d_%u", port_id, queue);
+            churn.rx_rings[port_id][queue] = rte_ring_create(name, CHURN_RING_SIZE, socket_id,
+                                                             RING_F_SP_ENQ | RING_F_SC_DEQ);
+            // pmds transmit to the egress port, possibly several on one queue
+            snprintf(name, sizeof(name), "churn_tx_%d_%u", port_id, queue);
+            churn.tx_rings[port_id][queue] = rte_ring_create(name, CHURN_RING_SIZE, socket_id, RING_F_SC_DEQ);
+            if (churn.rx_rings[port_id][queue] == NULL || churn.tx_rings[port_id][queue] == NULL) {
+                DOCA_LOG_ERR("Failed to create churn rings: %s", rte_strerror(rte_errno));
+                return DOCA_ERROR_NO_MEMORY;
+            }
+        }
+
+        snprintf(name, sizeof(name), "churn%d", port_id);
+        int ret = rte_eth_from_rings(name, churn.rx_rings[port_id], nb_queues,
+                                     churn.tx_rings[port_id], nb_queues, socket_id);
+        if (ret != port_id) {
+            DOCA_LOG_ERR("Churn port %s got port id %d, run without other ports (--no-pci)", name, ret);
+            return DOCA_ERROR_DRIVER;
+        }
+    }
+
+    // enough for every ring to be full, plus what the pmds hold
+    nb_mbufs = 2 * nb_ports * nb_queues * (CHURN_RING_SIZE + PACKET_BURST_SZ) + CHURN_POOL_CACHE;
+    churn.pool = rte_pktmbuf_pool_create("churn_pool", nb_mbufs, CHURN_POOL_CACHE, 0,
+                                         RTE_MBUF_DEFAULT_BUF_SIZE, socket_id);
+    if (churn.pool == NULL) {
+        DOCA_LOG_ERR("Failed to create churn mbuf pool: %s", rte_strerror(rte_errno));
+        return DOCA_ERROR_NO_MEMORY;
+    }
+    return DOCA_SUCCESS;
+}
+
+void
+churn_ports_destroy(void)
+{
+    for (int port_id = 0; port_id < churn.nb_ports; port_id++) {
+        for (uint16_t queue = 0; queue < churn.nb_queues; queue++) {
+            rte_ring_free(churn.rx_rings[port_id][queue]);
+            rte_ring_free(churn.tx_rings[port_id][queue]);
+        }
+    }
+    rte_mempool_free(churn.pool);
+    churn.pool = NULL;
+}
+
+/*
+ * Draw the time until the next flow arrives at the current rate
+ *
+ * @return: TSC cycles
+ */
+static uint64_t
+churn_interarrival(void)
+{
+    std::exponential_distribution<double> interarrival(churn.rate);
+
+    return interarrival(churn.rng) * rte_get_tsc_hz();
+}
+
+/*
+ * Start a measurement step
+ *
+ * @now [in]: current TSC
+ */
+static void
+churn_start_step(uint64_t now)
+{
+    churn.step_start_tsc = now;
+    churn.step_offered = 0;
+    churn.step_gen_drops = 0;
+    churn.step_max_backlog = 0;
+    metrics_aggregate(&churn.step_start);
+}
+
+void
+churn_start(void)
+{
+    uint64_t now = rte_rdtsc();
+
+    churn.rng.seed(now);
+    churn.rate = churn.cfg.rate;
+    churn.next_arrival_tsc = now + churn_interarrival();
+    churn.started = true;
+    churn_start_step(now);
+    DOCA_LOG_INFO("Churn: %u flows/s%s, %u ms mean lifetime, %u packets per flow",
+                  churn.cfg.rate,
+                  churn.cfg.step ? " ramping" : "",
+                  churn.cfg.lifetime_ms,
+                  churn.cfg.pkts_per_flow);
+}
+
+/*
+ * Evaluate a finished step and move the offered rate along the ramp
+ *
+ * @now [in]: current TSC
+ */
+static void
+churn_end_step(uint64_t now)
+{
+    struct lcore_metrics total;
+    double elapsed_sec = (double)(now - churn.step_start_tsc) / rte_get_tsc_hz();
+
+    metrics_aggregate(&total);
+    uint64_t inserts = total.inserts - churn.step_start.inserts;
+    uint64_t insert_fails = total.insert_fails - churn.step_start.insert_fails;
+    double offered_rate = churn.step_offered / elapsed_sec;
+    bool sustained = insert_fails == 0 && churn.step_gen_drops == 0 &&
+                     inserts >= CHURN_SUSTAINED_RATIO * churn.step_offered &&
+                     churn.step_max_backlog < CHURN_RING_SIZE / 2;
+
+    DOCA_LOG_INFO("Churn: offered %.0f flows/s, inserted %.0f/s, %lu insert fails, "
+                  "max backlog %u packets, %lu generator drops, %zu active flows: %s",
+                  offered_rate,
+                  inserts / elapsed_sec,
+                  insert_fails,
+                  churn.step_max_backlog,
+                  churn.step_gen_drops,
+                  churn.flows.size(),
+                  sustained ? "sustained" : "NOT sustained");
+
+    if (sustained && offered_rate > churn.max_sustained_rate)
+        churn.max_sustained_rate = offered_rate;
+    if (churn.cfg.step != 0) {
+        if (!sustained) {
+            force_quit = true;
+            return;
+        }
+        churn.rate += churn.cfg.step;
+    }
+    churn_start_step(now);
+}
+
+/*
+ * Build the next packet of a flow
+ *
+ * @flow [in]: flow
+ * @return: packet, NULL when the pool is exhausted
+ */
+static struct rte_mbuf*
+churn_build_packet(const struct churn_flow* flow)
+{
+    struct rte_mbuf* pkt = rte_pktmbuf_alloc(churn.pool);
+    struct rte_ether_hdr* eth_hdr;
+    struct rte_ipv4_hdr* ipv4_hdr;
+    struct rte_tcp_hdr* tcp_hdr;
+
+    if (pkt == NULL)
+        return NULL;
+    eth_hdr = (struct rte_ether_hdr*)rte_pktmbuf_append(pkt, CHURN_PKT_SIZE);
+    memset(eth_hdr, 0, CHURN_PKT_SIZE);
+    ipv4_hdr = (struct rte_ipv4_hdr*)(eth_hdr + 1);
+    tcp_hdr = (struct rte_tcp_hdr*)(ipv4_hdr + 1);
+
+    eth_hdr->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+    ipv4_hdr->version_ihl = RTE_IPV4_VHL_DEF;
+    ipv4_hdr->total_length = rte_cpu_to_be_16(CHURN_PKT_SIZE - sizeof(struct rte_ether_hdr));
+    ipv4_hdr->time_to_live = 64;
+    ipv4_hdr->next_proto_id = IPPROTO_TCP;
+    // same 5-tuple scheme as the replay benchmark and the bench traces
+    ipv4_hdr->src_addr = rte_cpu_to_be_32((10u << 24) | (flow->id >> 8));
+    ipv4_hdr->dst_addr = BE_IPV4_ADDR(192, 168, 0, 1);
+    tcp_hdr->src_port = rte_cpu_to_be_16(1024 + (flow->id & 0xff));
+    tcp_hdr->dst_port = rte_cpu_to_be_16(80);
+    tcp_hdr->data_off = (sizeof(struct rte_tcp_hdr) / 4) << 4;
+    tcp_hdr->tcp_flags = RTE_TCP_ACK_FLAG;
+    return pkt;
+}
+
+/*
+ * Send the next packet of a flow to the Rx ring of its port and queue
+ *
+ * @flow [in]: flow
+ */
+static void
+churn_send_packet(const struct churn_flow* flow)
+{
+    int port_id = flow->id % churn.nb_ports;
+    uint16_t queue = (flow->id / churn.nb_ports) % churn.nb_queues;
+    struct rte_mbuf* pkt = churn_build_packet(flow);
+
+    if (pkt == NULL || rte_ring_sp_enqueue(churn.rx_rings[port_id][queue], pkt) != 0) {
+        churn.step_gen_drops++;
+        rte_pktmbuf_free(pkt);
+    }
+}
+
+/*
+ * Free what the pmds transmitted and sample the Rx backlog
+ */
+static void
+churn_drain(void)
+{
+    struct rte_mbuf* pkts[CHURN_BURST_SZ];
+    uint32_t backlog = 0;
+    unsigned int nb;
+
+    for (int port_id = 0; port_id < churn.nb_ports; port_id++) {
+        for (uint16_t queue = 0; queue < churn.nb_queues; queue++) {
+            nb = rte_ring_sc_dequeue_burst(churn.tx_rings[port_id][queue], (void**)pkts, CHURN_BURST_SZ, NULL);
+            rte_pktmbuf_free_bulk(pkts, nb);
+            backlog = RTE_MAX(backlog, rte_ring_count(churn.rx_rings[port_id][queue]));
+        }
+    }
+    churn.step_max_backlog = RTE_MAX(churn.step_max_backlog, backlog);
+}
+
+void
+churn_poll(uint64_t deadline)
+{
+    const uint64_t hz = rte_get_tsc_hz();
+    const uint64_t step_len = CHURN_STEP_SEC * hz;
+    std::exponential_distribution<double> lifetime(1000.0 / RTE_MAX(churn.cfg.lifetime_ms, 1u));
+    uint64_t now = rte_rdtsc();
+    uint32_t nb;
+
+    do {
+        if (now - churn.step_start_tsc >= step_len) {
+            churn_end_step(now);
+            if (force_quit)
+                return;
+        }
+
+        // a generator falling behind shows up as a lower offered rate
+        for (nb = 0; nb < CHURN_BURST_SZ && churn.next_arrival_tsc <= now; nb++) {
+            struct churn_flow flow;
+
+            flow.id = churn.next_flow_id++;
+            flow.pkts_left = churn.cfg.pkts_per_flow;
+            flow.next_pkt_tsc = churn.next_arrival_tsc;
+            flow.pkt_interval_tsc = churn.cfg.pkts_per_flow > 1
+                                        ? lifetime(churn.rng) * hz / (churn.cfg.pkts_per_flow - 1)
+                                        : 0;
+            churn.flows.push(flow);
+            churn.step_offered++;
+            churn.next_arrival_tsc += churn_interarrival();
+        }
+
+        for (nb = 0; nb < CHURN_BURST_SZ && !churn.flows.empty() && churn.flows.top().next_pkt_tsc <= now; nb++) {
+            struct churn_flow flow = churn.flows.top();
+
+            churn.flows.pop();
+            churn_send_packet(&flow);
+            if (--flow.pkts_left > 0) {
+                flow.next_pkt_tsc += flow.pkt_interval_tsc;
+                churn.flows.push(flow);
+            }
+        }
+
+        churn_drain();
+        if (nb == 0)
+            rte_pause();
+        now = rte_rdtsc();
+    } while (now < deadline);
+}
+
+void
+churn_report(void)
+{
+    if (!churn.started)
+        return;
+    DOCA_LOG_INFO("Churn: max sustained %.0f new flows/s, time to offload p50 %.1f us, p99 %.1f us, p99.9 %.1f us",
+                  churn.max_sustained_rate,
+                  metrics_latency_percentile_us(offsetof(struct lcore_latency, offload), 50),
+                  metrics_latency_percentile_us(offsetof(struct lcore_latency, offload), 99),
+                  metrics_latency_percentile_us(offsetof(struct lcore_latency, offload), 99.9));
+}
@@ -11,8 +11,12 @@
  *
  */
 
+#include <pthread.h>
+#include <time.h>
+
 #include <rte_ethdev.h>
 #include <rte_ether.h>
+#include <rte_lcore.h>
 #include <rte_malloc.h>
 
 #include <doca_buf_inventory.h>
@@ -35,6 +39,17 @@ DOCA_LOG_REGISTER(NUTILS);
         addr[15]
 #endif
 
+/* Port to set up on a thread of its own */
+struct port_init_job
+{
+    struct rte_mempool* mbuf_pool;
+    uint8_t port;
+    struct application_dpdk_config* app_config;
+    pthread_t thread;
+    bool threaded;
+    doca_error_t result;
+};
+
 struct dpdk_mempool_shadow
 {
     struct doca_dev* device; /* DOCA device used to register memory */
@@ -43,6 +58,15 @@ struct dpdk_mempool_shadow
     uint32_t nb_mmaps; /* Number of elements in mmap_arr */
 };
 
+double
+elapsed_ms(const struct timespec* since)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1e3 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
 /*
  * Bind port to all the peer ports
  *
@@ -141,6 +165,25 @@ unbind_hairpin_queues(uint16_t port_id)
     return DOCA_SUCCESS;
 }
 
+/*
+ * Number of hairpin queues port_init() sets up from a port to each of its peers
+ *
+ * @app_config [in]: application DPDK configuration values
+ * @port [in]: port ID
+ * @return: number of hairpin queues per peer
+ */
+static uint16_t
+hairpin_queues_per_peer(const struct application_dpdk_config* app_config, uint16_t port)
+{
+    const uint16_t nb_hairpin_queues = app_config->port_config.nb_hairpin_q;
+
+    if (app_config->port_config.hairpin_all_ports)
+        return nb_hairpin_queues / app_config->port_config.nb_ports;
+    if (app_config->port_config.self_hairpin && rte_eth_dev_is_valid_port(port ^ 1))
+        return nb_hairpin_queues / 2;
+    return nb_hairpin_queues;
+}
+
 /*
  * Set up all hairpin queues
  *
@@ -182,7 +225,6 @@ setup_hairpin_queues(struct application_dpdk_config* app_config,
 
     app_config->hairpin_queues[port_id][peer_port_id] =
         reserved_hairpin_q_list[0];
-    app_config->hairpin_q_count = hairpin_queue_len;
 
     for (hairpin_q = 0; hairpin_q < hairpin_queue_len; hairpin_q++) {
         // TX
@@ -303,8 +345,8 @@ port_init(struct rte_mempool* mbuf_pool,
     int ret = 0;
     int symmetric_hash_key_length = RSS_KEY_LEN;
     const uint16_t nb_hairpin_queues = app_config->port_config.nb_hairpin_q;
-    const uint16_t rx_rings = app_config->port_config.nb_queues;
-    const uint16_t tx_rings = app_config->port_config.nb_queues;
+    const uint16_t rx_rings = app_config->port_config.nb_queues + app_config->port_config.nb_extra_q;
+    const uint16_t tx_rings = app_config->port_config.nb_queues + app_config->port_config.nb_extra_q;
     const uint16_t rss_support = !!(app_config->port_config.rss_support &&
                                     (app_config->port_config.nb_queues > 1));
     bool isolated = !!app_config->port_config.isolated_mode;
@@ -348,6 +390,7 @@ port_init(struct rte_mempool* mbuf_pool,
 
     port_conf.rxmode.mq_mode =
         rss_support ? RTE_ETH_MQ_RX_RSS : RTE_ETH_MQ_RX_NONE;
+    port_conf.intr_conf.rxq = app_config->port_config.rx_intr;
 
     /* Configure the Ethernet device */
     ret = rte_eth_dev_configure(port,
@@ -404,14 +447,33 @@ port_init(struct rte_mempool* mbuf_pool,
     if (nb_hairpin_queues) {
         uint16_t rss_queue_list[nb_hairpin_queues];
 
-        if (app_config->port_config.self_hairpin &&
+        if (app_config->port_config.hairpin_all_ports) {
+            /* Hairpin to every port, in port order */
+            const uint16_t nb_peers = app_config->port_config.nb_ports;
+            const uint16_t nb_peer_queues = nb_hairpin_queues / nb_peers;
+            uint16_t peer;
+
+            assert(nb_peer_queues > 0 && (nb_hairpin_queues % nb_peers) == 0);
+            for (peer = 0; peer < nb_peers; peer++) {
+                for (queue_index = 0; queue_index < nb_peer_queues; queue_index++)
+                    rss_queue_list[queue_index] = rx_rings + peer * nb_peer_queues + queue_index;
+                result = setup_hairpin_queues(
+                    app_config, port, peer, rss_queue_list, nb_peer_queues);
+                if (result != DOCA_SUCCESS) {
+                    DOCA_LOG_ERR("Cannot hairpin port %" PRIu8 " to port %u, ret: %s",
+                                 port,
+                                 peer,
+                                 doca_error_get_descr(result));
+                    return result;
+                }
+            }
+        } else if (app_config->port_config.self_hairpin &&
             rte_eth_dev_is_valid_port(port ^ 1)) {
             /* Hairpin to both self and peer */
             assert((nb_hairpin_queues % 2) == 0);
             for (queue_index = 0; queue_index < nb_hairpin_queues / 2;
                  queue_index++)
-                rss_queue_list[queue_index] =
-                    app_config->port_config.nb_queues + queue_index;
+                rss_queue_list[queue_index] = rx_rings + queue_index;
             result = setup_hairpin_queues(
                 app_config, port, port, rss_queue_list, nb_hairpin_queues / 2);
             if (result != DOCA_SUCCESS) {
@@ -423,8 +485,7 @@ port_init(struct rte_mempool* mbuf_pool,
             for (queue_index = 0; queue_index < nb_hairpin_queues / 2;
                  queue_index++)
                 rss_queue_list[queue_index] =
-                    app_config->port_config.nb_queues +
-                    (nb_hairpin_queues / 2) + queue_index;
+                    rx_rings + (nb_hairpin_queues / 2) + queue_index;
             result = setup_hairpin_queues(app_config,
                                           port,
                                           port ^ 1,
@@ -440,8 +501,7 @@ port_init(struct rte_mempool* mbuf_pool,
             /* Hairpin to self or peer */
             for (queue_index = 0; queue_index < nb_hairpin_queues;
                  queue_index++)
-                rss_queue_list[queue_index] =
-                    app_config->port_config.nb_queues + queue_index;
+                rss_queue_list[queue_index] = rx_rings + queue_index;
             if (rte_eth_dev_is_valid_port(port ^ 1))
                 result = setup_hairpin_queues(app_config,
                                               port,
@@ -461,7 +521,10 @@ port_init(struct rte_mempool* mbuf_pool,
 
     /* Set isolated mode (true or false) before port start */
     ret = rte_flow_isolate(port, isolated, &error);
-    if (ret < 0) {
+    if (ret < 0 && !isolated) {
+        /* Virtual devices without rte_flow support are never isolated */
+        DOCA_LOG_DBG("Port %u does not support isolated mode (%s)", port, error.message);
+    } else if (ret < 0) {
         DOCA_LOG_ERR("Port %u could not be set isolated mode to %s (%s)",
                      port,
                      isolated ? "true" : "false",
@@ -502,6 +565,62 @@ port_init(struct rte_mempool* mbuf_pool,
     return DOCA_SUCCESS;
 }
 
+/*
+ * Thread setting up a port, see port_init()
+ *
+ * @arg [in]: port_init_job of the port
+ * @return: NULL
+ */
+static void*
+port_init_thread(void* arg)
+{
+    struct port_init_job* job = (struct port_init_job*)arg;
+
+    job->result = port_init(job->mbuf_pool, job->port, job->app_config);
+    return NULL;
+}
+
+/*
+ * Set up ports concurrently, one control thread each. Ports are set up
+ * independently; only binding their hairpin queues needs them all started.
+ *
+ * @app_config [in]: application DPDK configuration values
+ * @port_ids [in]: IDs of the ports
+ * @nb_ports [in]: number of ports
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+ports_init_parallel(struct application_dpdk_config* app_config, const uint16_t* port_ids, uint16_t nb_ports)
+{
+    struct port_init_job jobs[RTE_MAX_ETHPORTS];
+    char name[RTE_MAX_THREAD_NAME_LEN];
+    doca_error_t result = DOCA_SUCCESS;
+    uint16_t i;
+    int ret;
+
+    for (i = 0; i < nb_ports; i++) {
+        jobs[i].mbuf_pool = app_config->mbuf_pool;
+        jobs[i].port = port_ids[i];
+        jobs[i].app_config = app_config;
+        snprintf(name, sizeof(name), "port_init_%u", port_ids[i]);
+        ret = rte_ctrl_thread_create(&jobs[i].thread, name, NULL, port_init_thread, &jobs[i]);
+        jobs[i].threaded = ret == 0;
+        if (!jobs[i].threaded) {
+            DOCA_LOG_WARN("Failed to create init thread of port %u, setting it up inline", port_ids[i]);
+            jobs[i].result = port_init(jobs[i].mbuf_pool, jobs[i].port, app_config);
+        }
+    }
+    for (i = 0; i < nb_ports; i++) {
+        if (jobs[i].threaded)
+            pthread_join(jobs[i].thread, NULL);
+        if (jobs[i].result != DOCA_SUCCESS) {
+            DOCA_LOG_ERR("Cannot init port %u", port_ids[i]);
+            result = jobs[i].result;
+        }
+    }
+    return result;
+}
+
 /*
  * Destroy all DPDK ports
  *
@@ -547,14 +666,18 @@ dpdk_ports_init(struct application_dpdk_config* app_config)
     int ret;
     uint16_t port_id;
     uint16_t n;
+    uint16_t port_ids[RTE_MAX_ETHPORTS];
+    struct timespec start;
     const uint16_t nb_ports = app_config->port_config.nb_ports;
     const uint32_t total_nb_mbufs =
-        app_config->port_config.nb_queues * nb_ports * NUM_MBUFS;
+        (app_config->port_config.nb_queues + app_config->port_config.nb_extra_q) * nb_ports * NUM_MBUFS;
 
     /* Initialize mbufs mempool */
+    clock_gettime(CLOCK_MONOTONIC, &start);
     result = allocate_mempool(total_nb_mbufs, &app_config->mbuf_pool);
     if (result != DOCA_SUCCESS)
         return result;
+    app_config->startup.mempool_ms = elapsed_ms(&start);
 
     /*
      * Enable metadata to be delivered to application in the packets mbuf, the
@@ -568,18 +691,32 @@ dpdk_ports_init(struct application_dpdk_config* app_config)
         }
     }
 
-    for (port_id = 0, n = 0; port_id < RTE_MAX_ETHPORTS; port_id++) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (port_id = 0, n = 0; port_id < RTE_MAX_ETHPORTS && n < nb_ports; port_id++) {
         if (!rte_eth_dev_is_valid_port(port_id))
             continue;
-        result = port_init(app_config->mbuf_pool, port_id, app_config);
+        port_ids[n++] = port_id;
+    }
+    // set once here, as the ports may be set up concurrently
+    if (n > 0)
+        app_config->hairpin_q_count = hairpin_queues_per_peer(app_config, port_ids[n - 1]);
+    if (app_config->port_config.parallel_init && n > 1) {
+        result = ports_init_parallel(app_config, port_ids, n);
         if (result != DOCA_SUCCESS) {
-            DOCA_LOG_ERR("Cannot init port %" PRIu8, port_id);
-            dpdk_ports_fini(app_config, port_id);
+            dpdk_ports_fini(app_config, port_ids[n - 1]);
             return result;
         }
-        if (++n >= nb_ports)
-            break;
+    } else {
+        for (uint16_t i = 0; i < n; i++) {
+            result = port_init(app_config->mbuf_pool, port_ids[i], app_config);
+            if (result != DOCA_SUCCESS) {
+                DOCA_LOG_ERR("Cannot init port %" PRIu8, port_ids[i]);
+                dpdk_ports_fini(app_config, port_ids[i]);
+                return result;
+            }
+        }
     }
+    app_config->startup.port_setup_ms = elapsed_ms(&start);
     return DOCA_SUCCESS;
 }
 
@@ -627,9 +764,13 @@ dpdk_queues_and_ports_init(struct application_dpdk_config* app_dpdk_config)
 
     /* Enable hairpin queues */
     if (app_dpdk_config->port_config.nb_hairpin_q > 0) {
+        struct timespec start;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
         result = enable_hairpin_queues(app_dpdk_config->port_config.nb_ports);
         if (result != DOCA_SUCCESS)
             goto ports_cleanup;
+        app_dpdk_config->startup.hairpin_bind_ms = elapsed_ms(&start);
     }
 
     return DOCA_SUCCESS;
@@ -642,7 +783,8 @@ ports_cleanup:
 void
 dpdk_queues_and_ports_fini(struct application_dpdk_config* app_dpdk_config)
 {
-    disable_hairpin_queues(RTE_MAX_ETHPORTS);
+    if (app_dpdk_config->port_config.nb_hairpin_q > 0)
+        disable_hairpin_queues(RTE_MAX_ETHPORTS);
 
     dpdk_ports_fini(app_dpdk_config, RTE_MAX_ETHPORTS);
 }
@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <rte_flow.h>
@@ -48,6 +49,9 @@ extern "C"
                                otherwise */
         uint16_t nb_queues; /* Set on init to 0 for don't care, required minimum
                                cores otherwise */
+        uint16_t nb_extra_q; /* Set on init to 0 to disable, Rx and Tx queues
+                                after the nb_queues ones, before the hairpin
+                                queues, polled by no worker core */
         int nb_hairpin_q;   /* Set on init to 0 to disable, hairpin queues
                                otherwise */
         uint16_t
@@ -55,12 +59,28 @@ extern "C"
                                          it will add meta to each mbuf */
         uint16_t self_hairpin : 1; /* Set on init to 1 enable both self and peer
                                       hairpin */
+        uint16_t hairpin_all_ports : 1; /* Set on init to 1 to hairpin each port
+                                           to all nb_ports ports, itself
+                                           included, splitting nb_hairpin_q
+                                           evenly */
         uint16_t rss_support : 1;  /* Set on init to 0 for no RSS support, RSS
                                       support  otherwise */
         uint16_t lpbk_support : 1; /* Enable loopback support */
         uint16_t isolated_mode : 1; /* Set on init to 0 for no isolation,
                                        isolated mode otherwise */
         uint16_t switch_mode : 1;   /* Set on init to 1 for switch mode */
+        uint16_t rx_intr : 1;       /* Set on init to 1 to enable Rx queue
+                                       interrupts */
+        uint16_t parallel_init : 1; /* Set on init to 1 to set up the ports
+                                       concurrently, one thread each */
+    };
+
+    /* Wall-clock time of the port initialization phases, in milliseconds */
+    struct application_startup_times
+    {
+        double mempool_ms;     /* mbuf pool allocation */
+        double port_setup_ms;  /* port configuration, queue setup and start */
+        double hairpin_bind_ms; /* hairpin queue binding between ports */
     };
 
     /* DPDK configuration */
@@ -84,6 +104,8 @@ extern "C"
         uint8_t hairpin_q_count;
         // worker cores which will not be used for a PMD and will not require a queue
         uint8_t reserved_cores;
+        // filled by "dpdk_queues_and_ports_init"
+        struct application_startup_times startup;
     };
 
     /*
@@ -189,6 +211,14 @@ extern "C"
                            const bool l3,
                            const bool l4);
 
+    /*
+     * Milliseconds elapsed since a monotonic time
+     *
+     * @since [in]: monotonic time, from clock_gettime(CLOCK_MONOTONIC)
+     * @return: elapsed milliseconds
+     */
+    double elapsed_ms(const struct timespec* since);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
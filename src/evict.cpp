@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES, ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of NVIDIA CORPORATION &
+ * AFFILIATES (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ *
+ */
+
+#include <algorithm>
+
+#include "selective_fwd.h"
+
+DOCA_LOG_REGISTER(SELECTIVE_FWD_EVICT);
+
+/*
+ * Rate-aware eviction. The hairpin pipe of every port holds a bounded number
+ * of entries, and aging only frees the entries of idle flows, so a burst of
+ * new flows can fill it while the flows it holds still trickle. Once a port
+ * reaches the low watermark, the main thread samples the hit counters of its
+ * flows every EVICT_INTERVAL_MS; once it reaches the high watermark, the
+ * slowest of them are removed until it is back to the low watermark, leaving
+ * room for new flows, which may be faster.
+ *
+ * An entry is only ever removed on the pipe queue which added it, so the
+ * flows of the pmds are handed to their pmd through a ring, and only those of
+ * the main thread are removed by the main thread itself. Provisioned flows
+ * are never evicted.
+ *
+ * When a table is full anyway, the pmds forward the packets of new flows in
+ * software without offloading them, like when their insertion budget runs
+ * out, rather than failing the insertion.
+ */
+
+// Eviction handed to the pmd owning the entry
+struct evict_request {
+    struct doca_flow_pipe_entry* entry;
+    // only dereferenced once the entry is known to be installed
+    struct flow_ctx* ctx;
+    uint64_t generation;
+};
+
+static struct {
+    struct application_dpdk_config* app_cfg;
+    struct doca_flow_port** ports;
+    // entries of each hairpin table, and the watermarks, 0 with eviction disabled
+    uint32_t capacity;
+    uint32_t high;
+    uint32_t low;
+    uint64_t next_tsc;
+    // filled by the main thread, drained by the pmd of each queue
+    struct rte_ring* rings[RTE_MAX_LCORE];
+    std::vector<struct evict_candidate> candidates[MAX_PORTS];
+} eviction;
+
+doca_error_t
+evict_init(const struct selective_fwd_cfg* cfg,
+           struct application_dpdk_config* app_cfg,
+           struct doca_flow_port* ports[MAX_PORTS])
+{
+    char name[RTE_RING_NAMESIZE];
+
+    eviction.app_cfg = app_cfg;
+    eviction.ports = ports;
+    eviction.capacity = flow_backend->hairpin_capacity();
+    if (cfg->evict_high_pct == 0)
+        return DOCA_SUCCESS;
+
+    eviction.high = (uint64_t)eviction.capacity * cfg->evict_high_pct / 100;
+    eviction.low = (uint64_t)eviction.capacity * cfg->evict_low_pct / 100;
+    for (uint16_t queue_id = 0; queue_id < app_cfg->port_config.nb_queues; queue_id++) {
+        snprintf(name, sizeof(name), "EVICT_RING_%u", queue_id);
+        // the main thread enqueues, the pmd of the queue dequeues
+        eviction.rings[queue_id] = rte_ring_create_elem(name, sizeof(struct evict_request), EVICT_RING_SIZE,
+                                                        rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
+        if (eviction.rings[queue_id] == NULL) {
+            DOCA_LOG_ERR("Failed to create eviction ring %u", queue_id);
+            evict_fini();
+            return DOCA_ERROR_NO_MEMORY;
+        }
+    }
+    DOCA_LOG_INFO("Evicting the slowest flows of a port past %u of its %u hairpin entries, down to %u",
+                  eviction.high, eviction.capacity, eviction.low);
+    return DOCA_SUCCESS;
+}
+
+uint32_t
+hairpin_capacity(void)
+{
+    return eviction.capacity;
+}
+
+/*
+ * Remove flows of the main thread on its own pipe queue, in batches whose
+ * completions release the flows
+ *
+ * @port_id [in]: port of the flows
+ * @candidates [in]: flows to remove
+ * @nb_candidates [in]: number of flows
+ * @metrics [in]: counters of the main thread
+ */
+static void
+evict_main(int port_id, const struct evict_candidate* candidates, uint32_t nb_candidates,
+           struct lcore_metrics* metrics)
+{
+    uint16_t pipe_queue = main_pipe_queue(eviction.app_cfg);
+    uint32_t batch_len = 0;
+
+    for (uint32_t i = 0; i < nb_candidates; i++) {
+        struct flow_ctx* ctx = candidates[i].ctx;
+        struct flow_record record;
+
+        flow_export_prepare(ctx, FLOW_END_LACK_OF_RESOURCES, &record);
+        __atomic_store_n(&ctx->remove_tsc, rte_rdtsc(), __ATOMIC_RELAXED);
+        if (flow_backend->remove_entry(pipe_queue, DOCA_FLOW_WAIT_FOR_BATCH, candidates[i].entry) != DOCA_SUCCESS) {
+            __atomic_store_n(&ctx->remove_tsc, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        flow_export_removed(&record);
+        metrics->evictions++;
+        if (++batch_len == HAIRPIN_BATCH_SZ) {
+            flow_backend->entries_process(eviction.ports[port_id], pipe_queue, DEFAULT_TIMEOUT_US, 0);
+            batch_len = 0;
+        }
+    }
+    if (batch_len > 0)
+        flow_backend->entries_process(eviction.ports[port_id], pipe_queue, DEFAULT_TIMEOUT_US, 0);
+}
+
+/*
+ * Evict the slowest flows of a port past the high watermark, down to the low
+ * watermark
+ *
+ * @port_id [in]: port ID
+ * @metrics [in]: counters of the main thread
+ */
+static void
+evict_port(int port_id, struct lcore_metrics* metrics)
+{
+    std::vector<struct evict_candidate>& candidates = eviction.candidates[port_id];
+    uint32_t occupancy = pipe_mgr.occupancy(port_id);
+    uint32_t nb_evict, nb_main, nb_handed = 0;
+
+    if (occupancy < eviction.high)
+        return;
+    nb_evict = RTE_MIN(RTE_MIN(occupancy - eviction.low, (uint32_t)EVICT_BATCH_MAX), (uint32_t)candidates.size());
+    if (nb_evict == 0)
+        return;
+    std::nth_element(candidates.begin(), candidates.begin() + nb_evict - 1, candidates.end(),
+                     [](const struct evict_candidate& a, const struct evict_candidate& b) {
+                         return a.rate < b.rate;
+                     });
+
+    // the flows of the main thread first, so they go out in batches
+    nb_main = std::partition(candidates.begin(), candidates.begin() + nb_evict,
+                             [](const struct evict_candidate& candidate) { return candidate.owner == NULL; }) -
+              candidates.begin();
+    evict_main(port_id, candidates.data(), nb_main, metrics);
+
+    for (uint32_t i = nb_main; i < nb_evict; i++) {
+        struct evict_request request = {candidates[i].entry, candidates[i].ctx, candidates[i].generation};
+
+        if (rte_ring_enqueue_elem(eviction.rings[candidates[i].owner->queue_id], &request, sizeof(request)) == 0)
+            nb_handed++;
+    }
+    DOCA_LOG_INFO("Port %d hairpin table holds %u of %u entries, evicting %u flows, %u handed to the pmds",
+                  port_id, occupancy, eviction.capacity, nb_main + nb_handed, nb_handed);
+}
+
+/*
+ * Sample the flows of the ports past the low watermark and evict from those
+ * past the high watermark, every EVICT_INTERVAL_MS, on the main thread
+ *
+ * @now [in]: current TSC
+ */
+void
+evict_poll(uint64_t now)
+{
+    bool sampled[MAX_PORTS] = {};
+    bool any = false;
+    uint16_t nb_ports;
+
+    if (eviction.high == 0 || now < eviction.next_tsc)
+        return;
+    nb_ports = eviction.app_cfg->port_config.nb_ports;
+    eviction.next_tsc = now + EVICT_INTERVAL_MS * rte_get_tsc_hz() / 1000;
+
+    for (uint16_t port_id = 0; port_id < nb_ports; port_id++) {
+        sampled[port_id] = pipe_mgr.occupancy(port_id) >= eviction.low;
+        any |= sampled[port_id];
+        eviction.candidates[port_id].clear();
+    }
+    if (!any)
+        return;
+    pipe_mgr.collect_evict(now, sampled, eviction.candidates);
+    for (uint16_t port_id = 0; port_id < nb_ports; port_id++)
+        evict_port(port_id, &lcore_metrics[rte_lcore_id()]);
+}
+
+/*
+ * Remove the flows the main thread handed to this pmd for eviction, skipping
+ * those which went away meanwhile. The completions are collected with those
+ * of the aging.
+ *
+ * @params [in]: pmd parameters
+ */
+void
+evict_pmd_poll(struct pmd_params_t* params)
+{
+    struct evict_request requests[EVICT_BURST_SZ];
+    struct rte_ring* ring = eviction.rings[params->queue_id];
+    struct flow_record record;
+    unsigned int nb_requests;
+
+    if (ring == NULL)
+        return;
+    nb_requests = rte_ring_sc_dequeue_burst_elem(ring, requests, sizeof(struct evict_request), EVICT_BURST_SZ,
+                                                 NULL);
+    for (unsigned int i = 0; i < nb_requests; i++) {
+        struct flow_ctx* ctx = requests[i].ctx;
+
+        // only this pmd releases its flows, so an installed one stays valid
+        if (!pipe_mgr.contains(requests[i].entry, ctx, requests[i].generation) || ctx->remove_tsc != 0)
+            continue;
+        flow_export_prepare(ctx, FLOW_END_LACK_OF_RESOURCES, &record);
+        insert_budget_take(params, INSERT_REMOVE);
+        __atomic_store_n(&ctx->remove_tsc, rte_rdtsc(), __ATOMIC_RELAXED);
+        if (flow_backend->remove_entry(params->queue_id, DOCA_FLOW_NO_WAIT, requests[i].entry) != DOCA_SUCCESS) {
+            __atomic_store_n(&ctx->remove_tsc, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        flow_export_removed(&record);
+        params->metrics->evictions++;
+    }
+}
+
+/*
+ * Release the eviction rings, once the pmds are stopped; evictions left in
+ * them are dropped with the flows, which the pipes flush removes
+ */
+void
+evict_fini(void)
+{
+    for (int queue_id = 0; queue_id < RTE_MAX_LCORE; queue_id++) {
+        rte_ring_free(eviction.rings[queue_id]);
+        eviction.rings[queue_id] = NULL;
+    }
+}
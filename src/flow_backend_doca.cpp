@@ -0,0 +1,1246 @@
+/*
+ * Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES, ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of NVIDIA CORPORATION &
+ * AFFILIATES (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ *
+ */
+
+#include "selective_fwd.h"
+
+DOCA_LOG_REGISTER(SELECTIVE_FWD_BACKEND_DOCA);
+
+/*
+ * Create DOCA Flow pipe with a match-all entry, that forwards the matched
+ * traffic to RSS
+ *
+ * @port [in]: port of the pipe
+ * @pipe_queue [in]: pipe queue owned by the caller, to add the entry on
+ * @pipe [out]: created pipe pointer
+ * @nb_queues [in]: number of RSS queues
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+static doca_error_t
+create_rss_pipe(struct doca_flow_port* port,
+                uint16_t pipe_queue,
+                struct doca_flow_pipe** pipe,
+                uint16_t nb_queues)
+{
+    struct doca_flow_match match;
+    struct doca_flow_pipe_cfg* cfg;
+    struct doca_flow_fwd fwd;
+    doca_error_t result;
+    uint16_t rss_queues[256];
+    // the entry process callback reads the kind of the context past its status
+    struct flow_ctx ctx = {};
+    uint32_t nb_entries = 1;
+
+    memset(&match, 0, sizeof(match));
+    memset(&fwd, 0, sizeof(fwd));
+
+    for (uint16_t i = 0; i < nb_queues; i++)
+        rss_queues[i] = i;
+
+    /* RSS queue - send matched traffic to all the configured queues  */
+    fwd.type = DOCA_FLOW_FWD_RSS;
+    fwd.rss_queues = rss_queues;
+    fwd.rss_outer_flags = DOCA_FLOW_RSS_IPV4 | DOCA_FLOW_RSS_TCP;
+    // both directions of a connection hash alike, and queue i is polled by the
+    // same lcore on every port, so a connection stays on one lcore
+    fwd.rss_hash_func = DOCA_FLOW_RSS_HASH_FUNCTION_SYMMETRIC_TOEPLITZ;
+    fwd.num_of_queues = nb_queues;
+
+    result = doca_flow_pipe_cfg_create(&cfg, port);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to create doca_flow_pipe_cfg: %s",
+                     doca_error_get_descr(result));
+        return result;
+    }
+
+    result = set_flow_pipe_cfg(cfg, "RSS_PIPE", DOCA_FLOW_PIPE_BASIC, false);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg: %s",
+                     doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+    result = doca_flow_pipe_cfg_set_match(cfg, &match, NULL);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg match: %s",
+                     doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    result = doca_flow_pipe_cfg_set_nr_entries(cfg, nb_entries);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg nb_entries: %s",
+                     doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    result = doca_flow_pipe_create(cfg, &fwd, NULL, pipe);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to create RSS pipe: %s",
+                     doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+    doca_flow_pipe_cfg_destroy(cfg);
+
+    for (uint32_t i = 0; i < nb_entries; i++) {
+        result = doca_flow_pipe_add_entry(pipe_queue,
+                                          *pipe,
+                                          &match,
+                                          NULL,
+                                          NULL,
+                                          &fwd,
+                                          DOCA_FLOW_WAIT_FOR_BATCH,
+                                          &ctx,
+                                          NULL);
+        if (result != DOCA_SUCCESS) {
+            DOCA_LOG_ERR("Failed to add RSS pipe entry: %s",
+                         doca_error_get_descr(result));
+            return result;
+        }
+    }
+
+    result = doca_flow_entries_process(port, pipe_queue, DEFAULT_TIMEOUT_US, nb_entries);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to process RSS entry: %s",
+                     doca_error_get_descr(result));
+        return result;
+    }
+
+    if (ctx.status.nb_processed != nb_entries || ctx.status.failure) {
+        DOCA_LOG_ERR("Failed to process RSS entry");
+        return DOCA_ERROR_BAD_STATE;
+    }
+
+    return result;
+
+destroy_pipe_cfg:
+    doca_flow_pipe_cfg_destroy(cfg);
+    return result;
+}
+
+/*
+ * Create DOCA Flow pipe matching the color given by the meter of a hairpin
+ * entry: green and yellow packets go to the hairpin queues towards one egress
+ * port, red ones are dropped
+ *
+ * @port [in]: port of the pipe
+ * @pipe_queue [in]: pipe queue owned by the caller, to add the entries on
+ * @base_hairpin_q [in]: first hairpin queue towards the egress port
+ * @hairpin_q_len [in]: number of hairpin queues towards the egress port
+ * @pipe [out]: created pipe pointer
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+static doca_error_t
+create_color_pipe(struct doca_flow_port* port,
+                  uint16_t pipe_queue,
+                  uint16_t base_hairpin_q,
+                  uint8_t hairpin_q_len,
+                  struct doca_flow_pipe** pipe)
+{
+    static const enum doca_flow_meter_color colors[] = { DOCA_FLOW_METER_COLOR_GREEN, DOCA_FLOW_METER_COLOR_YELLOW };
+    uint32_t nb_entries = sizeof(colors) / sizeof(colors[0]);
+    struct doca_flow_match match;
+    struct doca_flow_pipe_cfg* cfg;
+    struct doca_flow_fwd fwd, fwd_miss;
+    struct flow_ctx ctx = {};
+    uint16_t hairpin_queues[hairpin_q_len];
+    doca_error_t result;
+
+    memset(&match, 0, sizeof(match));
+    memset(&fwd, 0, sizeof(fwd));
+    memset(&fwd_miss, 0, sizeof(fwd_miss));
+
+    match.parser_meta.meter_color = (enum doca_flow_meter_color)0xff;
+
+    for (uint16_t i = 0; i < hairpin_q_len; i++)
+        hairpin_queues[i] = base_hairpin_q + i;
+    fwd.type = DOCA_FLOW_FWD_RSS;
+    fwd.rss_queues = hairpin_queues;
+    fwd.num_of_queues = hairpin_q_len;
+    fwd.rss_outer_flags = DOCA_FLOW_RSS_IPV4 | DOCA_FLOW_RSS_TCP;
+
+    /* red packets match no entry */
+    fwd_miss.type = DOCA_FLOW_FWD_DROP;
+
+    result = doca_flow_pipe_cfg_create(&cfg, port);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to create doca_flow_pipe_cfg: %s",
+                     doca_error_get_descr(result));
+        return result;
+    }
+
+    result = set_flow_pipe_cfg(cfg, "COLOR_PIPE", DOCA_FLOW_PIPE_BASIC, false);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg: %s",
+                     doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+    result = doca_flow_pipe_cfg_set_match(cfg, &match, NULL);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg match: %s",
+                     doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    result = doca_flow_pipe_cfg_set_nr_entries(cfg, nb_entries);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg nb_entries: %s",
+                     doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    result = doca_flow_pipe_create(cfg, &fwd, &fwd_miss, pipe);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to create color pipe: %s",
+                     doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+    doca_flow_pipe_cfg_destroy(cfg);
+
+    for (uint32_t i = 0; i < nb_entries; i++) {
+        match.parser_meta.meter_color = colors[i];
+        result = doca_flow_pipe_add_entry(pipe_queue,
+                                          *pipe,
+                                          &match,
+                                          NULL,
+                                          NULL,
+                                          NULL,
+                                          DOCA_FLOW_WAIT_FOR_BATCH,
+                                          &ctx,
+                                          NULL);
+        if (result != DOCA_SUCCESS) {
+            DOCA_LOG_ERR("Failed to add color pipe entry: %s",
+                         doca_error_get_descr(result));
+            return result;
+        }
+    }
+
+    result = doca_flow_entries_process(port, pipe_queue, DEFAULT_TIMEOUT_US, nb_entries);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to process color entries: %s",
+                     doca_error_get_descr(result));
+        return result;
+    }
+
+    if (ctx.status.nb_processed != nb_entries || ctx.status.failure) {
+        DOCA_LOG_ERR("Failed to process color entries");
+        return DOCA_ERROR_BAD_STATE;
+    }
+
+    return result;
+
+destroy_pipe_cfg:
+    doca_flow_pipe_cfg_destroy(cfg);
+    return result;
+}
+
+/*
+ * Create DOCA Flow control pipe mirroring a sample of the traffic of the
+ * hairpin entries towards one egress port: packets whose random value is 0
+ * under the rate mask go through the shared mirror of the port, then every
+ * packet goes on to the next pipe, or to the hairpin queues
+ *
+ * @port [in]: port of the pipe
+ * @pipe_queue [in]: pipe queue owned by the caller, to add the entries on
+ * @mirror_id [in]: shared mirror of the port
+ * @rate [in]: 1 in rate packets are mirrored, a power of two
+ * @base_hairpin_q [in]: first hairpin queue towards the egress port
+ * @hairpin_q_len [in]: number of hairpin queues towards the egress port
+ * @next_pipe [in]: pipe the packets go to, NULL for the hairpin queues
+ * @pipe [out]: created pipe pointer
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+static doca_error_t
+create_sample_pipe(struct doca_flow_port* port,
+                   uint16_t pipe_queue,
+                   uint32_t mirror_id,
+                   uint32_t rate,
+                   uint16_t base_hairpin_q,
+                   uint8_t hairpin_q_len,
+                   struct doca_flow_pipe* next_pipe,
+                   struct doca_flow_pipe** pipe)
+{
+    struct doca_flow_match match, match_mask;
+    struct doca_flow_monitor monitor;
+    struct doca_flow_pipe_cfg* cfg;
+    struct doca_flow_fwd fwd;
+    struct flow_ctx ctx = {};
+    uint16_t hairpin_queues[hairpin_q_len];
+    doca_error_t result;
+
+    memset(&match, 0, sizeof(match));
+    memset(&match_mask, 0, sizeof(match_mask));
+    memset(&monitor, 0, sizeof(monitor));
+    memset(&fwd, 0, sizeof(fwd));
+
+    if (next_pipe != NULL) {
+        fwd.type = DOCA_FLOW_FWD_PIPE;
+        fwd.next_pipe = next_pipe;
+    } else {
+        for (uint16_t i = 0; i < hairpin_q_len; i++)
+            hairpin_queues[i] = base_hairpin_q + i;
+        fwd.type = DOCA_FLOW_FWD_RSS;
+        fwd.rss_queues = hairpin_queues;
+        fwd.num_of_queues = hairpin_q_len;
+        fwd.rss_outer_flags = DOCA_FLOW_RSS_IPV4 | DOCA_FLOW_RSS_TCP;
+    }
+
+    result = doca_flow_pipe_cfg_create(&cfg, port);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to create doca_flow_pipe_cfg: %s",
+                     doca_error_get_descr(result));
+        return result;
+    }
+
+    result = set_flow_pipe_cfg(cfg, "SAMPLE_PIPE", DOCA_FLOW_PIPE_CONTROL, false);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg: %s",
+                     doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    result = doca_flow_pipe_cfg_set_nr_entries(cfg, 2);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg nb_entries: %s",
+                     doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    result = doca_flow_pipe_create(cfg, NULL, NULL, pipe);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to create sample pipe: %s",
+                     doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+    doca_flow_pipe_cfg_destroy(cfg);
+
+    /* the sampled packets, mirrored */
+    match_mask.parser_meta.random = rate - 1;
+    monitor.shared_mirror_id = mirror_id;
+    result = doca_flow_pipe_control_add_entry(pipe_queue, 0, *pipe, &match, &match_mask, NULL, NULL, NULL, NULL,
+                                              &monitor, &fwd, &ctx, NULL);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to add sample pipe entry: %s",
+                     doca_error_get_descr(result));
+        return result;
+    }
+
+    /* all the others */
+    match_mask.parser_meta.random = 0;
+    result = doca_flow_pipe_control_add_entry(pipe_queue, 1, *pipe, &match, &match_mask, NULL, NULL, NULL, NULL,
+                                              NULL, &fwd, &ctx, NULL);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to add sample pipe entry: %s",
+                     doca_error_get_descr(result));
+        return result;
+    }
+
+    result = doca_flow_entries_process(port, pipe_queue, DEFAULT_TIMEOUT_US, 2);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to process sample entries: %s",
+                     doca_error_get_descr(result));
+        return result;
+    }
+
+    if (ctx.status.nb_processed != 2 || ctx.status.failure) {
+        DOCA_LOG_ERR("Failed to process sample entries");
+        return DOCA_ERROR_BAD_STATE;
+    }
+
+    return result;
+
+destroy_pipe_cfg:
+    doca_flow_pipe_cfg_destroy(cfg);
+    return result;
+}
+
+/*
+ * Create DOCA Flow ACL pipe matching masked 5-tuples and L4 port ranges, each
+ * entry forwarding to the hairpin queues of its egress port
+ *
+ * @port [in]: port of the pipe
+ * @pipe_fwd_miss [in]: pipe the packets matching no entry go to
+ * @nb_rules [in]: maximum number of entries
+ * @pipe [out]: created pipe pointer
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+static doca_error_t
+create_acl_pipe(struct doca_flow_port* port,
+                struct doca_flow_pipe* pipe_fwd_miss,
+                uint32_t nb_rules,
+                struct doca_flow_pipe** pipe)
+{
+    struct doca_flow_match match;
+    struct doca_flow_match match_mask;
+    struct doca_flow_pipe_cfg* pipe_cfg;
+    struct doca_flow_fwd fwd_miss;
+    doca_error_t result;
+
+    memset(&match, 0, sizeof(match));
+    memset(&match_mask, 0, sizeof(match_mask));
+    memset(&fwd_miss, 0, sizeof(fwd_miss));
+
+    /* masked 5 tuple match, masks and port ranges set per entry */
+    match.outer.l4_type_ext = DOCA_FLOW_L4_TYPE_EXT_TCP;
+    match.outer.l3_type = DOCA_FLOW_L3_TYPE_IP4;
+    match.outer.ip4.src_ip = 0xffffffff;
+    match.outer.ip4.dst_ip = 0xffffffff;
+    match.outer.tcp.l4_port.src_port = 0xffff;
+    match.outer.tcp.l4_port.dst_port = 0xffff;
+    match_mask = match;
+
+    result = doca_flow_pipe_cfg_create(&pipe_cfg, port);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to create doca_flow_pipe_cfg: %s",
+                     doca_error_get_descr(result));
+        return result;
+    }
+
+    result = set_flow_pipe_cfg(pipe_cfg, "ACL_PIPE", DOCA_FLOW_PIPE_ACL, false);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg: %s", doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    result = doca_flow_pipe_cfg_set_match(pipe_cfg, &match, &match_mask);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg match: %s", doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    result = doca_flow_pipe_cfg_set_nr_entries(pipe_cfg, nb_rules);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg nr_entries: %s", doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    fwd_miss.type = DOCA_FLOW_FWD_PIPE;
+    fwd_miss.next_pipe = pipe_fwd_miss;
+
+    /* forwarding traffic to the egress port, set per entry */
+    result = doca_flow_pipe_create(pipe_cfg, NULL, &fwd_miss, pipe);
+    if (result != DOCA_SUCCESS)
+        DOCA_LOG_ERR("Failed to create ACL pipe: %s", doca_error_get_descr(result));
+
+destroy_pipe_cfg:
+    doca_flow_pipe_cfg_destroy(pipe_cfg);
+    return result;
+}
+
+/*
+ * Match and mask of an L4 port range of an ACL entry: a single port is matched
+ * exactly and a partial range as a range, from the match value to the mask value
+ *
+ * @min [in]: first port of the range
+ * @max [in]: last port of the range
+ * @port [out]: match value
+ * @port_mask [out]: mask value
+ */
+static void
+acl_port_range(uint16_t min, uint16_t max, doca_be16_t* port, doca_be16_t* port_mask)
+{
+    if (min == 0 && max == UINT16_MAX) {
+        *port = 0;
+        *port_mask = 0;
+    } else if (min == max) {
+        *port = rte_cpu_to_be_16(min);
+        *port_mask = 0xffff;
+    } else {
+        *port = rte_cpu_to_be_16(min);
+        *port_mask = rte_cpu_to_be_16(max);
+    }
+}
+
+/*
+ * Submit the ACL entry of an aggregate without waiting for its completion
+ *
+ * @pipe [in]: ACL pipe of the ingress port
+ * @rule [in]: aggregate to match
+ * @hairpin_fwd [in]: hairpin queues towards the egress port
+ * @pipe_queue [in]: pipe queue to submit on
+ * @flags [in]: DOCA_FLOW_WAIT_FOR_BATCH or DOCA_FLOW_NO_WAIT
+ * @user_ctx [in]: user context passed to the entry process callback
+ * @entry [out]: created entry
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+static doca_error_t
+submit_acl_pipe_entry(struct doca_flow_pipe* pipe,
+                      const struct aggregate_rule* rule,
+                      const struct hairpin_fwd* hairpin_fwd,
+                      uint16_t pipe_queue,
+                      uint32_t flags,
+                      void* user_ctx,
+                      struct doca_flow_pipe_entry** entry)
+{
+    struct doca_flow_match match;
+    struct doca_flow_match match_mask;
+
+    memset(&match, 0, sizeof(match));
+    memset(&match_mask, 0, sizeof(match_mask));
+
+    match.outer.l4_type_ext = DOCA_FLOW_L4_TYPE_EXT_TCP;
+    match.outer.l3_type = DOCA_FLOW_L3_TYPE_IP4;
+    match.outer.ip4.src_ip = rule->src_ip;
+    match_mask.outer.ip4.src_ip = aggregate_prefix_mask(rule->src_prefix);
+    match.outer.ip4.dst_ip = rule->dst_ip;
+    match_mask.outer.ip4.dst_ip = aggregate_prefix_mask(rule->dst_prefix);
+    acl_port_range(rule->src_port_min, rule->src_port_max,
+                   &match.outer.tcp.l4_port.src_port, &match_mask.outer.tcp.l4_port.src_port);
+    acl_port_range(rule->dst_port_min, rule->dst_port_max,
+                   &match.outer.tcp.l4_port.dst_port, &match_mask.outer.tcp.l4_port.dst_port);
+
+    uint16_t hairpin_queues[hairpin_fwd->hairpin_q_len];
+    for (uint16_t i = 0; i < hairpin_fwd->hairpin_q_len; i++)
+        hairpin_queues[i] = hairpin_fwd->base_hairpin_q + i;
+
+    struct doca_flow_fwd fwd = {};
+    fwd.type = DOCA_FLOW_FWD_RSS;
+    fwd.rss_queues = (uint16_t*)&hairpin_queues;
+    fwd.num_of_queues = hairpin_fwd->hairpin_q_len;
+    fwd.rss_outer_flags = DOCA_FLOW_RSS_IPV4 | DOCA_FLOW_RSS_TCP;
+
+    return doca_flow_pipe_acl_add_entry(pipe_queue, pipe, &match, &match_mask, rule->priority, &fwd,
+                                        (enum doca_flow_flags_type)flags, user_ctx, entry);
+}
+
+/*
+ * Create DOCA Flow LPM pipe matching the IPv4 source by longest prefix and
+ * dropping the matched traffic
+ *
+ * @port [in]: port of the pipe
+ * @pipe_fwd_miss [in]: pipe the packets matching no prefix go to
+ * @nb_prefixes [in]: maximum number of entries
+ * @pipe [out]: created pipe pointer
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+static doca_error_t
+create_lpm_pipe(struct doca_flow_port* port,
+                struct doca_flow_pipe* pipe_fwd_miss,
+                uint32_t nb_prefixes,
+                struct doca_flow_pipe** pipe)
+{
+    struct doca_flow_match match;
+    struct doca_flow_match match_mask;
+    struct doca_flow_pipe_cfg* pipe_cfg;
+    struct doca_flow_fwd fwd, fwd_miss;
+    doca_error_t result;
+
+    memset(&match, 0, sizeof(match));
+    memset(&match_mask, 0, sizeof(match_mask));
+    memset(&fwd, 0, sizeof(fwd));
+    memset(&fwd_miss, 0, sizeof(fwd_miss));
+
+    /* source prefix match, the prefix length set per entry */
+    match.outer.l3_type = DOCA_FLOW_L3_TYPE_IP4;
+    match.outer.ip4.src_ip = 0xffffffff;
+    match_mask.outer.ip4.src_ip = 0xffffffff;
+
+    result = doca_flow_pipe_cfg_create(&pipe_cfg, port);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to create doca_flow_pipe_cfg: %s",
+                     doca_error_get_descr(result));
+        return result;
+    }
+
+    result = set_flow_pipe_cfg(pipe_cfg, "BLOCKLIST_PIPE", DOCA_FLOW_PIPE_LPM, false);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg: %s", doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    result = doca_flow_pipe_cfg_set_match(pipe_cfg, &match, &match_mask);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg match: %s", doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    result = doca_flow_pipe_cfg_set_nr_entries(pipe_cfg, nb_prefixes);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg nr_entries: %s", doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    fwd.type = DOCA_FLOW_FWD_DROP;
+    fwd_miss.type = DOCA_FLOW_FWD_PIPE;
+    fwd_miss.next_pipe = pipe_fwd_miss;
+
+    result = doca_flow_pipe_create(pipe_cfg, &fwd, &fwd_miss, pipe);
+    if (result != DOCA_SUCCESS)
+        DOCA_LOG_ERR("Failed to create LPM pipe: %s", doca_error_get_descr(result));
+
+destroy_pipe_cfg:
+    doca_flow_pipe_cfg_destroy(pipe_cfg);
+    return result;
+}
+
+/*
+ * Create DOCA Flow root pipe with a match-all entry, that forwards all the
+ * traffic to the blocklist pipe
+ *
+ * @port [in]: port of the pipe
+ * @pipe_queue [in]: pipe queue owned by the caller, to add the entry on
+ * @blocklist_pipe [in]: LPM pipe of the blocklist
+ * @pipe [out]: created pipe pointer
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+static doca_error_t
+create_blocklist_root_pipe(struct doca_flow_port* port,
+                           uint16_t pipe_queue,
+                           struct doca_flow_pipe* blocklist_pipe,
+                           struct doca_flow_pipe** pipe)
+{
+    struct doca_flow_match match;
+    struct doca_flow_pipe_cfg* cfg;
+    struct doca_flow_fwd fwd;
+    struct flow_ctx ctx = {};
+    doca_error_t result;
+
+    memset(&match, 0, sizeof(match));
+    memset(&fwd, 0, sizeof(fwd));
+
+    fwd.type = DOCA_FLOW_FWD_PIPE;
+    fwd.next_pipe = blocklist_pipe;
+
+    result = doca_flow_pipe_cfg_create(&cfg, port);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to create doca_flow_pipe_cfg: %s",
+                     doca_error_get_descr(result));
+        return result;
+    }
+
+    result = set_flow_pipe_cfg(cfg, "BLOCKLIST_ROOT_PIPE", DOCA_FLOW_PIPE_BASIC, true);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg: %s",
+                     doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+    result = doca_flow_pipe_cfg_set_match(cfg, &match, NULL);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg match: %s",
+                     doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    result = doca_flow_pipe_cfg_set_nr_entries(cfg, 1);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg nb_entries: %s",
+                     doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    result = doca_flow_pipe_create(cfg, &fwd, NULL, pipe);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to create blocklist root pipe: %s",
+                     doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+    doca_flow_pipe_cfg_destroy(cfg);
+
+    result = doca_flow_pipe_add_entry(pipe_queue, *pipe, &match, NULL, NULL, &fwd,
+                                      DOCA_FLOW_NO_WAIT, &ctx, NULL);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to add blocklist root pipe entry: %s",
+                     doca_error_get_descr(result));
+        return result;
+    }
+
+    result = doca_flow_entries_process(port, pipe_queue, DEFAULT_TIMEOUT_US, 1);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to process blocklist root entry: %s",
+                     doca_error_get_descr(result));
+        return result;
+    }
+
+    if (ctx.status.nb_processed != 1 || ctx.status.failure) {
+        DOCA_LOG_ERR("Failed to process blocklist root entry");
+        return DOCA_ERROR_BAD_STATE;
+    }
+
+    return result;
+
+destroy_pipe_cfg:
+    doca_flow_pipe_cfg_destroy(cfg);
+    return result;
+}
+
+/*
+ * Submit a blocklist prefix without waiting for its completion
+ *
+ * @pipe [in]: LPM pipe of the blocklist
+ * @addr [in]: address of the prefix, network order
+ * @prefix [in]: prefix length
+ * @pipe_queue [in]: pipe queue to submit on
+ * @flags [in]: DOCA_FLOW_WAIT_FOR_BATCH or DOCA_FLOW_NO_WAIT
+ * @user_ctx [in]: user context passed to the entry process callback
+ * @entry [out]: created entry
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+static doca_error_t
+submit_lpm_pipe_entry(struct doca_flow_pipe* pipe,
+                      doca_be32_t addr,
+                      uint8_t prefix,
+                      uint16_t pipe_queue,
+                      uint32_t flags,
+                      void* user_ctx,
+                      struct doca_flow_pipe_entry** entry)
+{
+    struct doca_flow_match match;
+    struct doca_flow_match match_mask;
+    struct doca_flow_fwd fwd;
+
+    memset(&match, 0, sizeof(match));
+    memset(&match_mask, 0, sizeof(match_mask));
+    memset(&fwd, 0, sizeof(fwd));
+
+    match.outer.l3_type = DOCA_FLOW_L3_TYPE_IP4;
+    match.outer.ip4.src_ip = addr;
+    match_mask.outer.ip4.src_ip = aggregate_prefix_mask(prefix);
+    fwd.type = DOCA_FLOW_FWD_DROP;
+
+    return doca_flow_pipe_lpm_add_entry(pipe_queue, pipe, &match, &match_mask, NULL, NULL, &fwd,
+                                        (enum doca_flow_flags_type)flags, user_ctx, entry);
+}
+
+// Resize state of the hairpin pipe of a port, its pipe user context
+struct hairpin_table {
+    int port_id;
+    struct doca_flow_pipe* pipe;
+    // entries the pipe holds now
+    std::atomic<uint32_t> nb_entries;
+    // set by the pipe process callback on the queue which found the pipe
+    // congested, cleared by the main thread when it starts the resize
+    std::atomic<bool> congested;
+    // from the resize until the pipe process callback reports it done
+    std::atomic<bool> resizing;
+};
+
+static struct hairpin_table hairpin_tables[MAX_PORTS];
+
+/*
+ * Pipe process callback, runs on the thread processing the pipe queue the
+ * event arrived on. Only the hairpin pipes are resizable, the other pipes
+ * have no user context.
+ *
+ * @pipe [in]: DOCA Flow pipe
+ * @status [in]: status of the operation
+ * @op [in]: pipe operation
+ * @user_ctx [in]: hairpin table of the pipe, NULL for the other pipes
+ */
+static void
+hairpin_pipe_process_cb(struct doca_flow_pipe* pipe,
+                        enum doca_flow_pipe_status status,
+                        enum doca_flow_pipe_op op,
+                        void* user_ctx)
+{
+    struct hairpin_table* table = (struct hairpin_table*)user_ctx;
+
+    (void)pipe;
+    if (table == NULL)
+        return;
+    switch (op) {
+        case DOCA_FLOW_PIPE_OP_CONGESTION_REACHED:
+            table->congested = true;
+            break;
+        case DOCA_FLOW_PIPE_OP_RESIZED:
+            if (status != DOCA_FLOW_PIPE_STATUS_SUCCESS)
+                DOCA_LOG_ERR("Failed to resize the hairpin pipe of port %d", table->port_id);
+            else
+                DOCA_LOG_INFO("Resized the hairpin pipe of port %d to %u entries", table->port_id,
+                              table->nb_entries.load());
+            table->resizing = false;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Resize callback, the hairpin pipe of a port got more entries
+ *
+ * @pipe_user_ctx [in]: hairpin table of the pipe
+ * @nr_entries [in]: entries of the pipe
+ * @return: DOCA_SUCCESS
+ */
+static doca_error_t
+hairpin_nr_entries_changed_cb(void* pipe_user_ctx, uint32_t nr_entries)
+{
+    ((struct hairpin_table*)pipe_user_ctx)->nb_entries = nr_entries;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * Resize callback, an entry moved to the grown table keeps its flow context
+ *
+ * @pipe_user_ctx [in]: hairpin table of the pipe
+ * @pipe_queue [in]: queue the entry is relocated on
+ * @entry_user_ctx [in]: flow context of the entry
+ * @new_entry_user_ctx [out]: flow context of the relocated entry
+ * @return: DOCA_SUCCESS
+ */
+static doca_error_t
+hairpin_entry_relocate_cb(void* pipe_user_ctx, uint16_t pipe_queue, void* entry_user_ctx, void** new_entry_user_ctx)
+{
+    (void)pipe_user_ctx;
+    (void)pipe_queue;
+    *new_entry_user_ctx = entry_user_ctx;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * Create DOCA Flow pipe with 5 tuple match that forwards the matched traffic to
+ * the hairpin queues of each entry's egress port, or through the entry's
+ * shared meter to the color pipe of its egress port when metered
+ *
+ * @port [in]: port of the pipe
+ * @port_id [in]: port ID of the pipe
+ * @metered [in]: whether every entry has a shared meter
+ * @sampled [in]: whether every entry goes through a sample pipe
+ * @is_root [in]: whether the pipe is the root pipe of the port
+ * @table_cfg [in]: entries of the pipe, and whether it grows
+ * @pipe [out]: created pipe pointer
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+static doca_error_t
+create_hairpin_pipe(struct doca_flow_port* port,
+                    int port_id,
+                    bool metered,
+                    bool sampled,
+                    bool is_root,
+                    const struct hairpin_table_cfg* table_cfg,
+                    struct doca_flow_pipe* pipe_fwd_miss,
+                    struct doca_flow_pipe** pipe)
+{
+    struct doca_flow_match match;
+    struct doca_flow_actions actions, *actions_arr[NB_ACTIONS_ARR];
+    struct doca_flow_fwd fwd, fwd_miss;
+    struct doca_flow_pipe_cfg* pipe_cfg;
+    struct doca_flow_monitor monitor;
+    doca_error_t result;
+
+    memset(&match, 0, sizeof(match));
+    memset(&actions, 0, sizeof(actions));
+    memset(&fwd, 0, sizeof(fwd));
+    memset(&fwd_miss, 0, sizeof(fwd_miss));
+    memset(&monitor, 0, sizeof(monitor));
+
+    /* 5 tuple match */
+    match.parser_meta.outer_l4_type = DOCA_FLOW_L4_META_TCP;
+    match.parser_meta.outer_l3_type = DOCA_FLOW_L3_META_IPV4;
+    match.outer.l4_type_ext = DOCA_FLOW_L4_TYPE_EXT_TCP;
+    match.outer.l3_type = DOCA_FLOW_L3_TYPE_IP4;
+    match.outer.ip4.src_ip = 0xffffffff;
+    match.outer.ip4.dst_ip = 0xffffffff;
+    match.outer.tcp.l4_port.src_port = 0xffff;
+    match.outer.tcp.l4_port.dst_port = 0xffff;
+
+    actions_arr[0] = &actions;
+
+    monitor.aging_sec = FLOW_TIMEOUT_SEC;
+    monitor.counter_type = DOCA_FLOW_RESOURCE_TYPE_NON_SHARED;
+    if (metered) {
+        monitor.meter_type = DOCA_FLOW_RESOURCE_TYPE_SHARED;
+        monitor.shared_meter_id = 0xffffffff;
+    }
+
+    result = doca_flow_pipe_cfg_create(&pipe_cfg, port);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to create doca_flow_pipe_cfg: %s",
+                     doca_error_get_descr(result));
+        return result;
+    }
+
+    result = set_flow_pipe_cfg(pipe_cfg, "HAIRPIN_PIPE", DOCA_FLOW_PIPE_BASIC, is_root);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg: %s", doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    result = doca_flow_pipe_cfg_set_match(pipe_cfg, &match, NULL);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg match: %s", doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    result = doca_flow_pipe_cfg_set_actions(pipe_cfg, actions_arr, NULL, NULL, NB_ACTIONS_ARR);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg actions: %s", doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    result = doca_flow_pipe_cfg_set_monitor(pipe_cfg, &monitor);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg monitor: %s", doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    result = doca_flow_pipe_cfg_set_nr_entries(pipe_cfg, table_cfg->initial_entries);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg nr_entries: %s", doca_error_get_descr(result));
+        goto destroy_pipe_cfg;
+    }
+
+    if (table_cfg->resizable) {
+        result = doca_flow_pipe_cfg_set_is_resizable(pipe_cfg, true);
+        if (result != DOCA_SUCCESS) {
+            DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg is_resizable: %s", doca_error_get_descr(result));
+            goto destroy_pipe_cfg;
+        }
+
+        result = doca_flow_pipe_cfg_set_congestion_level_threshold(pipe_cfg, TABLE_CONGESTION_PCT);
+        if (result != DOCA_SUCCESS) {
+            DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg congestion_level_threshold: %s",
+                         doca_error_get_descr(result));
+            goto destroy_pipe_cfg;
+        }
+
+        hairpin_tables[port_id].port_id = port_id;
+        hairpin_tables[port_id].nb_entries = table_cfg->initial_entries;
+        hairpin_tables[port_id].congested = false;
+        hairpin_tables[port_id].resizing = false;
+        result = doca_flow_pipe_cfg_set_user_ctx(pipe_cfg, &hairpin_tables[port_id]);
+        if (result != DOCA_SUCCESS) {
+            DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg user_ctx: %s", doca_error_get_descr(result));
+            goto destroy_pipe_cfg;
+        }
+    }
+
+    /* forwarding traffic to the egress port, set per entry */
+    if (metered || sampled) {
+        fwd.type = DOCA_FLOW_FWD_PIPE;
+        fwd.next_pipe = NULL;
+    } else {
+        fwd.type = DOCA_FLOW_FWD_RSS;
+        fwd.num_of_queues = 0xffffffff;
+    }
+
+    fwd_miss.type = DOCA_FLOW_FWD_PIPE;
+    fwd_miss.next_pipe = pipe_fwd_miss;
+
+    result = doca_flow_pipe_create(pipe_cfg, &fwd, &fwd_miss, pipe);
+    if (result != DOCA_SUCCESS)
+        DOCA_LOG_ERR("Failed to create pipe: %s", doca_error_get_descr(result));
+    else if (table_cfg->resizable)
+        hairpin_tables[port_id].pipe = *pipe;
+
+destroy_pipe_cfg:
+    doca_flow_pipe_cfg_destroy(pipe_cfg);
+    return result;
+}
+
+/*
+ * Submit a hairpin pipe entry without waiting for its completion
+ *
+ * @pipe [in]: hairpin pipe of the ingress port
+ * @key [in]: 5-tuple to match
+ * @hairpin_fwd [in]: hairpin queues towards the egress port, or meter,
+ *                    sample pipe and color pipe of the entry
+ * @pipe_queue [in]: pipe queue to submit on
+ * @flags [in]: DOCA_FLOW_WAIT_FOR_BATCH or DOCA_FLOW_NO_WAIT
+ * @user_ctx [in]: user context passed to the entry process callback
+ * @entry [out]: created entry
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+static doca_error_t
+submit_hairpin_pipe_entry(struct doca_flow_pipe* pipe,
+                          const struct flow_key* key,
+                          const struct hairpin_fwd* hairpin_fwd,
+                          uint16_t pipe_queue,
+                          uint32_t flags,
+                          void* user_ctx,
+                          struct doca_flow_pipe_entry** entry)
+{
+    struct doca_flow_match match;
+    struct doca_flow_actions actions;
+    struct doca_flow_monitor monitor;
+
+    memset(&match, 0, sizeof(match));
+    memset(&actions, 0, sizeof(actions));
+    memset(&monitor, 0, sizeof(monitor));
+
+    match.outer.ip4.dst_ip = key->dst_ip;
+    match.outer.ip4.src_ip = key->src_ip;
+    match.outer.tcp.l4_port.dst_port = key->dst_port;
+    match.outer.tcp.l4_port.src_port = key->src_port;
+
+    struct doca_flow_fwd fwd = {};
+    if (hairpin_fwd->color_pipe != NULL || hairpin_fwd->sample_pipe != NULL) {
+        // the sample pipe goes on to the color pipe
+        monitor.shared_meter_id = hairpin_fwd->meter_id;
+        fwd.type = DOCA_FLOW_FWD_PIPE;
+        fwd.next_pipe = hairpin_fwd->sample_pipe != NULL ? hairpin_fwd->sample_pipe : hairpin_fwd->color_pipe;
+        return doca_flow_pipe_add_entry(pipe_queue, pipe, &match, &actions, &monitor, &fwd, flags, user_ctx, entry);
+    }
+
+    uint16_t hairpin_queues[hairpin_fwd->hairpin_q_len];
+    for (uint16_t i = 0; i < hairpin_fwd->hairpin_q_len; i++)
+        hairpin_queues[i] = hairpin_fwd->base_hairpin_q + i;
+
+    fwd.type = DOCA_FLOW_FWD_RSS;
+    fwd.rss_queues = (uint16_t*)&hairpin_queues;
+    fwd.num_of_queues = hairpin_fwd->hairpin_q_len;
+    fwd.rss_outer_flags = DOCA_FLOW_RSS_IPV4 | DOCA_FLOW_RSS_TCP;
+
+    return doca_flow_pipe_add_entry(pipe_queue, pipe, &match, &actions, NULL, &fwd, flags, user_ctx, entry);
+}
+
+class DocaFlowBackend : public FlowBackend {
+private:
+    // hairpin entries go through a shared meter and a color pipe
+    bool metered = false;
+    // hairpin entries go through a sample pipe
+    bool sampled = false;
+    struct hairpin_table_cfg table = {};
+
+public:
+    const char* name() const override { return "doca"; }
+
+    doca_error_t init(uint16_t nb_rss_queues,
+                      uint16_t nb_pipe_queues,
+                      uint32_t nb_meters,
+                      uint32_t nb_mirrors,
+                      const struct hairpin_table_cfg* table_cfg,
+                      uint16_t nb_ports,
+                      doca_flow_entry_process_cb cb) override
+    {
+        struct flow_resources resource = {};
+        uint32_t nr_shared_resources[SHARED_RESOURCE_NUM_VALUES] = { 0 };
+
+        metered = nb_meters > 0;
+        sampled = nb_mirrors > 0;
+        table = *table_cfg;
+        // counters cannot be added later, so a resizable pipe has them for all its entries from the start
+        resource.nr_counters = table.max_entries * nb_ports;
+        nr_shared_resources[DOCA_FLOW_SHARED_RESOURCE_METER] = nb_meters;
+        nr_shared_resources[DOCA_FLOW_SHARED_RESOURCE_MIRROR] = nb_mirrors;
+        return init_doca_flow_cb(nb_rss_queues, nb_pipe_queues, "vnf,hws", &resource, nr_shared_resources, cb,
+                                 table.resizable ? hairpin_pipe_process_cb : NULL);
+    }
+
+    void destroy() override
+    {
+        doca_flow_destroy();
+    }
+
+    doca_error_t start_ports(uint16_t nb_ports, struct doca_flow_port* ports[MAX_PORTS]) override
+    {
+        struct doca_dev* dev_arr[MAX_PORTS];
+
+        memset(dev_arr, 0, sizeof(struct doca_dev*) * MAX_PORTS);
+        return init_doca_flow_ports(nb_ports, ports, true, dev_arr);
+    }
+
+    void stop_ports(uint16_t nb_ports, struct doca_flow_port* ports[MAX_PORTS]) override
+    {
+        stop_doca_flow_ports(nb_ports, ports);
+    }
+
+    doca_error_t create_rss_pipe(struct doca_flow_port* port,
+                                 uint16_t pipe_queue,
+                                 uint16_t nb_queues,
+                                 struct doca_flow_pipe** pipe) override
+    {
+        return ::create_rss_pipe(port, pipe_queue, pipe, nb_queues);
+    }
+
+    doca_error_t configure_meter(uint32_t meter_id, const struct meter_profile* profile) override
+    {
+        struct doca_flow_shared_resource_cfg cfg;
+
+        memset(&cfg, 0, sizeof(cfg));
+        cfg.meter_cfg.limit_type = DOCA_FLOW_METER_LIMIT_TYPE_BYTES;
+        cfg.meter_cfg.color_mode = DOCA_FLOW_METER_COLOR_MODE_BLIND;
+        cfg.meter_cfg.alg = DOCA_FLOW_METER_ALGORITHM_TYPE_RFC2697;
+        cfg.meter_cfg.cir = profile->cir;
+        cfg.meter_cfg.cbs = profile->cbs;
+        return doca_flow_shared_resource_set_cfg(DOCA_FLOW_SHARED_RESOURCE_METER, meter_id, &cfg);
+    }
+
+    doca_error_t bind_meters(struct doca_flow_port* port, uint32_t* meter_ids, uint32_t nb_meters) override
+    {
+        return doca_flow_shared_resources_bind(DOCA_FLOW_SHARED_RESOURCE_METER, meter_ids, nb_meters, port);
+    }
+
+    doca_error_t create_color_pipe(struct doca_flow_port* port,
+                                   uint16_t pipe_queue,
+                                   uint16_t base_hairpin_q,
+                                   uint8_t hairpin_q_len,
+                                   struct doca_flow_pipe** pipe) override
+    {
+        return ::create_color_pipe(port, pipe_queue, base_hairpin_q, hairpin_q_len, pipe);
+    }
+
+    doca_error_t configure_mirror(struct doca_flow_port* port, uint32_t mirror_id, uint16_t queue) override
+    {
+        struct doca_flow_shared_resource_cfg cfg;
+        struct doca_flow_mirror_target target;
+        struct doca_flow_fwd fwd;
+        doca_error_t result;
+
+        memset(&cfg, 0, sizeof(cfg));
+        memset(&target, 0, sizeof(target));
+        memset(&fwd, 0, sizeof(fwd));
+        fwd.type = DOCA_FLOW_FWD_RSS;
+        fwd.rss_queues = &queue;
+        fwd.num_of_queues = 1;
+        fwd.rss_outer_flags = DOCA_FLOW_RSS_IPV4 | DOCA_FLOW_RSS_TCP;
+        target.fwd = &fwd;
+        cfg.mirror_cfg.nr_targets = 1;
+        cfg.mirror_cfg.target = &target;
+        result = doca_flow_shared_resource_set_cfg(DOCA_FLOW_SHARED_RESOURCE_MIRROR, mirror_id, &cfg);
+        if (result != DOCA_SUCCESS)
+            return result;
+        return doca_flow_shared_resources_bind(DOCA_FLOW_SHARED_RESOURCE_MIRROR, &mirror_id, 1, port);
+    }
+
+    doca_error_t create_sample_pipe(struct doca_flow_port* port,
+                                    uint16_t pipe_queue,
+                                    uint32_t mirror_id,
+                                    uint32_t rate,
+                                    uint16_t base_hairpin_q,
+                                    uint8_t hairpin_q_len,
+                                    struct doca_flow_pipe* next_pipe,
+                                    struct doca_flow_pipe** pipe) override
+    {
+        return ::create_sample_pipe(port, pipe_queue, mirror_id, rate, base_hairpin_q, hairpin_q_len, next_pipe,
+                                    pipe);
+    }
+
+    doca_error_t create_acl_pipe(struct doca_flow_port* port,
+                                 struct doca_flow_pipe* pipe_fwd_miss,
+                                 uint32_t nb_rules,
+                                 struct doca_flow_pipe** pipe) override
+    {
+        return ::create_acl_pipe(port, pipe_fwd_miss, nb_rules, pipe);
+    }
+
+    doca_error_t create_hairpin_pipe(struct doca_flow_port* port,
+                                     int port_id,
+                                     bool is_root,
+                                     struct doca_flow_pipe* pipe_fwd_miss,
+                                     struct doca_flow_pipe** pipe) override
+    {
+        return ::create_hairpin_pipe(port, port_id, metered, sampled, is_root, &table, pipe_fwd_miss, pipe);
+    }
+
+    doca_error_t create_blocklist_pipe(struct doca_flow_port* port,
+                                       uint16_t pipe_queue,
+                                       struct doca_flow_pipe* pipe_fwd_miss,
+                                       uint32_t nb_prefixes,
+                                       struct doca_flow_pipe** pipe) override
+    {
+        struct doca_flow_pipe* root_pipe;
+        doca_error_t result;
+
+        result = create_lpm_pipe(port, pipe_fwd_miss, nb_prefixes, pipe);
+        if (result != DOCA_SUCCESS)
+            return result;
+        // an LPM pipe cannot be the root pipe, a match-all one leads to it
+        return create_blocklist_root_pipe(port, pipe_queue, *pipe, &root_pipe);
+    }
+
+    doca_error_t add_hairpin_entry(uint16_t pipe_queue,
+                                   struct doca_flow_pipe* pipe,
+                                   const struct flow_key* key,
+                                   const struct hairpin_fwd* fwd,
+                                   uint32_t flags,
+                                   void* user_ctx,
+                                   struct doca_flow_pipe_entry** entry) override
+    {
+        // the hairpin queues are bound to the egress port
+        return submit_hairpin_pipe_entry(pipe, key, fwd, pipe_queue, flags, user_ctx, entry);
+    }
+
+    doca_error_t add_acl_entry(uint16_t pipe_queue,
+                               struct doca_flow_pipe* pipe,
+                               const struct aggregate_rule* rule,
+                               const struct hairpin_fwd* fwd,
+                               uint32_t flags,
+                               void* user_ctx,
+                               struct doca_flow_pipe_entry** entry) override
+    {
+        return submit_acl_pipe_entry(pipe, rule, fwd, pipe_queue, flags, user_ctx, entry);
+    }
+
+    doca_error_t add_blocklist_entry(uint16_t pipe_queue,
+                                     struct doca_flow_pipe* pipe,
+                                     doca_be32_t addr,
+                                     uint8_t prefix,
+                                     uint32_t flags,
+                                     void* user_ctx,
+                                     struct doca_flow_pipe_entry** entry) override
+    {
+        return submit_lpm_pipe_entry(pipe, addr, prefix, pipe_queue, flags, user_ctx, entry);
+    }
+
+    doca_error_t remove_entry(uint16_t pipe_queue,
+                              uint32_t flags,
+                              struct doca_flow_pipe_entry* entry) override
+    {
+        return doca_flow_pipe_remove_entry(pipe_queue, flags, entry);
+    }
+
+    doca_error_t entries_process(struct doca_flow_port* port,
+                                 uint16_t pipe_queue,
+                                 uint64_t timeout_us,
+                                 uint32_t max_processed_entries) override
+    {
+        return doca_flow_entries_process(port, pipe_queue, timeout_us, max_processed_entries);
+    }
+
+    doca_error_t query_entry(struct doca_flow_pipe_entry* entry,
+                             struct doca_flow_resource_query* query) override
+    {
+        return doca_flow_resource_query_entry(entry, query);
+    }
+
+    void aging_handle(struct doca_flow_port* port, uint16_t pipe_queue, uint64_t quota_us) override
+    {
+        doca_flow_aging_handle(port, pipe_queue, quota_us, 0);
+    }
+
+    doca_error_t pipes_flush(struct doca_flow_port* port) override
+    {
+        return doca_flow_port_pipes_flush(port);
+    }
+
+    uint32_t hairpin_capacity() const override
+    {
+        return table.max_entries;
+    }
+
+    void hairpin_resize_poll() override
+    {
+        for (struct hairpin_table& hairpin_table : hairpin_tables) {
+            doca_error_t result;
+
+            if (hairpin_table.pipe == NULL || hairpin_table.resizing || !hairpin_table.congested.exchange(false))
+                continue;
+            // past its counters the pipe stays as it is, the eviction makes room
+            if (hairpin_table.nb_entries >= table.max_entries)
+                continue;
+            hairpin_table.resizing = true;
+            // the entries are relocated on the queues which own them, as the pmds process their completions
+            result = doca_flow_pipe_resize(hairpin_table.pipe, TABLE_RESIZE_CONGESTION_PCT,
+                                           hairpin_nr_entries_changed_cb, hairpin_entry_relocate_cb);
+            if (result != DOCA_SUCCESS) {
+                DOCA_LOG_ERR("Failed to resize the hairpin pipe of port %d: %s", hairpin_table.port_id,
+                             doca_error_get_descr(result));
+                hairpin_table.resizing = false;
+            }
+        }
+    }
+};
+
+FlowBackend*
+flow_backend_doca_create(void)
+{
+    return new DocaFlowBackend();
+}
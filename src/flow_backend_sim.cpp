@@ -0,0 +1,785 @@
+/*
+ * Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES, ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of NVIDIA CORPORATION &
+ * AFFILIATES (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ *
+ */
+
+#include <algorithm>
+#include <deque>
+
+#include "selective_fwd.h"
+
+DOCA_LOG_REGISTER(SELECTIVE_FWD_BACKEND_SIM);
+
+/*
+ * In-memory model of the DOCA Flow HWS offload path, so the pmd and offload
+ * logic can run against ports without flow offload (net_ring, net_pcap).
+ *
+ * It models:
+ * - table capacity: a hairpin pipe holds at most table_size entries, further
+ *   additions fail with DOCA_ERROR_FULL
+ * - queue depth: each pipe queue holds at most queue_depth operations in
+ *   flight, further submissions fail with DOCA_ERROR_AGAIN
+ * - completion latency: an operation completes latency_us after being pushed,
+ *   either by a DOCA_FLOW_NO_WAIT submission or by entries_process()
+ * - aging: entries without hits for the pipe's aging time are reported by
+ *   aging_handle() on the queue which added them, until they get removed
+ * - hits: emulate_hit() stands in for the NIC matching a packet, updates the
+ *   entry counters and gives the egress port the pmd forwards it to
+ * - meters: a metered entry takes the packet's bytes from the token bucket of
+ *   its meter, filled at the meter's CIR up to its CBS; packets finding too few
+ *   tokens are red and dropped
+ * - aggregates: packets missing the hairpin pipe are matched against the
+ *   aggregate rules of the port's ACL pipe, narrowest first
+ * - blocklist: packets whose source falls in a prefix of the port's LPM pipe
+ *   are dropped before the hairpin pipe
+ * - sampling: a hit of an entry going through a sample pipe is mirrored with
+ *   the pipe's probability, the pmd hands a copy to the sampler
+ *
+ * Like in DOCA Flow, each pipe queue must only be used by one thread; the
+ * tables are shared and locked per pipe.
+ */
+
+struct sim_port;
+struct sim_pipe;
+
+struct sim_entry {
+    struct flow_key key;
+    struct sim_pipe* pipe;
+    void* user_ctx;
+    // port hits are forwarded to
+    int port_id_out;
+    // shared meter the hits go through, when metered
+    bool metered;
+    uint32_t meter_id;
+    // 1 in sample_rate hits are mirrored, 0 when not sampled
+    uint32_t sample_rate;
+    // ACL pipe entries only
+    struct aggregate_rule rule;
+    // LPM pipe entries only, see blocklist_prefix_key()
+    uint64_t prefix;
+    // pipe queue which added the entry, its removal and aging events go there too
+    uint16_t pipe_queue;
+    // in the table and matching packets
+    bool installed;
+    bool removed;
+    bool aged;
+    // counters, under the pipe lock
+    uint64_t pkts;
+    uint64_t bytes;
+    // TSC of the last hit, or of the addition; read by aging without the lock
+    uint64_t last_hit_tsc;
+    TAILQ_ENTRY(sim_entry) queue_link;
+};
+
+TAILQ_HEAD(sim_entry_list, sim_entry);
+
+struct sim_pipe {
+    struct sim_port* port;
+    uint32_t aging_sec;
+    // guards the table, the entry counters and nb_entries
+    std::mutex lock;
+    std::unordered_map<struct flow_key, struct sim_entry*, flow_key_hash, flow_key_equal> table;
+    // ACL pipe: installed entries instead of the table, by priority
+    bool acl;
+    std::vector<struct sim_entry*> rules;
+    // LPM pipe: installed entries instead of the table, by prefix, and how
+    // many prefixes of each length it holds, to only look up those
+    bool lpm;
+    std::unordered_map<uint64_t, struct sim_entry*> prefixes;
+    uint32_t nb_prefixes_by_len[33];
+    // sample pipe: 1 in sample_rate packets are mirrored
+    uint32_t sample_rate;
+    // entries added and not removed yet, bounded by the capacity
+    uint32_t nb_entries;
+    uint32_t capacity;
+};
+
+struct sim_op {
+    struct sim_entry* entry;
+    enum doca_flow_entry_op op;
+    // TSC from which the completion is available, UINT64_MAX until pushed
+    uint64_t due_tsc;
+};
+
+// Pipe queue of a port, only touched by the thread owning the queue
+struct sim_queue {
+    std::deque<struct sim_op> ops;
+    // operations at the back of ops submitted with DOCA_FLOW_WAIT_FOR_BATCH and not pushed yet
+    uint32_t nb_unpushed;
+    // entries added on this queue, rotated by the aging scan
+    struct sim_entry_list entries;
+    uint32_t nb_entries;
+};
+
+// Committed rate token bucket of a shared meter
+struct sim_meter {
+    uint64_t cir;
+    uint64_t cbs;
+    // bytes which may pass now, as of last_tsc
+    double tokens;
+    uint64_t last_tsc;
+};
+
+struct sim_port {
+    int port_id;
+    std::vector<struct sim_queue> queues;
+    std::vector<struct sim_pipe*> pipes;
+    struct sim_pipe* hairpin_pipe;
+    struct sim_pipe* acl_pipe;
+    struct sim_pipe* lpm_pipe;
+};
+
+class SimFlowBackend : public FlowBackend {
+private:
+    struct sim_backend_cfg cfg;
+    uint64_t latency_cycles;
+    uint16_t nb_queues;
+    doca_flow_entry_process_cb entry_cb;
+    struct sim_port* sim_ports[MAX_PORTS];
+    // guards the meters, configured by any thread and used by the pmds
+    std::mutex meter_lock;
+    std::vector<struct sim_meter> meters;
+
+    /*
+     * Refill the bucket of a meter and take a packet from it
+     *
+     * @meter_id [in]: meter of the entry
+     * @pkt_len [in]: packet length, bytes
+     * @now [in]: current TSC
+     * @return: true when the packet is green, false when red
+     */
+    bool meter_color(uint32_t meter_id, uint32_t pkt_len, uint64_t now)
+    {
+        std::lock_guard<std::mutex> guard(meter_lock);
+        struct sim_meter* meter = &meters[meter_id];
+
+        meter->tokens += (double)(now - meter->last_tsc) * meter->cir / rte_get_tsc_hz();
+        if (meter->tokens > meter->cbs)
+            meter->tokens = meter->cbs;
+        meter->last_tsc = now;
+        if (meter->tokens < pkt_len)
+            return false;
+        meter->tokens -= pkt_len;
+        return true;
+    }
+
+    /*
+     * Make the pending operations of a queue due after the completion latency
+     *
+     * @queue [in]: pipe queue
+     * @now [in]: current TSC
+     */
+    void push(struct sim_queue* queue, uint64_t now)
+    {
+        for (size_t i = queue->ops.size() - queue->nb_unpushed; i < queue->ops.size(); i++)
+            queue->ops[i].due_tsc = now + latency_cycles;
+        queue->nb_unpushed = 0;
+    }
+
+    /*
+     * Queue an operation, the caller checked the queue depth
+     *
+     * @queue [in]: pipe queue
+     * @entry [in]: entry of the operation
+     * @op [in]: operation
+     * @flags [in]: DOCA_FLOW_WAIT_FOR_BATCH or DOCA_FLOW_NO_WAIT
+     */
+    void submit(struct sim_queue* queue, struct sim_entry* entry, enum doca_flow_entry_op op, uint32_t flags)
+    {
+        struct sim_op sim_op = { entry, op, UINT64_MAX };
+
+        queue->ops.push_back(sim_op);
+        queue->nb_unpushed++;
+        if ((flags & DOCA_FLOW_WAIT_FOR_BATCH) == 0)
+            push(queue, rte_rdtsc());
+    }
+
+    /*
+     * Apply a completed operation and report it to the entry process callback
+     *
+     * @queue [in]: pipe queue
+     * @pipe_queue [in]: pipe queue identifier
+     * @op [in]: completed operation
+     * @now [in]: current TSC
+     */
+    void complete(struct sim_queue* queue, uint16_t pipe_queue, const struct sim_op& op, uint64_t now)
+    {
+        struct sim_entry* entry = op.entry;
+        struct sim_pipe* pipe = entry->pipe;
+        enum doca_flow_entry_status status = DOCA_FLOW_ENTRY_STATUS_SUCCESS;
+
+        if (op.op == DOCA_FLOW_ENTRY_OP_ADD) {
+            std::lock_guard<std::mutex> guard(pipe->lock);
+            // an entry removed before its addition completed is never installed
+            if (!entry->removed && pipe->acl) {
+                auto pos = pipe->rules.begin();
+                while (pos != pipe->rules.end() && (*pos)->rule.priority <= entry->rule.priority)
+                    pos++;
+                pipe->rules.insert(pos, entry);
+                entry->installed = true;
+            } else if (!entry->removed && pipe->lpm) {
+                if (pipe->prefixes.emplace(entry->prefix, entry).second) {
+                    pipe->nb_prefixes_by_len[entry->prefix >> 32]++;
+                    entry->installed = true;
+                } else {
+                    status = DOCA_FLOW_ENTRY_STATUS_ERROR;
+                    pipe->nb_entries--;
+                }
+            } else if (!entry->removed) {
+                if (pipe->table.emplace(entry->key, entry).second) {
+                    entry->installed = true;
+                    entry->last_hit_tsc = now;
+                } else {
+                    status = DOCA_FLOW_ENTRY_STATUS_ERROR;
+                    pipe->nb_entries--;
+                }
+            }
+        } else {
+            std::lock_guard<std::mutex> guard(pipe->lock);
+            pipe->nb_entries--;
+        }
+
+        entry_cb((struct doca_flow_pipe_entry*)entry, pipe_queue, status, op.op, entry->user_ctx);
+
+        if (op.op == DOCA_FLOW_ENTRY_OP_DEL || status != DOCA_FLOW_ENTRY_STATUS_SUCCESS) {
+            TAILQ_REMOVE(&queue->entries, entry, queue_link);
+            queue->nb_entries--;
+            delete entry;
+        }
+    }
+
+public:
+    SimFlowBackend(const struct sim_backend_cfg* sim_cfg)
+        : cfg(*sim_cfg), latency_cycles(0), nb_queues(0), entry_cb(NULL), sim_ports() {}
+
+    const char* name() const override { return "sim"; }
+
+    doca_error_t init(uint16_t nb_rss_queues,
+                      uint16_t nb_pipe_queues,
+                      uint32_t nb_meters,
+                      uint32_t nb_mirrors,
+                      const struct hairpin_table_cfg* table_cfg,
+                      uint16_t nb_ports,
+                      doca_flow_entry_process_cb cb) override
+    {
+        (void)nb_rss_queues;
+        (void)nb_mirrors;
+        (void)nb_ports;
+        // the simulated NIC holds what the configuration allows, up to its own capacity; pipes do not resize
+        cfg.table_size = RTE_MIN(cfg.table_size, table_cfg->max_entries);
+        nb_queues = nb_pipe_queues;
+        meters.assign(nb_meters, sim_meter());
+        entry_cb = cb;
+        latency_cycles = (uint64_t)cfg.latency_us * rte_get_tsc_hz() / 1000000;
+        DOCA_LOG_INFO("Simulated flow backend: %u entries per port, queue depth %u, completion latency %u us",
+                      cfg.table_size, cfg.queue_depth, cfg.latency_us);
+        return DOCA_SUCCESS;
+    }
+
+    void destroy() override {}
+
+    doca_error_t start_ports(uint16_t nb_ports, struct doca_flow_port* ports[MAX_PORTS]) override
+    {
+        for (int port_id = 0; port_id < nb_ports; port_id++) {
+            struct sim_port* port = new sim_port();
+
+            port->port_id = port_id;
+            // sized once, the queues hold list heads which must not move
+            port->queues.resize(nb_queues);
+            for (struct sim_queue& queue : port->queues) {
+                queue.nb_unpushed = 0;
+                queue.nb_entries = 0;
+                TAILQ_INIT(&queue.entries);
+            }
+            port->hairpin_pipe = NULL;
+            port->acl_pipe = NULL;
+            port->lpm_pipe = NULL;
+            sim_ports[port_id] = port;
+            ports[port_id] = (struct doca_flow_port*)port;
+        }
+        return DOCA_SUCCESS;
+    }
+
+    void stop_ports(uint16_t nb_ports, struct doca_flow_port* ports[MAX_PORTS]) override
+    {
+        for (int port_id = 0; port_id < nb_ports; port_id++) {
+            if (ports[port_id] == NULL)
+                continue;
+            pipes_flush(ports[port_id]);
+            delete (struct sim_port*)ports[port_id];
+            sim_ports[port_id] = NULL;
+            ports[port_id] = NULL;
+        }
+    }
+
+    doca_error_t create_rss_pipe(struct doca_flow_port* port,
+                                 uint16_t pipe_queue,
+                                 uint16_t nb_queues,
+                                 struct doca_flow_pipe** pipe) override
+    {
+        struct sim_port* sim_port = (struct sim_port*)port;
+        struct sim_pipe* sim_pipe = new struct sim_pipe();
+
+        (void)pipe_queue;
+        (void)nb_queues;
+        // misses always end up on the software path, nothing to model
+        sim_pipe->port = sim_port;
+        sim_port->pipes.push_back(sim_pipe);
+        *pipe = (struct doca_flow_pipe*)sim_pipe;
+        return DOCA_SUCCESS;
+    }
+
+    doca_error_t configure_meter(uint32_t meter_id, const struct meter_profile* profile) override
+    {
+        std::lock_guard<std::mutex> guard(meter_lock);
+
+        if (meter_id >= meters.size())
+            return DOCA_ERROR_INVALID_VALUE;
+        // a meter handed out again starts with a full bucket
+        meters[meter_id].cir = profile->cir;
+        meters[meter_id].cbs = profile->cbs;
+        meters[meter_id].tokens = profile->cbs;
+        meters[meter_id].last_tsc = rte_rdtsc();
+        return DOCA_SUCCESS;
+    }
+
+    doca_error_t bind_meters(struct doca_flow_port* port, uint32_t* meter_ids, uint32_t nb_meters) override
+    {
+        (void)port;
+        (void)meter_ids;
+        (void)nb_meters;
+        // meter ids are checked when configured, binding models nothing
+        return DOCA_SUCCESS;
+    }
+
+    doca_error_t create_color_pipe(struct doca_flow_port* port,
+                                   uint16_t pipe_queue,
+                                   uint16_t base_hairpin_q,
+                                   uint8_t hairpin_q_len,
+                                   struct doca_flow_pipe** pipe) override
+    {
+        struct sim_port* sim_port = (struct sim_port*)port;
+        struct sim_pipe* sim_pipe = new struct sim_pipe();
+
+        (void)pipe_queue;
+        (void)base_hairpin_q;
+        (void)hairpin_q_len;
+        // colors are worked out by emulate_hit(), the pipe only marks metered entries
+        sim_pipe->port = sim_port;
+        sim_port->pipes.push_back(sim_pipe);
+        *pipe = (struct doca_flow_pipe*)sim_pipe;
+        return DOCA_SUCCESS;
+    }
+
+    doca_error_t configure_mirror(struct doca_flow_port* port, uint32_t mirror_id, uint16_t queue) override
+    {
+        (void)port;
+        (void)mirror_id;
+        (void)queue;
+        // mirrored packets are handed to the sampler by the pmds, not through an Rx queue
+        return DOCA_SUCCESS;
+    }
+
+    doca_error_t create_sample_pipe(struct doca_flow_port* port,
+                                    uint16_t pipe_queue,
+                                    uint32_t mirror_id,
+                                    uint32_t rate,
+                                    uint16_t base_hairpin_q,
+                                    uint8_t hairpin_q_len,
+                                    struct doca_flow_pipe* next_pipe,
+                                    struct doca_flow_pipe** pipe) override
+    {
+        struct sim_port* sim_port = (struct sim_port*)port;
+        struct sim_pipe* sim_pipe = new struct sim_pipe();
+
+        (void)pipe_queue;
+        (void)mirror_id;
+        (void)base_hairpin_q;
+        (void)hairpin_q_len;
+        (void)next_pipe;
+        // sampling is worked out by emulate_hit(), the pipe only gives the rate of its entries
+        sim_pipe->port = sim_port;
+        sim_pipe->sample_rate = rate;
+        sim_port->pipes.push_back(sim_pipe);
+        *pipe = (struct doca_flow_pipe*)sim_pipe;
+        return DOCA_SUCCESS;
+    }
+
+    doca_error_t create_acl_pipe(struct doca_flow_port* port,
+                                 struct doca_flow_pipe* pipe_fwd_miss,
+                                 uint32_t nb_rules,
+                                 struct doca_flow_pipe** pipe) override
+    {
+        struct sim_port* sim_port = (struct sim_port*)port;
+        struct sim_pipe* sim_pipe = new struct sim_pipe();
+
+        (void)pipe_fwd_miss;
+        // ACL entries do not age
+        sim_pipe->port = sim_port;
+        sim_pipe->acl = true;
+        sim_pipe->rules.reserve(nb_rules);
+        sim_pipe->capacity = nb_rules;
+        sim_port->pipes.push_back(sim_pipe);
+        sim_port->acl_pipe = sim_pipe;
+        *pipe = (struct doca_flow_pipe*)sim_pipe;
+        return DOCA_SUCCESS;
+    }
+
+    doca_error_t create_hairpin_pipe(struct doca_flow_port* port,
+                                     int port_id,
+                                     bool is_root,
+                                     struct doca_flow_pipe* pipe_fwd_miss,
+                                     struct doca_flow_pipe** pipe) override
+    {
+        struct sim_port* sim_port = (struct sim_port*)port;
+        struct sim_pipe* sim_pipe = new struct sim_pipe();
+
+        (void)port_id;
+        (void)is_root;
+        (void)pipe_fwd_miss;
+        sim_pipe->port = sim_port;
+        sim_pipe->aging_sec = FLOW_TIMEOUT_SEC;
+        sim_pipe->table.reserve(cfg.table_size);
+        sim_pipe->capacity = cfg.table_size;
+        sim_port->pipes.push_back(sim_pipe);
+        sim_port->hairpin_pipe = sim_pipe;
+        *pipe = (struct doca_flow_pipe*)sim_pipe;
+        return DOCA_SUCCESS;
+    }
+
+    doca_error_t create_blocklist_pipe(struct doca_flow_port* port,
+                                       uint16_t pipe_queue,
+                                       struct doca_flow_pipe* pipe_fwd_miss,
+                                       uint32_t nb_prefixes,
+                                       struct doca_flow_pipe** pipe) override
+    {
+        struct sim_port* sim_port = (struct sim_port*)port;
+        struct sim_pipe* sim_pipe = new struct sim_pipe();
+
+        (void)pipe_queue;
+        (void)pipe_fwd_miss;
+        // prefixes do not age, and emulate_hit() looks them up before the hairpin pipe
+        sim_pipe->port = sim_port;
+        sim_pipe->lpm = true;
+        sim_pipe->capacity = nb_prefixes;
+        sim_port->pipes.push_back(sim_pipe);
+        sim_port->lpm_pipe = sim_pipe;
+        *pipe = (struct doca_flow_pipe*)sim_pipe;
+        return DOCA_SUCCESS;
+    }
+
+    doca_error_t add_hairpin_entry(uint16_t pipe_queue,
+                                   struct doca_flow_pipe* pipe,
+                                   const struct flow_key* key,
+                                   const struct hairpin_fwd* fwd,
+                                   uint32_t flags,
+                                   void* user_ctx,
+                                   struct doca_flow_pipe_entry** entry) override
+    {
+        struct sim_pipe* sim_pipe = (struct sim_pipe*)pipe;
+        struct sim_queue* queue;
+        struct sim_entry* sim_entry;
+
+        if (pipe_queue >= nb_queues)
+            return DOCA_ERROR_INVALID_VALUE;
+        queue = &sim_pipe->port->queues[pipe_queue];
+        if (queue->ops.size() >= cfg.queue_depth)
+            return DOCA_ERROR_AGAIN;
+        if (fwd->color_pipe != NULL && fwd->meter_id >= meters.size())
+            return DOCA_ERROR_INVALID_VALUE;
+        {
+            std::lock_guard<std::mutex> guard(sim_pipe->lock);
+            if (sim_pipe->nb_entries >= sim_pipe->capacity)
+                return DOCA_ERROR_FULL;
+            sim_pipe->nb_entries++;
+        }
+
+        sim_entry = new struct sim_entry();
+        sim_entry->key = *key;
+        sim_entry->pipe = sim_pipe;
+        sim_entry->user_ctx = user_ctx;
+        sim_entry->port_id_out = fwd->port_id_out;
+        sim_entry->metered = fwd->color_pipe != NULL;
+        sim_entry->meter_id = fwd->meter_id;
+        sim_entry->sample_rate = fwd->sample_pipe != NULL ? ((struct sim_pipe*)fwd->sample_pipe)->sample_rate : 0;
+        sim_entry->pipe_queue = pipe_queue;
+        TAILQ_INSERT_TAIL(&queue->entries, sim_entry, queue_link);
+        queue->nb_entries++;
+        submit(queue, sim_entry, DOCA_FLOW_ENTRY_OP_ADD, flags);
+
+        *entry = (struct doca_flow_pipe_entry*)sim_entry;
+        return DOCA_SUCCESS;
+    }
+
+    doca_error_t add_acl_entry(uint16_t pipe_queue,
+                               struct doca_flow_pipe* pipe,
+                               const struct aggregate_rule* rule,
+                               const struct hairpin_fwd* fwd,
+                               uint32_t flags,
+                               void* user_ctx,
+                               struct doca_flow_pipe_entry** entry) override
+    {
+        struct flow_key key = { rule->src_ip, rule->dst_ip, 0, 0 };
+        struct hairpin_fwd acl_fwd = *fwd;
+        doca_error_t result;
+
+        acl_fwd.color_pipe = NULL;
+        acl_fwd.sample_pipe = NULL;
+        result = add_hairpin_entry(pipe_queue, pipe, &key, &acl_fwd, flags, user_ctx, entry);
+        // only looked at once the addition completes
+        if (result == DOCA_SUCCESS)
+            ((struct sim_entry*)*entry)->rule = *rule;
+        return result;
+    }
+
+    doca_error_t add_blocklist_entry(uint16_t pipe_queue,
+                                     struct doca_flow_pipe* pipe,
+                                     doca_be32_t addr,
+                                     uint8_t prefix,
+                                     uint32_t flags,
+                                     void* user_ctx,
+                                     struct doca_flow_pipe_entry** entry) override
+    {
+        struct flow_key key = { addr, 0, 0, 0 };
+        struct hairpin_fwd drop_fwd = {};
+        doca_error_t result;
+
+        drop_fwd.port_id_out = -1;
+        result = add_hairpin_entry(pipe_queue, pipe, &key, &drop_fwd, flags, user_ctx, entry);
+        // only looked at once the addition completes
+        if (result == DOCA_SUCCESS)
+            ((struct sim_entry*)*entry)->prefix = blocklist_prefix_key(addr, prefix);
+        return result;
+    }
+
+    doca_error_t remove_entry(uint16_t pipe_queue,
+                              uint32_t flags,
+                              struct doca_flow_pipe_entry* entry) override
+    {
+        struct sim_entry* sim_entry = (struct sim_entry*)entry;
+        struct sim_pipe* sim_pipe = sim_entry->pipe;
+        struct sim_queue* queue;
+
+        // the queue lists are not shared, so entries are removed on the queue which added them
+        if (pipe_queue != sim_entry->pipe_queue)
+            return DOCA_ERROR_INVALID_VALUE;
+        queue = &sim_pipe->port->queues[pipe_queue];
+        if (queue->ops.size() >= cfg.queue_depth)
+            return DOCA_ERROR_AGAIN;
+        if (sim_entry->removed)
+            return DOCA_ERROR_BAD_STATE;
+
+        {
+            std::lock_guard<std::mutex> guard(sim_pipe->lock);
+            if (sim_entry->installed && sim_pipe->acl) {
+                sim_pipe->rules.erase(std::find(sim_pipe->rules.begin(), sim_pipe->rules.end(), sim_entry));
+            } else if (sim_entry->installed && sim_pipe->lpm) {
+                sim_pipe->prefixes.erase(sim_entry->prefix);
+                sim_pipe->nb_prefixes_by_len[sim_entry->prefix >> 32]--;
+            } else if (sim_entry->installed)
+                sim_pipe->table.erase(sim_entry->key);
+            sim_entry->installed = false;
+            sim_entry->removed = true;
+        }
+        submit(queue, sim_entry, DOCA_FLOW_ENTRY_OP_DEL, flags);
+        return DOCA_SUCCESS;
+    }
+
+    doca_error_t entries_process(struct doca_flow_port* port,
+                                 uint16_t pipe_queue,
+                                 uint64_t timeout_us,
+                                 uint32_t max_processed_entries) override
+    {
+        struct sim_port* sim_port = (struct sim_port*)port;
+        struct sim_queue* queue;
+        uint64_t now = rte_rdtsc();
+        uint64_t deadline = now + timeout_us * rte_get_tsc_hz() / 1000000;
+        uint32_t nb_processed = 0;
+
+        if (pipe_queue >= nb_queues)
+            return DOCA_ERROR_INVALID_VALUE;
+        queue = &sim_port->queues[pipe_queue];
+        push(queue, now);
+
+        // without a count to wait for, only collect what already completed
+        while (!queue->ops.empty() && (max_processed_entries == 0 || nb_processed < max_processed_entries)) {
+            struct sim_op op = queue->ops.front();
+
+            if (op.due_tsc > now) {
+                if (max_processed_entries == 0 || now >= deadline)
+                    break;
+                rte_pause();
+                now = rte_rdtsc();
+                continue;
+            }
+            queue->ops.pop_front();
+            complete(queue, pipe_queue, op, now);
+            nb_processed++;
+        }
+        return DOCA_SUCCESS;
+    }
+
+    doca_error_t query_entry(struct doca_flow_pipe_entry* entry,
+                             struct doca_flow_resource_query* query) override
+    {
+        struct sim_entry* sim_entry = (struct sim_entry*)entry;
+        std::lock_guard<std::mutex> guard(sim_entry->pipe->lock);
+
+        query->counter.total_pkts = sim_entry->pkts;
+        query->counter.total_bytes = sim_entry->bytes;
+        return DOCA_SUCCESS;
+    }
+
+    void aging_handle(struct doca_flow_port* port, uint16_t pipe_queue, uint64_t quota_us) override
+    {
+        struct sim_port* sim_port = (struct sim_port*)port;
+        struct sim_queue* queue;
+        uint64_t now = rte_rdtsc();
+        uint64_t deadline = now + quota_us * rte_get_tsc_hz() / 1000000;
+        struct sim_entry* entry;
+
+        if (pipe_queue >= nb_queues)
+            return;
+        queue = &sim_port->queues[pipe_queue];
+
+        // scan each entry at most once, resuming where the previous call ran out of quota
+        for (uint32_t i = 0, nb_entries = queue->nb_entries; i < nb_entries; i++) {
+            entry = TAILQ_FIRST(&queue->entries);
+            TAILQ_REMOVE(&queue->entries, entry, queue_link);
+            TAILQ_INSERT_TAIL(&queue->entries, entry, queue_link);
+
+            uint64_t aging = entry->pipe->aging_sec * rte_get_tsc_hz();
+            if (entry->installed && !entry->aged && aging != 0 &&
+                now - __atomic_load_n(&entry->last_hit_tsc, __ATOMIC_RELAXED) >= aging) {
+                entry->aged = true;
+                entry_cb((struct doca_flow_pipe_entry*)entry, pipe_queue, DOCA_FLOW_ENTRY_STATUS_SUCCESS,
+                         DOCA_FLOW_ENTRY_OP_AGED, entry->user_ctx);
+                // a removal rejected on a full queue gets another chance on the next scan
+                entry->aged = entry->removed;
+            }
+            if ((i & 63) == 63 && rte_rdtsc() >= deadline)
+                break;
+        }
+    }
+
+    uint32_t hairpin_capacity() const override
+    {
+        return cfg.table_size;
+    }
+
+    void hairpin_resize_poll() override {}
+
+    doca_error_t pipes_flush(struct doca_flow_port* port) override
+    {
+        struct sim_port* sim_port = (struct sim_port*)port;
+        struct sim_entry* entry;
+
+        // like a flush on the NIC, entries go away without completions
+        for (struct sim_queue& queue : sim_port->queues) {
+            queue.ops.clear();
+            queue.nb_unpushed = 0;
+            while ((entry = TAILQ_FIRST(&queue.entries)) != NULL) {
+                TAILQ_REMOVE(&queue.entries, entry, queue_link);
+                delete entry;
+            }
+            queue.nb_entries = 0;
+        }
+        for (struct sim_pipe* pipe : sim_port->pipes)
+            delete pipe;
+        sim_port->pipes.clear();
+        sim_port->hairpin_pipe = NULL;
+        sim_port->acl_pipe = NULL;
+        sim_port->lpm_pipe = NULL;
+        return DOCA_SUCCESS;
+    }
+
+    bool emulates_hits() const override { return true; }
+
+    /*
+     * Longest blocklist prefix holding the source of a packet
+     *
+     * @pipe [in]: LPM pipe of the port, locked by the caller
+     * @src_ip [in]: source address, network order
+     * @return: the entry of the prefix, NULL when there is none
+     */
+    struct sim_entry* lpm_lookup(struct sim_pipe* pipe, doca_be32_t src_ip)
+    {
+        for (int len = 32; len >= 0; len--) {
+            if (pipe->nb_prefixes_by_len[len] == 0)
+                continue;
+            auto it = pipe->prefixes.find(blocklist_prefix_key(src_ip, len));
+            if (it != pipe->prefixes.end())
+                return it->second;
+        }
+        return NULL;
+    }
+
+    bool emulate_hit(int port_id, const struct flow_key* key, uint32_t pkt_len, int* port_id_out,
+                     bool* sampled) override
+    {
+        struct sim_pipe* pipe = sim_ports[port_id]->hairpin_pipe;
+
+        *sampled = false;
+        if (pipe == NULL)
+            return false;
+
+        if (sim_ports[port_id]->lpm_pipe != NULL) {
+            struct sim_pipe* lpm_pipe = sim_ports[port_id]->lpm_pipe;
+            std::lock_guard<std::mutex> guard(lpm_pipe->lock);
+            struct sim_entry* entry = lpm_lookup(lpm_pipe, key->src_ip);
+
+            if (entry != NULL) {
+                entry->pkts++;
+                entry->bytes += pkt_len;
+                *port_id_out = -1;
+                return true;
+            }
+        }
+
+        std::unique_lock<std::mutex> guard(pipe->lock);
+        struct sim_entry* entry = NULL;
+        auto it = pipe->table.find(*key);
+        if (it != pipe->table.end()) {
+            entry = it->second;
+        } else if (sim_ports[port_id]->acl_pipe != NULL) {
+            // on the miss path of the hairpin pipe
+            guard.unlock();
+            pipe = sim_ports[port_id]->acl_pipe;
+            guard = std::unique_lock<std::mutex>(pipe->lock);
+            for (struct sim_entry* rule_entry : pipe->rules) {
+                if (aggregate_contains(&rule_entry->rule, key)) {
+                    entry = rule_entry;
+                    break;
+                }
+            }
+        }
+        if (entry == NULL)
+            return false;
+
+        uint64_t now = rte_rdtsc();
+        entry->pkts++;
+        entry->bytes += pkt_len;
+        __atomic_store_n(&entry->last_hit_tsc, now, __ATOMIC_RELAXED);
+        // mirrored ahead of the meter, red packets included
+        *sampled = entry->sample_rate != 0 && (rte_rand() & (entry->sample_rate - 1)) == 0;
+        if (entry->metered && !meter_color(entry->meter_id, pkt_len, now))
+            *port_id_out = -1;
+        else
+            *port_id_out = entry->port_id_out;
+        return true;
+    }
+};
+
+FlowBackend*
+flow_backend_sim_create(const struct sim_backend_cfg* cfg)
+{
+    return new SimFlowBackend(cfg);
+}
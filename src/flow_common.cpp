@@ -65,6 +65,7 @@ init_doca_flow(int nb_queues,
                uint32_t nr_shared_resources[])
 {
     return init_doca_flow_cb(nb_queues,
+                             nb_queues,
                              mode,
                              resource,
                              nr_shared_resources,
@@ -74,6 +75,7 @@ init_doca_flow(int nb_queues,
 
 doca_error_t
 init_doca_flow_cb(int nb_queues,
+                  int nb_pipe_queues,
                   const char* mode,
                   struct flow_resources* resource,
                   uint32_t nr_shared_resources[],
@@ -96,6 +98,7 @@ init_doca_flow_cb(int nb_queues,
     for (qidx = 0; qidx < nb_queues; qidx++)
         rss_queues[qidx] = qidx;
     rss.queues_array = rss_queues;
+    rss.rss_hash_func = DOCA_FLOW_RSS_HASH_FUNCTION_SYMMETRIC_TOEPLITZ;
     result = doca_flow_cfg_set_default_rss(flow_cfg, &rss);
     if (result != DOCA_SUCCESS) {
         DOCA_LOG_ERR("Failed to set doca_flow_cfg rss: %s",
@@ -103,7 +106,7 @@ init_doca_flow_cb(int nb_queues,
         goto destroy_cfg;
     }
 
-    result = doca_flow_cfg_set_pipe_queues(flow_cfg, 64);
+    result = doca_flow_cfg_set_pipe_queues(flow_cfg, nb_pipe_queues);
     if (result != DOCA_SUCCESS) {
         DOCA_LOG_ERR("Failed to set doca_flow_cfg pipe_queues: %s",
                      doca_error_get_descr(result));
@@ -80,6 +80,7 @@ init_doca_flow(int nb_queues,
  * Initialize DOCA Flow library with callback
  *
  * @nb_queues [in]: number of queues the sample will use
+ * @nb_pipe_queues [in]: number of pipe queues, one per thread managing entries
  * @mode [in]: doca flow architecture mode
  * @resource [in]: number of meters and counters to configure
  * @nr_shared_resources [in]: total shared resource per type
@@ -89,6 +90,7 @@ init_doca_flow(int nb_queues,
  */
 doca_error_t
 init_doca_flow_cb(int nb_queues,
+                  int nb_pipe_queues,
                   const char* mode,
                   struct flow_resources* resource,
                   uint32_t nr_shared_resources[],
@@ -0,0 +1,534 @@
+/*
+ * Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES, ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of NVIDIA CORPORATION &
+ * AFFILIATES (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ *
+ */
+
+#include "selective_fwd.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <time.h>
+
+DOCA_LOG_REGISTER(SELECTIVE_FWD_EXPORT);
+
+/*
+ * Flow record export. The counters of a hairpin entry go away with it, so
+ * whoever removes an entry, the pmd owning it when it ages out or the main
+ * thread when it is removed through the provisioning socket, reads them first
+ * and queues a fixed size record on the export ring: one counter query and
+ * one enqueue, nothing else on the pmd.
+ *
+ * The exporter thread, a control thread off the pmd cores, encodes the
+ * records into IPFIX (NetFlow v10) messages in place in a preallocated batch,
+ * adds a record every active timeout for the flows which stay installed, and
+ * sends the batch to a UDP collector with a single sendmmsg(), or appends it
+ * to a file, which then holds a stream of IPFIX messages. Records still
+ * installed at exit are exported as forced ends.
+ */
+
+// IPFIX message layout, RFC 7011
+#define IPFIX_VERSION 10
+#define IPFIX_MSG_HDR_LEN 16
+#define IPFIX_SET_HDR_LEN 4
+#define IPFIX_TEMPLATE_SET_ID 2
+#define IPFIX_TEMPLATE_ID 256
+#define IPFIX_RECORD_LEN 54
+
+// Information element and length of a field of the template
+struct ipfix_field {
+    uint16_t id;
+    uint16_t len;
+};
+
+// Fields of a data record, in order, IANA IPFIX information elements
+static const struct ipfix_field record_fields[] = {
+    { 8, 4 },   // sourceIPv4Address
+    { 12, 4 },  // destinationIPv4Address
+    { 7, 2 },   // sourceTransportPort
+    { 11, 2 },  // destinationTransportPort
+    { 4, 1 },   // protocolIdentifier
+    { 10, 4 },  // ingressInterface
+    { 14, 4 },  // egressInterface
+    { 152, 8 }, // flowStartMilliseconds
+    { 153, 8 }, // flowEndMilliseconds
+    { 86, 8 },  // packetTotalCount
+    { 85, 8 },  // octetTotalCount
+    { 136, 1 }, // flowEndReason
+};
+
+#define IPFIX_TEMPLATE_SET_LEN (IPFIX_SET_HDR_LEN + 4 + 4 * RTE_DIM(record_fields))
+
+static struct {
+    // records of removed entries, any producer, the exporter thread consumes
+    struct rte_ring* ring;
+    // TSC cycles between the records of a flow which stays installed
+    uint64_t active_interval;
+    // file appended to, or else a UDP socket connected to the collector
+    FILE* file;
+    // wall clock of a TSC value, to timestamp the records
+    uint64_t epoch_ms;
+    uint64_t epoch_tsc;
+    // batch of messages, the open one being msgs[nb_msgs]
+    uint8_t msgs[EXPORT_BATCH_MSGS][EXPORT_MSG_MAX];
+    uint16_t msg_len[EXPORT_BATCH_MSGS];
+    uint32_t nb_msgs;
+    bool msg_open;
+    uint16_t data_set_off;
+    uint16_t nb_msg_records;
+    // data records in the messages before the open one
+    uint32_t sequence;
+    uint64_t next_template_tsc;
+    // records dequeued at once, and those of the installed flows
+    struct flow_record burst[EXPORT_BURST_SZ];
+    std::vector<struct flow_record> installed;
+    uint64_t nb_records;
+    uint64_t nb_sent;
+    uint64_t nb_send_fails;
+    pthread_t thread;
+    bool thread_started;
+    std::atomic<bool> stop;
+} exporter;
+static int export_sock = -1;
+
+static inline void
+put16(uint8_t* buf, uint16_t value)
+{
+    value = rte_cpu_to_be_16(value);
+    memcpy(buf, &value, sizeof(value));
+}
+
+static inline void
+put32(uint8_t* buf, uint32_t value)
+{
+    value = rte_cpu_to_be_32(value);
+    memcpy(buf, &value, sizeof(value));
+}
+
+static inline void
+put64(uint8_t* buf, uint64_t value)
+{
+    value = rte_cpu_to_be_64(value);
+    memcpy(buf, &value, sizeof(value));
+}
+
+/*
+ * Wall clock of a TSC value
+ *
+ * @tsc [in]: TSC value
+ * @return: milliseconds since the epoch
+ */
+static uint64_t
+tsc_to_epoch_ms(uint64_t tsc)
+{
+    const int64_t hz = rte_get_tsc_hz();
+    int64_t delta = (int64_t)(tsc - exporter.epoch_tsc);
+    // split, so that days of uptime do not overflow
+    int64_t delta_ms = delta / hz * 1000 + delta % hz * 1000 / hz;
+
+    return exporter.epoch_ms + delta_ms;
+}
+
+/*
+ * Open a message at the end of the batch, with the template set first when
+ * it is due
+ *
+ * @now [in]: current TSC
+ */
+static void
+msg_open(uint64_t now)
+{
+    uint8_t* msg = exporter.msgs[exporter.nb_msgs];
+    uint16_t len = IPFIX_MSG_HDR_LEN;
+
+    if (now >= exporter.next_template_tsc) {
+        put16(msg + len, IPFIX_TEMPLATE_SET_ID);
+        put16(msg + len + 2, IPFIX_TEMPLATE_SET_LEN);
+        put16(msg + len + 4, IPFIX_TEMPLATE_ID);
+        put16(msg + len + 6, RTE_DIM(record_fields));
+        len += IPFIX_SET_HDR_LEN + 4;
+        for (size_t i = 0; i < RTE_DIM(record_fields); i++, len += 4) {
+            put16(msg + len, record_fields[i].id);
+            put16(msg + len + 2, record_fields[i].len);
+        }
+        // a file is read from its start, a UDP collector may come and go
+        exporter.next_template_tsc = exporter.file != NULL
+                                         ? UINT64_MAX
+                                         : now + EXPORT_TEMPLATE_INTERVAL_SEC * rte_get_tsc_hz();
+    }
+    exporter.data_set_off = len;
+    exporter.msg_len[exporter.nb_msgs] = len + IPFIX_SET_HDR_LEN;
+    exporter.nb_msg_records = 0;
+    exporter.msg_open = true;
+}
+
+/*
+ * Fill in the headers of the open message and add it to the batch
+ */
+static void
+msg_close(void)
+{
+    uint8_t* msg = exporter.msgs[exporter.nb_msgs];
+    uint16_t len = exporter.msg_len[exporter.nb_msgs];
+
+    put16(msg, IPFIX_VERSION);
+    put16(msg + 2, len);
+    put32(msg + 4, time(NULL));
+    put32(msg + 8, exporter.sequence);
+    // observation domain
+    put32(msg + 12, 0);
+    put16(msg + exporter.data_set_off, IPFIX_TEMPLATE_ID);
+    put16(msg + exporter.data_set_off + 2, len - exporter.data_set_off);
+    exporter.sequence += exporter.nb_msg_records;
+    exporter.nb_msgs++;
+    exporter.msg_open = false;
+}
+
+/*
+ * Send the batch to the collector, or append it to the file, closing the
+ * open message first
+ */
+static void
+batch_flush(void)
+{
+    struct mmsghdr hdrs[EXPORT_BATCH_MSGS];
+    struct iovec iovs[EXPORT_BATCH_MSGS];
+    uint32_t nb_sent = 0;
+    int ret;
+
+    if (exporter.msg_open && exporter.nb_msg_records > 0)
+        msg_close();
+    if (exporter.nb_msgs == 0)
+        return;
+
+    if (exporter.file != NULL) {
+        for (; nb_sent < exporter.nb_msgs; nb_sent++) {
+            if (fwrite(exporter.msgs[nb_sent], exporter.msg_len[nb_sent], 1, exporter.file) != 1)
+                break;
+        }
+        if (fflush(exporter.file) != 0)
+            nb_sent = 0;
+    } else {
+        memset(hdrs, 0, sizeof(hdrs[0]) * exporter.nb_msgs);
+        for (uint32_t i = 0; i < exporter.nb_msgs; i++) {
+            iovs[i].iov_base = exporter.msgs[i];
+            iovs[i].iov_len = exporter.msg_len[i];
+            hdrs[i].msg_hdr.msg_iov = &iovs[i];
+            hdrs[i].msg_hdr.msg_iovlen = 1;
+        }
+        while (nb_sent < exporter.nb_msgs) {
+            ret = sendmmsg(export_sock, &hdrs[nb_sent], exporter.nb_msgs - nb_sent, 0);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret <= 0)
+                break;
+            nb_sent += ret;
+        }
+    }
+
+    if (nb_sent < exporter.nb_msgs) {
+        if (exporter.nb_send_fails == 0)
+            DOCA_LOG_WARN("Failed to export flow records: %s", strerror(errno));
+        exporter.nb_send_fails += exporter.nb_msgs - nb_sent;
+    }
+    exporter.nb_sent += nb_sent;
+    exporter.nb_msgs = 0;
+}
+
+/*
+ * Encode a record into the open message, sending the batch once full
+ *
+ * @record [in]: flow record
+ * @now [in]: current TSC
+ */
+static void
+export_record(const struct flow_record* record, uint64_t now)
+{
+    uint8_t* data;
+
+    if (!exporter.msg_open)
+        msg_open(now);
+    data = exporter.msgs[exporter.nb_msgs] + exporter.msg_len[exporter.nb_msgs];
+    // addresses and L4 ports are kept in network order
+    memcpy(data, &record->key.src_ip, 4);
+    memcpy(data + 4, &record->key.dst_ip, 4);
+    memcpy(data + 8, &record->key.src_port, 2);
+    memcpy(data + 10, &record->key.dst_port, 2);
+    data[12] = IPPROTO_TCP;
+    put32(data + 13, record->port_in);
+    put32(data + 17, record->port_out);
+    put64(data + 21, tsc_to_epoch_ms(record->first_tsc));
+    put64(data + 29, tsc_to_epoch_ms(record->last_tsc));
+    put64(data + 37, record->pkts);
+    put64(data + 45, record->bytes);
+    data[53] = record->end_reason;
+    exporter.msg_len[exporter.nb_msgs] += IPFIX_RECORD_LEN;
+    exporter.nb_msg_records++;
+    exporter.nb_records++;
+
+    if (exporter.msg_len[exporter.nb_msgs] + IPFIX_RECORD_LEN > EXPORT_MSG_MAX) {
+        msg_close();
+        if (exporter.nb_msgs == EXPORT_BATCH_MSGS)
+            batch_flush();
+    }
+}
+
+/*
+ * Export a record of every installed flow last exported at least interval
+ * cycles ago
+ *
+ * @now [in]: current TSC
+ * @interval [in]: TSC cycles between the records of a flow, 0 for all flows
+ * @reason [in]: reason given by the records
+ */
+static void
+export_installed(uint64_t now, uint64_t interval, enum flow_end_reason reason)
+{
+    // keeps its capacity, no allocation once the table stopped growing
+    exporter.installed.clear();
+    pipe_mgr.collect_export(now, interval, reason, exporter.installed);
+    for (const struct flow_record& record : exporter.installed)
+        export_record(&record, now);
+}
+
+/*
+ * Exporter thread: drain the export ring, add the records of the long lived
+ * flows once a second and send whatever is pending each time the ring runs
+ * dry
+ *
+ * @arg [in]: unused
+ * @return: NULL
+ */
+static void*
+flow_export_loop(void* arg)
+{
+    const uint64_t active_check_interval = rte_get_tsc_hz();
+    uint64_t next_active_check = rte_rdtsc() + active_check_interval;
+    unsigned int nb_records;
+
+    (void)arg;
+    while (!exporter.stop) {
+        uint64_t now = rte_rdtsc();
+
+        nb_records = rte_ring_sc_dequeue_burst_elem(exporter.ring, exporter.burst, sizeof(struct flow_record),
+                                                    EXPORT_BURST_SZ, NULL);
+        for (unsigned int i = 0; i < nb_records; i++)
+            export_record(&exporter.burst[i], now);
+        if (now >= next_active_check) {
+            export_installed(now, exporter.active_interval, FLOW_END_ACTIVE_TIMEOUT);
+            next_active_check = now + active_check_interval;
+        }
+        if (nb_records == EXPORT_BURST_SZ)
+            continue;
+        batch_flush();
+        rte_delay_us_sleep(EXPORT_IDLE_SLEEP_US);
+    }
+    return NULL;
+}
+
+/*
+ * Open the UDP socket to a collector given as <address>:<port>
+ *
+ * @dest [in]: collector address
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+export_udp_open(const char* dest)
+{
+    struct sockaddr_in addr = {};
+    char host[INET_ADDRSTRLEN];
+    const char* colon = strrchr(dest, ':');
+    char* end;
+    long port;
+
+    if (colon == NULL || colon - dest >= (long)sizeof(host)) {
+        DOCA_LOG_ERR("Invalid flow collector %s, expected udp:<address>:<port>", dest);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    memcpy(host, dest, colon - dest);
+    host[colon - dest] = '\0';
+    port = strtol(colon + 1, &end, 10);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1 || *end != '\0' || port <= 0 || port > UINT16_MAX) {
+        DOCA_LOG_ERR("Invalid flow collector %s, expected udp:<address>:<port>", dest);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+
+    export_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (export_sock < 0 || connect(export_sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        DOCA_LOG_ERR("Failed to open socket to flow collector %s: %s", dest, strerror(errno));
+        return DOCA_ERROR_IO_FAILED;
+    }
+    return DOCA_SUCCESS;
+}
+
+doca_error_t
+flow_export_init(const struct selective_fwd_cfg* cfg)
+{
+    struct timespec ts;
+    doca_error_t result;
+    int ret;
+
+    if (cfg->flow_export[0] == '\0')
+        return DOCA_SUCCESS;
+
+    if (strncmp(cfg->flow_export, "udp:", 4) == 0) {
+        result = export_udp_open(cfg->flow_export + 4);
+        if (result != DOCA_SUCCESS)
+            return result;
+    } else {
+        exporter.file = fopen(cfg->flow_export, "ab");
+        if (exporter.file == NULL) {
+            DOCA_LOG_ERR("Failed to open %s: %s", cfg->flow_export, strerror(errno));
+            return DOCA_ERROR_IO_FAILED;
+        }
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    exporter.epoch_tsc = rte_rdtsc();
+    exporter.epoch_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    exporter.active_interval = (uint64_t)cfg->export_active_timeout_sec * rte_get_tsc_hz();
+
+    // any lcore queues the records of the entries it removes, the exporter alone dequeues
+    exporter.ring = rte_ring_create_elem("EXPORT_RING", sizeof(struct flow_record), EXPORT_RING_SIZE,
+                                         rte_socket_id(), RING_F_SC_DEQ);
+    if (exporter.ring == NULL) {
+        DOCA_LOG_ERR("Failed to create the export ring: %s", rte_strerror(rte_errno));
+        return DOCA_ERROR_NO_MEMORY;
+    }
+
+    ret = rte_ctrl_thread_create(&exporter.thread, "flow_export", NULL, flow_export_loop, NULL);
+    if (ret != 0) {
+        DOCA_LOG_ERR("Failed to start the exporter thread: %s", strerror(-ret));
+        return DOCA_ERROR_OPERATING_SYSTEM;
+    }
+    exporter.thread_started = true;
+    DOCA_LOG_INFO("Exporting IPFIX flow records to %s, active timeout %u s", cfg->flow_export,
+                  cfg->export_active_timeout_sec);
+    return DOCA_SUCCESS;
+}
+
+/*
+ * Fill the record of a flow from the counters of its entry
+ *
+ * @record [out]: flow record
+ * @ctx [in]: flow context
+ * @query [in]: counters of the entry
+ * @reason [in]: why the record is emitted
+ * @now [in]: current TSC
+ */
+void
+flow_record_fill(struct flow_record* record,
+                 const struct flow_ctx* ctx,
+                 const struct doca_flow_resource_query* query,
+                 enum flow_end_reason reason,
+                 uint64_t now)
+{
+    uint64_t last_tsc = now;
+
+    // no hit since the main thread last sampled the counters
+    if (query->counter.total_pkts == ctx->last_pkts)
+        last_tsc = ctx->last_active_tsc;
+    // an aged out entry saw no packet for the whole flow timeout
+    if (reason == FLOW_END_IDLE_TIMEOUT)
+        last_tsc = RTE_MIN(last_tsc, now - FLOW_TIMEOUT_SEC * rte_get_tsc_hz());
+
+    record->key = ctx->key;
+    record->port_in = ctx->port_in;
+    record->port_out = ctx->port_out;
+    record->end_reason = reason;
+    record->reserved = 0;
+    record->first_tsc = ctx->first_pkt_tsc;
+    record->last_tsc = RTE_MAX(last_tsc, ctx->first_pkt_tsc);
+    record->pkts = query->counter.total_pkts;
+    record->bytes = query->counter.total_bytes;
+}
+
+/*
+ * Fill the record of a flow whose entry is about to be removed, since its
+ * counters go away with it; flow_export_removed() queues it once the removal
+ * is submitted
+ *
+ * @ctx [in]: flow context, its entry still installed
+ * @reason [in]: why the entry is removed
+ * @record [out]: flow record, left untouched when nothing is exported
+ */
+void
+flow_export_prepare(const struct flow_ctx* ctx, enum flow_end_reason reason, struct flow_record* record)
+{
+    struct doca_flow_resource_query query = {};
+
+    if (exporter.ring == NULL)
+        return;
+    // a failed query still tells the flow ended, without its counters
+    flow_backend->query_entry(ctx->entry, &query);
+    flow_record_fill(record, ctx, &query, reason, rte_rdtsc());
+}
+
+/*
+ * Queue the record of a flow whose entry removal was submitted, on the thread
+ * removing it
+ *
+ * @record [in]: flow record, filled by flow_export_prepare()
+ */
+void
+flow_export_removed(const struct flow_record* record)
+{
+    struct lcore_metrics* metrics = &lcore_metrics[rte_lcore_id()];
+
+    if (exporter.ring == NULL)
+        return;
+    if (rte_ring_mp_enqueue_elem(exporter.ring, (void*)record, sizeof(*record)) != 0) {
+        metrics->flow_record_drops++;
+        return;
+    }
+    metrics->flow_records++;
+}
+
+/*
+ * Stop the exporter thread, once the workers stopped, and export what is
+ * left: the records still queued and a forced end of the installed flows
+ */
+void
+flow_export_fini(void)
+{
+    uint64_t now = rte_rdtsc();
+    unsigned int nb_records;
+
+    if (exporter.thread_started) {
+        exporter.stop = true;
+        pthread_join(exporter.thread, NULL);
+        exporter.thread_started = false;
+    }
+    if (exporter.ring != NULL) {
+        while ((nb_records = rte_ring_sc_dequeue_burst_elem(exporter.ring, exporter.burst,
+                                                            sizeof(struct flow_record), EXPORT_BURST_SZ,
+                                                            NULL)) > 0) {
+            for (unsigned int i = 0; i < nb_records; i++)
+                export_record(&exporter.burst[i], now);
+        }
+        export_installed(now, 0, FLOW_END_FORCED);
+        batch_flush();
+        DOCA_LOG_INFO("Exported %lu flow records in %lu IPFIX messages, %lu messages failed", exporter.nb_records,
+                      exporter.nb_sent, exporter.nb_send_fails);
+        rte_ring_free(exporter.ring);
+        exporter.ring = NULL;
+    }
+    if (exporter.file != NULL) {
+        fclose(exporter.file);
+        exporter.file = NULL;
+    }
+    if (export_sock >= 0) {
+        close(export_sock);
+        export_sock = -1;
+    }
+}
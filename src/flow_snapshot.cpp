@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES, ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of NVIDIA CORPORATION &
+ * AFFILIATES (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ *
+ */
+
+#include "selective_fwd.h"
+
+DOCA_LOG_REGISTER(SELECTIVE_FWD_SNAPSHOT);
+
+/*
+ * Snapshot file layout: a flow_snapshot_hdr followed by nb_records
+ * flow_snapshot_record, 18 bytes each. Addresses and L4 ports are kept in
+ * network byte order, the rest is host order; snapshots are only meant to be
+ * replayed on the node which wrote them.
+ */
+#define FLOW_SNAPSHOT_MAGIC 0x44574653 /* "SFWD" */
+#define FLOW_SNAPSHOT_VERSION 2
+
+struct flow_snapshot_hdr {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint64_t nb_records;
+    // wall clock time of the snapshot, to age the records by the downtime
+    uint64_t saved_at_sec;
+} __attribute__((packed));
+
+doca_error_t
+flow_snapshot_save(const char* path)
+{
+    std::vector<struct flow_snapshot_record> records;
+    struct flow_snapshot_hdr hdr = {};
+    std::string tmp_path = std::string(path) + ".tmp";
+    uint64_t start = rte_get_tsc_cycles();
+    FILE* file;
+
+    pipe_mgr.collect_snapshot(records);
+
+    hdr.magic = FLOW_SNAPSHOT_MAGIC;
+    hdr.version = FLOW_SNAPSHOT_VERSION;
+    hdr.record_size = sizeof(struct flow_snapshot_record);
+    hdr.nb_records = records.size();
+    hdr.saved_at_sec = time(NULL);
+
+    // write next to the target and rename, so a crash never leaves a torn snapshot
+    file = fopen(tmp_path.c_str(), "wb");
+    if (file == NULL) {
+        DOCA_LOG_ERR("Failed to open %s: %s", tmp_path.c_str(), strerror(errno));
+        return DOCA_ERROR_IO_FAILED;
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, file) != 1 ||
+        fwrite(records.data(), sizeof(struct flow_snapshot_record), records.size(), file) != records.size()) {
+        DOCA_LOG_ERR("Failed to write %s: %s", tmp_path.c_str(), strerror(errno));
+        fclose(file);
+        unlink(tmp_path.c_str());
+        return DOCA_ERROR_IO_FAILED;
+    }
+    if (fclose(file) != 0 || rename(tmp_path.c_str(), path) != 0) {
+        DOCA_LOG_ERR("Failed to save %s: %s", path, strerror(errno));
+        unlink(tmp_path.c_str());
+        return DOCA_ERROR_IO_FAILED;
+    }
+
+    DOCA_LOG_INFO("Saved %zu flows to %s in %.1f ms",
+                  records.size(),
+                  path,
+                  (rte_get_tsc_cycles() - start) * 1000.0 / rte_get_tsc_hz());
+    return DOCA_SUCCESS;
+}
+
+/*
+ * Offload a set of flows from the main thread, before the workers start, and
+ * register them with the pipe manager
+ *
+ * @records [in]: flows to offload
+ * @app_cfg [in]: application DPDK configuration values
+ * @ports [in]: DOCA Flow ports
+ * @hairpin_pipes [in]: hairpin pipe of each port
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+static doca_error_t
+replay_records(const std::vector<struct flow_snapshot_record>& records,
+               struct application_dpdk_config* app_cfg,
+               struct doca_flow_port* ports[MAX_PORTS],
+               struct doca_flow_pipe* hairpin_pipes[MAX_PORTS])
+{
+    std::vector<struct flow_ctx*> ctxs;
+    uint64_t now = rte_get_tsc_cycles();
+    uint32_t nb_failed;
+    doca_error_t result;
+
+    ctxs.reserve(records.size());
+    for (const struct flow_snapshot_record& record : records) {
+        if (record.port_in >= app_cfg->port_config.nb_ports || record.port_out >= app_cfg->port_config.nb_ports)
+            continue;
+
+        struct flow_ctx* ctx = new flow_ctx();
+        ctx->key.src_ip = record.src_ip;
+        ctx->key.dst_ip = record.dst_ip;
+        ctx->key.src_port = record.src_port;
+        ctx->key.dst_port = record.dst_port;
+        ctx->port_in = record.port_in;
+        ctx->port_out = record.port_out;
+        ctx->meter_profile = record.meter_profile;
+        // flow records of this run start at the replay
+        ctx->first_pkt_tsc = now;
+        ctx->last_active_tsc = now;
+        ctxs.push_back(ctx);
+    }
+
+    uint64_t start = rte_get_tsc_cycles();
+    result = add_hairpin_pipe_entries(app_cfg, ports, hairpin_pipes, main_pipe_queue(app_cfg),
+                                      ctxs.data(), ctxs.size(), &nb_failed);
+    double elapsed_sec = (double)(rte_get_tsc_cycles() - start) / rte_get_tsc_hz();
+
+    for (struct flow_ctx* ctx : ctxs)
+        if (ctx != NULL)
+            pipe_mgr.add_entry(ctx);
+
+    DOCA_LOG_INFO("Offloaded %zu flows in %.1f ms (%.0f flows/s), %u failed",
+                  ctxs.size() - nb_failed,
+                  elapsed_sec * 1000,
+                  elapsed_sec > 0 ? (ctxs.size() - nb_failed) / elapsed_sec : 0.0,
+                  nb_failed);
+    return result;
+}
+
+doca_error_t
+flow_snapshot_replay(const char* path,
+                     struct application_dpdk_config* app_cfg,
+                     struct doca_flow_port* ports[MAX_PORTS],
+                     struct doca_flow_pipe* hairpin_pipes[MAX_PORTS])
+{
+    std::vector<struct flow_snapshot_record> records;
+    struct flow_snapshot_record record;
+    struct flow_snapshot_hdr hdr;
+    uint64_t downtime_sec;
+    FILE* file;
+
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        if (errno == ENOENT) {
+            DOCA_LOG_INFO("No flow snapshot at %s, starting cold", path);
+            return DOCA_SUCCESS;
+        }
+        DOCA_LOG_ERR("Failed to open %s: %s", path, strerror(errno));
+        return DOCA_ERROR_IO_FAILED;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, file) != 1 ||
+        hdr.magic != FLOW_SNAPSHOT_MAGIC ||
+        hdr.version != FLOW_SNAPSHOT_VERSION ||
+        hdr.record_size != sizeof(struct flow_snapshot_record)) {
+        DOCA_LOG_ERR("%s is not a valid flow snapshot", path);
+        fclose(file);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+
+    // flows which would have aged out while the application was down are skipped
+    downtime_sec = time(NULL) - hdr.saved_at_sec;
+    records.reserve(hdr.nb_records);
+    for (uint64_t i = 0; i < hdr.nb_records; i++) {
+        if (fread(&record, sizeof(record), 1, file) != 1) {
+            DOCA_LOG_WARN("%s is truncated after %lu flows", path, i);
+            break;
+        }
+        if (record.remaining_age_sec > downtime_sec)
+            records.push_back(record);
+    }
+    fclose(file);
+
+    DOCA_LOG_INFO("Replaying %zu of %lu flows from %s, down for %lu s",
+                  records.size(), hdr.nb_records, path, downtime_sec);
+    return replay_records(records, app_cfg, ports, hairpin_pipes);
+}
+
+doca_error_t
+flow_replay_bench(uint32_t nb_flows,
+                  struct selective_fwd_cfg* fwd_cfg,
+                  struct application_dpdk_config* app_cfg,
+                  struct doca_flow_port* ports[MAX_PORTS],
+                  struct doca_flow_pipe* hairpin_pipes[MAX_PORTS])
+{
+    std::vector<struct flow_snapshot_record> records(nb_flows);
+
+    // distinct 5-tuples: 10.x.y.z:<port> -> 192.168.0.1:80, spread over all ports
+    for (uint32_t i = 0; i < nb_flows; i++) {
+        records[i].src_ip = rte_cpu_to_be_32((10u << 24) | (i >> 8));
+        records[i].dst_ip = BE_IPV4_ADDR(192, 168, 0, 1);
+        records[i].src_port = rte_cpu_to_be_16(1024 + (i & 0xff));
+        records[i].dst_port = rte_cpu_to_be_16(80);
+        records[i].port_in = i % app_cfg->port_config.nb_ports;
+        struct flow_key key = { records[i].src_ip, records[i].dst_ip, records[i].src_port, records[i].dst_port };
+        records[i].port_out = fwd_select_egress(fwd_cfg, records[i].port_in, &key);
+        records[i].remaining_age_sec = FLOW_TIMEOUT_SEC;
+        records[i].meter_profile = fwd_cfg->default_meter;
+    }
+
+    DOCA_LOG_INFO("Replay benchmark: offloading %u synthetic flows", nb_flows);
+    return replay_records(records, app_cfg, ports, hairpin_pipes);
+}
@@ -11,14 +11,170 @@
  *
  */
 
+#include <poll.h>
+
 #include "selective_fwd.h"
 
 DOCA_LOG_REGISTER(SELECTIVE_FWD);
 
+std::atomic<bool> force_quit(false);
+
+FlowBackend* flow_backend = NULL;
+
+// Monotonic time the process started and the last startup phase ended, for the boot report
+static struct timespec boot_start;
+static struct timespec boot_phase_start;
+static struct {
+    const char* name;
+    double ms;
+} boot_phases[BOOT_PHASES_MAX];
+static int nb_boot_phases;
+
+/*
+ * Record how long a startup phase took, for the boot report
+ *
+ * @phase [in]: name of the phase
+ * @ms [in]: wall-clock time of the phase
+ */
+static void
+boot_phase_add(const char* phase, double ms)
+{
+    if (nb_boot_phases == BOOT_PHASES_MAX)
+        return;
+    boot_phases[nb_boot_phases].name = phase;
+    boot_phases[nb_boot_phases].ms = ms;
+    nb_boot_phases++;
+}
+
+/*
+ * Record the startup phase which just ended, timed from the end of the previous one
+ *
+ * @phase [in]: name of the phase
+ */
+static void
+boot_phase_done(const char* phase)
+{
+    boot_phase_add(phase, elapsed_ms(&boot_phase_start));
+    clock_gettime(CLOCK_MONOTONIC, &boot_phase_start);
+}
+
+/*
+ * Log the time of each startup phase, the total startup time and the memory
+ * footprint once the pmds are running
+ *
+ * @fwd_cfg [in]: application configuration
+ * @nb_ports [in]: number of ports
+ */
+static void
+boot_report(const struct selective_fwd_cfg* fwd_cfg, uint16_t nb_ports)
+{
+    struct rte_malloc_socket_stats stats;
+    uint64_t hugepage_bytes = 0;
+    char phases[512];
+    int len = 0;
+
+    for (int i = 0; i < nb_boot_phases && len < (int)sizeof(phases); i++)
+        len += snprintf(phases + len, sizeof(phases) - len, "%s%s %.1f ms", i > 0 ? ", " : "", boot_phases[i].name,
+                        boot_phases[i].ms);
+    DOCA_LOG_INFO("Startup phases: %s", nb_boot_phases > 0 ? phases : "none");
+    for (unsigned int i = 0; i < rte_socket_count(); i++)
+        if (rte_malloc_get_socket_stats(rte_socket_id_by_idx(i), &stats) == 0)
+            hugepage_bytes += stats.heap_allocsz_bytes;
+    DOCA_LOG_INFO("Started in %.1f ms: %u hairpin entries per port, %u flow counters, %.1f MB of hugepage memory in use",
+                  elapsed_ms(&boot_start), fwd_cfg->table.initial_entries, fwd_cfg->table.max_entries * nb_ports,
+                  hugepage_bytes / 1e6);
+}
+
+/*
+ * Signal handler, asks the main thread and the workers to stop
+ *
+ * @signum [in]: signal number
+ */
+static void
+signal_handler(int signum)
+{
+    (void)signum;
+    force_quit = true;
+}
+
+/*
+ * SIGHUP handler, asks the main thread to reload the blocklist
+ *
+ * @signum [in]: signal number
+ */
+static void
+reload_handler(int signum)
+{
+    (void)signum;
+    blocklist_request_reload();
+}
+
+/*
+ * Wait for and serve metrics scrapes, provisioning requests and capture commands
+ *
+ * @timeout_ms [in]: longest wait for a connection
+ */
+static void
+serve_sockets(int timeout_ms)
+{
+    struct pollfd pfds[3] = {
+        { .fd = metrics_server_fd(), .events = POLLIN, .revents = 0 },
+        { .fd = provision_server_fd(), .events = POLLIN, .revents = 0 },
+        { .fd = capture_server_fd(), .events = POLLIN, .revents = 0 },
+    };
+
+    // disabled servers have a negative fd, which poll() ignores
+    if (poll(pfds, 3, timeout_ms) <= 0)
+        return;
+    if (pfds[0].revents & POLLIN)
+        metrics_server_accept();
+    if (pfds[1].revents & POLLIN)
+        provision_server_accept();
+    if (pfds[2].revents & POLLIN)
+        capture_server_accept();
+}
+
+/*
+ * Allocate the parameters of the pmd polling a queue
+ *
+ * @app_cfg [in]: application DPDK configuration values
+ * @fwd_cfg [in]: application configuration
+ * @ports [in]: doca flow ports
+ * @hairpin_pipes [in]: hairpin pipe of each port
+ * @queue_id [in]: queue of the pmd
+ * @return: pmd parameters, NULL on failure
+ */
+static struct pmd_params_t*
+pmd_params_create(struct application_dpdk_config* app_cfg,
+                  struct selective_fwd_cfg* fwd_cfg,
+                  struct doca_flow_port* ports[MAX_PORTS],
+                  struct doca_flow_pipe* hairpin_pipes[MAX_PORTS],
+                  uint16_t queue_id)
+{
+    struct pmd_params_t *pmd_params = new pmd_params_t;
+    if (pmd_params == NULL) {
+        DOCA_LOG_ERR("Failed to allocate memory for pmd_params");
+        return NULL;
+    }
+
+    pmd_params->app_cfg = app_cfg;
+    pmd_params->fwd_cfg = fwd_cfg;
+    pmd_params->queue_id = queue_id;
+    pmd_params->ports = ports;
+    pmd_params->hairpin_pipes = hairpin_pipes;
+    pmd_params->verdict = fwd_cfg->verdict != VERDICT_INLINE ? verdict_queue_get(queue_id) : NULL;
+    TAILQ_INIT(&pmd_params->awaiting_hit);
+    pmd_params->nb_awaiting_hit = 0;
+    return pmd_params;
+}
+
 /*
  * Start workers:
  * - pmd workers: read packets and queue offloads to the offload workers
  * - offload workers: offload entries to hardware
+ * - with sampling, the sampler on the worker lcore left without a queue
+ * - without a reserved main lcore, the pmd of the last queue, which the
+ *   caller runs on the main lcore
  *
  * Queueing to offload workers:
  * - add_entry_ring: queue to add entries
@@ -26,97 +182,359 @@ DOCA_LOG_REGISTER(SELECTIVE_FWD);
  */
 doca_error_t start_workers(
     struct application_dpdk_config* app_cfg,
-    struct doca_flow_port* ports[NUM_PORTS],
-    struct doca_flow_pipe* hairpin_pipes[NUM_PORTS]
+    struct selective_fwd_cfg* fwd_cfg,
+    struct doca_flow_port* ports[MAX_PORTS],
+    struct doca_flow_pipe* hairpin_pipes[MAX_PORTS],
+    struct pmd_params_t** main_pmd
 )
 {
     uint32_t lcore_id;
     uint16_t queue_id = 0;
+    uint16_t nb_worker_queues = app_cfg->port_config.nb_queues - (app_cfg->reserve_main_thread ? 0 : 1);
+
+    *main_pmd = NULL;
     RTE_LCORE_FOREACH_WORKER(lcore_id) {
+        if (queue_id == nb_worker_queues) {
+            if (sample_rate() > 0)
+                rte_eal_remote_launch(start_sampler, NULL, lcore_id);
+            continue;
+        }
         DOCA_LOG_INFO("Starting PMD on lcore %u", lcore_id);
 
-        struct pmd_params_t *pmd_params = new pmd_params_t;
-        if (pmd_params == NULL) {
-            DOCA_LOG_ERR("Failed to allocate memory for pmd_params");
+        struct pmd_params_t *pmd_params = pmd_params_create(app_cfg, fwd_cfg, ports, hairpin_pipes, queue_id++);
+        if (pmd_params == NULL)
             return DOCA_ERROR_NO_MEMORY;
-        }
-
-        pmd_params->app_cfg = app_cfg;
-        pmd_params->queue_id = queue_id++;
-        pmd_params->ports = ports;
-        pmd_params->hairpin_pipes = hairpin_pipes;
         rte_eal_remote_launch(start_pmd, (void*)pmd_params, lcore_id);
     }
 
+    if (!app_cfg->reserve_main_thread) {
+        DOCA_LOG_INFO("Starting PMD on main lcore %u", rte_get_main_lcore());
+        *main_pmd = pmd_params_create(app_cfg, fwd_cfg, ports, hairpin_pipes, queue_id);
+        if (*main_pmd == NULL)
+            return DOCA_ERROR_NO_MEMORY;
+    }
+
     return DOCA_SUCCESS;
 }
 
+// What the control loop needs, see control_loop()
+struct control_params {
+    struct application_dpdk_config* app_cfg;
+    struct selective_fwd_cfg* fwd_cfg;
+    struct doca_flow_port** ports;
+    uint64_t start_tsc;
+};
+
+/*
+ * Serve metrics scrapes, provisioning requests and the commands of secondary
+ * processes in between stats prints, until asked to stop or the configured
+ * duration is over. Runs on the main thread, or on the control thread when the
+ * main lcore runs a pmd.
+ *
+ * @params [in]: control loop parameters
+ */
+static void
+control_loop(const struct control_params* params)
+{
+    struct application_dpdk_config* app_cfg = params->app_cfg;
+    struct selective_fwd_cfg* fwd_cfg = params->fwd_cfg;
+    uint64_t next_stats_tsc, stop_tsc = UINT64_MAX;
+
+    if (fwd_cfg->duration_sec > 0)
+        stop_tsc = params->start_tsc + fwd_cfg->duration_sec * rte_get_tsc_hz();
+    next_stats_tsc = params->start_tsc + STATS_INTERVAL_SEC * rte_get_tsc_hz();
+    while (!force_quit) {
+        uint64_t now = rte_get_tsc_cycles();
+        if (now >= stop_tsc)
+            break;
+        blocklist_poll();
+        flow_backend->hairpin_resize_poll();
+        evict_poll(now);
+        shm_poll();
+        if (now >= next_stats_tsc) {
+            // flows offloaded by the control path age out on its own pipe queue
+            handle_pipe_queue_aging(params->ports, app_cfg->port_config.nb_ports, main_pipe_queue(app_cfg));
+            // secondary processes print the stats out of the shared memzones instead, but the
+            // hit counters are still sampled for the snapshot and the export
+            print_stats(!shm_enabled());
+            if (!shm_enabled())
+                metrics_print_rates(STATS_INTERVAL_SEC);
+            next_stats_tsc = now + STATS_INTERVAL_SEC * rte_get_tsc_hz();
+            continue;
+        }
+        if (fwd_cfg->churn.rate > 0) {
+            // generating packets leaves no time to block, check for connections in passing
+            churn_poll(RTE_MIN(next_stats_tsc, now + rte_get_tsc_hz() / 1000));
+            serve_sockets(0);
+            continue;
+        }
+        // the signal may land on any thread, so do not block past the stop poll interval
+        serve_sockets(RTE_MIN((next_stats_tsc - now) * 1000 / rte_get_tsc_hz() + 1,
+                              (uint64_t)STOP_POLL_INTERVAL_MS));
+    }
+    // a pmd on the main lcore stops with the rest
+    force_quit = true;
+}
+
+/*
+ * Control thread, takes the control loop off the main lcore so that it runs a pmd
+ *
+ * @arg [in]: control loop parameters
+ * @return: NULL
+ */
+static void*
+control_thread(void* arg)
+{
+    // an lcore id of its own, for the counters of the evictions, exports and removals it makes
+    if (rte_thread_register() != 0) {
+        DOCA_LOG_ERR("Failed to register the control thread: %s", rte_strerror(rte_errno));
+        force_quit = true;
+        return NULL;
+    }
+    shm_add_control_lcore(rte_lcore_id());
+    DOCA_LOG_INFO("Control thread running as lcore %u", rte_lcore_id());
+    control_loop((const struct control_params*)arg);
+    return NULL;
+}
+
 /*
  * Initialize doca, doca ports, create static configuration, and then start
  * worker threads that dynamically add/remove entries
  *
- * @nb_queues [in]: number of queues the sample will use
+ * @app_cfg [in]: application DPDK configuration values
+ * @fwd_cfg [in]: application configuration
  * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
  */
-doca_error_t run_app(struct application_dpdk_config* app_cfg)
+doca_error_t run_app(struct application_dpdk_config* app_cfg,
+                     struct selective_fwd_cfg* fwd_cfg)
 {
-    struct flow_resources resource = {};
-    uint32_t nr_shared_resources[SHARED_RESOURCE_NUM_VALUES] = { 0 };
-    struct doca_flow_port* port_arr[NUM_PORTS];
-    struct doca_flow_pipe* hairpin_pipe_arr[NUM_PORTS];
-    struct doca_dev* dev_arr[NUM_PORTS];
+    struct doca_flow_port* port_arr[MAX_PORTS];
+    struct doca_flow_pipe* hairpin_pipe_arr[MAX_PORTS];
+    struct control_params control;
+    struct pmd_params_t* main_pmd = NULL;
+    pthread_t control_tid;
+    uint64_t start_tsc = 0;
+    bool save_snapshot = false;
     doca_error_t result;
+    int ret;
 
-    resource.nr_counters = 8000000;
+    if (fwd_cfg->flow_backend == FLOW_BACKEND_SIM)
+        flow_backend = flow_backend_sim_create(&fwd_cfg->sim);
+    else
+        flow_backend = flow_backend_doca_create();
+    DOCA_LOG_INFO("Using the %s flow backend", flow_backend->name());
 
-    result = init_doca_flow(app_cfg->port_config.nb_queues,
-                            "vnf,hws",
-                            &resource,
-                            nr_shared_resources);
+    // before anything counts, so the counters start out shared
+    result = shm_init(fwd_cfg);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to init multi-process mode: %s", doca_error_get_descr(result));
+        goto exit;
+    }
+
+    result = meter_init(fwd_cfg, app_cfg->port_config.nb_ports);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to init meters: %s", doca_error_get_descr(result));
+        goto exit;
+    }
+
+    result = aggregate_init(fwd_cfg, app_cfg->port_config.nb_ports);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to init aggregates: %s", doca_error_get_descr(result));
+        goto exit;
+    }
+
+    result = sample_init(fwd_cfg, app_cfg);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to init sampling: %s", doca_error_get_descr(result));
+        goto exit;
+    }
+
+    hairpin_table_configure(fwd_cfg, app_cfg);
+    // one shared mirror per port
+    result = flow_backend->init(app_cfg->port_config.nb_queues, nb_pipe_queues(app_cfg), meter_count(),
+                                sample_rate() > 0 ? app_cfg->port_config.nb_ports : 0, &fwd_cfg->table,
+                                app_cfg->port_config.nb_ports, pmd_entry_process_cb);
     if (result != DOCA_SUCCESS) {
         DOCA_LOG_ERR("Failed to init DOCA Flow: %s",
                      doca_error_get_descr(result));
         goto exit;
     }
+    boot_phase_done("DOCA init");
 
-    memset(dev_arr, 0, sizeof(struct doca_dev*) * NUM_PORTS);
-    result = init_doca_flow_ports(NUM_PORTS, port_arr, true, dev_arr);
+    memset(port_arr, 0, sizeof(struct doca_flow_port*) * MAX_PORTS);
+    result = flow_backend->start_ports(app_cfg->port_config.nb_ports, port_arr);
     if (result != DOCA_SUCCESS) {
         DOCA_LOG_ERR("Failed to init DOCA ports: %s",
                      doca_error_get_descr(result));
         goto cleanup_port_stopped;
     }
+    boot_phase_done("flow ports");
+
+    result = meter_configure(port_arr, app_cfg->port_config.nb_ports);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to configure meters: %s", doca_error_get_descr(result));
+        goto cleanup;
+    }
+
+    result = sample_configure(port_arr, app_cfg->port_config.nb_ports);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to configure sampling: %s", doca_error_get_descr(result));
+        goto cleanup;
+    }
+
+    result = blocklist_init(fwd_cfg, app_cfg, port_arr);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to init blocklist: %s", doca_error_get_descr(result));
+        goto cleanup;
+    }
+
+    result = evict_init(fwd_cfg, app_cfg, port_arr);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to init eviction: %s", doca_error_get_descr(result));
+        goto cleanup;
+    }
 
     // STATIC CONFIGURATION
     // 	On each port
     // 	1. Add an RSS pipe and a match-all entry on the RSS pipe to forward packets to RSS
     // 	2. Add a hairpin pipe with no entries in it. The entries will be dynamically added later.
-    // 		- On miss, the hairpin pipe will forward packets to the RSS pipe.
-    // 		- On hit, the hairpin pipe entry will hairpin packets to the other port's tx.
+    // 		- On miss, the hairpin pipe will forward packets to the RSS pipe, through an ACL pipe
+    // 		  hairpinning the trusted aggregates when they are configured.
+    // 		- On hit, the hairpin pipe entry will hairpin packets to the tx of the flow's egress port.
+    // 		- With meters, it meters them instead and forwards them to a color pipe of the port pair,
+    // 		  which hairpins green and yellow packets and drops red ones.
+    // 		- With sampling, it goes through a sample pipe of the port pair first, which mirrors
+    // 		  1 in N packets to the sample queue of the port.
+    // 	3. With a blocklist, add a blocklist pipe in front of the hairpin pipe, as the root pipe.
+    // 		- Packets whose source falls in a blocklisted prefix are dropped.
+    // 		- The others go on to the hairpin pipe.
     result = configure_static_pipes(app_cfg, port_arr, hairpin_pipe_arr);
     if (result != DOCA_SUCCESS) {
         DOCA_LOG_ERR("Failed to configure static pipes: %s", doca_error_get_descr(result));
         goto cleanup;
     }
+    boot_phase_done("pipe creation");
+
+    if (fwd_cfg->blocklist_bench_prefixes > 0) {
+        result = blocklist_bench(fwd_cfg->blocklist_bench_prefixes);
+        goto cleanup;
+    }
+
+    if (fwd_cfg->blocklist[0] != '\0') {
+        result = blocklist_load();
+        if (result != DOCA_SUCCESS) {
+            DOCA_LOG_ERR("Failed to load blocklist: %s", doca_error_get_descr(result));
+            goto cleanup;
+        }
+        signal(SIGHUP, reload_handler);
+    }
+
+    result = flow_export_init(fwd_cfg);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to start flow export: %s", doca_error_get_descr(result));
+        goto cleanup;
+    }
+
+    result = metrics_server_init(fwd_cfg);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to start metrics server: %s", doca_error_get_descr(result));
+        goto cleanup;
+    }
+
+    result = provision_server_init(fwd_cfg, app_cfg, port_arr, hairpin_pipe_arr);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to start provisioning server: %s", doca_error_get_descr(result));
+        goto cleanup;
+    }
+
+    result = capture_init(fwd_cfg, app_cfg);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to start capture: %s", doca_error_get_descr(result));
+        goto cleanup;
+    }
+
+    if (fwd_cfg->replay_bench_flows > 0) {
+        result = flow_replay_bench(fwd_cfg->replay_bench_flows, fwd_cfg, app_cfg, port_arr, hairpin_pipe_arr);
+        goto cleanup;
+    }
+
+    // WARM RESTART
+    //   Offload the flows of the previous run before any packet reaches the PMDs
+    if (fwd_cfg->flow_snapshot[0] != '\0') {
+        result = flow_snapshot_replay(fwd_cfg->flow_snapshot, app_cfg, port_arr, hairpin_pipe_arr);
+        if (result != DOCA_SUCCESS)
+            DOCA_LOG_WARN("Failed to replay flow snapshot, starting cold: %s", doca_error_get_descr(result));
+        // only overwrite the snapshot once this run owns the flow table
+        save_snapshot = true;
+    }
+
+    if (fwd_cfg->verdict != VERDICT_INLINE) {
+        result = verdict_init(fwd_cfg->verdict, app_cfg->port_config.nb_queues, app_cfg->port_config.nb_ports,
+                              fwd_cfg->nb_meter_profiles);
+        if (result != DOCA_SUCCESS) {
+            DOCA_LOG_ERR("Failed to start the verdict control thread: %s", doca_error_get_descr(result));
+            goto cleanup;
+        }
+    }
 
     // DYNAMIC CONFIGURATION
     //   Start PMD threads which pull packets and offload to HW
-    result = start_workers(app_cfg, port_arr, hairpin_pipe_arr);
+    affinity_init(fwd_cfg);
+    result = start_workers(app_cfg, fwd_cfg, port_arr, hairpin_pipe_arr, &main_pmd);
     if (result != DOCA_SUCCESS) {
         DOCA_LOG_ERR("Failed to start workers: %s", doca_error_get_descr(result));
         goto cleanup;
     }
+    boot_report(fwd_cfg, app_cfg->port_config.nb_ports);
+    if (fwd_cfg->churn.rate > 0)
+        churn_start();
 
-    while (1) {
-        print_stats();
-        sleep(5);
+    start_tsc = rte_get_tsc_cycles();
+    control.app_cfg = app_cfg;
+    control.fwd_cfg = fwd_cfg;
+    control.ports = port_arr;
+    control.start_tsc = start_tsc;
+    if (main_pmd == NULL) {
+        control_loop(&control);
+    } else {
+        // the main lcore forwards as well, and the control thread takes its other duties
+        ret = rte_ctrl_thread_create(&control_tid, "sfwd_control", NULL, control_thread, &control);
+        if (ret != 0) {
+            DOCA_LOG_ERR("Failed to start the control thread: %s", strerror(-ret));
+            delete main_pmd;
+            result = DOCA_ERROR_OPERATING_SYSTEM;
+            goto cleanup;
+        }
+        start_pmd(main_pmd);
+        pthread_join(control_tid, NULL);
     }
+    DOCA_LOG_INFO("Stopping, waiting for workers to drain");
 
 cleanup:
-    stop_doca_flow_ports(NUM_PORTS, port_arr);
+    force_quit = true;
+    rte_eal_mp_wait_lcore();
+    capture_fini();
+    sample_fini();
+    evict_fini();
+    verdict_fini();
+    affinity_fini();
+    churn_report();
+    metrics_server_fini();
+    provision_server_fini();
+    if (start_tsc != 0 && fwd_cfg->results_json[0] != '\0')
+        metrics_write_json(fwd_cfg->results_json, (double)(rte_get_tsc_cycles() - start_tsc) / rte_get_tsc_hz());
+    if (save_snapshot)
+        flow_snapshot_save(fwd_cfg->flow_snapshot);
+    flow_export_fini();
+    flush_pipes(port_arr, app_cfg->port_config.nb_ports);
+    blocklist_fini();
+    flow_backend->stop_ports(app_cfg->port_config.nb_ports, port_arr);
 cleanup_port_stopped:
-    doca_flow_destroy();
+    flow_backend->destroy();
 exit:
+    shm_fini();
+    delete flow_backend;
+    flow_backend = NULL;
     return result;
 }
 
@@ -133,13 +551,27 @@ main(int argc, char** argv)
     doca_error_t result;
     struct doca_log_backend* sdk_log;
     int exit_status = EXIT_FAILURE;
-    struct application_dpdk_config dpdk_config;
-    dpdk_config.port_config.nb_ports = NUM_PORTS;
-    dpdk_config.port_config.nb_hairpin_q = 4; // total per-port
-    dpdk_config.reserve_main_thread = true; // used for stats
-    dpdk_config.port_config.self_hairpin = true;
+    struct application_dpdk_config dpdk_config = {};
+    struct selective_fwd_cfg fwd_cfg = {};
     dpdk_config.port_config.nb_queues = 1; // N queues and N pmd workers
     dpdk_config.reserved_cores = 0; // 0 reserved cores
+    fwd_cfg.idle_sleep_us = DEFAULT_IDLE_SLEEP_US;
+    fwd_cfg.flow_backend = FLOW_BACKEND_DOCA;
+    fwd_cfg.sim.table_size = SIM_DEFAULT_TABLE_SIZE;
+    fwd_cfg.sim.queue_depth = SIM_DEFAULT_QUEUE_DEPTH;
+    fwd_cfg.sim.latency_us = SIM_DEFAULT_LATENCY_US;
+    fwd_cfg.churn.lifetime_ms = CHURN_DEFAULT_LIFETIME_MS;
+    fwd_cfg.churn.pkts_per_flow = CHURN_DEFAULT_PKTS_PER_FLOW;
+    fwd_cfg.export_active_timeout_sec = EXPORT_DEFAULT_ACTIVE_TIMEOUT_SEC;
+    clock_gettime(CLOCK_MONOTONIC, &boot_start);
+    boot_phase_start = boot_start;
+    // a VF pair forwarding to each other, unless --fwd-table says otherwise
+    fwd_cfg.nb_ports = 2;
+    for (uint16_t port_id = 0; port_id < 2; port_id++) {
+        fwd_cfg.fwd_table[port_id].nb_egress = 1;
+        fwd_cfg.fwd_table[port_id].egress_port[0] = port_id ^ 1;
+        fwd_cfg.fwd_table[port_id].weight[0] = 1;
+    }
 
     /* Register a logger backend */
     result = doca_log_backend_create_standard();
@@ -157,17 +589,67 @@ main(int argc, char** argv)
 
     DOCA_LOG_INFO("Starting the sample");
 
-    result = doca_argp_init("doca_selective_fwd", NULL);
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    result = doca_argp_init("doca_selective_fwd", &fwd_cfg);
     if (result != DOCA_SUCCESS) {
         DOCA_LOG_ERR("Failed to init ARGP resources: %s", doca_error_get_descr(result));
         goto sample_exit;
     }
     doca_argp_set_dpdk_program(dpdk_init);
+    result = register_selective_fwd_params();
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to register application params: %s", doca_error_get_descr(result));
+        goto argp_cleanup;
+    }
     result = doca_argp_start(argc, argv);
     if (result != DOCA_SUCCESS) {
         DOCA_LOG_ERR("Failed to parse sample input: %s", doca_error_get_descr(result));
         goto argp_cleanup;
     }
+    boot_phase_done("EAL init");
+
+    // used for stats and control, unless --multi-process moves control to a thread and stats to secondaries
+    dpdk_config.reserve_main_thread = !fwd_cfg.multi_process;
+
+    if (fwd_cfg.rx_intr && fwd_cfg.idle_sleep_us < 1000)
+        DOCA_LOG_WARN("Rx interrupt waits have a 1 ms granularity, idle pmds sleep 1 ms rather than %u us",
+                      fwd_cfg.idle_sleep_us);
+    dpdk_config.port_config.rx_intr = fwd_cfg.rx_intr;
+    dpdk_config.port_config.parallel_init = fwd_cfg.parallel_init;
+    // any verdict may name any egress port, so every port hairpins to every port
+    dpdk_config.port_config.nb_ports = fwd_cfg.nb_ports;
+    dpdk_config.port_config.nb_hairpin_q = HAIRPIN_Q_PER_PORT_PAIR * fwd_cfg.nb_ports; // total per-port
+    dpdk_config.port_config.hairpin_all_ports = true;
+    for (uint16_t port_id = 0; port_id < fwd_cfg.nb_ports; port_id++) {
+        const struct fwd_rule* rule = &fwd_cfg.fwd_table[port_id];
+
+        for (uint8_t i = 0; i < rule->nb_egress; i++)
+            DOCA_LOG_INFO("Port %u forwards to port %u, weight %u", port_id, rule->egress_port[i], rule->weight[i]);
+    }
+    // the sampler gets a worker lcore of its own
+    if (fwd_cfg.sample_rate > 0)
+        dpdk_config.reserved_cores = 1;
+    // the churn generator feeds ring backed ports, which only the simulator can offload
+    if (fwd_cfg.churn.rate > 0) {
+        if (fwd_cfg.flow_backend != FLOW_BACKEND_SIM)
+            DOCA_LOG_INFO("Flow churn enabled, using the simulated flow backend");
+        fwd_cfg.flow_backend = FLOW_BACKEND_SIM;
+        result = churn_ports_create(&fwd_cfg.churn, fwd_cfg.nb_ports,
+                                    rte_lcore_count() - (dpdk_config.reserve_main_thread ? 1 : 0) -
+                                        dpdk_config.reserved_cores);
+        if (result != DOCA_SUCCESS) {
+            DOCA_LOG_ERR("Failed to create churn ports: %s", doca_error_get_descr(result));
+            goto dpdk_cleanup;
+        }
+    }
+    // virtual devices have no hairpin queues, the simulator forwards hits from the pmds
+    if (fwd_cfg.flow_backend == FLOW_BACKEND_SIM)
+        dpdk_config.port_config.nb_hairpin_q = 0;
+    // the NIC mirrors samples to an Rx queue after those of the pmds; the simulator hands them over in software
+    else if (fwd_cfg.sample_rate > 0)
+        dpdk_config.port_config.nb_extra_q = 1;
 
     /* update queues and ports */
     result = dpdk_queues_and_ports_init(&dpdk_config);
@@ -175,9 +657,13 @@ main(int argc, char** argv)
         DOCA_LOG_ERR("Failed to update ports and queues");
         goto dpdk_cleanup;
     }
+    boot_phase_add("mempool", dpdk_config.startup.mempool_ms);
+    boot_phase_add("queue setup", dpdk_config.startup.port_setup_ms);
+    boot_phase_add("hairpin bind", dpdk_config.startup.hairpin_bind_ms);
+    clock_gettime(CLOCK_MONOTONIC, &boot_phase_start);
 
     /* configure static pipes, then run "pmd" */
-    result = run_app(&dpdk_config);
+    result = run_app(&dpdk_config, &fwd_cfg);
     if (result != DOCA_SUCCESS) {
         DOCA_LOG_ERR("run_app() encountered an error: %s", doca_error_get_descr(result));
         goto dpdk_ports_queues_cleanup;
@@ -187,6 +673,8 @@ main(int argc, char** argv)
 dpdk_ports_queues_cleanup:
     dpdk_queues_and_ports_fini(&dpdk_config);
 dpdk_cleanup:
+    if (fwd_cfg.churn.rate > 0)
+        churn_ports_destroy();
     dpdk_fini();
 argp_cleanup:
     doca_argp_destroy();
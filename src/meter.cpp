@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES, ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of NVIDIA CORPORATION &
+ * AFFILIATES (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ *
+ */
+
+#include "selective_fwd.h"
+
+DOCA_LOG_REGISTER(SELECTIVE_FWD_METER);
+
+/*
+ * Hardware meters of offloaded flows. All of them are DOCA Flow shared meters,
+ * since a shared resource is bound to a port, each port gets its own range of
+ * meter ids:
+ * - 0: unlimited, for the flows without a meter, as every entry of a metered
+ *   hairpin pipe needs one
+ * - 1 to nb_meter_profiles: the meter of each profile, shared by all the flows
+ *   of the class received on the port
+ * - then METER_FLOWS_PER_PORT meters handed out one per flow to the flows of
+ *   per-flow profiles, split evenly between those profiles and configured with
+ *   their rate at startup, so that handing one out on a pmd is a pop
+ */
+
+// Rate of the meter of the flows without one, above any port speed
+#define METER_UNLIMITED_CIR (1ULL << 40)
+#define METER_UNLIMITED_CBS (1ULL << 30)
+
+static struct {
+    struct meter_profile profiles[MAX_METER_PROFILES + 1];
+    uint8_t nb_profiles;
+    uint16_t nb_ports;
+    // meter ids of each port, and how many of them are per-flow meters
+    uint32_t per_port;
+    uint32_t nb_flow_meters;
+    // per-flow meters of each profile, from the first one of the port's range
+    uint32_t flow_first[MAX_METER_PROFILES + 1];
+    uint32_t flow_count[MAX_METER_PROFILES + 1];
+    // the pmds and the main thread hand out per-flow meters
+    std::mutex lock;
+    std::vector<uint32_t> free_ids[MAX_PORTS][MAX_METER_PROFILES + 1];
+} meters;
+
+doca_error_t
+meter_init(const struct selective_fwd_cfg* cfg, uint16_t nb_ports)
+{
+    uint32_t nb_flow_profiles = 0, flow_first = 0;
+
+    meters.nb_profiles = cfg->nb_meter_profiles;
+    meters.nb_ports = nb_ports;
+    meters.nb_flow_meters = 0;
+    meters.profiles[0].cir = METER_UNLIMITED_CIR;
+    meters.profiles[0].cbs = METER_UNLIMITED_CBS;
+    for (uint8_t profile = 1; profile <= cfg->nb_meter_profiles; profile++) {
+        meters.profiles[profile] = cfg->meter_profiles[profile - 1];
+        if (meters.profiles[profile].per_flow) {
+            meters.nb_flow_meters = METER_FLOWS_PER_PORT;
+            nb_flow_profiles++;
+        }
+    }
+    if (cfg->default_meter > cfg->nb_meter_profiles) {
+        DOCA_LOG_ERR("Default meter profile %u not configured", cfg->default_meter);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    if (meters.nb_profiles == 0) {
+        meters.per_port = 0;
+        return DOCA_SUCCESS;
+    }
+
+    meters.per_port = 1 + meters.nb_profiles + meters.nb_flow_meters;
+    for (uint8_t profile = 0; profile <= meters.nb_profiles; profile++) {
+        meters.flow_first[profile] = flow_first;
+        meters.flow_count[profile] = meters.profiles[profile].per_flow ? meters.nb_flow_meters / nb_flow_profiles : 0;
+        flow_first += meters.flow_count[profile];
+    }
+    for (uint16_t port_id = 0; port_id < nb_ports; port_id++) {
+        uint32_t first = port_id * meters.per_port + 1 + meters.nb_profiles;
+
+        for (uint8_t profile = 1; profile <= meters.nb_profiles; profile++) {
+            std::vector<uint32_t>& free_ids = meters.free_ids[port_id][profile];
+
+            free_ids.reserve(meters.flow_count[profile]);
+            // popped from the back, so lower ids go first
+            for (uint32_t i = meters.flow_count[profile]; i > 0; i--)
+                free_ids.push_back(first + meters.flow_first[profile] + i - 1);
+        }
+    }
+    DOCA_LOG_INFO("%u meter profiles, %u per-flow meters per port", meters.nb_profiles, meters.nb_flow_meters);
+    return DOCA_SUCCESS;
+}
+
+uint32_t
+meter_count(void)
+{
+    return meters.per_port * meters.nb_ports;
+}
+
+doca_error_t
+meter_configure(struct doca_flow_port* ports[MAX_PORTS], uint16_t nb_ports)
+{
+    std::vector<uint32_t> ids(meters.per_port);
+    doca_error_t result;
+
+    for (uint16_t port_id = 0; port_id < nb_ports && meters.per_port > 0; port_id++) {
+        uint32_t base = port_id * meters.per_port;
+
+        for (uint32_t i = 0; i < meters.per_port; i++)
+            ids[i] = base + i;
+        for (uint8_t profile = 0; profile <= meters.nb_profiles; profile++) {
+            result = flow_backend->configure_meter(base + profile, &meters.profiles[profile]);
+            if (result != DOCA_SUCCESS) {
+                DOCA_LOG_ERR("Failed to configure meter %u: %s", base + profile, doca_error_get_descr(result));
+                return result;
+            }
+            // the per-flow meters of the profile, so that none is configured on a pmd
+            for (uint32_t i = 0; i < meters.flow_count[profile]; i++) {
+                uint32_t meter_id = base + 1 + meters.nb_profiles + meters.flow_first[profile] + i;
+
+                result = flow_backend->configure_meter(meter_id, &meters.profiles[profile]);
+                if (result != DOCA_SUCCESS) {
+                    DOCA_LOG_ERR("Failed to configure meter %u: %s", meter_id, doca_error_get_descr(result));
+                    return result;
+                }
+            }
+        }
+        result = flow_backend->bind_meters(ports[port_id], ids.data(), ids.size());
+        if (result != DOCA_SUCCESS) {
+            DOCA_LOG_ERR("Failed to bind meters to port %u: %s", port_id, doca_error_get_descr(result));
+            return result;
+        }
+    }
+    return DOCA_SUCCESS;
+}
+
+/*
+ * Hand out the meter of a new flow
+ *
+ * @port_id [in]: ingress port of the flow
+ * @profile [in]: meter profile, 0 for none
+ * @meter_id [out]: meter to attach to the hairpin entry
+ * @return: DOCA_SUCCESS on success, DOCA_ERROR_FULL when the port has no
+ *          per-flow meter of the profile left and DOCA_ERROR otherwise
+ */
+doca_error_t
+meter_alloc(int port_id, uint8_t profile, uint32_t* meter_id)
+{
+    uint32_t base = port_id * meters.per_port;
+
+    if (profile > meters.nb_profiles)
+        return DOCA_ERROR_INVALID_VALUE;
+    if (!meters.profiles[profile].per_flow) {
+        *meter_id = base + profile;
+        return DOCA_SUCCESS;
+    }
+
+    std::lock_guard<std::mutex> guard(meters.lock);
+    std::vector<uint32_t>& free_ids = meters.free_ids[port_id][profile];
+    if (free_ids.empty())
+        return DOCA_ERROR_FULL;
+    *meter_id = free_ids.back();
+    free_ids.pop_back();
+    return DOCA_SUCCESS;
+}
+
+/*
+ * Give back the meter of a flow once its entry is gone; meters shared by a
+ * class are not handed out, so only per-flow ones are taken back
+ *
+ * @port_id [in]: ingress port of the flow
+ * @meter_id [in]: meter of the flow
+ */
+void
+meter_free(int port_id, uint32_t meter_id)
+{
+    uint32_t first = port_id * meters.per_port + 1 + meters.nb_profiles;
+
+    if (meters.nb_flow_meters == 0 || meter_id < first || meter_id >= first + meters.nb_flow_meters)
+        return;
+
+    // back to the profile whose rate it was configured with
+    for (uint8_t profile = 1; profile <= meters.nb_profiles; profile++) {
+        if (meter_id - first - meters.flow_first[profile] < meters.flow_count[profile]) {
+            std::lock_guard<std::mutex> guard(meters.lock);
+            meters.free_ids[port_id][profile].push_back(meter_id);
+            return;
+        }
+    }
+}
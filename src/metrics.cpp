@@ -0,0 +1,584 @@
+/*
+ * Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES, ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of NVIDIA CORPORATION &
+ * AFFILIATES (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ *
+ */
+
+#include "selective_fwd.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+DOCA_LOG_REGISTER(SELECTIVE_FWD_METRICS);
+
+static struct lcore_metrics local_metrics[RTE_MAX_LCORE];
+struct lcore_metrics* lcore_metrics = local_metrics;
+struct lcore_latency lcore_latency[RTE_MAX_LCORE];
+
+// Every lcore which may count: the EAL lcores, and the control thread, which
+// registers as a non-EAL lcore with --multi-process
+#define METRICS_LCORE_FOREACH(lcore_id) \
+    for ((lcore_id) = 0; (lcore_id) < RTE_MAX_LCORE; (lcore_id)++) \
+        if (rte_eal_lcore_role(lcore_id) != ROLE_OFF)
+
+struct metric_desc {
+    const char* name;
+    const char* type;
+    const char* help;
+    size_t offset;
+};
+
+static const struct metric_desc metric_descs[] = {
+    { "selective_fwd_rx_packets_total", "counter",
+      "Packets received on the software path",
+      offsetof(struct lcore_metrics, rx_pkts) },
+    { "selective_fwd_rx_bytes_total", "counter",
+      "Bytes received on the software path",
+      offsetof(struct lcore_metrics, rx_bytes) },
+    { "selective_fwd_tx_packets_total", "counter",
+      "Packets forwarded by the software path",
+      offsetof(struct lcore_metrics, tx_pkts) },
+    { "selective_fwd_drops_total", "counter",
+      "Packets dropped on the software path",
+      offsetof(struct lcore_metrics, drops) },
+    { "selective_fwd_parse_errors_total", "counter",
+      "Packets which are not IPv4 TCP",
+      offsetof(struct lcore_metrics, parse_errors) },
+    { "selective_fwd_inserts_total", "counter",
+      "Hairpin entries inserted",
+      offsetof(struct lcore_metrics, inserts) },
+    { "selective_fwd_insert_fails_total", "counter",
+      "Hairpin entry insertions which failed",
+      offsetof(struct lcore_metrics, insert_fails) },
+    { "selective_fwd_insert_cycles_total", "counter",
+      "TSC cycles spent inserting hairpin entries",
+      offsetof(struct lcore_metrics, insert_cycles) },
+    { "selective_fwd_insert_deferrals_total", "counter",
+      "New flows forwarded in software because the insertion budget of their class ran out or their hairpin table was full",
+      offsetof(struct lcore_metrics, insert_deferrals) },
+    { "selective_fwd_evictions_total", "counter",
+      "Hairpin entries removed to make room in a hairpin table nearing capacity",
+      offsetof(struct lcore_metrics, evictions) },
+    { "selective_fwd_polls_total", "counter",
+      "PMD loop iterations",
+      offsetof(struct lcore_metrics, polls) },
+    { "selective_fwd_empty_polls_total", "counter",
+      "PMD loop iterations which received no packets",
+      offsetof(struct lcore_metrics, empty_polls) },
+    { "selective_fwd_sleeps_total", "counter",
+      "Times an idle PMD went to sleep",
+      offsetof(struct lcore_metrics, sleeps) },
+    { "selective_fwd_busy_cycles_total", "counter",
+      "TSC cycles spent in PMD loop iterations which received packets",
+      offsetof(struct lcore_metrics, busy_cycles) },
+    { "selective_fwd_idle_cycles_total", "counter",
+      "TSC cycles spent in PMD loop iterations which received no packets",
+      offsetof(struct lcore_metrics, idle_cycles) },
+    { "selective_fwd_emulated_hits_total", "counter",
+      "Packets hairpinned by the simulated flow backend",
+      offsetof(struct lcore_metrics, emulated_hits) },
+    { "selective_fwd_emulated_drops_total", "counter",
+      "Packets of the simulated flow backend dropped red by their meter or blocklisted",
+      offsetof(struct lcore_metrics, emulated_drops) },
+    { "selective_fwd_aggregated_flows_total", "counter",
+      "New flows offloaded by an aggregate rule rather than an entry of their own",
+      offsetof(struct lcore_metrics, aggregated_flows) },
+    { "selective_fwd_sampled_packets_total", "counter",
+      "Packets of offloaded flows mirrored to the sampler",
+      offsetof(struct lcore_metrics, sampled_pkts) },
+    { "selective_fwd_sampled_bytes_total", "counter",
+      "Bytes of offloaded flows mirrored to the sampler",
+      offsetof(struct lcore_metrics, sampled_bytes) },
+    { "selective_fwd_flow_records_total", "counter",
+      "Flow records of removed entries queued for export",
+      offsetof(struct lcore_metrics, flow_records) },
+    { "selective_fwd_flow_record_drops_total", "counter",
+      "Flow records of removed entries lost to a full export ring",
+      offsetof(struct lcore_metrics, flow_record_drops) },
+    { "selective_fwd_captured_packets_total", "counter",
+      "Slow path packets copied for the capture",
+      offsetof(struct lcore_metrics, captured_pkts) },
+    { "selective_fwd_capture_drops_total", "counter",
+      "Slow path packets the capture lost to a full ring or pool",
+      offsetof(struct lcore_metrics, capture_drops) },
+    { "selective_fwd_affinity_violations_total", "counter",
+      "Packets received on another lcore than the rest of their connection",
+      offsetof(struct lcore_metrics, affinity_violations) },
+    { "selective_fwd_verdict_requests_total", "counter",
+      "New flows handed to the verdict control thread",
+      offsetof(struct lcore_metrics, verdict_requests) },
+    { "selective_fwd_verdict_timeouts_total", "counter",
+      "New flows whose verdict did not arrive in time, their held packets dropped",
+      offsetof(struct lcore_metrics, verdict_timeouts) },
+    { "selective_fwd_verdict_hold_drops_total", "counter",
+      "Packets dropped because the hold queue of their flow or the pending flow table was full",
+      offsetof(struct lcore_metrics, verdict_hold_drops) },
+};
+
+struct latency_desc {
+    const char* name;
+    const char* help;
+    size_t offset;
+};
+
+static const struct latency_desc latency_descs[] = {
+    { "insert", "Hairpin entry insertion, submit to completion",
+      offsetof(struct lcore_latency, insert) },
+    { "remove", "Aged hairpin entry removal, submit to completion",
+      offsetof(struct lcore_latency, remove) },
+    { "offload", "First packet of a flow to its first hardware hit",
+      offsetof(struct lcore_latency, offload) },
+    { "verdict", "New flow published to the verdict control thread to its verdict applied",
+      offsetof(struct lcore_latency, verdict) },
+};
+
+static const double reported_percentiles[] = { 50, 99, 99.9 };
+
+static int metrics_fd = -1;
+static struct lcore_metrics last_total;
+static struct lcore_metrics last_lcore[RTE_MAX_LCORE];
+static struct latency_hist last_latency[RTE_DIM(latency_descs)];
+
+/*
+ * Upper bound of the values counted in a histogram bucket
+ *
+ * @bucket [in]: bucket index
+ * @return: largest value mapping to the bucket
+ */
+static uint64_t
+latency_hist_bucket_max(uint32_t bucket)
+{
+    uint32_t group = bucket >> LAT_HIST_SUB_BITS;
+    uint64_t sub = bucket & (LAT_HIST_SUB_BUCKETS - 1);
+
+    if (group == 0)
+        return sub;
+    return ((LAT_HIST_SUB_BUCKETS + sub + 1) << (group - 1)) - 1;
+}
+
+uint64_t
+latency_hist_percentile(const struct latency_hist* hist, double percentile)
+{
+    uint64_t rank, seen = 0;
+
+    if (hist->count == 0)
+        return 0;
+    rank = (uint64_t)(hist->count * percentile / 100.0);
+    if (rank >= hist->count)
+        rank = hist->count - 1;
+    for (uint32_t bucket = 0; bucket < LAT_HIST_BUCKETS; bucket++) {
+        seen += hist->buckets[bucket];
+        if (seen > rank)
+            return latency_hist_bucket_max(bucket);
+    }
+    return latency_hist_bucket_max(LAT_HIST_BUCKETS - 1);
+}
+
+/*
+ * Read a histogram out of a per-lcore latency block. Buckets are copied one by
+ * one while the owning lcore keeps writing, so the copy may be off by a few
+ * in-flight samples.
+ *
+ * @latency [in]: per-lcore latency block
+ * @offset [in]: offset of the histogram within the block
+ * @hist [out]: copy of the histogram
+ */
+static void
+latency_hist_read(const struct lcore_latency* latency, size_t offset, struct latency_hist* hist)
+{
+    const volatile struct latency_hist* src =
+        (const volatile struct latency_hist*)((const char*)latency + offset);
+
+    hist->count = src->count;
+    hist->sum = src->sum;
+    for (uint32_t bucket = 0; bucket < LAT_HIST_BUCKETS; bucket++)
+        hist->buckets[bucket] = src->buckets[bucket];
+}
+
+/*
+ * Add up the histograms of all lcores
+ *
+ * @offset [in]: offset of the histogram within the per-lcore latency block
+ * @total [out]: merged histogram
+ */
+static void
+latency_hist_aggregate(size_t offset, struct latency_hist* total)
+{
+    struct latency_hist hist;
+    uint32_t lcore_id;
+
+    memset(total, 0, sizeof(*total));
+    METRICS_LCORE_FOREACH(lcore_id) {
+        latency_hist_read(&lcore_latency[lcore_id], offset, &hist);
+        total->count += hist.count;
+        total->sum += hist.sum;
+        for (uint32_t bucket = 0; bucket < LAT_HIST_BUCKETS; bucket++)
+            total->buckets[bucket] += hist.buckets[bucket];
+    }
+}
+
+/*
+ * Convert TSC cycles to microseconds
+ *
+ * @cycles [in]: TSC cycles
+ * @return: microseconds
+ */
+static inline double
+cycles_to_us(uint64_t cycles)
+{
+    return (double)cycles * 1e6 / rte_get_tsc_hz();
+}
+
+double
+metrics_latency_percentile_us(size_t offset, double percentile)
+{
+    struct latency_hist hist;
+
+    latency_hist_aggregate(offset, &hist);
+    return cycles_to_us(latency_hist_percentile(&hist, percentile));
+}
+
+/*
+ * Read a single counter out of a per-lcore block
+ *
+ * @m [in]: per-lcore counters
+ * @offset [in]: offset of the counter within the block
+ * @return: counter value
+ */
+static inline uint64_t
+metric_value(const struct lcore_metrics* m, size_t offset)
+{
+    return *(const volatile uint64_t*)((const char*)m + offset);
+}
+
+void
+metrics_aggregate(struct lcore_metrics* total)
+{
+    uint32_t lcore_id;
+
+    memset(total, 0, sizeof(*total));
+    METRICS_LCORE_FOREACH(lcore_id) {
+        for (const struct metric_desc& desc : metric_descs) {
+            uint64_t* dst = (uint64_t*)((char*)total + desc.offset);
+            *dst += metric_value(&lcore_metrics[lcore_id], desc.offset);
+        }
+    }
+}
+
+/*
+ * Move the per-lcore counters, with their values so far, to other blocks,
+ * while no worker runs
+ *
+ * @blocks [in]: RTE_MAX_LCORE blocks, NULL to move back to process memory
+ */
+void
+metrics_relocate(struct lcore_metrics* blocks)
+{
+    if (blocks == NULL)
+        blocks = local_metrics;
+    if (blocks == lcore_metrics)
+        return;
+    memcpy(blocks, lcore_metrics, sizeof(local_metrics));
+    lcore_metrics = blocks;
+}
+
+void
+metrics_print_rates(double interval_sec)
+{
+    struct lcore_metrics total;
+
+    metrics_aggregate(&total);
+    uint64_t rx = total.rx_pkts - last_total.rx_pkts;
+    uint64_t tx = total.tx_pkts - last_total.tx_pkts;
+    uint64_t drops = total.drops - last_total.drops;
+    uint64_t inserts = total.inserts - last_total.inserts;
+    uint64_t insert_cycles = total.insert_cycles - last_total.insert_cycles;
+
+    DOCA_LOG_INFO("sw path: rx %.3f Mpps, tx %.3f Mpps, drop %.3f Mpps, "
+                  "%.0f inserts/s (%.1f us avg), %lu parse errors, %lu insert fails",
+                  rx / interval_sec / 1e6,
+                  tx / interval_sec / 1e6,
+                  drops / interval_sec / 1e6,
+                  inserts / interval_sec,
+                  inserts ? (double)insert_cycles / inserts * 1e6 / rte_get_tsc_hz() : 0.0,
+                  total.parse_errors,
+                  total.insert_fails);
+    last_total = total;
+
+    std::ostringstream load;
+    uint32_t lcore_id;
+    RTE_LCORE_FOREACH(lcore_id) {
+        const struct lcore_metrics* cur = &lcore_metrics[lcore_id];
+        uint64_t busy = metric_value(cur, offsetof(struct lcore_metrics, busy_cycles));
+        uint64_t idle = metric_value(cur, offsetof(struct lcore_metrics, idle_cycles));
+        uint64_t busy_delta = busy - last_lcore[lcore_id].busy_cycles;
+        uint64_t idle_delta = idle - last_lcore[lcore_id].idle_cycles;
+
+        if (busy_delta + idle_delta > 0)
+            load << " lcore " << lcore_id << ' '
+                 << 100 * busy_delta / (busy_delta + idle_delta) << '%';
+        last_lcore[lcore_id].busy_cycles = busy;
+        last_lcore[lcore_id].idle_cycles = idle;
+    }
+    DOCA_LOG_INFO("pmd busy:%s", load.str().c_str());
+
+    for (size_t i = 0; i < RTE_DIM(latency_descs); i++) {
+        struct latency_hist cur, interval;
+
+        latency_hist_aggregate(latency_descs[i].offset, &cur);
+        interval.count = cur.count - last_latency[i].count;
+        interval.sum = cur.sum - last_latency[i].sum;
+        for (uint32_t bucket = 0; bucket < LAT_HIST_BUCKETS; bucket++)
+            interval.buckets[bucket] = cur.buckets[bucket] - last_latency[i].buckets[bucket];
+        last_latency[i] = cur;
+
+        if (interval.count == 0)
+            continue;
+        DOCA_LOG_INFO("%s latency: p50 %.1f us, p99 %.1f us, p99.9 %.1f us, avg %.1f us (%lu samples)",
+                      latency_descs[i].name,
+                      cycles_to_us(latency_hist_percentile(&interval, 50)),
+                      cycles_to_us(latency_hist_percentile(&interval, 99)),
+                      cycles_to_us(latency_hist_percentile(&interval, 99.9)),
+                      cycles_to_us(interval.sum / interval.count),
+                      interval.count);
+    }
+}
+
+/*
+ * Write the counters, rates and latency percentiles of one lcore, or of all of
+ * them, as a JSON object
+ *
+ * @file [in]: output file
+ * @m [in]: counters
+ * @latency [in]: histograms, in latency_descs order
+ * @elapsed_sec [in]: length of the run
+ */
+static void
+metrics_write_json_block(FILE* file,
+                         const struct lcore_metrics* m,
+                         const struct latency_hist latency[],
+                         double elapsed_sec)
+{
+    const size_t prefix_len = strlen("selective_fwd_");
+
+    for (const struct metric_desc& desc : metric_descs)
+        fprintf(file, "\"%s\": %lu, ", desc.name + prefix_len, metric_value(m, desc.offset));
+    for (size_t i = 0; i < RTE_DIM(latency_descs); i++) {
+        fprintf(file, "\"%s_latency_us\": {", latency_descs[i].name);
+        for (size_t j = 0; j < RTE_DIM(reported_percentiles); j++)
+            fprintf(file, "%s\"p%g\": %.3f",
+                    j ? ", " : "",
+                    reported_percentiles[j],
+                    cycles_to_us(latency_hist_percentile(&latency[i], reported_percentiles[j])));
+        fprintf(file, "}, ");
+    }
+    fprintf(file, "\"rx_mpps\": %.6f, \"cycles_per_pkt\": %.1f, \"drop_rate\": %.6f",
+            m->rx_pkts / elapsed_sec / 1e6,
+            m->rx_pkts ? (double)m->busy_cycles / m->rx_pkts : 0.0,
+            m->rx_pkts ? (double)m->drops / m->rx_pkts : 0.0);
+}
+
+doca_error_t
+metrics_write_json(const char* path, double elapsed_sec)
+{
+    struct latency_hist latency[RTE_DIM(latency_descs)];
+    struct lcore_metrics total;
+    uint32_t lcore_id;
+    bool first = true;
+    FILE* file;
+
+    file = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (file == NULL) {
+        DOCA_LOG_ERR("Failed to open %s: %s", path, strerror(errno));
+        return DOCA_ERROR_IO_FAILED;
+    }
+
+    fprintf(file, "{\"elapsed_sec\": %.3f, \"tsc_hz\": %lu, \"lcores\": [", elapsed_sec, rte_get_tsc_hz());
+    RTE_LCORE_FOREACH(lcore_id) {
+        // the main lcore only runs a pmd with --multi-process
+        if (lcore_id == rte_get_main_lcore() && !shm_enabled())
+            continue;
+        for (size_t i = 0; i < RTE_DIM(latency_descs); i++)
+            latency_hist_read(&lcore_latency[lcore_id], latency_descs[i].offset, &latency[i]);
+        fprintf(file, "%s\n  {\"lcore\": %u, ", first ? "" : ",", lcore_id);
+        metrics_write_json_block(file, &lcore_metrics[lcore_id], latency, elapsed_sec);
+        fprintf(file, "}");
+        first = false;
+    }
+
+    metrics_aggregate(&total);
+    for (size_t i = 0; i < RTE_DIM(latency_descs); i++)
+        latency_hist_aggregate(latency_descs[i].offset, &latency[i]);
+    fprintf(file, "\n], \"total\": {");
+    metrics_write_json_block(file, &total, latency, elapsed_sec);
+    fprintf(file, "}}\n");
+
+    if (file != stdout && fclose(file) != 0) {
+        DOCA_LOG_ERR("Failed to write %s: %s", path, strerror(errno));
+        return DOCA_ERROR_IO_FAILED;
+    }
+    return DOCA_SUCCESS;
+}
+
+/*
+ * Render all counters in the Prometheus text exposition format
+ *
+ * @return: rendered metrics
+ */
+static std::string
+metrics_render(void)
+{
+    std::ostringstream oss;
+    uint32_t lcore_id;
+
+    for (const struct metric_desc& desc : metric_descs) {
+        oss << "# HELP " << desc.name << ' ' << desc.help << '\n'
+            << "# TYPE " << desc.name << ' ' << desc.type << '\n';
+        // every lcore, like metrics_aggregate(), so that a scrape adds up to the logged totals
+        METRICS_LCORE_FOREACH(lcore_id) {
+            oss << desc.name << "{lcore=\"" << lcore_id << "\"} "
+                << metric_value(&lcore_metrics[lcore_id], desc.offset) << '\n';
+        }
+    }
+    for (const struct latency_desc& desc : latency_descs) {
+        struct latency_hist hist;
+
+        oss << "# HELP selective_fwd_" << desc.name << "_latency_seconds " << desc.help << '\n'
+            << "# TYPE selective_fwd_" << desc.name << "_latency_seconds summary\n";
+        METRICS_LCORE_FOREACH(lcore_id) {
+            latency_hist_read(&lcore_latency[lcore_id], desc.offset, &hist);
+            for (double percentile : reported_percentiles)
+                oss << "selective_fwd_" << desc.name << "_latency_seconds{lcore=\"" << lcore_id
+                    << "\",quantile=\"" << percentile / 100 << "\"} "
+                    << cycles_to_us(latency_hist_percentile(&hist, percentile)) / 1e6 << '\n';
+            oss << "selective_fwd_" << desc.name << "_latency_seconds_sum{lcore=\"" << lcore_id << "\"} "
+                << cycles_to_us(hist.sum) / 1e6 << '\n'
+                << "selective_fwd_" << desc.name << "_latency_seconds_count{lcore=\"" << lcore_id << "\"} "
+                << hist.count << '\n';
+        }
+    }
+    oss << "# HELP selective_fwd_tsc_hz TSC frequency, to convert cycle counters\n"
+        << "# TYPE selective_fwd_tsc_hz gauge\n"
+        << "selective_fwd_tsc_hz " << rte_get_tsc_hz() << '\n';
+    return oss.str();
+}
+
+/*
+ * Answer a single scrape on an accepted connection. Any request is answered
+ * with the full metrics page.
+ *
+ * @fd [in]: connected socket
+ */
+static void
+metrics_serve(int fd)
+{
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+    char request[1024];
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (recv(fd, request, sizeof(request), 0) <= 0)
+        return;
+
+    std::string body = metrics_render();
+    std::ostringstream oss;
+    oss << "HTTP/1.0 200 OK\r\n"
+        << "Content-Type: text/plain; version=0.0.4\r\n"
+        << "Content-Length: " << body.size() << "\r\n"
+        << "Connection: close\r\n\r\n"
+        << body;
+    std::string response = oss.str();
+
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t ret = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (ret <= 0)
+            break;
+        sent += ret;
+    }
+}
+
+doca_error_t
+metrics_server_init(struct selective_fwd_cfg* cfg)
+{
+    int one = 1;
+
+    if (cfg->metrics_sock[0] != '\0') {
+        struct sockaddr_un addr = {};
+
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, cfg->metrics_sock);
+        unlink(cfg->metrics_sock);
+
+        metrics_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (metrics_fd < 0 ||
+            bind(metrics_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            DOCA_LOG_ERR("Failed to bind metrics socket %s: %s", cfg->metrics_sock, strerror(errno));
+            goto close_fd;
+        }
+        DOCA_LOG_INFO("Serving metrics on unix:%s", cfg->metrics_sock);
+    } else if (cfg->metrics_port != 0) {
+        struct sockaddr_in addr = {};
+
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(cfg->metrics_port);
+
+        metrics_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (metrics_fd < 0)
+            goto close_fd;
+        setsockopt(metrics_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(metrics_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            DOCA_LOG_ERR("Failed to bind metrics port %u: %s", cfg->metrics_port, strerror(errno));
+            goto close_fd;
+        }
+        DOCA_LOG_INFO("Serving metrics on http://127.0.0.1:%u/metrics", cfg->metrics_port);
+    } else {
+        return DOCA_SUCCESS;
+    }
+
+    if (listen(metrics_fd, 8) < 0) {
+        DOCA_LOG_ERR("Failed to listen on metrics socket: %s", strerror(errno));
+        goto close_fd;
+    }
+    return DOCA_SUCCESS;
+
+close_fd:
+    if (metrics_fd >= 0)
+        close(metrics_fd);
+    metrics_fd = -1;
+    return DOCA_ERROR_IO_FAILED;
+}
+
+int
+metrics_server_fd(void)
+{
+    return metrics_fd;
+}
+
+void
+metrics_server_accept(void)
+{
+    int fd = accept(metrics_fd, NULL, NULL);
+    if (fd < 0)
+        return;
+    metrics_serve(fd);
+    close(fd);
+}
+
+void
+metrics_server_fini(void)
+{
+    if (metrics_fd >= 0)
+        close(metrics_fd);
+    metrics_fd = -1;
+}
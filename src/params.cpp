@@ -0,0 +1,1349 @@
+/*
+ * Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES, ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of NVIDIA CORPORATION &
+ * AFFILIATES (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ *
+ */
+
+#include "selective_fwd.h"
+
+DOCA_LOG_REGISTER(SELECTIVE_FWD_PARAMS);
+
+/*
+ * ARGP callback - metrics TCP port
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+metrics_port_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    int port = *(int*)param;
+
+    if (port < 0 || port > UINT16_MAX) {
+        DOCA_LOG_ERR("Invalid metrics port %d", port);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    cfg->metrics_port = port;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - metrics UNIX socket path
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+metrics_sock_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    const char* path = (const char*)param;
+
+    if (strnlen(path, METRICS_SOCK_PATH_LEN) == METRICS_SOCK_PATH_LEN) {
+        DOCA_LOG_ERR("Metrics socket path is too long, max %d characters",
+                     METRICS_SOCK_PATH_LEN - 1);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    strcpy(cfg->metrics_sock, path);
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - empty polls before a pmd backs off
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+idle_threshold_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    int threshold = *(int*)param;
+
+    if (threshold < 0) {
+        DOCA_LOG_ERR("Invalid idle threshold %d", threshold);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    cfg->idle_threshold = threshold;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - longest sleep of an idle pmd
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+idle_sleep_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    int sleep_us = *(int*)param;
+
+    if (sleep_us <= 0 || sleep_us > FIRST_HIT_CHECK_INTERVAL_US) {
+        DOCA_LOG_ERR("Idle sleep must be between 1 and %d us", FIRST_HIT_CHECK_INTERVAL_US);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    cfg->idle_sleep_us = sleep_us;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - hardware rule operations per second of each pmd
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+insert_budget_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    int ops = *(int*)param;
+
+    if (ops < 0) {
+        DOCA_LOG_ERR("Invalid insertion budget %d", ops);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    cfg->insert_budget = ops;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - hairpin entries of each port
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+table_size_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    int entries = *(int*)param;
+
+    // every entry has a flow counter, and the counters of all ports add up
+    if (entries <= 0 || (uint32_t)entries > UINT32_MAX / MAX_PORTS) {
+        DOCA_LOG_ERR("Invalid table size %d", entries);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    cfg->table.max_entries = entries;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - start the hairpin pipes small and grow them on demand
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+table_resize_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+
+    cfg->table.resizable = *(bool*)param;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - hairpin table watermarks of the eviction, "<high>:<low>" in
+ * percent of the table
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+evict_watermarks_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    const char* str = (const char*)param;
+    unsigned long high, low;
+    char* end;
+
+    high = strtoul(str, &end, 10);
+    if (end == str || *end != ':')
+        goto invalid;
+    str = end + 1;
+    low = strtoul(str, &end, 10);
+    if (end == str || *end != '\0' || high == 0 || high > 100 || low >= high)
+        goto invalid;
+    cfg->evict_high_pct = high;
+    cfg->evict_low_pct = low;
+    return DOCA_SUCCESS;
+
+invalid:
+    DOCA_LOG_ERR("Invalid eviction watermarks %s, expected <high>:<low> with 0 <= low < high <= 100",
+                 (const char*)param);
+    return DOCA_ERROR_INVALID_VALUE;
+}
+
+/*
+ * ARGP callback - sleep on Rx interrupts when idle
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+rx_intr_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+
+    cfg->rx_intr = *(bool*)param;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - set up the ports concurrently
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+parallel_init_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+
+    cfg->parallel_init = *(bool*)param;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - share stats and flows with secondary processes
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+multi_process_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+
+    cfg->multi_process = *(bool*)param;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - provisioning UNIX socket path
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+provision_sock_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    const char* path = (const char*)param;
+
+    if (strnlen(path, METRICS_SOCK_PATH_LEN) == METRICS_SOCK_PATH_LEN) {
+        DOCA_LOG_ERR("Provisioning socket path is too long, max %d characters",
+                     METRICS_SOCK_PATH_LEN - 1);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    strcpy(cfg->provision_sock, path);
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - lcore affinity verification
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+verify_affinity_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+
+    cfg->verify_affinity = *(bool*)param;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - flow table snapshot path
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+flow_snapshot_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    const char* path = (const char*)param;
+
+    if (strnlen(path, PATH_MAX) == PATH_MAX) {
+        DOCA_LOG_ERR("Flow snapshot path is too long, max %d characters", PATH_MAX - 1);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    strcpy(cfg->flow_snapshot, path);
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - number of synthetic flows to offload and time
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+replay_bench_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    int nb_flows = *(int*)param;
+
+    if (nb_flows <= 0) {
+        DOCA_LOG_ERR("Invalid number of replay benchmark flows %d", nb_flows);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    cfg->replay_bench_flows = nb_flows;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - blocklist prefix file
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+blocklist_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    const char* path = (const char*)param;
+
+    if (strnlen(path, PATH_MAX) == PATH_MAX) {
+        DOCA_LOG_ERR("Blocklist path is too long, max %d characters", PATH_MAX - 1);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    strcpy(cfg->blocklist, path);
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - number of synthetic blocklist prefixes to load and time
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+blocklist_bench_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    int nb_prefixes = *(int*)param;
+
+    if (nb_prefixes <= 0 || nb_prefixes > BLOCKLIST_MAX_PREFIXES) {
+        DOCA_LOG_ERR("Invalid number of blocklist benchmark prefixes %d, max %d", nb_prefixes,
+                     BLOCKLIST_MAX_PREFIXES);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    cfg->blocklist_bench_prefixes = nb_prefixes;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - sample rate of the offloaded flows
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+sample_rate_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    int rate = *(int*)param;
+
+    // the NIC samples by matching the low bits of a random value
+    if (rate < 2 || rate > SAMPLE_RATE_MAX || (rate & (rate - 1)) != 0) {
+        DOCA_LOG_ERR("Invalid sample rate %d, a power of two from 2 to %d", rate, SAMPLE_RATE_MAX);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    cfg->sample_rate = rate;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - capture control UNIX socket path
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+capture_sock_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    const char* path = (const char*)param;
+
+    if (strnlen(path, METRICS_SOCK_PATH_LEN) == METRICS_SOCK_PATH_LEN) {
+        DOCA_LOG_ERR("Capture socket path is too long, max %d characters",
+                     METRICS_SOCK_PATH_LEN - 1);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    strcpy(cfg->capture_sock, path);
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - IPFIX collector of the flow records
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+flow_export_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    const char* dest = (const char*)param;
+
+    if (strnlen(dest, PATH_MAX) == PATH_MAX) {
+        DOCA_LOG_ERR("Flow export destination is too long, max %d characters", PATH_MAX - 1);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    strcpy(cfg->flow_export, dest);
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - interval between the records of a flow which stays installed
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+export_active_timeout_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    int timeout_sec = *(int*)param;
+
+    if (timeout_sec <= 0) {
+        DOCA_LOG_ERR("Invalid flow export active timeout %d", timeout_sec);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    cfg->export_active_timeout_sec = timeout_sec;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - flow offload backend
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+flow_backend_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    const char* backend = (const char*)param;
+
+    if (strcmp(backend, "doca") == 0)
+        cfg->flow_backend = FLOW_BACKEND_DOCA;
+    else if (strcmp(backend, "sim") == 0)
+        cfg->flow_backend = FLOW_BACKEND_SIM;
+    else {
+        DOCA_LOG_ERR("Unknown flow backend %s, expected doca or sim", backend);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - verdict mode
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+verdict_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    const char* mode = (const char*)param;
+
+    if (strcmp(mode, "inline") == 0)
+        cfg->verdict = VERDICT_INLINE;
+    else if (strcmp(mode, "console") == 0)
+        cfg->verdict = VERDICT_CONSOLE;
+    else {
+        DOCA_LOG_ERR("Unknown verdict mode %s, expected inline or console", mode);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - forwarding table, comma separated <in>:<egress> rules where
+ * <egress> is one or more <out>[/<weight>] joined by '+', e.g. 0:1/3+2,1:0.
+ * The highest port named sets the number of ports; ports without a rule
+ * forward to their peer, port ^ 1, or to themselves when it does not exist.
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+fwd_table_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    const char* pos = (const char*)param;
+    bool set[MAX_PORTS] = {};
+    uint16_t nb_ports = 0;
+    char* end;
+
+    while (*pos != '\0') {
+        unsigned long port_in = strtoul(pos, &end, 10);
+        if (end == pos || *end != ':')
+            goto invalid;
+        if (port_in >= MAX_PORTS)
+            goto out_of_range;
+        struct fwd_rule* rule = &cfg->fwd_table[port_in];
+
+        rule->nb_egress = 0;
+        do {
+            pos = end + 1;
+            unsigned long port_out = strtoul(pos, &end, 10);
+            unsigned long weight = 1;
+            if (end == pos)
+                goto invalid;
+            if (*end == '/') {
+                pos = end + 1;
+                weight = strtoul(pos, &end, 10);
+                if (end == pos || weight == 0 || weight > UINT16_MAX)
+                    goto invalid;
+            }
+            if (port_out >= MAX_PORTS)
+                goto out_of_range;
+            if (rule->nb_egress == MAX_PORTS)
+                goto invalid;
+            rule->egress_port[rule->nb_egress] = port_out;
+            rule->weight[rule->nb_egress] = weight;
+            rule->nb_egress++;
+            nb_ports = RTE_MAX(nb_ports, (uint16_t)(port_out + 1));
+        } while (*end == '+');
+        if (*end != ',' && *end != '\0')
+            goto invalid;
+        pos = *end == ',' ? end + 1 : end;
+
+        set[port_in] = true;
+        nb_ports = RTE_MAX(nb_ports, (uint16_t)(port_in + 1));
+    }
+    if (nb_ports == 0)
+        goto invalid;
+
+    for (uint16_t port_id = 0; port_id < nb_ports; port_id++) {
+        if (set[port_id])
+            continue;
+        cfg->fwd_table[port_id].nb_egress = 1;
+        cfg->fwd_table[port_id].egress_port[0] = (port_id ^ 1) < nb_ports ? port_id ^ 1 : port_id;
+        cfg->fwd_table[port_id].weight[0] = 1;
+    }
+    cfg->nb_ports = nb_ports;
+    return DOCA_SUCCESS;
+
+invalid:
+    DOCA_LOG_ERR("Invalid forwarding table %s, expected <in>:<out>[/<weight>][+<out>[/<weight>]...][,...]",
+                 (const char*)param);
+    return DOCA_ERROR_INVALID_VALUE;
+out_of_range:
+    DOCA_LOG_ERR("Forwarding table port out of range, at most %d ports", MAX_PORTS);
+    return DOCA_ERROR_INVALID_VALUE;
+}
+
+/*
+ * ARGP callback - meter profiles, comma separated <cir>:<cbs>[:flow] where
+ * <cir> is in bytes per second and <cbs> in bytes, numbered from 1 in order.
+ * Profiles ending with :flow give each flow a meter of its own, the others
+ * one meter per ingress port shared by all the flows of the profile.
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+meter_profiles_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    const char* pos = (const char*)param;
+    uint8_t nb_profiles = 0;
+    char* end;
+
+    while (*pos != '\0') {
+        if (nb_profiles == MAX_METER_PROFILES) {
+            DOCA_LOG_ERR("Too many meter profiles, at most %d", MAX_METER_PROFILES);
+            return DOCA_ERROR_INVALID_VALUE;
+        }
+        struct meter_profile* profile = &cfg->meter_profiles[nb_profiles];
+
+        profile->cir = strtoull(pos, &end, 10);
+        if (end == pos || *end != ':' || profile->cir == 0)
+            goto invalid;
+        pos = end + 1;
+        profile->cbs = strtoull(pos, &end, 10);
+        if (end == pos || profile->cbs == 0)
+            goto invalid;
+        profile->per_flow = strncmp(end, ":flow", 5) == 0;
+        if (profile->per_flow)
+            end += 5;
+        if (*end != ',' && *end != '\0')
+            goto invalid;
+        pos = *end == ',' ? end + 1 : end;
+        nb_profiles++;
+    }
+    if (nb_profiles == 0)
+        goto invalid;
+    cfg->nb_meter_profiles = nb_profiles;
+    return DOCA_SUCCESS;
+
+invalid:
+    DOCA_LOG_ERR("Invalid meter profiles %s, expected <cir>:<cbs>[:flow][,...]", (const char*)param);
+    return DOCA_ERROR_INVALID_VALUE;
+}
+
+/*
+ * ARGP callback - meter profile of the flows whose verdict names none
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+meter_default_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    int profile = *(int*)param;
+
+    // checked against the configured profiles once all are parsed
+    if (profile < 0 || profile > MAX_METER_PROFILES) {
+        DOCA_LOG_ERR("Invalid default meter profile %d", profile);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    cfg->default_meter = profile;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * Parse an IPv4 prefix, <a.b.c.d>[/<len>] or * for any
+ *
+ * @str [in]: prefix
+ * @addr [out]: address, network order
+ * @prefix [out]: prefix length
+ * @return: true on success
+ */
+bool
+parse_ipv4_prefix(const char* str, doca_be32_t* addr, uint8_t* prefix)
+{
+    char buf[INET_ADDRSTRLEN];
+    const char* slash = strchr(str, '/');
+    size_t addr_len = slash != NULL ? (size_t)(slash - str) : strlen(str);
+    unsigned long len = 32;
+    char* end;
+
+    if (strcmp(str, "*") == 0) {
+        *addr = 0;
+        *prefix = 0;
+        return true;
+    }
+    if (addr_len >= sizeof(buf))
+        return false;
+    memcpy(buf, str, addr_len);
+    buf[addr_len] = '\0';
+    if (inet_pton(AF_INET, buf, addr) != 1)
+        return false;
+    if (slash != NULL) {
+        len = strtoul(slash + 1, &end, 10);
+        if (end == slash + 1 || *end != '\0' || len > 32)
+            return false;
+    }
+    *prefix = len;
+    return true;
+}
+
+/*
+ * Parse an L4 port range of an aggregate, <port>[-<port>] or * for any
+ *
+ * @str [in]: port range
+ * @min [out]: first port
+ * @max [out]: last port
+ * @return: true on success
+ */
+static bool
+parse_aggregate_ports(const char* str, uint16_t* min, uint16_t* max)
+{
+    unsigned long first, last;
+    char* end;
+
+    if (strcmp(str, "*") == 0) {
+        *min = 0;
+        *max = UINT16_MAX;
+        return true;
+    }
+    first = strtoul(str, &end, 10);
+    if (end == str)
+        return false;
+    last = first;
+    if (*end == '-') {
+        str = end + 1;
+        last = strtoul(str, &end, 10);
+        if (end == str)
+            return false;
+    }
+    if (*end != '\0' || first > last || last > UINT16_MAX)
+        return false;
+    *min = first;
+    *max = last;
+    return true;
+}
+
+/*
+ * ARGP callback - trusted aggregates, comma separated
+ * <in>:<out>:<src prefix>:<dst prefix>:<src ports>:<dst ports>, e.g.
+ * 0:1:*:10.1.0.0/16:*:443. Prefixes are <a.b.c.d>[/<len>], port ranges
+ * <port>[-<port>], and either may be * for any.
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+aggregates_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    char* rules = strdup((const char*)param);
+    char *rule_save, *field_save;
+    uint16_t nb_aggregates = 0;
+
+    if (rules == NULL)
+        return DOCA_ERROR_NO_MEMORY;
+    for (char* str = strtok_r(rules, ",", &rule_save); str != NULL; str = strtok_r(NULL, ",", &rule_save)) {
+        if (nb_aggregates == MAX_AGGREGATES) {
+            DOCA_LOG_ERR("Too many aggregates, at most %d", MAX_AGGREGATES);
+            free(rules);
+            return DOCA_ERROR_INVALID_VALUE;
+        }
+        struct aggregate_rule* rule = &cfg->aggregates[nb_aggregates];
+        const char* fields[6];
+        int nb_fields = 0;
+        unsigned long port_in, port_out;
+        char* end;
+
+        for (char* field = strtok_r(str, ":", &field_save); field != NULL && nb_fields < 6;
+             field = strtok_r(NULL, ":", &field_save))
+            fields[nb_fields++] = field;
+        if (nb_fields != 6 || strtok_r(NULL, ":", &field_save) != NULL)
+            goto invalid;
+        port_in = strtoul(fields[0], &end, 10);
+        if (end == fields[0] || *end != '\0' || port_in >= MAX_PORTS)
+            goto invalid;
+        port_out = strtoul(fields[1], &end, 10);
+        if (end == fields[1] || *end != '\0' || port_out >= MAX_PORTS)
+            goto invalid;
+        rule->port_in = port_in;
+        rule->port_out = port_out;
+        if (!parse_ipv4_prefix(fields[2], &rule->src_ip, &rule->src_prefix) ||
+            !parse_ipv4_prefix(fields[3], &rule->dst_ip, &rule->dst_prefix) ||
+            !parse_aggregate_ports(fields[4], &rule->src_port_min, &rule->src_port_max) ||
+            !parse_aggregate_ports(fields[5], &rule->dst_port_min, &rule->dst_port_max))
+            goto invalid;
+        nb_aggregates++;
+    }
+    if (nb_aggregates == 0)
+        goto invalid;
+    free(rules);
+    cfg->nb_aggregates = nb_aggregates;
+    return DOCA_SUCCESS;
+
+invalid:
+    free(rules);
+    DOCA_LOG_ERR("Invalid aggregates %s, expected <in>:<out>:<src prefix>:<dst prefix>:<src ports>:<dst ports>[,...]",
+                 (const char*)param);
+    return DOCA_ERROR_INVALID_VALUE;
+}
+
+/*
+ * ARGP callback - entries per port of the simulated backend
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+sim_table_size_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    int table_size = *(int*)param;
+
+    if (table_size <= 0) {
+        DOCA_LOG_ERR("Invalid simulated table size %d", table_size);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    cfg->sim.table_size = table_size;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - pipe queue depth of the simulated backend
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+sim_queue_depth_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    int queue_depth = *(int*)param;
+
+    if (queue_depth <= 0) {
+        DOCA_LOG_ERR("Invalid simulated queue depth %d", queue_depth);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    cfg->sim.queue_depth = queue_depth;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - completion latency of the simulated backend
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+sim_latency_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    int latency_us = *(int*)param;
+
+    if (latency_us < 0 || latency_us >= DEFAULT_TIMEOUT_US) {
+        DOCA_LOG_ERR("Simulated completion latency must be between 0 and %d us", DEFAULT_TIMEOUT_US - 1);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    cfg->sim.latency_us = latency_us;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - run duration
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+duration_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    int duration_sec = *(int*)param;
+
+    if (duration_sec < 0) {
+        DOCA_LOG_ERR("Invalid duration %d", duration_sec);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    cfg->duration_sec = duration_sec;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - JSON results path
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+results_json_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    const char* path = (const char*)param;
+
+    if (strnlen(path, PATH_MAX) == PATH_MAX) {
+        DOCA_LOG_ERR("Results path is too long, max %d characters", PATH_MAX - 1);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    strcpy(cfg->results_json, path);
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - churn rate
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+churn_rate_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    int value = *(int*)param;
+
+    if (value < 0) {
+        DOCA_LOG_ERR("Invalid churn rate %d", value);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    cfg->churn.rate = value;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - churn rate step
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+churn_step_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    int value = *(int*)param;
+
+    if (value < 0) {
+        DOCA_LOG_ERR("Invalid churn step %d", value);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    cfg->churn.step = value;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - churn flow lifetime
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+churn_lifetime_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    int value = *(int*)param;
+
+    if (value <= 0) {
+        DOCA_LOG_ERR("Invalid churn flow lifetime %d", value);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    cfg->churn.lifetime_ms = value;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * ARGP callback - churn packets per flow
+ *
+ * @param [in]: input parameter
+ * @config [out]: application configuration
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+churn_pkts_callback(void* param, void* config)
+{
+    struct selective_fwd_cfg* cfg = (struct selective_fwd_cfg*)config;
+    int value = *(int*)param;
+
+    if (value <= 0) {
+        DOCA_LOG_ERR("Invalid churn packets per flow %d", value);
+        return DOCA_ERROR_INVALID_VALUE;
+    }
+    cfg->churn.pkts_per_flow = value;
+    return DOCA_SUCCESS;
+}
+
+/*
+ * Create and register a single ARGP parameter
+ *
+ * @short_name [in]: short flag name, may be NULL
+ * @long_name [in]: long flag name
+ * @arguments [in]: argument placeholder shown in the usage, may be NULL
+ * @description [in]: usage description
+ * @type [in]: argument type
+ * @callback [in]: callback invoked with the parsed value
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise
+ */
+static doca_error_t
+register_param(const char* short_name,
+               const char* long_name,
+               const char* arguments,
+               const char* description,
+               enum doca_argp_type type,
+               doca_argp_param_cb_t callback)
+{
+    struct doca_argp_param* param;
+    doca_error_t result;
+
+    result = doca_argp_param_create(&param);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to create ARGP param: %s", doca_error_get_descr(result));
+        return result;
+    }
+    if (short_name != NULL)
+        doca_argp_param_set_short_name(param, short_name);
+    doca_argp_param_set_long_name(param, long_name);
+    if (arguments != NULL)
+        doca_argp_param_set_arguments(param, arguments);
+    doca_argp_param_set_description(param, description);
+    doca_argp_param_set_callback(param, callback);
+    doca_argp_param_set_type(param, type);
+
+    result = doca_argp_register_param(param);
+    if (result != DOCA_SUCCESS)
+        DOCA_LOG_ERR("Failed to register param %s: %s", long_name, doca_error_get_descr(result));
+    return result;
+}
+
+doca_error_t
+register_selective_fwd_params(void)
+{
+    doca_error_t result;
+
+    result = register_param(NULL,
+                            "metrics-port",
+                            "<port>",
+                            "Serve Prometheus metrics over HTTP on 127.0.0.1:<port>",
+                            DOCA_ARGP_TYPE_INT,
+                            metrics_port_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "metrics-sock",
+                            "<path>",
+                            "Serve Prometheus metrics over HTTP on a UNIX socket",
+                            DOCA_ARGP_TYPE_STRING,
+                            metrics_sock_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "idle-threshold",
+                            "<polls>",
+                            "Consecutive empty polls before a PMD backs off, 0 to always busy poll (default)",
+                            DOCA_ARGP_TYPE_INT,
+                            idle_threshold_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "idle-sleep-us",
+                            "<us>",
+                            "Longest a backed off PMD sleeps before polling again",
+                            DOCA_ARGP_TYPE_INT,
+                            idle_sleep_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "insert-budget",
+                            "<ops/s>",
+                            "Hardware rule operations each PMD submits per second, removals first and unmetered flows last, 0 for no limit (default)",
+                            DOCA_ARGP_TYPE_INT,
+                            insert_budget_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "table-size",
+                            "<entries>",
+                            "Hairpin entries of each port, derived from the flow counters and the insertion budget by default",
+                            DOCA_ARGP_TYPE_INT,
+                            table_size_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "table-resize",
+                            NULL,
+                            "Start the hairpin pipes small and grow them up to the table size as they fill up",
+                            DOCA_ARGP_TYPE_BOOLEAN,
+                            table_resize_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "evict-watermarks",
+                            "<high>:<low>",
+                            "Evict the slowest flows of a port once its hairpin table is <high> percent full, down to <low> percent",
+                            DOCA_ARGP_TYPE_STRING,
+                            evict_watermarks_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "rx-intr",
+                            NULL,
+                            "Sleep on Rx queue interrupts when a PMD is idle",
+                            DOCA_ARGP_TYPE_BOOLEAN,
+                            rx_intr_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "parallel-init",
+                            NULL,
+                            "Set up the ports and create their static pipes concurrently, one thread per port",
+                            DOCA_ARGP_TYPE_BOOLEAN,
+                            parallel_init_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "multi-process",
+                            NULL,
+                            "Share the counters and flows with DPDK secondary processes, which print the stats",
+                            DOCA_ARGP_TYPE_BOOLEAN,
+                            multi_process_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "provision-sock",
+                            "<path>",
+                            "Accept bulk flow add, remove and query requests on a UNIX socket",
+                            DOCA_ARGP_TYPE_STRING,
+                            provision_sock_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "verify-affinity",
+                            NULL,
+                            "Count packets received on another lcore than the rest of their connection",
+                            DOCA_ARGP_TYPE_BOOLEAN,
+                            verify_affinity_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "flow-snapshot",
+                            "<path>",
+                            "Save the offloaded flows to <path> on exit and offload them again on start",
+                            DOCA_ARGP_TYPE_STRING,
+                            flow_snapshot_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "replay-bench",
+                            "<flows>",
+                            "Offload <flows> synthetic flows, report the time to full offload and exit",
+                            DOCA_ARGP_TYPE_INT,
+                            replay_bench_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "flow-backend",
+                            "<doca|sim>",
+                            "Offload flows with DOCA Flow (default) or an in-memory simulator",
+                            DOCA_ARGP_TYPE_STRING,
+                            flow_backend_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "verdict",
+                            "<inline|console>",
+                            "Decide on new flows inline on the PMD (default) or asynchronously on the console",
+                            DOCA_ARGP_TYPE_STRING,
+                            verdict_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "fwd-table",
+                            "<in:out,...>",
+                            "Egress ports of the flows received on each port, by weight, e.g. 0:1/3+2/1,1:0 (default 0:1,1:0)",
+                            DOCA_ARGP_TYPE_STRING,
+                            fwd_table_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "meter-profiles",
+                            "<cir:cbs[:flow],...>",
+                            "Hardware meter profiles 1, 2, ... in bytes/s and bytes, :flow for a meter per flow",
+                            DOCA_ARGP_TYPE_STRING,
+                            meter_profiles_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "meter-default",
+                            "<profile>",
+                            "Meter profile of the offloaded flows whose verdict names none, 0 for none (default)",
+                            DOCA_ARGP_TYPE_INT,
+                            meter_default_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "aggregates",
+                            "<in:out:src:dst:sports:dports,...>",
+                            "Trusted aggregates offloaded by one masked rule, e.g. 0:1:*:10.1.0.0/16:*:443",
+                            DOCA_ARGP_TYPE_STRING,
+                            aggregates_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "sim-table-size",
+                            "<entries>",
+                            "Hairpin entries per port of the simulated backend",
+                            DOCA_ARGP_TYPE_INT,
+                            sim_table_size_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "sim-queue-depth",
+                            "<ops>",
+                            "Operations in flight per pipe queue of the simulated backend",
+                            DOCA_ARGP_TYPE_INT,
+                            sim_queue_depth_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "sim-latency-us",
+                            "<us>",
+                            "Completion latency of the simulated backend",
+                            DOCA_ARGP_TYPE_INT,
+                            sim_latency_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "duration",
+                            "<sec>",
+                            "Stop after forwarding for <sec> seconds",
+                            DOCA_ARGP_TYPE_INT,
+                            duration_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "results-json",
+                            "<path>",
+                            "Write per-lcore counters, rates and latencies as JSON on exit, - for stdout",
+                            DOCA_ARGP_TYPE_STRING,
+                            results_json_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "blocklist",
+                            "<path>",
+                            "Drop in the NIC the sources in the prefixes of <path>, one a.b.c.d[/len] per line; reloaded on SIGHUP",
+                            DOCA_ARGP_TYPE_STRING,
+                            blocklist_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "blocklist-bench",
+                            "<prefixes>",
+                            "Load <prefixes> synthetic blocklist prefixes, report the time to load them and exit",
+                            DOCA_ARGP_TYPE_INT,
+                            blocklist_bench_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "sample-rate",
+                            "<N>",
+                            "Mirror 1 in <N> packets of the offloaded flows to a sampler lcore, a power of two",
+                            DOCA_ARGP_TYPE_INT,
+                            sample_rate_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "export",
+                            "<dest>",
+                            "Export IPFIX flow records of the offloaded flows to udp:<address>:<port> or append them to a file",
+                            DOCA_ARGP_TYPE_STRING,
+                            flow_export_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "export-active-timeout",
+                            "<sec>",
+                            "Export a record of the flows which stay offloaded every <sec> seconds, default 60",
+                            DOCA_ARGP_TYPE_INT,
+                            export_active_timeout_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "capture-sock",
+                            "<path>",
+                            "UNIX socket taking commands to capture the slow path to pcapng: start, filter, stop, status",
+                            DOCA_ARGP_TYPE_STRING,
+                            capture_sock_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "churn-rate",
+                            "<flows/s>",
+                            "Generate <flows/s> new flows on ring backed ports, forces the simulated backend",
+                            DOCA_ARGP_TYPE_INT,
+                            churn_rate_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "churn-step",
+                            "<flows/s>",
+                            "Raise the churn rate by <flows/s> after each sustained step until one is not",
+                            DOCA_ARGP_TYPE_INT,
+                            churn_step_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "churn-lifetime-ms",
+                            "<ms>",
+                            "Mean lifetime of a churn flow",
+                            DOCA_ARGP_TYPE_INT,
+                            churn_lifetime_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    result = register_param(NULL,
+                            "churn-pkts",
+                            "<n>",
+                            "Packets sent by each churn flow",
+                            DOCA_ARGP_TYPE_INT,
+                            churn_pkts_callback);
+    if (result != DOCA_SUCCESS)
+        return result;
+
+    return DOCA_SUCCESS;
+}
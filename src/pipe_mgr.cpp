@@ -2,33 +2,298 @@
 
 DOCA_LOG_REGISTER(SELECTIVE_FWD_PIPE_MGR);
 
-PipeMgr::PipeMgr() {}
+PipeMgr::PipeMgr() : last_generation(0) {
+    for (int port_id = 0; port_id < MAX_PORTS; port_id++)
+        nb_entries[port_id] = 0;
+}
 
 PipeMgr::~PipeMgr() {}
 
-doca_error_t PipeMgr::add_entry(std::string name, struct doca_flow_pipe_entry* entry) {
-    entries.push_back(std::make_pair(name, entry));
+/*
+ * Format the 5-tuple of a flow for logging
+ *
+ * @key [in]: 5-tuple of the flow
+ * @return: printable flow name
+ */
+static std::string create_entry_name(const struct flow_key* key) {
+    char src_ip_str[INET_ADDRSTRLEN];
+    char dst_ip_str[INET_ADDRSTRLEN];
+
+    // Convert IP addresses to strings
+    inet_ntop(AF_INET, &key->src_ip, src_ip_str, INET_ADDRSTRLEN);
+    inet_ntop(AF_INET, &key->dst_ip, dst_ip_str, INET_ADDRSTRLEN);
+
+    std::ostringstream oss;
+    oss << "hairpin_"
+        << src_ip_str << ':' << ntohs(key->src_port)
+        << "->"
+        << dst_ip_str << ':' << ntohs(key->dst_port);
+    return oss.str();
+}
+
+doca_error_t PipeMgr::add_entry(struct flow_ctx* ctx) {
+    std::lock_guard<TicketLock> guard(lock);
+    ctx->generation = ++last_generation;
+    if (entries.emplace(ctx->entry, ctx).second)
+        nb_entries[ctx->port_in].fetch_add(1, std::memory_order_relaxed);
     return DOCA_SUCCESS;
 }
 
 doca_error_t PipeMgr::remove_entry(struct doca_flow_pipe_entry* entry) {
-    for (auto it = entries.begin(); it != entries.end(); it++) {
-        if (it->second == entry) {
-            entries.erase(it);
-            return DOCA_SUCCESS;
+    std::lock_guard<TicketLock> guard(lock);
+    auto it = entries.find(entry);
+    if (it == entries.end())
+        return DOCA_ERROR_NOT_FOUND;
+    nb_entries[it->second->port_in].fetch_sub(1, std::memory_order_relaxed);
+    entries.erase(it);
+    return DOCA_SUCCESS;
+}
+
+/*
+ * Whether an entry is still installed with the given context, without
+ * touching the context unless it is installed, as it may be released already.
+ * Entries and contexts are reused, so the generation tells whether it is the
+ * same flow rather than a later one which got both.
+ *
+ * @entry [in]: DOCA Flow entry
+ * @ctx [in]: flow context the entry was installed with
+ * @generation [in]: generation of the context when it was installed
+ * @return: true when the entry is installed
+ */
+bool PipeMgr::contains(struct doca_flow_pipe_entry* entry, const struct flow_ctx* ctx, uint64_t generation) {
+    std::lock_guard<TicketLock> guard(lock);
+    auto it = entries.find(entry);
+    return it != entries.end() && it->second == ctx && ctx->generation == generation;
+}
+
+/*
+ * Visit the entries PIPE_MGR_WALK_CHUNK at a time, releasing the lock between
+ * chunks, so the pmds adding and removing entries never wait for more than a
+ * chunk. A context is only valid during its visit. Entries added meanwhile may
+ * be missed, and a rehash meanwhile may also skip or repeat some entries.
+ *
+ * @visit [in]: called with each entry and its context, returns false to stop
+ */
+void PipeMgr::walk(const std::function<bool(struct doca_flow_pipe_entry*, struct flow_ctx*)>& visit) {
+    size_t bucket = 0;
+
+    for (;;) {
+        std::lock_guard<TicketLock> guard(lock);
+        uint32_t visited = 0;
+
+        for (; bucket < entries.bucket_count() && visited < PIPE_MGR_WALK_CHUNK; bucket++) {
+            for (auto it = entries.begin(bucket); it != entries.end(bucket); ++it, visited++) {
+                if (!visit(it->first, it->second))
+                    return;
+            }
         }
+        if (bucket >= entries.bucket_count())
+            return;
     }
-    return DOCA_ERROR_NOT_FOUND;
 }
 
-void PipeMgr::print_stats() {
-    DOCA_LOG_INFO("=================================");
-    for (auto entry : entries) {
+void PipeMgr::print_stats(bool log) {
+    struct {
+        struct flow_key key;
+        doca_error_t result;
         struct doca_flow_resource_query stats;
-        doca_error_t result = doca_flow_resource_query_entry(entry.second, &stats);
-        if (result == DOCA_SUCCESS)
-            DOCA_LOG_INFO("%s hit: %lu packets, %lu bytes", entry.first.c_str(), stats.counter.total_pkts, stats.counter.total_bytes);
+    } printed[PRINT_ENTRIES_MAX];
+    uint64_t now = rte_get_tsc_cycles();
+    uint32_t nb_entries_seen = 0;
+
+    // every entry is sampled, for the activity the snapshot and the export rely
+    // on, even when nothing is logged, but only the printed ones are kept, and
+    // logged once the walk is over
+    walk([&](struct doca_flow_pipe_entry* entry, struct flow_ctx* ctx) {
+        struct doca_flow_resource_query stats = {};
+        doca_error_t result = flow_backend->query_entry(entry, &stats);
+
+        if (result == DOCA_SUCCESS && stats.counter.total_pkts != ctx->last_pkts) {
+            ctx->last_pkts = stats.counter.total_pkts;
+            ctx->last_active_tsc = now;
+        }
+        if (log && nb_entries_seen < PRINT_ENTRIES_MAX) {
+            printed[nb_entries_seen].key = ctx->key;
+            printed[nb_entries_seen].result = result;
+            printed[nb_entries_seen].stats = stats;
+        }
+        nb_entries_seen++;
+        return true;
+    });
+
+    if (!log)
+        return;
+    DOCA_LOG_INFO("=================================");
+    for (uint32_t i = 0; i < RTE_MIN(nb_entries_seen, (uint32_t)PRINT_ENTRIES_MAX); i++) {
+        if (printed[i].result != DOCA_SUCCESS)
+            DOCA_LOG_ERR("Failed to query entry %s: %s", create_entry_name(&printed[i].key).c_str(),
+                         doca_error_get_descr(printed[i].result));
         else
-            DOCA_LOG_ERR("Failed to query entry %s: %s", entry.first.c_str(), doca_error_get_descr(result));
+            DOCA_LOG_INFO("%s hit: %lu packets, %lu bytes", create_entry_name(&printed[i].key).c_str(),
+                          printed[i].stats.counter.total_pkts, printed[i].stats.counter.total_bytes);
+    }
+    if (nb_entries_seen > PRINT_ENTRIES_MAX)
+        DOCA_LOG_INFO("... %u more entries", nb_entries_seen - PRINT_ENTRIES_MAX);
+}
+
+/*
+ * Records of the installed flows which have not gone idle, once the pmds are
+ * stopped. Nothing removes entries or releases contexts anymore by then, so
+ * only the entries are copied under the lock, and queried without it.
+ *
+ * @records [out]: records appended to
+ */
+void PipeMgr::collect_snapshot(std::vector<struct flow_snapshot_record>& records) {
+    std::vector<std::pair<struct doca_flow_pipe_entry*, struct flow_ctx*>> installed;
+    uint64_t now = rte_get_tsc_cycles();
+
+    {
+        std::lock_guard<TicketLock> guard(lock);
+        installed.assign(entries.begin(), entries.end());
     }
+    records.reserve(installed.size());
+    for (auto entry : installed) {
+        struct flow_ctx* ctx = entry.second;
+        struct doca_flow_resource_query stats;
+
+        if (flow_backend->query_entry(entry.first, &stats) == DOCA_SUCCESS &&
+            stats.counter.total_pkts != ctx->last_pkts)
+            ctx->last_active_tsc = now;
+
+        uint64_t idle_sec = (now - ctx->last_active_tsc) / rte_get_tsc_hz();
+        if (idle_sec >= FLOW_TIMEOUT_SEC)
+            continue;
+
+        struct flow_snapshot_record record = {};
+        record.src_ip = ctx->key.src_ip;
+        record.dst_ip = ctx->key.dst_ip;
+        record.src_port = ctx->key.src_port;
+        record.dst_port = ctx->key.dst_port;
+        record.port_in = ctx->port_in;
+        record.port_out = ctx->port_out;
+        record.remaining_age_sec = FLOW_TIMEOUT_SEC - idle_sec;
+        record.meter_profile = ctx->meter_profile;
+        records.push_back(record);
+    }
+}
+
+/*
+ * Query the installed flows for secondary processes, walking the table in
+ * chunks so the pmds never wait on a publication for more than a chunk
+ *
+ * @flows [out]: flows, at most max_flows of them
+ * @max_flows [in]: most flows returned
+ * @return: number of installed flows
+ */
+uint32_t PipeMgr::collect_flows(std::vector<struct shm_flow>& flows, uint32_t max_flows) {
+    uint64_t now = rte_get_tsc_cycles();
+    uint32_t nb_total = 0;
+
+    for (int port_id = 0; port_id < MAX_PORTS; port_id++)
+        nb_total += occupancy(port_id);
+    flows.reserve(RTE_MIN(max_flows, nb_total));
+    walk([&](struct doca_flow_pipe_entry* entry, struct flow_ctx* ctx) {
+        struct doca_flow_resource_query stats = {};
+
+        if (flows.size() == max_flows)
+            return false;
+        if (flow_backend->query_entry(entry, &stats) == DOCA_SUCCESS &&
+            stats.counter.total_pkts != ctx->last_pkts) {
+            ctx->last_pkts = stats.counter.total_pkts;
+            ctx->last_active_tsc = now;
+        }
+
+        struct shm_flow flow = {};
+        flow.src_ip = ctx->key.src_ip;
+        flow.dst_ip = ctx->key.dst_ip;
+        flow.src_port = ctx->key.src_port;
+        flow.dst_port = ctx->key.dst_port;
+        flow.port_in = ctx->port_in;
+        flow.port_out = ctx->port_out;
+        flow.meter_profile = ctx->meter_profile;
+        flow.provisioned = ctx->provisioned;
+        flow.idle_sec = (now - ctx->last_active_tsc) / rte_get_tsc_hz();
+        flow.pkts = stats.counter.total_pkts;
+        flow.bytes = stats.counter.total_bytes;
+        flows.push_back(flow);
+        return true;
+    });
+    return nb_total;
+}
+
+/*
+ * Sample the hit rate of the installed flows of some ports since the previous
+ * sample, for the eviction. Provisioned flows, flows whose removal is already
+ * submitted and flows too young for their rate to tell are left out. The
+ * table is walked in chunks, so the pmds, inserting hardest when a table
+ * fills up, never wait on the sampling for more than a chunk.
+ *
+ * @now [in]: current TSC
+ * @sampled_ports [in]: ports whose flows are sampled
+ * @candidates [out]: flows of each sampled port which may be evicted, appended to
+ */
+void PipeMgr::collect_evict(uint64_t now,
+                            const bool sampled_ports[MAX_PORTS],
+                            std::vector<struct evict_candidate> candidates[MAX_PORTS]) {
+    const uint64_t min_age = EVICT_MIN_AGE_SEC * rte_get_tsc_hz();
+
+    walk([&](struct doca_flow_pipe_entry* entry, struct flow_ctx* ctx) {
+        struct doca_flow_resource_query stats;
+        uint64_t sample_tsc = ctx->evict_tsc != 0 ? ctx->evict_tsc : ctx->first_pkt_tsc;
+
+        if (!sampled_ports[ctx->port_in] || __atomic_load_n(&ctx->remove_tsc, __ATOMIC_RELAXED) != 0 ||
+            ctx->provisioned)
+            return true;
+        if (flow_backend->query_entry(entry, &stats) != DOCA_SUCCESS)
+            return true;
+        if (stats.counter.total_pkts != ctx->last_pkts) {
+            ctx->last_pkts = stats.counter.total_pkts;
+            ctx->last_active_tsc = now;
+        }
+        // a flow repeated by a rehash was sampled at now already, so it is left out
+        if (now - ctx->first_pkt_tsc >= min_age && now > sample_tsc) {
+            struct evict_candidate candidate;
+
+            candidate.rate = (double)(stats.counter.total_pkts - ctx->evict_pkts) * rte_get_tsc_hz() /
+                             (now - sample_tsc);
+            candidate.entry = entry;
+            candidate.ctx = ctx;
+            candidate.generation = ctx->generation;
+            candidate.owner = ctx->owner;
+            candidates[ctx->port_in].push_back(candidate);
+        }
+        ctx->evict_pkts = stats.counter.total_pkts;
+        ctx->evict_tsc = now;
+        return true;
+    });
+}
+
+/*
+ * Records of the installed flows last exported at least interval cycles ago,
+ * for the exporter thread. Flows whose removal is already submitted get their
+ * record from the removal. The table is walked in chunks, so the pmds never
+ * wait on the export for more than a chunk.
+ *
+ * @now [in]: current TSC
+ * @interval [in]: TSC cycles between the records of a flow, 0 for every flow
+ * @reason [in]: reason given by the records
+ * @records [out]: records appended to
+ */
+void PipeMgr::collect_export(uint64_t now,
+                             uint64_t interval,
+                             enum flow_end_reason reason,
+                             std::vector<struct flow_record>& records) {
+    walk([&](struct doca_flow_pipe_entry* entry, struct flow_ctx* ctx) {
+        struct doca_flow_resource_query stats = {};
+        uint64_t exported_tsc = ctx->exported_tsc != 0 ? ctx->exported_tsc : ctx->first_pkt_tsc;
+
+        if (__atomic_load_n(&ctx->remove_tsc, __ATOMIC_RELAXED) != 0 || now - exported_tsc < interval)
+            return true;
+        if (flow_backend->query_entry(entry, &stats) != DOCA_SUCCESS)
+            return true;
+        records.emplace_back();
+        flow_record_fill(&records.back(), ctx, &stats, reason, now);
+        ctx->exported_tsc = now;
+        return true;
+    });
 }
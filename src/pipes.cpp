@@ -15,211 +15,86 @@
 
 DOCA_LOG_REGISTER(SELECTIVE_FWD_PIPES);
 
+// with meters configured, pipe taking the flows from port x to port y once metered
+static struct doca_flow_pipe* color_pipes[MAX_PORTS][MAX_PORTS];
+// with sampling configured, pipe mirroring a sample of the flows from port x to port y
+static struct doca_flow_pipe* sample_pipes[MAX_PORTS][MAX_PORTS];
+
 /*
- * Create DOCA Flow pipe with a match-all entry, that forwards the matched
- * traffic to RSS
+ * Work out where the hairpin entry of a flow sends its packets, through the
+ * sample pipe of its port pair when sampling, and hand out the meter of its
+ * profile when meters are configured
  *
- * @port [in]: port of the pipe
- * @port_id [in]: port ID of the pipe
- * @pipe [out]: created pipe pointer
+ * @app_cfg [in]: application DPDK configuration values
+ * @ctx [in/out]: flow context, gets its meter
+ * @fwd [out]: forwarding of the hairpin entry
  * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
  */
-static doca_error_t
-create_rss_pipe(struct doca_flow_port* port,
-                struct doca_flow_pipe** pipe,
-                uint16_t nb_queues)
+doca_error_t
+hairpin_fwd_prepare(struct application_dpdk_config* app_cfg, struct flow_ctx* ctx, struct hairpin_fwd* fwd)
 {
-    struct doca_flow_match match;
-    struct doca_flow_pipe_cfg* cfg;
-    struct doca_flow_fwd fwd;
     doca_error_t result;
-    uint16_t rss_queues[256];
-    struct entries_status status;
-    uint32_t nb_entries = 1;
-
-    memset(&match, 0, sizeof(match));
-    memset(&fwd, 0, sizeof(fwd));
-    memset(&status, 0, sizeof(status));
-
-    for (uint16_t i = 0; i < nb_queues; i++)
-        rss_queues[i] = i;
-
-    /* RSS queue - send matched traffic to all the configured queues  */
-    fwd.type = DOCA_FLOW_FWD_RSS;
-    fwd.rss_queues = rss_queues;
-    fwd.rss_outer_flags = DOCA_FLOW_RSS_IPV4 | DOCA_FLOW_RSS_TCP;
-    fwd.num_of_queues = nb_queues;
 
-    result = doca_flow_pipe_cfg_create(&cfg, port);
-    if (result != DOCA_SUCCESS) {
-        DOCA_LOG_ERR("Failed to create doca_flow_pipe_cfg: %s",
-                     doca_error_get_descr(result));
-        return result;
-    }
+    fwd->port_id_out = ctx->port_out;
+    fwd->base_hairpin_q = app_cfg->hairpin_queues[ctx->port_in][ctx->port_out];
+    fwd->hairpin_q_len = app_cfg->hairpin_q_count;
+    fwd->color_pipe = color_pipes[ctx->port_in][ctx->port_out];
+    fwd->sample_pipe = sample_pipes[ctx->port_in][ctx->port_out];
+    fwd->meter_id = 0;
+    if (fwd->color_pipe == NULL)
+        return DOCA_SUCCESS;
 
-    result = set_flow_pipe_cfg(cfg, "RSS_PIPE", DOCA_FLOW_PIPE_BASIC, false);
-    if (result != DOCA_SUCCESS) {
-        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg: %s",
-                     doca_error_get_descr(result));
-        goto destroy_pipe_cfg;
-    }
-    result = doca_flow_pipe_cfg_set_match(cfg, &match, NULL);
-    if (result != DOCA_SUCCESS) {
-        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg match: %s",
-                     doca_error_get_descr(result));
-        goto destroy_pipe_cfg;
-    }
-
-    result = doca_flow_pipe_cfg_set_nr_entries(cfg, nb_entries);
-    if (result != DOCA_SUCCESS) {
-        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg nb_entries: %s",
-                     doca_error_get_descr(result));
-        goto destroy_pipe_cfg;
-    }
-
-    result = doca_flow_pipe_create(cfg, &fwd, NULL, pipe);
-    if (result != DOCA_SUCCESS) {
-        DOCA_LOG_ERR("Failed to create RSS pipe: %s",
-                     doca_error_get_descr(result));
-        goto destroy_pipe_cfg;
-    }
-    doca_flow_pipe_cfg_destroy(cfg);
-
-    for (uint32_t i = 0; i < nb_entries; i++) {
-        result = doca_flow_pipe_add_entry(0,
-                                          *pipe,
-                                          &match,
-                                          NULL,
-                                          NULL,
-                                          &fwd,
-                                          DOCA_FLOW_WAIT_FOR_BATCH,
-                                          &status,
-                                          NULL);
-        if (result != DOCA_SUCCESS) {
-            DOCA_LOG_ERR("Failed to add RSS pipe entry: %s",
-                         doca_error_get_descr(result));
-            return result;
-        }
-    }
-
-    result = doca_flow_entries_process(port, 0, DEFAULT_TIMEOUT_US, nb_entries);
-    if (result != DOCA_SUCCESS) {
-        DOCA_LOG_ERR("Failed to process RSS entry: %s",
-                     doca_error_get_descr(result));
+    result = meter_alloc(ctx->port_in, ctx->meter_profile, &ctx->meter_id);
+    if (result != DOCA_SUCCESS)
         return result;
-    }
-
-    if (status.nb_processed != nb_entries || status.failure) {
-        DOCA_LOG_ERR("Failed to process RSS entry");
-        return DOCA_ERROR_BAD_STATE;
-    }
-
-    return result;
+    fwd->meter_id = ctx->meter_id;
+    return DOCA_SUCCESS;
+}
 
-destroy_pipe_cfg:
-    doca_flow_pipe_cfg_destroy(cfg);
-    return result;
+/*
+ * Release a flow context, giving back its meter
+ *
+ * @ctx [in]: flow context
+ */
+void
+flow_ctx_free(struct flow_ctx* ctx)
+{
+    if (color_pipes[ctx->port_in][ctx->port_out] != NULL)
+        meter_free(ctx->port_in, ctx->meter_id);
+    delete ctx;
 }
 
 /*
- * Create DOCA Flow pipe with 5 tuple match that forwards the matched traffic to
- * the other port
+ * Process the completions of a pipe queue until the one of a single entry
+ * arrives. Completions come back in submission order, so those of entries
+ * submitted before it on the queue, like the aging removals of the pmd owning
+ * it, go to the entry process callback first.
  *
- * @port [in]: port of the pipe
- * @port_id [in]: port ID of the pipe
- * @pipe [out]: created pipe pointer
- * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ * @port [in]: port the entry was submitted on
+ * @pipe_queue [in]: pipe queue the entry was submitted on
+ * @status [in]: status of the entry, updated by the entry process callback
+ * @return: DOCA_SUCCESS once the entry is processed, DOCA_ERROR_TIME_OUT when
+ *          it is still pending and DOCA_ERROR otherwise
  */
-static doca_error_t
-create_hairpin_pipe(struct doca_flow_port* port,
-                    int port_id,
-                    struct doca_flow_pipe* pipe_fwd_miss,
-                    struct doca_flow_pipe** pipe)
+doca_error_t
+wait_entry_processed(struct doca_flow_port* port, uint16_t pipe_queue, const struct entries_status* status)
 {
-    struct doca_flow_match match;
-    struct doca_flow_actions actions, *actions_arr[NB_ACTIONS_ARR];
-    struct doca_flow_fwd fwd, fwd_miss;
-    struct doca_flow_pipe_cfg* pipe_cfg;
-    struct doca_flow_monitor monitor;
     doca_error_t result;
 
-    memset(&match, 0, sizeof(match));
-    memset(&actions, 0, sizeof(actions));
-    memset(&fwd, 0, sizeof(fwd));
-    memset(&fwd_miss, 0, sizeof(fwd_miss));
-    memset(&monitor, 0, sizeof(monitor));
-
-    /* 5 tuple match */
-    match.parser_meta.outer_l4_type = DOCA_FLOW_L4_META_TCP;
-    match.parser_meta.outer_l3_type = DOCA_FLOW_L3_META_IPV4;
-    match.outer.l4_type_ext = DOCA_FLOW_L4_TYPE_EXT_TCP;
-    match.outer.l3_type = DOCA_FLOW_L3_TYPE_IP4;
-    match.outer.ip4.src_ip = 0xffffffff;
-    match.outer.ip4.dst_ip = 0xffffffff;
-    match.outer.tcp.l4_port.src_port = 0xffff;
-    match.outer.tcp.l4_port.dst_port = 0xffff;
-
-    actions_arr[0] = &actions;
-
-    monitor.aging_sec = FLOW_TIMEOUT_SEC;
-
-    result = doca_flow_pipe_cfg_create(&pipe_cfg, port);
-    if (result != DOCA_SUCCESS) {
-        DOCA_LOG_ERR("Failed to create doca_flow_pipe_cfg: %s",
-                     doca_error_get_descr(result));
-        return result;
-    }
-
-    result = set_flow_pipe_cfg(pipe_cfg, "HAIRPIN_PIPE", DOCA_FLOW_PIPE_BASIC, true);
-    if (result != DOCA_SUCCESS) {
-        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg: %s", doca_error_get_descr(result));
-        goto destroy_pipe_cfg;
-    }
-
-    result = doca_flow_pipe_cfg_set_match(pipe_cfg, &match, NULL);
-    if (result != DOCA_SUCCESS) {
-        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg match: %s", doca_error_get_descr(result));
-        goto destroy_pipe_cfg;
-    }
-
-    result = doca_flow_pipe_cfg_set_actions(pipe_cfg, actions_arr, NULL, NULL, NB_ACTIONS_ARR);
-    if (result != DOCA_SUCCESS) {
-        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg actions: %s", doca_error_get_descr(result));
-        goto destroy_pipe_cfg;
-    }
-
-    result = doca_flow_pipe_cfg_set_monitor(pipe_cfg, &monitor);
-    if (result != DOCA_SUCCESS) {
-        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg monitor: %s", doca_error_get_descr(result));
-        goto destroy_pipe_cfg;
-    }
-
-    result = doca_flow_pipe_cfg_set_nr_entries(pipe_cfg, 8000000);
-    if (result != DOCA_SUCCESS) {
-        DOCA_LOG_ERR("Failed to set doca_flow_pipe_cfg nr_entries: %s", doca_error_get_descr(result));
-        goto destroy_pipe_cfg;
+    for (int retry = 0; retry < BATCH_PROCESS_RETRIES && status->nb_processed == 0; retry++) {
+        result = flow_backend->entries_process(port, pipe_queue, DEFAULT_TIMEOUT_US, 0);
+        if (result != DOCA_SUCCESS)
+            return result;
     }
-
-    /* forwarding traffic to other port */
-    fwd.type = DOCA_FLOW_FWD_RSS;
-    fwd.num_of_queues = 0xffffffff;
-
-    fwd_miss.type = DOCA_FLOW_FWD_PIPE;
-    fwd_miss.next_pipe = pipe_fwd_miss;
-
-    result = doca_flow_pipe_create(pipe_cfg, &fwd, &fwd_miss, pipe);
-    if (result != DOCA_SUCCESS)
-        DOCA_LOG_ERR("Failed to create pipe: %s", doca_error_get_descr(result));
-
-destroy_pipe_cfg:
-    doca_flow_pipe_cfg_destroy(pipe_cfg);
-    return result;
+    return status->nb_processed != 0 ? DOCA_SUCCESS : DOCA_ERROR_TIME_OUT;
 }
 
 /*
  * Add DOCA Flow pipe entry to the hairpin pipe
  *
- * @port [in]: port of the entry
+ * @ports [in]: DOCA Flow ports
+ * @port_id_in [in]: port of the entry
+ * @fwd [in]: where the entry sends its packets
  * @pipe [in]: pipe of the entry
  * @dst_ip_addr [in]: destination IP address of the entry
  * @src_ip_addr [in]: source IP address of the entry
@@ -228,94 +103,386 @@ destroy_pipe_cfg:
  * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
  */
 doca_error_t
-add_hairpin_pipe_entry(struct doca_flow_port* ports[NUM_PORTS],
+add_hairpin_pipe_entry(struct doca_flow_port* ports[MAX_PORTS],
                        int port_id_in,
-                       uint16_t base_hairpin_q,
-                       uint8_t hairpin_q_len,
+                       const struct hairpin_fwd* fwd,
                        struct doca_flow_pipe* pipe,
                        doca_be32_t dst_ip_addr,
                        doca_be32_t src_ip_addr,
                        doca_be16_t dst_port,
                        doca_be16_t src_port,
-                       uint8_t pipe_queue,
+                       uint16_t pipe_queue,
                        struct entries_status *status,
                        struct doca_flow_pipe_entry** entry)
 {
-    struct doca_flow_match match;
-    struct doca_flow_actions actions;
+    struct flow_key key;
     doca_error_t result;
 
-    /* example 5-tuple to forward */
-    memset(&match, 0, sizeof(match));
-    memset(&actions, 0, sizeof(actions));
+    key.dst_ip = dst_ip_addr;
+    key.src_ip = src_ip_addr;
+    key.dst_port = dst_port;
+    key.src_port = src_port;
 
-    match.outer.ip4.dst_ip = dst_ip_addr;
-    match.outer.ip4.src_ip = src_ip_addr;
-    match.outer.tcp.l4_port.dst_port = dst_port;
-    match.outer.tcp.l4_port.src_port = src_port;
-
-    uint16_t hairpin_queues[hairpin_q_len];
-    for (uint16_t i = 0; i < hairpin_q_len; i++)
-        hairpin_queues[i] = base_hairpin_q + i;
-
-    struct doca_flow_fwd fwd = {};
-    fwd.type = DOCA_FLOW_FWD_RSS;
-    fwd.rss_queues = (uint16_t*)&hairpin_queues;
-    fwd.num_of_queues = hairpin_q_len;
-    fwd.rss_outer_flags = DOCA_FLOW_RSS_IPV4 | DOCA_FLOW_RSS_TCP;
-
-    result = doca_flow_pipe_add_entry(pipe_queue, pipe, &match, &actions, NULL, &fwd, DOCA_FLOW_WAIT_FOR_BATCH, status, entry);
+    result = flow_backend->add_hairpin_entry(pipe_queue, pipe, &key, fwd, DOCA_FLOW_WAIT_FOR_BATCH, status, entry);
     if (result != DOCA_SUCCESS) {
         DOCA_LOG_ERR("Failed to add entry: %s", doca_error_get_descr(result));
         return result;
     }
 
-    result = doca_flow_entries_process(ports[port_id_in], 0, DEFAULT_TIMEOUT_US, 1);
-    if (result != DOCA_SUCCESS || status->nb_processed != 1 || status->failure) {
+    result = wait_entry_processed(ports[port_id_in], pipe_queue, status);
+    if (result != DOCA_SUCCESS || status->failure) {
         DOCA_LOG_ERR("Failed to process entries");
         return DOCA_ERROR_BAD_STATE;
     }
 
-    DOCA_LOG_DBG("Added a hairpin pipe entry to port %d on queues %d-%d",
+    DOCA_LOG_DBG("Added a hairpin pipe entry from port %d to port %d on queues %d-%d",
                 port_id_in,
-                base_hairpin_q,
-                base_hairpin_q + hairpin_q_len - 1);
+                fwd->port_id_out,
+                fwd->base_hairpin_q,
+                fwd->base_hairpin_q + fwd->hairpin_q_len - 1);
     return DOCA_SUCCESS;
 }
 
+/*
+ * Wait for the completions of a batch of hairpin entries. Entries which failed
+ * are released, entries whose completion did not arrive in time are left to
+ * the entry process callback; both are dropped from ctxs.
+ *
+ * @port [in]: port the batch was submitted on
+ * @pipe_queue [in]: pipe queue the batch was submitted on
+ * @ctxs [in/out]: flow contexts
+ * @batch [in]: indexes in ctxs of the batch entries
+ * @batch_len [in]: number of entries in the batch
+ * @return: number of entries which were not added
+ */
+static uint32_t
+complete_hairpin_batch(struct doca_flow_port* port,
+                       uint16_t pipe_queue,
+                       struct flow_ctx* ctxs[],
+                       const uint32_t batch[],
+                       uint32_t batch_len)
+{
+    uint32_t nb_done = 0, nb_failed = 0;
+
+    for (int retry = 0; retry < BATCH_PROCESS_RETRIES && nb_done < batch_len; retry++) {
+        flow_backend->entries_process(port, pipe_queue, DEFAULT_TIMEOUT_US, batch_len - nb_done);
+        nb_done = 0;
+        for (uint32_t i = 0; i < batch_len; i++)
+            nb_done += ctxs[batch[i]]->status.nb_processed != 0;
+    }
+
+    for (uint32_t i = 0; i < batch_len; i++) {
+        struct flow_ctx* ctx = ctxs[batch[i]];
+
+        if (ctx->status.nb_processed == 0)
+            ctx->orphaned = true;
+        else if (ctx->status.failure)
+            flow_ctx_free(ctx);
+        else
+            continue;
+        ctxs[batch[i]] = NULL;
+        nb_failed++;
+    }
+    return nb_failed;
+}
+
+/*
+ * Add hairpin pipe entries in bulk, submitting them in batches of
+ * HAIRPIN_BATCH_SZ per port and collecting each batch's completions at once.
+ * Every flow goes to the hairpin queues from its port_in to its port_out,
+ * metered by its meter_profile when meters are configured.
+ *
+ * @app_cfg [in]: application DPDK configuration values
+ * @ports [in]: DOCA Flow ports
+ * @hairpin_pipes [in]: hairpin pipe of each port
+ * @pipe_queue [in]: pipe queue owned by the caller
+ * @ctxs [in/out]: flow contexts, the ones which could not be added are released
+ *                 and set to NULL
+ * @nb_flows [in]: number of flow contexts
+ * @nb_failed [out]: number of flows which could not be added
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
 doca_error_t
-configure_static_pipes(struct application_dpdk_config* app_cfg,
-                       struct doca_flow_port* ports[NUM_PORTS],
-                       struct doca_flow_pipe* hairpin_pipes[NUM_PORTS])
+add_hairpin_pipe_entries(struct application_dpdk_config* app_cfg,
+                         struct doca_flow_port* ports[MAX_PORTS],
+                         struct doca_flow_pipe* hairpin_pipes[MAX_PORTS],
+                         uint16_t pipe_queue,
+                         struct flow_ctx* ctxs[],
+                         uint32_t nb_flows,
+                         uint32_t* nb_failed)
 {
+    uint32_t batch[MAX_PORTS][HAIRPIN_BATCH_SZ];
+    uint32_t batch_len[MAX_PORTS] = {};
     doca_error_t result;
 
-    struct doca_flow_pipe* rss_pipes[NUM_PORTS];
-    for (int port_id = 0; port_id < NUM_PORTS; port_id++) {
+    *nb_failed = 0;
+    for (uint32_t i = 0; i < nb_flows; i++) {
+        struct flow_ctx* ctx = ctxs[i];
+        int port_id = ctx->port_in;
+        struct hairpin_fwd fwd;
+
+        result = hairpin_fwd_prepare(app_cfg, ctx, &fwd);
+        if (result == DOCA_SUCCESS)
+            result = flow_backend->add_hairpin_entry(pipe_queue,
+                                                     hairpin_pipes[port_id],
+                                                     &ctx->key,
+                                                     &fwd,
+                                                     DOCA_FLOW_WAIT_FOR_BATCH,
+                                                     ctx,
+                                                     &ctx->entry);
+        if (result != DOCA_SUCCESS) {
+            DOCA_LOG_DBG("Failed to add entry: %s", doca_error_get_descr(result));
+            flow_ctx_free(ctx);
+            ctxs[i] = NULL;
+            (*nb_failed)++;
+            continue;
+        }
+
+        batch[port_id][batch_len[port_id]++] = i;
+        if (batch_len[port_id] == HAIRPIN_BATCH_SZ) {
+            *nb_failed += complete_hairpin_batch(ports[port_id], pipe_queue, ctxs, batch[port_id], HAIRPIN_BATCH_SZ);
+            batch_len[port_id] = 0;
+        }
+    }
 
-        result = create_rss_pipe(ports[port_id],
-                                 &rss_pipes[port_id],
-                                 app_cfg->port_config.nb_queues);
+    for (int port_id = 0; port_id < app_cfg->port_config.nb_ports; port_id++)
+        if (batch_len[port_id] > 0)
+            *nb_failed += complete_hairpin_batch(ports[port_id], pipe_queue, ctxs, batch[port_id], batch_len[port_id]);
+
+    return *nb_failed == nb_flows && nb_flows > 0 ? DOCA_ERROR_BAD_STATE : DOCA_SUCCESS;
+}
+
+/*
+ * Size the hairpin pipes from the configuration, unless --table-size does. By
+ * default the flow counters are shared between the ports. With an insertion
+ * budget the pmds cannot install more entries than they may add in the time
+ * aging takes to remove them, twice that to leave headroom.
+ *
+ * @cfg [in/out]: application configuration, gets the table sizes
+ * @app_cfg [in]: application DPDK configuration values
+ */
+void
+hairpin_table_configure(struct selective_fwd_cfg* cfg, const struct application_dpdk_config* app_cfg)
+{
+    struct hairpin_table_cfg* table = &cfg->table;
+    uint16_t nb_ports = app_cfg->port_config.nb_ports;
+
+    if (table->max_entries == 0) {
+        uint32_t share = HAIRPIN_TABLE_SIZE / RTE_MAX(nb_ports, (uint16_t)1);
+
+        table->max_entries = share;
+        // clamped before rounding up, so the budgeted size stays a power of two within the share
+        if (cfg->insert_budget > 0)
+            table->max_entries = rte_align32pow2(RTE_MIN((uint64_t)rte_align32prevpow2(share),
+                                                         2ULL * cfg->insert_budget * app_cfg->port_config.nb_queues *
+                                                             (FLOW_TIMEOUT_SEC + AGING_HANDLE_INTERVAL_SEC)));
+    }
+    table->initial_entries =
+        table->resizable ? RTE_MIN(table->max_entries, (uint32_t)TABLE_RESIZE_INITIAL_ENTRIES) : table->max_entries;
+    if (table->resizable)
+        DOCA_LOG_INFO("Hairpin pipes of %u entries per port, growing up to %u, %u flow counters",
+                      table->initial_entries, table->max_entries, table->max_entries * nb_ports);
+    else
+        DOCA_LOG_INFO("Hairpin pipes of %u entries per port, %u flow counters", table->max_entries,
+                      table->max_entries * nb_ports);
+}
+
+/*
+ * Create the static pipes of a port, adding their entries on the given pipe
+ * queue
+ *
+ * @app_cfg [in]: application DPDK configuration values
+ * @ports [in]: DOCA Flow ports
+ * @hairpin_pipes [out]: hairpin pipe of each port, gets the port's
+ * @port_id [in]: port ID
+ * @pipe_queue [in]: pipe queue no other thread uses meanwhile
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+static doca_error_t
+configure_port_pipes(struct application_dpdk_config* app_cfg,
+                     struct doca_flow_port* ports[MAX_PORTS],
+                     struct doca_flow_pipe* hairpin_pipes[MAX_PORTS],
+                     int port_id,
+                     uint16_t pipe_queue)
+{
+    struct doca_flow_pipe* rss_pipe;
+    struct doca_flow_pipe* miss_pipe;
+    doca_error_t result;
+
+    result = flow_backend->create_rss_pipe(ports[port_id],
+                                           pipe_queue,
+                                           app_cfg->port_config.nb_queues,
+                                           &rss_pipe);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to create RSS pipe: %s",
+                     doca_error_get_descr(result));
+        return result;
+    }
+
+    result = aggregate_pipe_create(ports[port_id], port_id, rss_pipe, &miss_pipe);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to create ACL pipe: %s",
+                     doca_error_get_descr(result));
+        return result;
+    }
+
+    result = flow_backend->create_hairpin_pipe(ports[port_id],
+                                               port_id,
+                                               !blocklist_enabled(),
+                                               miss_pipe,
+                                               &hairpin_pipes[port_id]);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to create hairpin pipe: %s",
+                     doca_error_get_descr(result));
+        return result;
+    }
+
+    result = blocklist_pipe_create(ports[port_id], port_id, pipe_queue, hairpin_pipes[port_id]);
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to create blocklist pipe: %s",
+                     doca_error_get_descr(result));
+        return result;
+    }
+
+    for (int port_id_out = 0; port_id_out < app_cfg->port_config.nb_ports && meter_count() > 0; port_id_out++) {
+        result = flow_backend->create_color_pipe(ports[port_id],
+                                                 pipe_queue,
+                                                 app_cfg->hairpin_queues[port_id][port_id_out],
+                                                 app_cfg->hairpin_q_count,
+                                                 &color_pipes[port_id][port_id_out]);
         if (result != DOCA_SUCCESS) {
-            DOCA_LOG_ERR("Failed to create RSS pipe: %s",
+            DOCA_LOG_ERR("Failed to create color pipe: %s",
                          doca_error_get_descr(result));
-            stop_doca_flow_ports(NUM_PORTS, ports);
-            doca_flow_destroy();
             return result;
         }
+    }
 
-        result = create_hairpin_pipe(ports[port_id],
-                                     port_id,
-                                     rss_pipes[port_id],
-                                     &hairpin_pipes[port_id]);
+    for (int port_id_out = 0; port_id_out < app_cfg->port_config.nb_ports && sample_rate() > 0; port_id_out++) {
+        // the shared mirror of each port has the port's ID
+        result = flow_backend->create_sample_pipe(ports[port_id],
+                                                  pipe_queue,
+                                                  port_id,
+                                                  sample_rate(),
+                                                  app_cfg->hairpin_queues[port_id][port_id_out],
+                                                  app_cfg->hairpin_q_count,
+                                                  color_pipes[port_id][port_id_out],
+                                                  &sample_pipes[port_id][port_id_out]);
         if (result != DOCA_SUCCESS) {
-            DOCA_LOG_ERR("Failed to create hairpin pipe: %s",
+            DOCA_LOG_ERR("Failed to create sample pipe: %s",
                          doca_error_get_descr(result));
-            stop_doca_flow_ports(NUM_PORTS, ports);
-            doca_flow_destroy();
             return result;
         }
     }
 
     return result;
 }
+
+// Ports of a static pipes thread, see configure_static_pipes()
+struct port_pipes_job {
+    struct application_dpdk_config* app_cfg;
+    struct doca_flow_port** ports;
+    struct doca_flow_pipe** hairpin_pipes;
+    // ports first_port, first_port + stride, ... on pipe queue first_port
+    int first_port;
+    int stride;
+    pthread_t thread;
+    doca_error_t result;
+};
+
+/*
+ * Thread creating the static pipes of its ports
+ *
+ * @arg [in]: port_pipes_job of the thread
+ * @return: NULL
+ */
+static void*
+port_pipes_thread(void* arg)
+{
+    struct port_pipes_job* job = (struct port_pipes_job*)arg;
+
+    job->result = DOCA_SUCCESS;
+    for (int port_id = job->first_port; port_id < job->app_cfg->port_config.nb_ports && job->result == DOCA_SUCCESS;
+         port_id += job->stride)
+        job->result = configure_port_pipes(job->app_cfg, job->ports, job->hairpin_pipes, port_id, job->first_port);
+    return NULL;
+}
+
+doca_error_t
+configure_static_pipes(struct application_dpdk_config* app_cfg,
+                       struct doca_flow_port* ports[MAX_PORTS],
+                       struct doca_flow_pipe* hairpin_pipes[MAX_PORTS])
+{
+    // the pmds do not use their pipe queues yet, each thread adds its entries on one of them
+    int nb_threads = RTE_MIN(app_cfg->port_config.nb_ports, (int)nb_pipe_queues(app_cfg));
+    struct port_pipes_job jobs[MAX_PORTS];
+    doca_error_t result = DOCA_SUCCESS;
+
+    if (!app_cfg->port_config.parallel_init || nb_threads < 2) {
+        for (int port_id = 0; port_id < app_cfg->port_config.nb_ports && result == DOCA_SUCCESS; port_id++)
+            result = configure_port_pipes(app_cfg, ports, hairpin_pipes, port_id, main_pipe_queue(app_cfg));
+        return result;
+    }
+
+    for (int i = 0; i < nb_threads; i++) {
+        char name[RTE_MAX_THREAD_NAME_LEN];
+
+        jobs[i].app_cfg = app_cfg;
+        jobs[i].ports = ports;
+        jobs[i].hairpin_pipes = hairpin_pipes;
+        jobs[i].first_port = i;
+        jobs[i].stride = nb_threads;
+        snprintf(name, sizeof(name), "port_pipes_%d", i);
+        if (rte_ctrl_thread_create(&jobs[i].thread, name, NULL, port_pipes_thread, &jobs[i]) != 0) {
+            DOCA_LOG_ERR("Failed to create static pipes thread %d", i);
+            nb_threads = i;
+            result = DOCA_ERROR_DRIVER;
+            break;
+        }
+    }
+    for (int i = 0; i < nb_threads; i++) {
+        pthread_join(jobs[i].thread, NULL);
+        if (jobs[i].result != DOCA_SUCCESS)
+            result = jobs[i].result;
+    }
+    return result;
+}
+
+/*
+ * Handle aged hairpin entries of a pipe queue on every port, and collect the
+ * completions of the removals this submits. Must run on the queue's owner.
+ *
+ * @ports [in]: DOCA Flow ports
+ * @nb_ports [in]: number of ports
+ * @pipe_queue [in]: pipe queue owned by the caller
+ */
+void
+handle_pipe_queue_aging(struct doca_flow_port* ports[MAX_PORTS], uint16_t nb_ports, uint16_t pipe_queue)
+{
+    for (int port_id = 0; port_id < nb_ports; port_id++) {
+        flow_backend->aging_handle(ports[port_id], pipe_queue, AGING_QUOTA_US);
+        flow_backend->entries_process(ports[port_id], pipe_queue, DEFAULT_TIMEOUT_US, 0);
+    }
+}
+
+/*
+ * Remove all pipes and their entries in bulk, rather than leaving millions of
+ * hairpin entries to be torn down one by one when the ports stop
+ *
+ * @ports [in]: ports to flush
+ * @nb_ports [in]: number of ports
+ */
+void
+flush_pipes(struct doca_flow_port* ports[MAX_PORTS], uint16_t nb_ports)
+{
+    for (int port_id = 0; port_id < nb_ports; port_id++) {
+        uint64_t start = rte_get_tsc_cycles();
+        doca_error_t result = flow_backend->pipes_flush(ports[port_id]);
+        if (result != DOCA_SUCCESS) {
+            DOCA_LOG_ERR("Failed to flush pipes of port %d: %s", port_id, doca_error_get_descr(result));
+            continue;
+        }
+        DOCA_LOG_INFO("Flushed pipes of port %d in %.1f ms",
+                      port_id,
+                      (rte_get_tsc_cycles() - start) * 1000.0 / rte_get_tsc_hz());
+    }
+}
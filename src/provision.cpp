@@ -0,0 +1,380 @@
+/*
+ * Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES, ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of NVIDIA CORPORATION &
+ * AFFILIATES (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ *
+ */
+
+#include "selective_fwd.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+DOCA_LOG_REGISTER(SELECTIVE_FWD_PROVISION);
+
+/*
+ * Bulk flow provisioning over a UNIX socket. A client sends a
+ * provision_hdr followed by nb_records provision_record and gets back a
+ * provision_hdr followed by one provision_result per record, in order; any
+ * number of requests may be sent on a connection. Requests run on the main
+ * thread, on its own pipe queue, in batches of HAIRPIN_BATCH_SZ per port.
+ * Only flows added through this socket can be removed or queried by it.
+ */
+
+// longest a client may take to send the rest of a request or read a reply
+#define PROVISION_IO_TIMEOUT_MS 1000
+
+static int provision_fd = -1;
+// connected client, served one request per wakeup of the main loop
+static int provision_client_fd = -1;
+static struct selective_fwd_cfg* provision_cfg;
+static struct application_dpdk_config* provision_app_cfg;
+static struct doca_flow_port** provision_ports;
+static struct doca_flow_pipe** provision_hairpin_pipes;
+// flows added through the socket, per ingress port; main thread only
+static std::unordered_map<struct flow_key, struct flow_ctx*, flow_key_hash, flow_key_equal>
+    provisioned[MAX_PORTS];
+
+doca_error_t
+provision_server_init(struct selective_fwd_cfg* cfg,
+                      struct application_dpdk_config* app_cfg,
+                      struct doca_flow_port* ports[MAX_PORTS],
+                      struct doca_flow_pipe* hairpin_pipes[MAX_PORTS])
+{
+    struct sockaddr_un addr = {};
+
+    if (cfg->provision_sock[0] == '\0')
+        return DOCA_SUCCESS;
+
+    provision_cfg = cfg;
+    provision_app_cfg = app_cfg;
+    provision_ports = ports;
+    provision_hairpin_pipes = hairpin_pipes;
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, cfg->provision_sock);
+    unlink(cfg->provision_sock);
+
+    provision_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (provision_fd < 0 ||
+        bind(provision_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(provision_fd, 8) < 0) {
+        DOCA_LOG_ERR("Failed to listen on provisioning socket %s: %s", cfg->provision_sock, strerror(errno));
+        if (provision_fd >= 0)
+            close(provision_fd);
+        provision_fd = -1;
+        return DOCA_ERROR_IO_FAILED;
+    }
+    DOCA_LOG_INFO("Accepting flow provisioning on unix:%s", cfg->provision_sock);
+    return DOCA_SUCCESS;
+}
+
+int
+provision_server_fd(void)
+{
+    // while a client is connected, further clients wait in the listen backlog
+    return provision_client_fd >= 0 ? provision_client_fd : provision_fd;
+}
+
+void
+provision_forget(struct flow_ctx* ctx)
+{
+    auto it = provisioned[ctx->port_in].find(ctx->key);
+
+    if (it != provisioned[ctx->port_in].end() && it->second == ctx)
+        provisioned[ctx->port_in].erase(it);
+}
+
+/*
+ * Add provisioned flows
+ *
+ * @records [in]: flows to add
+ * @results [out]: status of each record
+ * @nb_records [in]: number of records
+ */
+static void
+provision_add(const struct provision_record* records, struct provision_result* results, uint32_t nb_records)
+{
+    std::vector<struct flow_ctx*> ctxs;
+    std::vector<uint32_t> indexes;
+    uint64_t now = rte_get_tsc_cycles();
+    uint32_t nb_failed;
+
+    ctxs.reserve(nb_records);
+    indexes.reserve(nb_records);
+    for (uint32_t i = 0; i < nb_records; i++) {
+        const struct provision_record* record = &records[i];
+        struct flow_key key = { record->src_ip, record->dst_ip, record->src_port, record->dst_port };
+
+        if (record->port_in >= provision_app_cfg->port_config.nb_ports ||
+            (record->port_out >= provision_app_cfg->port_config.nb_ports &&
+             record->port_out != PROVISION_PORT_DEFAULT) ||
+            (record->meter > provision_cfg->nb_meter_profiles && record->meter != PROVISION_METER_NONE)) {
+            results[i].status = DOCA_ERROR_INVALID_VALUE;
+            continue;
+        }
+        // reserve the key, so a duplicate within the request is caught too
+        if (!provisioned[record->port_in].emplace(key, (struct flow_ctx*)NULL).second) {
+            results[i].status = DOCA_ERROR_ALREADY_EXIST;
+            continue;
+        }
+
+        struct flow_ctx* ctx = new flow_ctx();
+        ctx->key = key;
+        ctx->port_in = record->port_in;
+        ctx->port_out = record->port_out == PROVISION_PORT_DEFAULT
+                            ? fwd_select_egress(provision_cfg, record->port_in, &key)
+                            : record->port_out;
+        if (record->meter == PROVISION_METER_NONE)
+            ctx->meter_profile = 0;
+        else
+            ctx->meter_profile = record->meter != 0 ? record->meter : provision_cfg->default_meter;
+        // no packet of the flow went through software, it starts with its entry
+        ctx->first_pkt_tsc = now;
+        ctx->last_active_tsc = now;
+        ctx->provisioned = true;
+        ctxs.push_back(ctx);
+        indexes.push_back(i);
+    }
+
+    add_hairpin_pipe_entries(provision_app_cfg, provision_ports, provision_hairpin_pipes,
+                             main_pipe_queue(provision_app_cfg), ctxs.data(), ctxs.size(), &nb_failed);
+
+    for (size_t i = 0; i < ctxs.size(); i++) {
+        const struct provision_record* record = &records[indexes[i]];
+        struct flow_key key = { record->src_ip, record->dst_ip, record->src_port, record->dst_port };
+
+        if (ctxs[i] == NULL) {
+            provisioned[record->port_in].erase(key);
+            results[indexes[i]].status = DOCA_ERROR_BAD_STATE;
+            continue;
+        }
+        provisioned[record->port_in][key] = ctxs[i];
+        pipe_mgr.add_entry(ctxs[i]);
+    }
+}
+
+/*
+ * Remove provisioned flows. The entry process callback releases each flow
+ * when its removal completes.
+ *
+ * @records [in]: flows to remove
+ * @results [out]: status of each record
+ * @nb_records [in]: number of records
+ */
+static void
+provision_remove(const struct provision_record* records, struct provision_result* results, uint32_t nb_records)
+{
+    uint16_t pipe_queue = main_pipe_queue(provision_app_cfg);
+    uint32_t batch_len[MAX_PORTS] = {};
+    std::vector<uint32_t> submitted;
+    uint32_t nb_pending;
+
+    submitted.reserve(nb_records);
+    for (uint32_t i = 0; i < nb_records; i++) {
+        const struct provision_record* record = &records[i];
+        struct flow_key key = { record->src_ip, record->dst_ip, record->src_port, record->dst_port };
+
+        if (record->port_in >= provision_app_cfg->port_config.nb_ports) {
+            results[i].status = DOCA_ERROR_INVALID_VALUE;
+            continue;
+        }
+        auto it = provisioned[record->port_in].find(key);
+        if (it == provisioned[record->port_in].end() || it->second->remove_tsc != 0) {
+            results[i].status = DOCA_ERROR_NOT_FOUND;
+            continue;
+        }
+
+        struct flow_ctx* ctx = it->second;
+        struct flow_record flow_record;
+
+        flow_export_prepare(ctx, FLOW_END_DETECTED, &flow_record);
+        __atomic_store_n(&ctx->remove_tsc, rte_rdtsc(), __ATOMIC_RELAXED);
+        doca_error_t result = flow_backend->remove_entry(pipe_queue, DOCA_FLOW_WAIT_FOR_BATCH, ctx->entry);
+        if (result != DOCA_SUCCESS) {
+            __atomic_store_n(&ctx->remove_tsc, 0, __ATOMIC_RELAXED);
+            results[i].status = result;
+            continue;
+        }
+        flow_export_removed(&flow_record);
+        submitted.push_back(i);
+        if (++batch_len[record->port_in] == HAIRPIN_BATCH_SZ) {
+            flow_backend->entries_process(provision_ports[record->port_in], pipe_queue, DEFAULT_TIMEOUT_US, 0);
+            batch_len[record->port_in] = 0;
+        }
+    }
+
+    // completions release the flows and drop them from the provisioned table
+    for (int retry = 0; retry < BATCH_PROCESS_RETRIES; retry++) {
+        for (int port_id = 0; port_id < provision_app_cfg->port_config.nb_ports; port_id++)
+            flow_backend->entries_process(provision_ports[port_id], pipe_queue, DEFAULT_TIMEOUT_US, 0);
+
+        nb_pending = 0;
+        for (uint32_t i : submitted) {
+            const struct provision_record* record = &records[i];
+            struct flow_key key = { record->src_ip, record->dst_ip, record->src_port, record->dst_port };
+
+            if (provisioned[record->port_in].count(key) != 0) {
+                results[i].status = DOCA_ERROR_IN_PROGRESS;
+                nb_pending++;
+            } else {
+                results[i].status = DOCA_SUCCESS;
+            }
+        }
+        if (nb_pending == 0)
+            break;
+    }
+}
+
+/*
+ * Report the hit counters of provisioned flows
+ *
+ * @records [in]: flows to query
+ * @results [out]: status and counters of each record
+ * @nb_records [in]: number of records
+ */
+static void
+provision_query(const struct provision_record* records, struct provision_result* results, uint32_t nb_records)
+{
+    struct doca_flow_resource_query query;
+
+    for (uint32_t i = 0; i < nb_records; i++) {
+        const struct provision_record* record = &records[i];
+        struct flow_key key = { record->src_ip, record->dst_ip, record->src_port, record->dst_port };
+
+        if (record->port_in >= provision_app_cfg->port_config.nb_ports) {
+            results[i].status = DOCA_ERROR_INVALID_VALUE;
+            continue;
+        }
+        auto it = provisioned[record->port_in].find(key);
+        if (it == provisioned[record->port_in].end()) {
+            results[i].status = DOCA_ERROR_NOT_FOUND;
+            continue;
+        }
+        results[i].status = flow_backend->query_entry(it->second->entry, &query);
+        if (results[i].status == DOCA_SUCCESS) {
+            results[i].pkts = query.counter.total_pkts;
+            results[i].bytes = query.counter.total_bytes;
+        }
+    }
+}
+
+/*
+ * Receive or send exactly len bytes
+ *
+ * @fd [in]: connected socket
+ * @buf [in/out]: data
+ * @len [in]: number of bytes
+ * @out [in]: send rather than receive
+ * @return: true on success, false on error, timeout or end of stream
+ */
+static bool
+provision_io(int fd, void* buf, size_t len, bool out)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t ret = out ? send(fd, (char*)buf + done, len - done, MSG_NOSIGNAL)
+                          : recv(fd, (char*)buf + done, len - done, 0);
+        if (ret <= 0)
+            return false;
+        done += ret;
+    }
+    return true;
+}
+
+/*
+ * Serve one request of a client, so that the main loop gets back to aging,
+ * stats and commands between the requests of a long session
+ *
+ * @fd [in]: connected socket
+ * @return: true to keep the connection, false to close it
+ */
+static bool
+provision_serve(int fd)
+{
+    std::vector<struct provision_record> records;
+    std::vector<struct provision_result> results;
+    struct provision_hdr hdr;
+
+    if (!provision_io(fd, &hdr, sizeof(hdr), false))
+        return false;
+    if (hdr.magic != PROVISION_MAGIC || hdr.version != PROVISION_VERSION ||
+        hdr.op < PROVISION_OP_ADD || hdr.op > PROVISION_OP_QUERY ||
+        hdr.nb_records > PROVISION_MAX_RECORDS) {
+        DOCA_LOG_WARN("Invalid provisioning request, closing the connection");
+        hdr.nb_records = 0;
+        hdr.status = DOCA_ERROR_INVALID_VALUE;
+        provision_io(fd, &hdr, sizeof(hdr), true);
+        return false;
+    }
+
+    records.resize(hdr.nb_records);
+    if (!provision_io(fd, records.data(), records.size() * sizeof(struct provision_record), false))
+        return false;
+    results.assign(hdr.nb_records, provision_result());
+
+    uint64_t start = rte_get_tsc_cycles();
+    switch (hdr.op) {
+        case PROVISION_OP_ADD:
+            provision_add(records.data(), results.data(), hdr.nb_records);
+            break;
+        case PROVISION_OP_REMOVE:
+            provision_remove(records.data(), results.data(), hdr.nb_records);
+            break;
+        default:
+            provision_query(records.data(), results.data(), hdr.nb_records);
+            break;
+    }
+
+    uint32_t nb_failed = 0;
+    for (const struct provision_result& result : results)
+        nb_failed += result.status != DOCA_SUCCESS;
+    if (hdr.op != PROVISION_OP_QUERY)
+        DOCA_LOG_INFO("Provisioning: %s %u flows in %.1f ms, %u failed",
+                      hdr.op == PROVISION_OP_ADD ? "added" : "removed",
+                      hdr.nb_records - nb_failed,
+                      (rte_get_tsc_cycles() - start) * 1000.0 / rte_get_tsc_hz(),
+                      nb_failed);
+
+    hdr.status = nb_failed == 0 ? DOCA_SUCCESS : DOCA_ERROR_BAD_STATE;
+    return provision_io(fd, &hdr, sizeof(hdr), true) &&
+           provision_io(fd, results.data(), results.size() * sizeof(struct provision_result), true);
+}
+
+void
+provision_server_accept(void)
+{
+    struct timeval tv = { .tv_sec = PROVISION_IO_TIMEOUT_MS / 1000, .tv_usec = PROVISION_IO_TIMEOUT_MS % 1000 * 1000 };
+
+    if (provision_client_fd >= 0) {
+        if (!provision_serve(provision_client_fd)) {
+            close(provision_client_fd);
+            provision_client_fd = -1;
+        }
+        return;
+    }
+
+    provision_client_fd = accept(provision_fd, NULL, NULL);
+    if (provision_client_fd < 0)
+        return;
+    setsockopt(provision_client_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(provision_client_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+void
+provision_server_fini(void)
+{
+    if (provision_client_fd >= 0)
+        close(provision_client_fd);
+    provision_client_fd = -1;
+    if (provision_fd >= 0)
+        close(provision_fd);
+    provision_fd = -1;
+}
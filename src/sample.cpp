@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES, ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of NVIDIA CORPORATION &
+ * AFFILIATES (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ *
+ */
+
+#include "selective_fwd.h"
+
+DOCA_LOG_REGISTER(SELECTIVE_FWD_SAMPLE);
+
+/*
+ * Sampled mirroring of offloaded flows. Hairpinned packets never reach
+ * software, so with a sample rate configured every hairpin entry forwards to
+ * a sample pipe of its port pair, which mirrors 1 in sample_rate packets to a
+ * dedicated Rx queue of the ingress port, after the pmd queues, before
+ * sending all of them on to the hairpin queues or the color pipe.
+ *
+ * The mirrored packets are inspected by the sampler, on a worker lcore of its
+ * own which no pmd uses, so the pmds never see them. The sampler naps when it
+ * finds nothing to do. With the simulated backend, which has no Rx queue to
+ * mirror to, the pmds copy the packets emulate_hit() says are mirrored to a
+ * ring the sampler drains instead.
+ */
+
+static struct {
+    uint32_t rate;
+    struct application_dpdk_config* app_cfg;
+    // Rx queue of every port the mirrored packets land on
+    uint16_t queue;
+    // mirrored packets copied by the pmds, when hits are emulated
+    struct rte_ring* ring;
+} sampling;
+
+doca_error_t
+sample_init(const struct selective_fwd_cfg* cfg, struct application_dpdk_config* app_cfg)
+{
+    sampling.rate = cfg->sample_rate;
+    sampling.app_cfg = app_cfg;
+    sampling.queue = app_cfg->port_config.nb_queues;
+    if (sampling.rate == 0 || !flow_backend->emulates_hits())
+        return DOCA_SUCCESS;
+
+    // the pmds enqueue, the sampler alone dequeues
+    sampling.ring = rte_ring_create("SAMPLE_RING", SAMPLE_RING_SIZE, rte_socket_id(), RING_F_SC_DEQ);
+    if (sampling.ring == NULL) {
+        DOCA_LOG_ERR("Failed to create the sample ring");
+        return DOCA_ERROR_NO_MEMORY;
+    }
+    return DOCA_SUCCESS;
+}
+
+uint32_t
+sample_rate(void)
+{
+    return sampling.rate;
+}
+
+/*
+ * Point the shared mirror of every port to the sample queue of the port; the
+ * mirror of a port has the port's ID
+ *
+ * @ports [in]: DOCA Flow ports
+ * @nb_ports [in]: number of ports
+ * @return: DOCA_SUCCESS on success and DOCA_ERROR otherwise.
+ */
+doca_error_t
+sample_configure(struct doca_flow_port* ports[MAX_PORTS], uint16_t nb_ports)
+{
+    doca_error_t result;
+
+    for (uint16_t port_id = 0; port_id < nb_ports && sampling.rate > 0; port_id++) {
+        result = flow_backend->configure_mirror(ports[port_id], port_id, sampling.queue);
+        if (result != DOCA_SUCCESS) {
+            DOCA_LOG_ERR("Failed to configure mirror of port %u: %s", port_id, doca_error_get_descr(result));
+            return result;
+        }
+    }
+    if (sampling.rate > 0)
+        DOCA_LOG_INFO("Mirroring 1 in %u packets of the offloaded flows to Rx queue %u", sampling.rate,
+                      sampling.queue);
+    return DOCA_SUCCESS;
+}
+
+/*
+ * Hand a copy of a packet the simulated NIC mirrors to the sampler, dropping
+ * it when the sampler lags behind
+ *
+ * @pkt [in]: mirrored packet, left to the caller
+ */
+void
+sample_mirror(struct rte_mbuf* pkt)
+{
+    struct rte_mbuf* copy = rte_pktmbuf_copy(pkt, sampling.app_cfg->mbuf_pool, 0, UINT32_MAX);
+
+    if (copy != NULL && rte_ring_enqueue(sampling.ring, copy) != 0)
+        rte_pktmbuf_free(copy);
+}
+
+/*
+ * Inspect a burst of mirrored packets and release them
+ *
+ * @packets [in]: mirrored packets
+ * @nb_packets [in]: number of packets
+ * @metrics [in]: counters of the sampler lcore
+ */
+static void
+sample_inspect(struct rte_mbuf* packets[], uint16_t nb_packets, struct lcore_metrics* metrics)
+{
+    for (uint16_t i = 0; i < nb_packets; i++) {
+        struct rte_ether_hdr* eth_hdr = rte_pktmbuf_mtod(packets[i], struct rte_ether_hdr*);
+        struct rte_ipv4_hdr* ipv4_hdr = (struct rte_ipv4_hdr*)((char*)eth_hdr + sizeof(struct rte_ether_hdr));
+        struct rte_tcp_hdr* tcp_hdr = (struct rte_tcp_hdr*)((char*)ipv4_hdr + sizeof(struct rte_ipv4_hdr));
+
+        metrics->sampled_pkts++;
+        metrics->sampled_bytes += rte_pktmbuf_pkt_len(packets[i]);
+        if (eth_hdr->ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4) && ipv4_hdr->next_proto_id == IPPROTO_TCP)
+            DOCA_LOG_DBG("Sampled %08x:%u -> %08x:%u, %u bytes",
+                         rte_be_to_cpu_32(ipv4_hdr->src_addr), rte_be_to_cpu_16(tcp_hdr->src_port),
+                         rte_be_to_cpu_32(ipv4_hdr->dst_addr), rte_be_to_cpu_16(tcp_hdr->dst_port),
+                         rte_pktmbuf_pkt_len(packets[i]));
+    }
+    rte_pktmbuf_free_bulk(packets, nb_packets);
+}
+
+/*
+ * Sampler loop, on the worker lcore left to it: drain the sample queue of
+ * every port, or the sample ring, and nap while there is nothing to inspect
+ *
+ * @arg [in]: unused
+ * @return: 0
+ */
+int
+start_sampler(void* arg)
+{
+    struct lcore_metrics* metrics = &lcore_metrics[rte_lcore_id()];
+    uint16_t nb_ports = sampling.app_cfg->port_config.nb_ports;
+    struct rte_mbuf* packets[PACKET_BURST_SZ];
+
+    (void)arg;
+    DOCA_LOG_INFO("Sampler started on lcore %u", rte_lcore_id());
+    while (!force_quit) {
+        uint64_t start = rte_rdtsc();
+        uint32_t nb_sampled = 0;
+        uint16_t nb_packets;
+
+        if (sampling.ring != NULL) {
+            nb_packets = rte_ring_sc_dequeue_burst(sampling.ring, (void**)packets, PACKET_BURST_SZ, NULL);
+            sample_inspect(packets, nb_packets, metrics);
+            nb_sampled += nb_packets;
+        } else {
+            for (uint16_t port_id = 0; port_id < nb_ports; port_id++) {
+                nb_packets = rte_eth_rx_burst(port_id, sampling.queue, packets, PACKET_BURST_SZ);
+                sample_inspect(packets, nb_packets, metrics);
+                nb_sampled += nb_packets;
+            }
+        }
+
+        if (nb_sampled > 0) {
+            metrics->busy_cycles += rte_rdtsc() - start;
+            continue;
+        }
+        rte_delay_us_sleep(SAMPLE_IDLE_SLEEP_US);
+        metrics->idle_cycles += rte_rdtsc() - start;
+    }
+    return 0;
+}
+
+/*
+ * Release the mirrored packets left in the sample ring, once the pmds and the
+ * sampler are stopped
+ */
+void
+sample_fini(void)
+{
+    struct rte_mbuf* pkt;
+
+    if (sampling.ring == NULL)
+        return;
+    while (rte_ring_dequeue(sampling.ring, (void**)&pkt) == 0)
+        rte_pktmbuf_free(pkt);
+    rte_ring_free(sampling.ring);
+    sampling.ring = NULL;
+}
@@ -12,10 +12,15 @@
  */
 
 #include <rte_byteorder.h>
+#include <rte_cycles.h>
+#include <rte_pause.h>
+#include <rte_power_intrinsics.h>
 #include <rte_ethdev.h>
 #include <rte_ether.h>
 #include <rte_malloc.h>
 #include <rte_lcore.h>
+#include <rte_seqlock.h>
+#include <rte_ticketlock.h>
 #include <sstream>
 
 #include <doca_argp.h>
@@ -26,68 +31,1097 @@
 
 #include <arpa/inet.h>
 #include <pthread.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/queue.h>
 #include <atomic>
 
 #include <vector>
 #include <string>
 #include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include <functional>
 
 #include "dpdk_utils.h"
 #include "flow_common.h"
 
-#define NUM_PORTS 2
 #define MAX_FLOWS_PER_PORT 4096
+// Flow counters shared by all ports when the table size is not bounded otherwise,
+// see hairpin_table_configure()
+#define HAIRPIN_TABLE_SIZE 8000000
+// Entries a resizable hairpin pipe starts with
+#define TABLE_RESIZE_INITIAL_ENTRIES 65536
+// Occupancy, percent, at which a resizable hairpin pipe asks to grow, and the
+// occupancy it is grown to, doubling it
+#define TABLE_CONGESTION_PCT 80
+#define TABLE_RESIZE_CONGESTION_PCT 40
 #define PACKET_BURST_SZ 256
 
 // Duration before a flow is considered stale
 #define FLOW_TIMEOUT_SEC 5
 // Interval between calls to remove stale flows
 #define AGING_HANDLE_INTERVAL_SEC 5
+// Interval between stats prints on the main thread
+#define STATS_INTERVAL_SEC 5
+// Interval between pmd checks for the first hardware hit of new flows
+#define FIRST_HIT_CHECK_INTERVAL_US 1000
+// Max flows per pmd tracked at once for time-to-offload
+#define FIRST_HIT_TRACK_MAX 256
+// Time budget of a single aging handle call
+#define AGING_QUOTA_US 1000
+// Entries submitted per queue before collecting completions when adding in bulk
+#define HAIRPIN_BATCH_SZ 512
+// Burst of the insertion budget of a pmd, in ms of its rate
+#define INSERT_BUDGET_BURST_MS 10
+// Share of the insertion burst mice flows cannot take, left to the policy classes
+#define INSERT_MICE_RESERVE_PCT 25
+// entries_process calls made waiting for a batch before giving up on it
+#define BATCH_PROCESS_RETRIES 100
+// Longest the main thread blocks before checking for a stop request
+#define STOP_POLL_INTERVAL_MS 100
+// Startup phases timed for the boot report
+#define BOOT_PHASES_MAX 16
+// Default longest sleep of an idle pmd, bounded by the first hit check interval
+#define DEFAULT_IDLE_SLEEP_US FIRST_HIT_CHECK_INTERVAL_US
+// Hairpin queues from each port to each port, itself included
+#define HAIRPIN_Q_PER_PORT_PAIR 2
+// Connection slots tracked by the affinity check, a power of two
+#define AFFINITY_TABLE_SIZE (1 << 20)
+
+#define METRICS_SOCK_PATH_LEN 108
+
+// Defaults of the software flow backend model
+#define SIM_DEFAULT_TABLE_SIZE (1 << 20)
+#define SIM_DEFAULT_QUEUE_DEPTH 1024
+#define SIM_DEFAULT_LATENCY_US 10
+
+// Synthetic flow churn, see churn.cpp
+struct churn_cfg {
+    // new flows per second, 0 to disable the generator
+    uint32_t rate;
+    // flows per second added to the rate after each sustained step, 0 for a fixed rate
+    uint32_t step;
+    // mean flow lifetime, exponentially distributed
+    uint32_t lifetime_ms;
+    uint32_t pkts_per_flow;
+};
+
+#define CHURN_DEFAULT_LIFETIME_MS 1000
+#define CHURN_DEFAULT_PKTS_PER_FLOW 10
+
+// Egress ports of the flows received on a port. Each flow is pinned to one of
+// them by weighted rendezvous hashing of its 5-tuple, see fwd_select_egress().
+struct fwd_rule {
+    uint8_t nb_egress;
+    uint8_t egress_port[MAX_PORTS];
+    uint16_t weight[MAX_PORTS];
+};
+
+// Hardware meter applied to offloaded flows, see meter.cpp
+struct meter_profile {
+    // committed information rate, bytes per second, and committed burst size, bytes
+    uint64_t cir;
+    uint64_t cbs;
+    // a meter of its own for every flow, rather than one per ingress port shared by the class
+    bool per_flow;
+};
+
+// Meter profiles are numbered from 1, 0 means no meter
+#define MAX_METER_PROFILES 16
+// Per-flow meters available on each port when a per-flow profile is configured
+#define METER_FLOWS_PER_PORT (1 << 16)
+
+// Trusted aggregate of flows offloaded by a single masked rule, see aggregate.cpp
+struct aggregate_rule {
+    uint8_t port_in;
+    uint8_t port_out;
+    // network order, masked to the prefix length, 0 for any
+    doca_be32_t src_ip;
+    doca_be32_t dst_ip;
+    uint8_t src_prefix;
+    uint8_t dst_prefix;
+    // inclusive L4 port ranges, host order
+    uint16_t src_port_min;
+    uint16_t src_port_max;
+    uint16_t dst_port_min;
+    uint16_t dst_port_max;
+    // wildcarded bits of the 5-tuple; the lowest priority wins in hardware, so
+    // narrower rules take precedence where rules overlap
+    uint16_t priority;
+};
+
+#define MAX_AGGREGATES 64
+
+// Source prefixes the blocklist pipe of each port holds, see blocklist.cpp
+#define BLOCKLIST_MAX_PREFIXES (1 << 21)
+
+// Sampled mirroring, see sample.cpp. The rate is a power of two matched
+// against the 16-bit random value the NIC draws for each packet.
+#define SAMPLE_RATE_MAX (1 << 15)
+// Mirrored packets queued in software when the flow backend is simulated
+#define SAMPLE_RING_SIZE 4096
+// Sleep of the sampler lcore when it found no packet, it runs at low priority
+#define SAMPLE_IDLE_SLEEP_US 1000
+
+// Flow record export, see flow_export.cpp. Records of removed entries queued
+// by the pmds and the main thread until the exporter thread encodes them.
+#define EXPORT_RING_SIZE (1 << 16)
+// Records the exporter dequeues at once
+#define EXPORT_BURST_SZ 256
+// Default interval between the records of a flow which stays installed
+#define EXPORT_DEFAULT_ACTIVE_TIMEOUT_SEC 60
+// Largest IPFIX message, fits a UDP datagram without fragmenting
+#define EXPORT_MSG_MAX 1400
+// Messages sent with a single sendmmsg()
+#define EXPORT_BATCH_MSGS 32
+// Interval between template sets resent to a UDP collector
+#define EXPORT_TEMPLATE_INTERVAL_SEC 30
+// Sleep of the exporter thread when there was nothing to export
+#define EXPORT_IDLE_SLEEP_US 10000
+
+// Eviction of the slowest flows from a hairpin table filling up, see evict.cpp
+#define EVICT_INTERVAL_MS 1000
+// Flows younger than this are never evicted, their rate is not known yet
+#define EVICT_MIN_AGE_SEC 1
+// Most flows evicted from a port per interval
+#define EVICT_BATCH_MAX (1 << 16)
+// Evictions handed to each pmd, which owns the entries
+#define EVICT_RING_SIZE (1 << 16)
+// Most evictions a pmd submits per poll
+#define EVICT_BURST_SZ 64
+
+// Slow path capture, see capture.cpp. Copies queued by each pmd for the writer thread.
+#define CAPTURE_RING_SIZE 4096
+// Copies in flight between the pmds and the writer thread
+#define CAPTURE_POOL_SIZE 16383
+#define CAPTURE_DEFAULT_SNAPLEN 256
+// Longest copy, a single segment of the capture pool
+#define CAPTURE_SNAPLEN_MAX RTE_MBUF_DEFAULT_DATAROOM
+// Sleep of the writer thread when it found no copy to write
+#define CAPTURE_IDLE_SLEEP_US 1000
+
+// Who decides whether a new flow is allowed
+enum verdict_mode {
+    VERDICT_INLINE,  // allow_offload() on the pmd, per packet
+    VERDICT_CONSOLE, // an operator on stdin, asynchronously, see verdict.cpp
+};
+
+enum flow_backend_type {
+    FLOW_BACKEND_DOCA, // DOCA Flow on a BlueField/ConnectX port
+    FLOW_BACKEND_SIM,  // in-memory simulator, for ports without flow offload
+};
+
+// Model of the simulated flow backend
+struct sim_backend_cfg {
+    // hairpin entries each port can hold
+    uint32_t table_size;
+    // operations in flight per pipe queue before submissions are rejected
+    uint32_t queue_depth;
+    // time from pushing an operation to its completion being available
+    uint32_t latency_us;
+};
+
+// Sizing of the hairpin pipes, see hairpin_table_configure()
+struct hairpin_table_cfg {
+    // entries each hairpin pipe may hold, with a flow counter reserved for each;
+    // 0 until derived from the rest of the configuration
+    uint32_t max_entries;
+    // entries each hairpin pipe starts with, max_entries unless resizable
+    uint32_t initial_entries;
+    // start small and grow as the pipes fill up
+    bool resizable;
+};
+
+// Application configuration, filled by the argp callbacks
+struct selective_fwd_cfg {
+    // TCP port of the metrics endpoint on localhost, 0 to disable
+    uint16_t metrics_port;
+    // UNIX socket path of the metrics endpoint, empty to disable
+    char metrics_sock[METRICS_SOCK_PATH_LEN];
+    // consecutive empty polls before a pmd starts backing off, 0 to always busy poll
+    uint32_t idle_threshold;
+    // longest a backed off pmd sleeps before polling again
+    uint32_t idle_sleep_us;
+    // hardware rule operations each pmd may submit per second, 0 for no limit
+    uint32_t insert_budget;
+    struct hairpin_table_cfg table;
+    // hairpin table occupancy, percent, past which the slowest flows are evicted
+    // down to the low watermark; 0 high watermark to disable
+    uint8_t evict_high_pct;
+    uint8_t evict_low_pct;
+    // sleep on Rx queue interrupts instead of monitor/pause when idle
+    bool rx_intr;
+    // set up the ports and create their static pipes concurrently
+    bool parallel_init;
+    // share the counters and flows with secondary processes, which take over the stats
+    bool multi_process;
+    // check that both directions of each connection land on the same lcore
+    bool verify_affinity;
+    // flow table snapshot, saved on shutdown and replayed on startup
+    char flow_snapshot[PATH_MAX];
+    // replay this many synthetic flows, report the time to offload them and exit
+    uint32_t replay_bench_flows;
+    enum flow_backend_type flow_backend;
+    struct sim_backend_cfg sim;
+    // stop after this many seconds of forwarding, 0 to run until signalled
+    uint32_t duration_sec;
+    // write the counters of the run as JSON on exit, "-" for stdout
+    char results_json[PATH_MAX];
+    struct churn_cfg churn;
+    enum verdict_mode verdict;
+    // UNIX socket path of the bulk provisioning API, empty to disable
+    char provision_sock[METRICS_SOCK_PATH_LEN];
+    // ports forwarded between, ports 0 to nb_ports - 1
+    uint16_t nb_ports;
+    // egress ports of the flows received on each port, unless their verdict names another
+    struct fwd_rule fwd_table[MAX_PORTS];
+    struct meter_profile meter_profiles[MAX_METER_PROFILES];
+    uint8_t nb_meter_profiles;
+    // profile of the flows whose verdict names none, 0 for none
+    uint8_t default_meter;
+    // aggregates a verdict may offload instead of a flow of theirs
+    struct aggregate_rule aggregates[MAX_AGGREGATES];
+    uint16_t nb_aggregates;
+    // source prefixes dropped by the NIC, reloaded on SIGHUP
+    char blocklist[PATH_MAX];
+    // load this many synthetic prefixes, report the time to load them and exit
+    uint32_t blocklist_bench_prefixes;
+    // mirror 1 in sample_rate packets of the offloaded flows to the sampler lcore, 0 for none
+    uint32_t sample_rate;
+    // IPFIX collector of the flow records, udp:<address>:<port> or a file path, empty to disable
+    char flow_export[PATH_MAX];
+    // interval between the records of a flow which stays installed
+    uint32_t export_active_timeout_sec;
+    // UNIX socket path of the capture control, empty to disable
+    char capture_sock[METRICS_SOCK_PATH_LEN];
+};
+
+// Per-lcore data path counters. Each block is only ever written by the lcore
+// owning it, so plain increments are enough; the main thread reads them when
+// aggregating.
+struct lcore_metrics {
+    uint64_t rx_pkts;
+    uint64_t rx_bytes;
+    uint64_t tx_pkts;
+    uint64_t drops;
+    uint64_t parse_errors;
+    uint64_t inserts;
+    uint64_t insert_fails;
+    // TSC cycles spent in add_hairpin_pipe_entry()
+    uint64_t insert_cycles;
+    // new flows forwarded in software because the insertion budget of their class ran out,
+    // or their hairpin table was full
+    uint64_t insert_deferrals;
+    // entries removed to make room in a hairpin table nearing capacity
+    uint64_t evictions;
+    uint64_t polls;
+    uint64_t empty_polls;
+    // times the pmd went to sleep after being idle
+    uint64_t sleeps;
+    // TSC cycles spent in loop iterations which did or did not receive packets
+    uint64_t busy_cycles;
+    uint64_t idle_cycles;
+    // packets which hit an entry of the simulated backend and were hairpinned in software
+    uint64_t emulated_hits;
+    // of those, packets marked red by their meter or blocklisted, which the pmd dropped
+    uint64_t emulated_drops;
+    // new flows offloaded by an aggregate rule rather than an entry of their own
+    uint64_t aggregated_flows;
+    // mirrored packets of offloaded flows inspected by the sampler lcore
+    uint64_t sampled_pkts;
+    uint64_t sampled_bytes;
+    // records of removed entries queued for export, and those lost to a full export ring
+    uint64_t flow_records;
+    uint64_t flow_record_drops;
+    // slow path packets copied for the capture, and those lost to a full ring or pool
+    uint64_t captured_pkts;
+    uint64_t capture_drops;
+    // packets of a connection whose other packets were received by another lcore
+    uint64_t affinity_violations;
+    // new flows handed to the verdict control thread, and those it never answered in time
+    uint64_t verdict_requests;
+    uint64_t verdict_timeouts;
+    // packets dropped because their flow's hold queue or the pending flow table was full
+    uint64_t verdict_hold_drops;
+} __rte_cache_aligned;
+
+// RTE_MAX_LCORE blocks, process memory unless moved by metrics_relocate()
+extern struct lcore_metrics* lcore_metrics;
+
+// Log-linear (HDR style) histogram of TSC cycles. Values below
+// LAT_HIST_SUB_BUCKETS get exact buckets, larger values get LAT_HIST_SUB_BUCKETS
+// buckets per power of two, which bounds the relative error to ~6%.
+#define LAT_HIST_SUB_BITS 4
+#define LAT_HIST_SUB_BUCKETS (1 << LAT_HIST_SUB_BITS)
+#define LAT_HIST_MAX_BITS 42
+#define LAT_HIST_BUCKETS ((LAT_HIST_MAX_BITS - LAT_HIST_SUB_BITS + 1) * LAT_HIST_SUB_BUCKETS)
+
+struct latency_hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t buckets[LAT_HIST_BUCKETS];
+};
+
+static inline uint32_t
+latency_hist_bucket(uint64_t cycles)
+{
+    if (cycles < LAT_HIST_SUB_BUCKETS)
+        return cycles;
+    uint32_t msb = 63 - __builtin_clzll(cycles);
+    if (msb >= LAT_HIST_MAX_BITS)
+        return LAT_HIST_BUCKETS - 1;
+    uint32_t sub = (cycles >> (msb - LAT_HIST_SUB_BITS)) & (LAT_HIST_SUB_BUCKETS - 1);
+    return ((msb - LAT_HIST_SUB_BITS + 1) << LAT_HIST_SUB_BITS) + sub;
+}
+
+static inline void
+latency_hist_record(struct latency_hist* hist, uint64_t cycles)
+{
+    hist->buckets[latency_hist_bucket(cycles)]++;
+    hist->sum += cycles;
+    hist->count++;
+}
+
+// Per-lcore latency histograms, written only by the owning lcore
+struct lcore_latency {
+    // add_hairpin_pipe_entry() submit to completion
+    struct latency_hist insert;
+    // aged entry removal submit to completion
+    struct latency_hist remove;
+    // first packet of a flow seen by the pmd to first hardware hit
+    struct latency_hist offload;
+    // new flow published to the verdict control thread to its verdict applied
+    struct latency_hist verdict;
+} __rte_cache_aligned;
+
+extern struct lcore_latency lcore_latency[RTE_MAX_LCORE];
+
+uint64_t latency_hist_percentile(const struct latency_hist* hist, double percentile);
+
+struct flow_ctx;
+TAILQ_HEAD(flow_ctx_list, flow_ctx);
+
+// How an idle pmd waits for traffic once past the idle threshold
+enum pmd_sleep_mode {
+    PMD_SLEEP_PAUSE,   // rte_pause() spin
+    PMD_SLEEP_TPAUSE,  // rte_power_pause(), TPAUSE
+    PMD_SLEEP_MONITOR, // rte_power_monitor_multi() on the Rx descriptors, UMWAIT
+    PMD_SLEEP_RX_INTR, // epoll on the Rx queue interrupts
+};
+
+// Priority classes of the hardware rule operations of a pmd, highest first
+enum insert_class {
+    // removals of aged entries, never held back as they free table space
+    INSERT_REMOVE,
+    // flows with a meter profile or an explicit verdict
+    INSERT_POLICY,
+    // every other new flow
+    INSERT_MICE,
+};
+
+// Token bucket of the hardware rule operations of a pmd, one token each
+struct insert_budget {
+    // operations per second, 0 for no limit
+    double rate;
+    double burst;
+    // below 0 after removals borrowed from the refill
+    double tokens;
+    uint64_t last_tsc;
+};
 
 struct pmd_params_t {
     struct application_dpdk_config* app_cfg;
+    struct selective_fwd_cfg* fwd_cfg;
     // rx queue, tx queue, and doca pipe queue
     uint16_t queue_id;
     struct doca_flow_port** ports;
     struct doca_flow_pipe** hairpin_pipes;
+    // counters of the lcore running this pmd
+    struct lcore_metrics* metrics;
+    struct lcore_latency* latency;
+    // flows whose first hardware hit has not been seen yet
+    struct flow_ctx_list awaiting_hit;
+    uint32_t nb_awaiting_hit;
+    // adaptive polling state
+    enum pmd_sleep_mode sleep_mode;
+    uint32_t empty_polls;
+    // the flow backend does not steer hits in hardware, look them up in software
+    bool emulated_hits;
+    bool verify_affinity;
+    // new flows wait for an asynchronous verdict, NULL to decide inline
+    struct verdict_queue* verdict;
+    struct insert_budget budget;
+};
+
+// 5-tuple of an offloaded flow, in network byte order as matched by the hairpin pipe
+struct flow_key {
+    doca_be32_t src_ip;
+    doca_be32_t dst_ip;
+    doca_be16_t src_port;
+    doca_be16_t dst_port;
+};
+
+struct flow_key_hash {
+    size_t operator()(const struct flow_key& key) const
+    {
+        uint64_t hash = ((uint64_t)key.src_ip << 32 | key.dst_ip) * 0x9e3779b97f4a7c15ULL;
+
+        hash ^= ((uint64_t)key.src_port << 16 | key.dst_port) * 0xc2b2ae3d27d4eb4fULL;
+        return hash ^ (hash >> 31);
+    }
+};
+
+struct flow_key_equal {
+    bool operator()(const struct flow_key& a, const struct flow_key& b) const
+    {
+        return a.src_ip == b.src_ip && a.dst_ip == b.dst_ip &&
+               a.src_port == b.src_port && a.dst_port == b.dst_port;
+    }
+};
+
+// Kind of user context of an entry, so the entry process callback tells them apart
+enum entry_kind {
+    ENTRY_FLOW,
+    // a prefix of the blocklist, see blocklist.cpp
+    ENTRY_BLOCKLIST,
+};
+
+// Per-flow context, passed as the user context of hairpin entries
+struct flow_ctx {
+    // must be first, check_for_valid_entry() casts the user context to it
+    struct entries_status status;
+    // must follow status, every user context starts with both
+    enum entry_kind kind;
+    struct doca_flow_pipe_entry* entry;
+    // pmd which inserted the entry, NULL for entries added by the main thread
+    struct pmd_params_t* owner;
+    struct flow_key key;
+    uint8_t port_in;
+    uint8_t port_out;
+    // hit count and TSC of the last time it changed, sampled by the main thread
+    uint64_t last_pkts;
+    uint64_t last_active_tsc;
+    // TSC of the first packet of the flow seen by the pmd
+    uint64_t first_pkt_tsc;
+    // TSC at which the removal of the entry was submitted, written by the
+    // thread owning the entry and read by the walks of the other threads with
+    // relaxed atomics
+    uint64_t remove_tsc;
+    // set once installed by PipeMgr::add_entry(), unique over the run, so a
+    // context is told from a later one reusing its memory
+    uint64_t generation;
+    // the insertion was given up on before its completion arrived
+    bool orphaned;
+    bool awaiting_hit;
+    // added through the provisioning socket, see provision.cpp
+    bool provisioned;
+    // meter profile given by the verdict, and the meter it got, see meter.cpp
+    uint8_t meter_profile;
+    uint32_t meter_id;
+    // TSC of the last record exported while the flow stays installed, only
+    // touched by the exporter thread
+    uint64_t exported_tsc;
+    // hit count and TSC of the last eviction sample, only touched by the main thread
+    uint64_t evict_pkts;
+    uint64_t evict_tsc;
+    TAILQ_ENTRY(flow_ctx) hit_link;
+};
+
+uint8_t fwd_select_egress(const struct selective_fwd_cfg* cfg, int port_id_in, const struct flow_key* key);
+
+// Set by SIGINT/SIGTERM, the main thread and the workers exit their loops
+extern std::atomic<bool> force_quit;
+
+// Where a hairpin entry sends the packets of its flow
+struct hairpin_fwd {
+    int port_id_out;
+    uint16_t base_hairpin_q;
+    uint8_t hairpin_q_len;
+    // with meters configured: the meter of the flow, and the pipe which drops
+    // its red packets and hairpins the others; NULL color_pipe otherwise
+    uint32_t meter_id;
+    struct doca_flow_pipe* color_pipe;
+    // with sampling configured: the pipe mirroring some packets before they
+    // go on, to the color pipe when metered; NULL otherwise
+    struct doca_flow_pipe* sample_pipe;
 };
 
 int start_pmd(void *pmd_params);
+void affinity_init(const struct selective_fwd_cfg* cfg);
+void affinity_fini(void);
+
+bool insert_budget_take(struct pmd_params_t* params, enum insert_class insert_class);
+
+doca_error_t offload_flow(struct rte_mbuf* pkt, int port_id_in, int port_id_out, uint8_t meter_profile, uint64_t first_pkt_tsc,
+                          struct pmd_params_t* params);
+
+doca_error_t verdict_init(enum verdict_mode mode, uint16_t nb_pmds, uint16_t nb_ports, uint8_t nb_meter_profiles);
+void verdict_fini(void);
+struct verdict_queue* verdict_queue_get(uint16_t queue_id);
+void verdict_hold(struct pmd_params_t* params, struct rte_mbuf* pkt, const struct flow_key* key,
+                  int port_id_in, uint64_t rx_tsc);
+void verdict_poll(struct pmd_params_t* params, uint64_t now);
+void verdict_pmd_stop(struct pmd_params_t* params);
+
+// Pipe queue ownership: pmd i owns pipe queue i on every port, the same index
+// as its Rx and Tx queues, and the main thread owns the one after the last
+// pmd. Entries are only ever submitted, completed and aged by their owner.
+// With --multi-process the main lcore runs a pmd too, and the duties of the
+// main thread, this queue included, move to a control thread.
+static inline uint16_t
+main_pipe_queue(const struct application_dpdk_config* app_cfg)
+{
+    return app_cfg->port_config.nb_queues;
+}
+
+static inline uint16_t
+nb_pipe_queues(const struct application_dpdk_config* app_cfg)
+{
+    return app_cfg->port_config.nb_queues + 1;
+}
+
+void
+pmd_entry_process_cb(struct doca_flow_pipe_entry* entry,
+                     uint16_t pipe_queue,
+                     enum doca_flow_entry_status status,
+                     enum doca_flow_entry_op op,
+                     void* user_ctx);
+
+doca_error_t
+wait_entry_processed(struct doca_flow_port* port, uint16_t pipe_queue, const struct entries_status* status);
 
 doca_error_t
-add_hairpin_pipe_entry(struct doca_flow_port* ports[NUM_PORTS],
+add_hairpin_pipe_entry(struct doca_flow_port* ports[MAX_PORTS],
                        int port_id_in,
-                       uint16_t base_hairpin_q,
-                       uint8_t hairpin_q_len,
+                       const struct hairpin_fwd* fwd,
                        struct doca_flow_pipe* pipe,
                        doca_be32_t dst_ip_addr,
                        doca_be32_t src_ip_addr,
                        doca_be16_t dst_port,
                        doca_be16_t src_port,
-                       uint8_t pipe_queue,
+                       uint16_t pipe_queue,
                        struct entries_status* status,
                        struct doca_flow_pipe_entry **entry);
 
+doca_error_t
+hairpin_fwd_prepare(struct application_dpdk_config* app_cfg, struct flow_ctx* ctx, struct hairpin_fwd* fwd);
+
+void flow_ctx_free(struct flow_ctx* ctx);
+
+doca_error_t
+add_hairpin_pipe_entries(struct application_dpdk_config* app_cfg,
+                         struct doca_flow_port* ports[MAX_PORTS],
+                         struct doca_flow_pipe* hairpin_pipes[MAX_PORTS],
+                         uint16_t pipe_queue,
+                         struct flow_ctx* ctxs[],
+                         uint32_t nb_flows,
+                         uint32_t* nb_failed);
+
+void hairpin_table_configure(struct selective_fwd_cfg* cfg, const struct application_dpdk_config* app_cfg);
+
 doca_error_t
 configure_static_pipes(struct application_dpdk_config* app_cfg,
-                       struct doca_flow_port* ports[NUM_PORTS],
-                       struct doca_flow_pipe* hairpin_pipes[NUM_PORTS]);
+                       struct doca_flow_port* ports[MAX_PORTS],
+                       struct doca_flow_pipe* hairpin_pipes[MAX_PORTS]);
+
+void
+handle_pipe_queue_aging(struct doca_flow_port* ports[MAX_PORTS], uint16_t nb_ports, uint16_t pipe_queue);
+
+void flush_pipes(struct doca_flow_port* ports[MAX_PORTS], uint16_t nb_ports);
+
+void print_stats(bool log);
+
+// On-disk record of an offloaded flow, see flow_snapshot.cpp
+struct flow_snapshot_record {
+    doca_be32_t src_ip;
+    doca_be32_t dst_ip;
+    doca_be16_t src_port;
+    doca_be16_t dst_port;
+    uint8_t port_in;
+    uint8_t port_out;
+    // seconds left before the flow would have aged out
+    uint16_t remaining_age_sec;
+    uint8_t meter_profile;
+    uint8_t reserved;
+} __attribute__((packed));
+
+// Why a flow record was emitted, as IPFIX flowEndReason
+enum flow_end_reason {
+    FLOW_END_IDLE_TIMEOUT = 1,
+    FLOW_END_ACTIVE_TIMEOUT = 2,
+    // removed through the provisioning socket
+    FLOW_END_DETECTED = 3,
+    // still installed at exit
+    FLOW_END_FORCED = 4,
+    // evicted from a hairpin table nearing capacity
+    FLOW_END_LACK_OF_RESOURCES = 5,
+};
+
+// Flow record on its way to the exporter thread, see flow_export.cpp
+struct flow_record {
+    struct flow_key key;
+    uint8_t port_in;
+    uint8_t port_out;
+    uint8_t end_reason;
+    uint8_t reserved;
+    // TSC of the first and last packets of the flow
+    uint64_t first_tsc;
+    uint64_t last_tsc;
+    // hardware counters of the entry since it was added
+    uint64_t pkts;
+    uint64_t bytes;
+};
+
+// Provisioning socket wire format, see provision.cpp. Integers are in host
+// order, addresses and L4 ports in network order as matched by the hairpin pipe.
+#define PROVISION_MAGIC 0x56504653 /* "SFPV" */
+#define PROVISION_VERSION 2
+#define PROVISION_MAX_RECORDS (1 << 16)
+#define PROVISION_PORT_DEFAULT 0xff
+#define PROVISION_METER_NONE 0xff
+
+enum provision_op {
+    PROVISION_OP_ADD = 1,
+    PROVISION_OP_REMOVE = 2,
+    PROVISION_OP_QUERY = 3,
+};
+
+struct provision_hdr {
+    uint32_t magic;
+    uint8_t version;
+    // enum provision_op, echoed in the reply
+    uint8_t op;
+    uint16_t reserved;
+    // records following the header, or results following the reply
+    uint32_t nb_records;
+    // reply only: doca_error_t of the request, DOCA_ERROR_BAD_STATE when some records failed
+    int32_t status;
+} __attribute__((packed));
+
+struct provision_record {
+    doca_be32_t src_ip;
+    doca_be32_t dst_ip;
+    doca_be16_t src_port;
+    doca_be16_t dst_port;
+    uint8_t port_in;
+    // egress port, PROVISION_PORT_DEFAULT for the forwarding table's
+    uint8_t port_out;
+    // meter profile, 0 for the default one, PROVISION_METER_NONE for none
+    uint8_t meter;
+    uint8_t reserved;
+} __attribute__((packed));
+
+struct provision_result {
+    // doca_error_t of the record
+    int32_t status;
+    uint32_t reserved;
+    // hit counters, query only
+    uint64_t pkts;
+    uint64_t bytes;
+} __attribute__((packed));
+
+doca_error_t provision_server_init(struct selective_fwd_cfg* cfg,
+                                   struct application_dpdk_config* app_cfg,
+                                   struct doca_flow_port* ports[MAX_PORTS],
+                                   struct doca_flow_pipe* hairpin_pipes[MAX_PORTS]);
+int provision_server_fd(void);
+void provision_server_accept(void);
+void provision_server_fini(void);
+void provision_forget(struct flow_ctx* ctx);
+
+doca_error_t flow_snapshot_save(const char* path);
+doca_error_t flow_snapshot_replay(const char* path,
+                                  struct application_dpdk_config* app_cfg,
+                                  struct doca_flow_port* ports[MAX_PORTS],
+                                  struct doca_flow_pipe* hairpin_pipes[MAX_PORTS]);
+doca_error_t flow_replay_bench(uint32_t nb_flows,
+                               struct selective_fwd_cfg* fwd_cfg,
+                               struct application_dpdk_config* app_cfg,
+                               struct doca_flow_port* ports[MAX_PORTS],
+                               struct doca_flow_pipe* hairpin_pipes[MAX_PORTS]);
+
+doca_error_t register_selective_fwd_params(void);
+bool parse_ipv4_prefix(const char* str, doca_be32_t* addr, uint8_t* prefix);
+
+doca_error_t metrics_server_init(struct selective_fwd_cfg* cfg);
+int metrics_server_fd(void);
+void metrics_server_accept(void);
+void metrics_server_fini(void);
+void metrics_aggregate(struct lcore_metrics* total);
+void metrics_relocate(struct lcore_metrics* blocks);
+void metrics_print_rates(double interval_sec);
+doca_error_t metrics_write_json(const char* path, double elapsed_sec);
+double metrics_latency_percentile_us(size_t offset, double percentile);
+
+doca_error_t meter_init(const struct selective_fwd_cfg* cfg, uint16_t nb_ports);
+uint32_t meter_count(void);
+doca_error_t meter_configure(struct doca_flow_port* ports[MAX_PORTS], uint16_t nb_ports);
+doca_error_t meter_alloc(int port_id, uint8_t profile, uint32_t* meter_id);
+void meter_free(int port_id, uint32_t meter_id);
+
+doca_error_t aggregate_init(struct selective_fwd_cfg* cfg, uint16_t nb_ports);
+uint16_t aggregate_count(void);
+doca_be32_t aggregate_prefix_mask(uint8_t prefix);
+bool aggregate_contains(const struct aggregate_rule* rule, const struct flow_key* key);
+doca_error_t aggregate_pipe_create(struct doca_flow_port* port,
+                                   int port_id,
+                                   struct doca_flow_pipe* pipe_fwd_miss,
+                                   struct doca_flow_pipe** pipe);
+bool aggregate_offload(struct pmd_params_t* params,
+                       int port_id_in,
+                       int port_id_out,
+                       uint8_t meter_profile,
+                       const struct flow_key* key);
+
+doca_error_t blocklist_init(const struct selective_fwd_cfg* cfg,
+                            struct application_dpdk_config* app_cfg,
+                            struct doca_flow_port* ports[MAX_PORTS]);
+bool blocklist_enabled(void);
+doca_error_t blocklist_pipe_create(struct doca_flow_port* port, int port_id, uint16_t pipe_queue,
+                                   struct doca_flow_pipe* pipe_fwd_miss);
+doca_error_t blocklist_load(void);
+void blocklist_request_reload(void);
+void blocklist_poll(void);
+doca_error_t blocklist_bench(uint32_t nb_prefixes);
+void blocklist_entry_process(struct doca_flow_pipe_entry* entry,
+                             enum doca_flow_entry_status status,
+                             enum doca_flow_entry_op op,
+                             void* user_ctx);
+void blocklist_fini(void);
+
+// Key of an IPv4 prefix: its length above its masked address, host order
+static inline uint64_t
+blocklist_prefix_key(doca_be32_t addr, uint8_t prefix)
+{
+    return (uint64_t)prefix << 32 | rte_be_to_cpu_32(addr & aggregate_prefix_mask(prefix));
+}
+
+doca_error_t sample_init(const struct selective_fwd_cfg* cfg, struct application_dpdk_config* app_cfg);
+uint32_t sample_rate(void);
+doca_error_t sample_configure(struct doca_flow_port* ports[MAX_PORTS], uint16_t nb_ports);
+void sample_mirror(struct rte_mbuf* pkt);
+int start_sampler(void* arg);
+void sample_fini(void);
+
+// What the pmd did with a captured packet, commented in the capture
+enum capture_verdict {
+    CAPTURE_PARSE_ERROR,
+    CAPTURE_DENIED,
+    CAPTURE_HELD,
+    CAPTURE_OFFLOADED,
+    CAPTURE_OFFLOAD_FAILED,
+    // forwarded in software, the insertion budget ran out
+    CAPTURE_DEFERRED,
+};
+
+// Set while a capture runs, checked by the pmds before anything else
+extern std::atomic<bool> capture_on;
+
+static inline bool
+capture_enabled(void)
+{
+    return capture_on.load(std::memory_order_relaxed);
+}
 
-void print_stats();
+doca_error_t capture_init(const struct selective_fwd_cfg* cfg, const struct application_dpdk_config* app_cfg);
+int capture_server_fd(void);
+void capture_server_accept(void);
+struct rte_mbuf* capture_copy(struct pmd_params_t* params,
+                              struct rte_mbuf* pkt,
+                              int port_id_in,
+                              const struct flow_key* key,
+                              uint64_t rx_tsc);
+void capture_commit(struct pmd_params_t* params, struct rte_mbuf* copy, enum capture_verdict verdict);
+void capture_packet(struct pmd_params_t* params,
+                    struct rte_mbuf* pkt,
+                    int port_id_in,
+                    const struct flow_key* key,
+                    uint64_t rx_tsc,
+                    enum capture_verdict verdict);
+void capture_fini(void);
+
+doca_error_t evict_init(const struct selective_fwd_cfg* cfg,
+                        struct application_dpdk_config* app_cfg,
+                        struct doca_flow_port* ports[MAX_PORTS]);
+uint32_t hairpin_capacity(void);
+void evict_poll(uint64_t now);
+void evict_pmd_poll(struct pmd_params_t* params);
+void evict_fini(void);
+
+doca_error_t flow_export_init(const struct selective_fwd_cfg* cfg);
+void flow_record_fill(struct flow_record* record,
+                      const struct flow_ctx* ctx,
+                      const struct doca_flow_resource_query* query,
+                      enum flow_end_reason reason,
+                      uint64_t now);
+void flow_export_prepare(const struct flow_ctx* ctx, enum flow_end_reason reason, struct flow_record* record);
+void flow_export_removed(const struct flow_record* record);
+void flow_export_fini(void);
+
+doca_error_t churn_ports_create(const struct churn_cfg* cfg, uint16_t nb_ports, uint16_t nb_queues);
+void churn_ports_destroy(void);
+void churn_start(void);
+void churn_poll(uint64_t deadline);
+void churn_report(void);
+
+// Shared memzones and command ring of the multi-process mode, see shm.cpp
+#define SHM_METRICS_MZ "SFWD_METRICS"
+#define SHM_FLOWS_MZ "SFWD_FLOWS"
+#define SHM_CTRL_RING "SFWD_CTRL"
+#define SHM_CTRL_RING_SIZE 64
+// Most flows published at once to secondary processes
+#define SHM_FLOWS_MAX (1 << 16)
+
+// Counters of the primary process, read by secondary processes. Each lcore
+// still writes its own block alone and readers load the aligned 64-bit
+// counters one at a time, like a metrics scrape does, so no side locks.
+struct shm_metrics {
+    uint64_t tsc_hz;
+    // cleared when the primary exits
+    volatile bool running;
+    // lcore id the control thread registered as, RTE_MAX_LCORE until then
+    uint32_t control_lcore;
+    // lcores of the primary, the control thread included once registered
+    uint32_t nb_lcores;
+    uint32_t lcore_ids[RTE_MAX_LCORE];
+    struct lcore_metrics lcores[RTE_MAX_LCORE];
+};
+
+// Installed flow as published to secondary processes
+struct shm_flow {
+    doca_be32_t src_ip;
+    doca_be32_t dst_ip;
+    doca_be16_t src_port;
+    doca_be16_t dst_port;
+    uint16_t port_in;
+    uint16_t port_out;
+    uint8_t meter_profile;
+    bool provisioned;
+    // seconds since the flow was last seen hit
+    uint32_t idle_sec;
+    uint64_t pkts;
+    uint64_t bytes;
+};
+
+// Flows published by the main thread when a secondary asks for them. The
+// main thread is the only writer; readers retry their copy when the sequence
+// number moved meanwhile, so they never hold it up.
+struct shm_flows {
+    rte_seqlock_t lock;
+    // bumped by every publication
+    uint64_t generation;
+    uint64_t tsc;
+    // installed flows, of which the first nb_flows are published
+    uint32_t nb_total;
+    uint32_t nb_flows;
+    struct shm_flow flows[SHM_FLOWS_MAX];
+};
+
+// Commands of secondary processes, one uint32_t per command ring element
+enum shm_command {
+    SHM_CMD_PUBLISH_FLOWS,
+    SHM_CMD_RELOAD_BLOCKLIST,
+    SHM_CMD_STOP,
+};
+
+doca_error_t shm_init(const struct selective_fwd_cfg* cfg);
+bool shm_enabled(void);
+void shm_add_control_lcore(uint32_t lcore_id);
+void shm_poll(void);
+void shm_fini(void);
+
+// Most entries printed one by one by PipeMgr::print_stats()
+#define PRINT_ENTRIES_MAX 32
+// Entries a walk of the flow table visits per hold of its lock
+#define PIPE_MGR_WALK_CHUNK 256
+
+// Installed flow the eviction may remove, see evict.cpp
+struct evict_candidate {
+    // packets per second since the last sample
+    double rate;
+    struct doca_flow_pipe_entry* entry;
+    struct flow_ctx* ctx;
+    uint64_t generation;
+    // pmd owning the entry, NULL for the main thread
+    struct pmd_params_t* owner;
+};
+
+// FIFO spinlock: a walker taking it again between two chunks queues up behind
+// the pmds already waiting for it
+class TicketLock {
+private:
+    rte_ticketlock_t tl;
+
+public:
+    TicketLock() { rte_ticketlock_init(&tl); }
+    void lock() { rte_ticketlock_lock(&tl); }
+    void unlock() { rte_ticketlock_unlock(&tl); }
+};
 
 class PipeMgr {
 private:
-    std::vector<std::pair<std::string, struct doca_flow_pipe_entry*>> entries;
+    // entries are added and removed by the pmds and walked by the main and exporter threads
+    TicketLock lock;
+    std::unordered_map<struct doca_flow_pipe_entry*, struct flow_ctx*> entries;
+    // entries of each port, read without the lock
+    std::atomic<uint32_t> nb_entries[MAX_PORTS];
+    // generation of the last context added, under the lock
+    uint64_t last_generation;
+
+    void walk(const std::function<bool(struct doca_flow_pipe_entry*, struct flow_ctx*)>& visit);
 
 public:
     PipeMgr();
     ~PipeMgr();
 
-    doca_error_t add_entry(std::string name, struct doca_flow_pipe_entry* entry);
+    doca_error_t add_entry(struct flow_ctx* ctx);
     doca_error_t remove_entry(struct doca_flow_pipe_entry* entry);
-    void print_stats();
+    void print_stats(bool log);
+    void collect_snapshot(std::vector<struct flow_snapshot_record>& records);
+    uint32_t collect_flows(std::vector<struct shm_flow>& flows, uint32_t max_flows);
+    uint32_t occupancy(int port_id) const { return nb_entries[port_id].load(std::memory_order_relaxed); }
+    bool contains(struct doca_flow_pipe_entry* entry, const struct flow_ctx* ctx, uint64_t generation);
+    void collect_evict(uint64_t now,
+                       const bool sampled_ports[MAX_PORTS],
+                       std::vector<struct evict_candidate> candidates[MAX_PORTS]);
+    void collect_export(uint64_t now,
+                        uint64_t interval,
+                        enum flow_end_reason reason,
+                        std::vector<struct flow_record>& records);
+};
+
+extern PipeMgr pipe_mgr;
+
+// Flow offload backend. Pipes, entries and ports are opaque handles to the
+// callers; the DOCA Flow backend passes them through, the simulator hands out
+// its own objects behind the same types. Completions and aging events are
+// delivered to the entry process callback given to init(), on the thread
+// calling entries_process() or aging_handle() for that pipe queue.
+class FlowBackend {
+public:
+    virtual ~FlowBackend() {}
+
+    virtual const char* name() const = 0;
+    // nb_meters shared meters, 0 to create the hairpin pipes without a meter;
+    // nb_mirrors shared mirrors, 0 to create them without sampling; table sizes
+    // the hairpin pipes of nb_ports ports
+    virtual doca_error_t init(uint16_t nb_rss_queues,
+                              uint16_t nb_pipe_queues,
+                              uint32_t nb_meters,
+                              uint32_t nb_mirrors,
+                              const struct hairpin_table_cfg* table,
+                              uint16_t nb_ports,
+                              doca_flow_entry_process_cb cb) = 0;
+    virtual void destroy() = 0;
+    virtual doca_error_t start_ports(uint16_t nb_ports, struct doca_flow_port* ports[MAX_PORTS]) = 0;
+    virtual void stop_ports(uint16_t nb_ports, struct doca_flow_port* ports[MAX_PORTS]) = 0;
+
+    // pipe with a match-all entry sending the traffic to the RSS queues
+    virtual doca_error_t create_rss_pipe(struct doca_flow_port* port,
+                                         uint16_t pipe_queue,
+                                         uint16_t nb_queues,
+                                         struct doca_flow_pipe** pipe) = 0;
+    // set the rate of a shared meter, and make a set of them usable on a port
+    virtual doca_error_t configure_meter(uint32_t meter_id, const struct meter_profile* profile) = 0;
+    virtual doca_error_t bind_meters(struct doca_flow_port* port, uint32_t* meter_ids, uint32_t nb_meters) = 0;
+    // pipe dropping red packets and hairpinning the others to the given queues
+    virtual doca_error_t create_color_pipe(struct doca_flow_port* port,
+                                           uint16_t pipe_queue,
+                                           uint16_t base_hairpin_q,
+                                           uint8_t hairpin_q_len,
+                                           struct doca_flow_pipe** pipe) = 0;
+    // set a shared mirror copying packets to an Rx queue, usable on a port
+    virtual doca_error_t configure_mirror(struct doca_flow_port* port, uint32_t mirror_id, uint16_t queue) = 0;
+    // pipe mirroring 1 in rate packets with a shared mirror, then sending all of
+    // them to next_pipe, or to the given hairpin queues when NULL
+    virtual doca_error_t create_sample_pipe(struct doca_flow_port* port,
+                                            uint16_t pipe_queue,
+                                            uint32_t mirror_id,
+                                            uint32_t rate,
+                                            uint16_t base_hairpin_q,
+                                            uint8_t hairpin_q_len,
+                                            struct doca_flow_pipe* next_pipe,
+                                            struct doca_flow_pipe** pipe) = 0;
+    // pipe matching masked 5-tuples by priority, missing to pipe_fwd_miss
+    virtual doca_error_t create_acl_pipe(struct doca_flow_port* port,
+                                         struct doca_flow_pipe* pipe_fwd_miss,
+                                         uint32_t nb_rules,
+                                         struct doca_flow_pipe** pipe) = 0;
+    // pipe matching 5-tuples with aging and counters, missing to pipe_fwd_miss;
+    // the root pipe of the port unless a blocklist pipe comes first
+    virtual doca_error_t create_hairpin_pipe(struct doca_flow_port* port,
+                                             int port_id,
+                                             bool is_root,
+                                             struct doca_flow_pipe* pipe_fwd_miss,
+                                             struct doca_flow_pipe** pipe) = 0;
+
+    // root pipe dropping the packets whose source falls in one of its prefixes,
+    // missing to pipe_fwd_miss; the pipe returned takes the prefixes
+    virtual doca_error_t create_blocklist_pipe(struct doca_flow_port* port,
+                                               uint16_t pipe_queue,
+                                               struct doca_flow_pipe* pipe_fwd_miss,
+                                               uint32_t nb_prefixes,
+                                               struct doca_flow_pipe** pipe) = 0;
+
+    virtual doca_error_t add_hairpin_entry(uint16_t pipe_queue,
+                                           struct doca_flow_pipe* pipe,
+                                           const struct flow_key* key,
+                                           const struct hairpin_fwd* fwd,
+                                           uint32_t flags,
+                                           void* user_ctx,
+                                           struct doca_flow_pipe_entry** entry) = 0;
+    // hairpins the flows of an aggregate without a meter, fwd->color_pipe is ignored
+    virtual doca_error_t add_acl_entry(uint16_t pipe_queue,
+                                       struct doca_flow_pipe* pipe,
+                                       const struct aggregate_rule* rule,
+                                       const struct hairpin_fwd* fwd,
+                                       uint32_t flags,
+                                       void* user_ctx,
+                                       struct doca_flow_pipe_entry** entry) = 0;
+    virtual doca_error_t add_blocklist_entry(uint16_t pipe_queue,
+                                             struct doca_flow_pipe* pipe,
+                                             doca_be32_t addr,
+                                             uint8_t prefix,
+                                             uint32_t flags,
+                                             void* user_ctx,
+                                             struct doca_flow_pipe_entry** entry) = 0;
+    virtual doca_error_t remove_entry(uint16_t pipe_queue,
+                                      uint32_t flags,
+                                      struct doca_flow_pipe_entry* entry) = 0;
+    virtual doca_error_t entries_process(struct doca_flow_port* port,
+                                         uint16_t pipe_queue,
+                                         uint64_t timeout_us,
+                                         uint32_t max_processed_entries) = 0;
+    virtual doca_error_t query_entry(struct doca_flow_pipe_entry* entry,
+                                     struct doca_flow_resource_query* query) = 0;
+    virtual void aging_handle(struct doca_flow_port* port,
+                              uint16_t pipe_queue,
+                              uint64_t quota_us) = 0;
+    virtual doca_error_t pipes_flush(struct doca_flow_port* port) = 0;
+    // Hairpin entries each port can hold once its pipe is fully grown
+    virtual uint32_t hairpin_capacity() const = 0;
+    // Grow the resizable hairpin pipes which asked for it, on the main thread
+    virtual void hairpin_resize_poll() = 0;
+
+    // Whether hits have to be looked up by the pmds with emulate_hit(), rather
+    // than being hairpinned by the NIC before reaching software
+    virtual bool emulates_hits() const { return false; }
+    // Count a packet against the hairpin entry matching it, if any, and give its
+    // egress port, -1 when its meter marked it red or its source is blocklisted,
+    // and whether its sample pipe mirrors it
+    virtual bool emulate_hit(int port_id, const struct flow_key* key, uint32_t pkt_len, int* port_id_out,
+                             bool* sampled)
+    {
+        return false;
+    }
 };
+
+FlowBackend* flow_backend_doca_create(void);
+FlowBackend* flow_backend_sim_create(const struct sim_backend_cfg* cfg);
+
+extern FlowBackend* flow_backend;
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES, ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of NVIDIA CORPORATION &
+ * AFFILIATES (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ *
+ */
+
+#include <rte_memzone.h>
+#include <rte_ring.h>
+
+#include "selective_fwd.h"
+
+DOCA_LOG_REGISTER(SELECTIVE_FWD_SHM);
+
+/*
+ * Multi-process mode. The counters of every lcore live in a named memzone
+ * rather than in process memory, the main thread publishes the installed
+ * flows to another memzone when asked to, and commands come in through a
+ * named ring. A DPDK secondary process, tools/selective_fwd_ctl.cpp, reads
+ * the stats, dumps the flows and sends the commands.
+ *
+ * The primary then leaves the stats to the secondary and no longer logs them
+ * every STATS_INTERVAL_SEC. Its control duties, aging of its own pipe queue,
+ * eviction, provisioning and blocklist reloads, move to a control thread,
+ * registered as a non-EAL lcore for its counters, and the main lcore runs a
+ * pmd like the workers.
+ */
+
+// Commands handled per main loop iteration
+#define SHM_CTRL_BURST_SZ 16
+
+static struct {
+    const struct selective_fwd_cfg* cfg;
+    const struct rte_memzone* metrics_mz;
+    const struct rte_memzone* flows_mz;
+    struct shm_metrics* metrics;
+    struct shm_flows* flows;
+    struct rte_ring* ring;
+    // published flows, kept across publications
+    std::vector<struct shm_flow> collected;
+} shm;
+
+doca_error_t
+shm_init(const struct selective_fwd_cfg* cfg)
+{
+    uint32_t lcore_id;
+
+    shm.cfg = cfg;
+    if (!cfg->multi_process)
+        return DOCA_SUCCESS;
+    if (rte_eal_process_type() != RTE_PROC_PRIMARY) {
+        DOCA_LOG_ERR("Multi-process mode needs this process to be the DPDK primary");
+        return DOCA_ERROR_NOT_SUPPORTED;
+    }
+
+    shm.metrics_mz = rte_memzone_reserve_aligned(SHM_METRICS_MZ, sizeof(struct shm_metrics), rte_socket_id(), 0,
+                                                 RTE_CACHE_LINE_SIZE);
+    shm.flows_mz = rte_memzone_reserve_aligned(SHM_FLOWS_MZ, sizeof(struct shm_flows), rte_socket_id(), 0,
+                                               RTE_CACHE_LINE_SIZE);
+    // any number of secondaries enqueue, the main thread alone dequeues
+    shm.ring = rte_ring_create_elem(SHM_CTRL_RING, sizeof(uint32_t), SHM_CTRL_RING_SIZE, rte_socket_id(),
+                                    RING_F_SC_DEQ);
+    if (shm.metrics_mz == NULL || shm.flows_mz == NULL || shm.ring == NULL) {
+        DOCA_LOG_ERR("Failed to reserve the shared memzones and command ring");
+        shm_fini();
+        return DOCA_ERROR_NO_MEMORY;
+    }
+
+    shm.metrics = (struct shm_metrics*)shm.metrics_mz->addr;
+    shm.flows = (struct shm_flows*)shm.flows_mz->addr;
+    memset(shm.metrics, 0, sizeof(*shm.metrics));
+    memset(shm.flows, 0, offsetof(struct shm_flows, flows));
+    rte_seqlock_init(&shm.flows->lock);
+    shm.metrics->tsc_hz = rte_get_tsc_hz();
+    // none until the control thread registers
+    shm.metrics->control_lcore = RTE_MAX_LCORE;
+    RTE_LCORE_FOREACH(lcore_id)
+        shm.metrics->lcore_ids[shm.metrics->nb_lcores++] = lcore_id;
+    metrics_relocate(shm.metrics->lcores);
+    shm.metrics->running = true;
+    DOCA_LOG_INFO("Sharing stats and flows with secondary processes through %s, %s and %s", SHM_METRICS_MZ,
+                  SHM_FLOWS_MZ, SHM_CTRL_RING);
+    return DOCA_SUCCESS;
+}
+
+bool
+shm_enabled(void)
+{
+    return shm.metrics != NULL;
+}
+
+/*
+ * Share the counters of the control thread too, once it has registered
+ *
+ * @lcore_id [in]: lcore id the control thread registered as
+ */
+void
+shm_add_control_lcore(uint32_t lcore_id)
+{
+    if (shm.metrics == NULL)
+        return;
+    shm.metrics->control_lcore = lcore_id;
+    shm.metrics->lcore_ids[shm.metrics->nb_lcores] = lcore_id;
+    // secondaries load the count before the ids
+    __atomic_store_n(&shm.metrics->nb_lcores, shm.metrics->nb_lcores + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Publish the installed flows, up to SHM_FLOWS_MAX of them. They are queried
+ * before taking the sequence lock, so readers only retry for the copy.
+ */
+static void
+shm_publish_flows(void)
+{
+    uint32_t nb_total;
+
+    shm.collected.clear();
+    nb_total = pipe_mgr.collect_flows(shm.collected, SHM_FLOWS_MAX);
+
+    rte_seqlock_write_lock(&shm.flows->lock);
+    memcpy(shm.flows->flows, shm.collected.data(), shm.collected.size() * sizeof(struct shm_flow));
+    shm.flows->nb_flows = shm.collected.size();
+    shm.flows->nb_total = nb_total;
+    shm.flows->tsc = rte_get_tsc_cycles();
+    shm.flows->generation++;
+    rte_seqlock_write_unlock(&shm.flows->lock);
+}
+
+/*
+ * Handle the commands of secondary processes, on the control path
+ */
+void
+shm_poll(void)
+{
+    uint32_t commands[SHM_CTRL_BURST_SZ];
+    bool publish = false;
+    unsigned int nb_commands;
+
+    if (shm.ring == NULL)
+        return;
+    nb_commands = rte_ring_sc_dequeue_burst_elem(shm.ring, commands, sizeof(uint32_t), SHM_CTRL_BURST_SZ, NULL);
+    for (unsigned int i = 0; i < nb_commands; i++) {
+        switch (commands[i]) {
+        case SHM_CMD_PUBLISH_FLOWS:
+            // a single publication answers all readers waiting
+            publish = true;
+            break;
+        case SHM_CMD_RELOAD_BLOCKLIST:
+            if (shm.cfg->blocklist[0] == '\0')
+                DOCA_LOG_WARN("Blocklist reload requested, but no blocklist is configured");
+            else
+                blocklist_request_reload();
+            break;
+        case SHM_CMD_STOP:
+            DOCA_LOG_INFO("Stop requested by a secondary process");
+            force_quit = true;
+            break;
+        default:
+            DOCA_LOG_WARN("Unknown command %u from a secondary process", commands[i]);
+            break;
+        }
+    }
+    if (publish)
+        shm_publish_flows();
+}
+
+/*
+ * Move the counters back to process memory and release the memzones and the
+ * command ring, once the workers are stopped. Secondaries still attached see
+ * the primary is gone and keep their mapping of the last values.
+ */
+void
+shm_fini(void)
+{
+    if (shm.metrics != NULL) {
+        shm.metrics->running = false;
+        metrics_relocate(NULL);
+    }
+    rte_ring_free(shm.ring);
+    rte_memzone_free(shm.flows_mz);
+    rte_memzone_free(shm.metrics_mz);
+    shm.ring = NULL;
+    shm.flows_mz = NULL;
+    shm.metrics_mz = NULL;
+    shm.flows = NULL;
+    shm.metrics = NULL;
+}
@@ -0,0 +1,515 @@
+/*
+ * Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES, ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of NVIDIA CORPORATION &
+ * AFFILIATES (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ *
+ */
+
+#include <poll.h>
+
+#include <rte_ring.h>
+
+#include "selective_fwd.h"
+
+DOCA_LOG_REGISTER(SELECTIVE_FWD_VERDICT);
+
+/*
+ * Asynchronous verdicts. A pmd seeing the first packet of an unknown flow
+ * parks it in a per-flow hold queue and publishes the flow on its request
+ * ring. The control thread decides and hands the flow back on the pmd's
+ * verdict ring, which the pmd drains every loop iteration to offload, forward
+ * or drop the held packets. Each pmd has its own pair of single producer,
+ * single consumer rings, and a pending flow belongs to the control thread
+ * only between taking it off the request ring and putting it on the verdict
+ * ring, so nothing is locked.
+ */
+
+#define VERDICT_RING_SIZE 1024
+// a ring of size N holds N - 1 objects
+#define VERDICT_MAX_PENDING (VERDICT_RING_SIZE - 1)
+// packets of a pending flow held for its verdict, later ones are dropped
+#define VERDICT_HOLD_PKTS 8
+// pending flows whose verdict takes longer have their held packets dropped
+#define VERDICT_TIMEOUT_SEC FLOW_TIMEOUT_SEC
+#define VERDICT_BURST_SZ 32
+#define VERDICT_ANSWER_LEN 256
+
+enum verdict {
+    VERDICT_PENDING,
+    VERDICT_OFFLOAD, // forward the held packets to port_out and offload the flow
+    VERDICT_PASS,    // forward the held packets to port_out, ask again on the next one
+    VERDICT_DROP,
+};
+
+struct verdict_flow {
+    // set by the pmd before publishing, read only for the control thread
+    struct flow_key key;
+    uint8_t port_in;
+    uint16_t queue_id;
+    uint64_t first_pkt_tsc;
+    // set by the control thread
+    enum verdict verdict;
+    // the forwarding table's egress port, unless the verdict names another
+    uint8_t port_out;
+    // the default meter profile, unless the verdict names another
+    uint8_t meter_profile;
+    // pmd only
+    bool expired;
+    uint16_t nb_held;
+    struct rte_mbuf* held[VERDICT_HOLD_PKTS];
+    TAILQ_ENTRY(verdict_flow) link;
+};
+
+TAILQ_HEAD(verdict_flow_list, verdict_flow);
+
+struct verdict_queue {
+    // pmd to control thread
+    struct rte_ring* requests;
+    // control thread to pmd
+    struct rte_ring* verdicts;
+    // pmd only: flows waiting for their verdict, and the same by age
+    std::unordered_map<struct flow_key, struct verdict_flow*, flow_key_hash, flow_key_equal> pending;
+    struct verdict_flow_list by_age;
+};
+
+static struct verdict_queue* verdict_queues;
+static uint16_t nb_verdict_queues;
+static uint16_t nb_verdict_ports;
+static uint8_t nb_verdict_meters;
+static pthread_t verdict_thread;
+static bool verdict_thread_started;
+
+// console input not consumed yet, lines may arrive split or several at once
+static char answer_buf[VERDICT_ANSWER_LEN];
+static size_t answer_len;
+
+/*
+ * Hand a decided flow back to its pmd
+ *
+ * @flow [in]: flow with its verdict set
+ */
+static void
+verdict_return(struct verdict_flow* flow)
+{
+    // the pmd drains its ring every iteration, it is only full for an instant
+    while (rte_ring_sp_enqueue(verdict_queues[flow->queue_id].verdicts, flow) != 0)
+        rte_pause();
+}
+
+/*
+ * Take the next pending flow, round robin over the pmds
+ *
+ * @return: flow, NULL when none is pending
+ */
+static struct verdict_flow*
+verdict_next_request(void)
+{
+    static uint16_t next_queue;
+    struct verdict_flow* flow;
+
+    for (uint16_t i = 0; i < nb_verdict_queues; i++) {
+        uint16_t queue_id = (next_queue + i) % nb_verdict_queues;
+
+        if (rte_ring_sc_dequeue(verdict_queues[queue_id].requests, (void**)&flow) == 0) {
+            next_queue = queue_id + 1;
+            return flow;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Read the next answer line from stdin without blocking past the stop poll
+ * interval
+ *
+ * @answer [out]: first non blank character of the line
+ * @port [out]: port number following it, -1 when there is none
+ * @meter [out]: meter profile given as m<profile> after it, -1 when there is none
+ * @return: 1 on an answer, 0 when none arrived in time, -1 once stdin is closed
+ */
+static int
+verdict_read_answer(char* answer, long* port, long* meter)
+{
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    char* eol;
+    ssize_t len;
+
+    while ((eol = (char*)memchr(answer_buf, '\n', answer_len)) == NULL) {
+        if (answer_len == sizeof(answer_buf))
+            answer_len = 0; // overlong line, discard it
+        if (poll(&pfd, 1, STOP_POLL_INTERVAL_MS) <= 0)
+            return 0;
+        len = read(STDIN_FILENO, answer_buf + answer_len, sizeof(answer_buf) - answer_len);
+        if (len <= 0)
+            return -1;
+        answer_len += len;
+    }
+
+    *answer = '\0';
+    *port = -1;
+    *meter = -1;
+    *eol = '\0';
+    for (char* c = answer_buf; c < eol; c++) {
+        if (*c != ' ' && *c != '\t' && *c != '\r') {
+            char* end;
+
+            *answer = *c;
+            long value = strtol(c + 1, &end, 10);
+            if (end != c + 1)
+                *port = value;
+            c = end;
+            while (c < eol && (*c == ' ' || *c == '\t'))
+                c++;
+            if (*c == 'm') {
+                value = strtol(c + 1, &end, 10);
+                if (end != c + 1)
+                    *meter = value;
+            }
+            break;
+        }
+    }
+    answer_len -= eol + 1 - answer_buf;
+    memmove(answer_buf, eol + 1, answer_len);
+    return 1;
+}
+
+/*
+ * Show a pending flow to the operator
+ *
+ * @flow [in]: pending flow
+ */
+static void
+verdict_prompt(const struct verdict_flow* flow)
+{
+    const uint8_t* src = (const uint8_t*)&flow->key.src_ip;
+    const uint8_t* dst = (const uint8_t*)&flow->key.dst_ip;
+
+    printf("New flow %u.%u.%u.%u:%u -> %u.%u.%u.%u:%u on port %u, [o]ffload or [p]ass to port %u, "
+           "offload to the [s]ame port, or [d]rop? ",
+           src[0], src[1], src[2], src[3], rte_be_to_cpu_16(flow->key.src_port),
+           dst[0], dst[1], dst[2], dst[3], rte_be_to_cpu_16(flow->key.dst_port),
+           flow->port_in, flow->port_out);
+    if (nb_verdict_meters > 0)
+        printf("(offloads metered by profile %u, m<profile> for another) ", flow->meter_profile);
+    fflush(stdout);
+}
+
+/*
+ * Console control thread: asks the operator for the verdict of each new flow,
+ * one at a time. o and p may be followed by the egress port, replacing the
+ * forwarding table's, and o and s by m<profile>, replacing the default meter
+ * profile. Once stdin is closed every new flow is dropped.
+ *
+ * @arg [in]: unused
+ * @return: NULL
+ */
+static void*
+verdict_console(void* arg)
+{
+    struct verdict_flow* flow = NULL;
+    bool stdin_closed = false;
+    char answer;
+    long port, meter;
+    int ret;
+
+    (void)arg;
+    while (!force_quit) {
+        if (flow == NULL) {
+            flow = verdict_next_request();
+            if (flow == NULL) {
+                usleep(FIRST_HIT_CHECK_INTERVAL_US);
+                continue;
+            }
+            if (!stdin_closed)
+                verdict_prompt(flow);
+        }
+
+        if (stdin_closed) {
+            flow->verdict = VERDICT_DROP;
+        } else {
+            ret = verdict_read_answer(&answer, &port, &meter);
+            if (ret == 0)
+                continue;
+            if (ret < 0) {
+                DOCA_LOG_WARN("Verdict console closed, dropping new flows");
+                stdin_closed = true;
+                continue;
+            }
+            if (port >= nb_verdict_ports) {
+                printf("No port %ld\n", port);
+                verdict_prompt(flow);
+                continue;
+            }
+            if (meter > nb_verdict_meters) {
+                printf("No meter profile %ld\n", meter);
+                verdict_prompt(flow);
+                continue;
+            }
+            switch (answer) {
+                case 'o':
+                    flow->verdict = VERDICT_OFFLOAD;
+                    break;
+                case 's':
+                    flow->verdict = VERDICT_OFFLOAD;
+                    port = flow->port_in;
+                    break;
+                case 'p':
+                    flow->verdict = VERDICT_PASS;
+                    break;
+                case 'd':
+                    flow->verdict = VERDICT_DROP;
+                    break;
+                default:
+                    verdict_prompt(flow);
+                    continue;
+            }
+            if (port >= 0)
+                flow->port_out = port;
+            if (meter >= 0)
+                flow->meter_profile = meter;
+        }
+        verdict_return(flow);
+        flow = NULL;
+    }
+
+    if (flow != NULL) {
+        flow->verdict = VERDICT_DROP;
+        verdict_return(flow);
+    }
+    return NULL;
+}
+
+doca_error_t
+verdict_init(enum verdict_mode mode, uint16_t nb_pmds, uint16_t nb_ports, uint8_t nb_meter_profiles)
+{
+    char name[RTE_RING_NAMESIZE];
+    int ret;
+
+    (void)mode; // the console is the only asynchronous decision maker so far
+    verdict_queues = new verdict_queue[nb_pmds];
+    nb_verdict_queues = nb_pmds;
+    nb_verdict_ports = nb_ports;
+    nb_verdict_meters = nb_meter_profiles;
+    for (uint16_t queue_id = 0; queue_id < nb_pmds; queue_id++) {
+        struct verdict_queue* queue = &verdict_queues[queue_id];
+
+        TAILQ_INIT(&queue->by_age);
+        snprintf(name, sizeof(name), "verdict_req_%u", queue_id);
+        queue->requests = rte_ring_create(name, VERDICT_RING_SIZE, rte_socket_id(),
+                                          RING_F_SP_ENQ | RING_F_SC_DEQ);
+        snprintf(name, sizeof(name), "verdict_%u", queue_id);
+        queue->verdicts = rte_ring_create(name, VERDICT_RING_SIZE, rte_socket_id(),
+                                          RING_F_SP_ENQ | RING_F_SC_DEQ);
+        if (queue->requests == NULL || queue->verdicts == NULL) {
+            DOCA_LOG_ERR("Failed to create verdict rings: %s", rte_strerror(rte_errno));
+            return DOCA_ERROR_NO_MEMORY;
+        }
+    }
+
+    ret = rte_ctrl_thread_create(&verdict_thread, "verdict", NULL, verdict_console, NULL);
+    if (ret != 0) {
+        DOCA_LOG_ERR("Failed to start the verdict console: %s", strerror(-ret));
+        return DOCA_ERROR_OPERATING_SYSTEM;
+    }
+    verdict_thread_started = true;
+    DOCA_LOG_INFO("New flows wait for a verdict on the console, answer o(ffload), p(ass), s(ame port) or d(rop)");
+    return DOCA_SUCCESS;
+}
+
+/*
+ * Release a flow handed back by the control thread after its pmd stopped
+ *
+ * @flow [in]: flow
+ */
+static void
+verdict_flow_free(struct verdict_flow* flow)
+{
+    if (!flow->expired)
+        rte_pktmbuf_free_bulk(flow->held, flow->nb_held);
+    delete flow;
+}
+
+void
+verdict_fini(void)
+{
+    struct verdict_flow* flow;
+
+    if (verdict_thread_started) {
+        pthread_join(verdict_thread, NULL);
+        verdict_thread_started = false;
+    }
+    if (verdict_queues == NULL)
+        return;
+
+    // the pmds have stopped: whatever is still in flight is only on the rings
+    for (uint16_t queue_id = 0; queue_id < nb_verdict_queues; queue_id++) {
+        struct verdict_queue* queue = &verdict_queues[queue_id];
+
+        while (queue->requests != NULL && rte_ring_sc_dequeue(queue->requests, (void**)&flow) == 0)
+            verdict_flow_free(flow);
+        while (queue->verdicts != NULL && rte_ring_sc_dequeue(queue->verdicts, (void**)&flow) == 0)
+            verdict_flow_free(flow);
+        rte_ring_free(queue->requests);
+        rte_ring_free(queue->verdicts);
+    }
+    delete[] verdict_queues;
+    verdict_queues = NULL;
+    nb_verdict_queues = 0;
+}
+
+struct verdict_queue*
+verdict_queue_get(uint16_t queue_id)
+{
+    return queue_id < nb_verdict_queues ? &verdict_queues[queue_id] : NULL;
+}
+
+void
+verdict_hold(struct pmd_params_t* params,
+             struct rte_mbuf* pkt,
+             const struct flow_key* key,
+             int port_id_in,
+             uint64_t rx_tsc)
+{
+    struct verdict_queue* queue = params->verdict;
+    struct lcore_metrics* metrics = params->metrics;
+    struct verdict_flow* flow;
+
+    auto it = queue->pending.find(*key);
+    if (it != queue->pending.end()) {
+        flow = it->second;
+        if (flow->nb_held == VERDICT_HOLD_PKTS)
+            goto drop;
+        flow->held[flow->nb_held++] = pkt;
+        return;
+    }
+
+    if (queue->pending.size() >= VERDICT_MAX_PENDING)
+        goto drop;
+
+    flow = new verdict_flow();
+    flow->key = *key;
+    flow->port_in = port_id_in;
+    flow->port_out = fwd_select_egress(params->fwd_cfg, port_id_in, key);
+    flow->meter_profile = params->fwd_cfg->default_meter;
+    flow->queue_id = params->queue_id;
+    flow->first_pkt_tsc = rx_tsc;
+    flow->verdict = VERDICT_PENDING;
+    flow->held[0] = pkt;
+    flow->nb_held = 1;
+    // flows given up on are still in flight, so the ring may fill before the table
+    if (rte_ring_sp_enqueue(queue->requests, flow) != 0) {
+        delete flow;
+        goto drop;
+    }
+    queue->pending.emplace(*key, flow);
+    TAILQ_INSERT_TAIL(&queue->by_age, flow, link);
+    metrics->verdict_requests++;
+    return;
+
+drop:
+    metrics->verdict_hold_drops++;
+    metrics->drops++;
+    rte_pktmbuf_free(pkt);
+}
+
+/*
+ * Offload, forward or drop the held packets of a decided flow
+ *
+ * @params [in]: pmd parameters
+ * @flow [in]: flow with its verdict set
+ */
+static void
+verdict_apply(struct pmd_params_t* params, struct verdict_flow* flow)
+{
+    struct lcore_metrics* metrics = params->metrics;
+    uint16_t nb_done = 0;
+    doca_error_t result;
+
+    switch (flow->verdict) {
+        case VERDICT_OFFLOAD:
+            // deferred by the insertion budget, the first packet is forwarded all the same;
+            // a failed offload leaves it with the held packets, forwarded in software like
+            // the inline path does
+            result = offload_flow(flow->held[0], flow->port_in, flow->port_out, flow->meter_profile,
+                                  flow->first_pkt_tsc, params);
+            if (result == DOCA_SUCCESS || result == DOCA_ERROR_AGAIN)
+                nb_done = 1;
+            /* fallthrough */
+        case VERDICT_PASS:
+            if (nb_done < flow->nb_held) {
+                uint16_t nb_sent = rte_eth_tx_burst(flow->port_out, params->queue_id,
+                                                    &flow->held[nb_done], flow->nb_held - nb_done);
+                metrics->tx_pkts += nb_sent;
+                nb_done += nb_sent;
+            }
+            break;
+        default:
+            break;
+    }
+    metrics->drops += flow->nb_held - nb_done;
+    rte_pktmbuf_free_bulk(&flow->held[nb_done], flow->nb_held - nb_done);
+    flow->nb_held = 0;
+}
+
+/*
+ * Stop waiting for the verdict of a flow and drop its held packets. The flow
+ * stays in flight and is freed once it comes back.
+ *
+ * @queue [in]: verdict queue of the pmd
+ * @flow [in]: pending flow
+ * @metrics [in]: counters of the pmd
+ */
+static void
+verdict_expire(struct verdict_queue* queue, struct verdict_flow* flow, struct lcore_metrics* metrics)
+{
+    TAILQ_REMOVE(&queue->by_age, flow, link);
+    queue->pending.erase(flow->key);
+    metrics->drops += flow->nb_held;
+    rte_pktmbuf_free_bulk(flow->held, flow->nb_held);
+    flow->nb_held = 0;
+    flow->expired = true;
+}
+
+void
+verdict_poll(struct pmd_params_t* params, uint64_t now)
+{
+    const uint64_t timeout = VERDICT_TIMEOUT_SEC * rte_get_tsc_hz();
+    struct verdict_queue* queue = params->verdict;
+    struct verdict_flow* flows[VERDICT_BURST_SZ];
+    struct verdict_flow* flow;
+    unsigned int nb;
+
+    nb = rte_ring_sc_dequeue_burst(queue->verdicts, (void**)flows, VERDICT_BURST_SZ, NULL);
+    for (unsigned int i = 0; i < nb; i++) {
+        flow = flows[i];
+        if (!flow->expired) {
+            TAILQ_REMOVE(&queue->by_age, flow, link);
+            queue->pending.erase(flow->key);
+            latency_hist_record(&params->latency->verdict, now - flow->first_pkt_tsc);
+            verdict_apply(params, flow);
+        }
+        delete flow;
+    }
+
+    while ((flow = TAILQ_FIRST(&queue->by_age)) != NULL && now - flow->first_pkt_tsc >= timeout) {
+        verdict_expire(queue, flow, params->metrics);
+        params->metrics->verdict_timeouts++;
+    }
+}
+
+void
+verdict_pmd_stop(struct pmd_params_t* params)
+{
+    struct verdict_queue* queue = params->verdict;
+    struct verdict_flow* flow;
+
+    // drop what the pmd still holds, verdict_fini() frees the flows in flight
+    while ((flow = TAILQ_FIRST(&queue->by_age)) != NULL)
+        verdict_expire(queue, flow, params->metrics);
+}
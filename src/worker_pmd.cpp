@@ -11,40 +11,475 @@
  *
  */
 
+#include <math.h>
+
 #include "selective_fwd.h"
 
 DOCA_LOG_REGISTER(SELECTIVE_FWD_PMD);
 
 PipeMgr pipe_mgr = PipeMgr();
 
+// Owner of each connection seen by the affinity check: fingerprint of the
+// connection with AFFINITY_OWNED set in the upper half, lcore id in the lower
+// half, so that an empty slot matches no connection. Racing updates may lose a
+// sample, which is good enough for a diagnostic. Only allocated with
+// --verify-affinity.
+#define AFFINITY_OWNED (1ULL << 31)
+static uint64_t* affinity_owner;
+
+void
+affinity_init(const struct selective_fwd_cfg* cfg)
+{
+    if (cfg->verify_affinity)
+        affinity_owner = new uint64_t[AFFINITY_TABLE_SIZE]();
+}
+
+void
+affinity_fini(void)
+{
+    delete[] affinity_owner;
+    affinity_owner = NULL;
+}
+
 bool allow_offload(struct rte_mbuf* pkt)
 {
     // todo: implement this function according to your firewall rules.
     return true;
 }
 
-std::string create_entry_name(const rte_ipv4_hdr* ipv4_hdr, const rte_tcp_hdr* tcp_hdr) {
-    char src_ip_str[INET_ADDRSTRLEN];
-    char dst_ip_str[INET_ADDRSTRLEN];
+/*
+ * Stop tracking a flow for time-to-offload
+ *
+ * @ctx [in]: flow context
+ */
+static void
+untrack_first_hit(struct flow_ctx* ctx)
+{
+    if (!ctx->awaiting_hit)
+        return;
+    TAILQ_REMOVE(&ctx->owner->awaiting_hit, ctx, hit_link);
+    ctx->owner->nb_awaiting_hit--;
+    ctx->awaiting_hit = false;
+}
+
+/*
+ * Refill the insertion budget of a pmd and take an operation of a class from
+ * it. Removals always go ahead, borrowing from the refill up to a burst, mice
+ * flows need more than the reserve of the policy classes left.
+ *
+ * @params [in]: pmd parameters
+ * @insert_class [in]: class of the operation
+ * @return: true when the operation may be submitted
+ */
+bool
+insert_budget_take(struct pmd_params_t* params, enum insert_class insert_class)
+{
+    struct insert_budget* budget = &params->budget;
+    uint64_t now;
+    double reserve;
+
+    if (budget->rate == 0)
+        return true;
+    now = rte_rdtsc();
+    budget->tokens += (double)(now - budget->last_tsc) * budget->rate / rte_get_tsc_hz();
+    if (budget->tokens > budget->burst)
+        budget->tokens = budget->burst;
+    budget->last_tsc = now;
+
+    if (insert_class == INSERT_REMOVE) {
+        budget->tokens = RTE_MAX(budget->tokens - 1, -budget->burst);
+        return true;
+    }
+    reserve = insert_class == INSERT_MICE ? budget->burst * INSERT_MICE_RESERVE_PCT / 100 : 0;
+    if (budget->tokens < reserve + 1)
+        return false;
+    budget->tokens -= 1;
+    return true;
+}
+
+/*
+ * Entry processing callback of the hairpin entries, runs on the thread owning
+ * the pipe queue the completion arrived on, a pmd or the main thread. Static
+ * pipe entries never age nor get removed, so only hairpin entries reach the
+ * AGED and DEL cases.
+ *
+ * @entry [in]: DOCA Flow entry pointer
+ * @pipe_queue [in]: queue identifier
+ * @status [in]: DOCA Flow entry status
+ * @op [in]: DOCA Flow entry operation
+ * @user_ctx [in]: flow context of the entry
+ */
+void
+pmd_entry_process_cb(struct doca_flow_pipe_entry* entry,
+                     uint16_t pipe_queue,
+                     enum doca_flow_entry_status status,
+                     enum doca_flow_entry_op op,
+                     void* user_ctx)
+{
+    struct flow_ctx* ctx = (struct flow_ctx*)user_ctx;
+    struct flow_record record;
+
+    if (ctx != NULL && ctx->kind == ENTRY_BLOCKLIST) {
+        blocklist_entry_process(entry, status, op, user_ctx);
+        return;
+    }
+
+    switch (op) {
+        case DOCA_FLOW_ENTRY_OP_AGED:
+            flow_export_prepare(ctx, FLOW_END_IDLE_TIMEOUT, &record);
+            // the main thread's own flows are not budgeted
+            if (ctx->owner != NULL)
+                insert_budget_take(ctx->owner, INSERT_REMOVE);
+            __atomic_store_n(&ctx->remove_tsc, rte_rdtsc(), __ATOMIC_RELAXED);
+            // an entry left installed ages out again, and is exported then
+            if (flow_backend->remove_entry(pipe_queue, DOCA_FLOW_NO_WAIT, entry) != DOCA_SUCCESS) {
+                __atomic_store_n(&ctx->remove_tsc, 0, __ATOMIC_RELAXED);
+                break;
+            }
+            flow_export_removed(&record);
+            break;
+        case DOCA_FLOW_ENTRY_OP_DEL:
+            latency_hist_record(&lcore_latency[rte_lcore_id()].remove, rte_rdtsc() - ctx->remove_tsc);
+            untrack_first_hit(ctx);
+            if (ctx->provisioned)
+                provision_forget(ctx);
+            pipe_mgr.remove_entry(entry);
+            flow_ctx_free(ctx);
+            break;
+        case DOCA_FLOW_ENTRY_OP_ADD:
+            if (ctx != NULL && ctx->orphaned && status != DOCA_FLOW_ENTRY_STATUS_SUCCESS) {
+                flow_ctx_free(ctx);
+                break;
+            }
+            /* fallthrough */
+        default:
+            check_for_valid_entry(entry, pipe_queue, status, op, user_ctx);
+            break;
+    }
+}
+
+/*
+ * Record time-to-offload of the tracked flows which got their first hardware
+ * hit, and stop tracking flows which never did within the flow timeout
+ *
+ * @params [in]: pmd parameters
+ * @now [in]: current TSC
+ */
+static void
+check_first_hits(struct pmd_params_t* params, uint64_t now)
+{
+    const uint64_t timeout = FLOW_TIMEOUT_SEC * rte_get_tsc_hz();
+    struct doca_flow_resource_query query;
+    struct flow_ctx *ctx, *next;
+
+    for (ctx = TAILQ_FIRST(&params->awaiting_hit); ctx != NULL; ctx = next) {
+        next = TAILQ_NEXT(ctx, hit_link);
+        if (flow_backend->query_entry(ctx->entry, &query) == DOCA_SUCCESS &&
+            query.counter.total_pkts > 0)
+            latency_hist_record(&params->latency->offload, now - ctx->first_pkt_tsc);
+        else if (now - ctx->first_pkt_tsc < timeout)
+            continue;
+        untrack_first_hit(ctx);
+    }
+}
+
+/*
+ * Pick how this pmd sleeps once idle: Rx interrupts when requested, otherwise
+ * the best power intrinsic the CPU supports
+ *
+ * @params [in]: pmd parameters
+ */
+static void
+init_idle_sleep(struct pmd_params_t* params)
+{
+    struct rte_cpu_intrinsics intrinsics;
+    int ret;
+
+    params->empty_polls = 0;
+    if (params->fwd_cfg->rx_intr) {
+        params->sleep_mode = PMD_SLEEP_RX_INTR;
+        for (int port_id = 0; port_id < params->app_cfg->port_config.nb_ports; port_id++) {
+            ret = rte_eth_dev_rx_intr_ctl_q(port_id, params->queue_id, RTE_EPOLL_PER_THREAD,
+                                            RTE_INTR_EVENT_ADD, NULL);
+            if (ret < 0) {
+                DOCA_LOG_WARN("Rx interrupts unavailable on port %d queue %u (%d), using power intrinsics",
+                              port_id, params->queue_id, ret);
+                // the power intrinsics never wait on the ports registered so far
+                while (--port_id >= 0)
+                    rte_eth_dev_rx_intr_ctl_q(port_id, params->queue_id, RTE_EPOLL_PER_THREAD,
+                                              RTE_INTR_EVENT_DEL, NULL);
+                break;
+            }
+        }
+        if (ret == 0)
+            return;
+    }
+
+    rte_cpu_get_intrinsics_support(&intrinsics);
+    if (intrinsics.power_monitor_multi)
+        params->sleep_mode = PMD_SLEEP_MONITOR;
+    else if (intrinsics.power_pause)
+        params->sleep_mode = PMD_SLEEP_TPAUSE;
+    else
+        params->sleep_mode = PMD_SLEEP_PAUSE;
+}
+
+/*
+ * Back off after an empty poll. Below the idle threshold the pmd keeps busy
+ * polling, up to twice the threshold it only spins with rte_pause(), past that
+ * it sleeps for at most idle_sleep_us or until traffic arrives.
+ *
+ * @params [in]: pmd parameters
+ * @now [in]: TSC at the start of the poll
+ */
+static void
+pmd_idle(struct pmd_params_t* params, uint64_t now)
+{
+    const uint32_t threshold = params->fwd_cfg->idle_threshold;
+    const uint64_t wakeup = now + params->fwd_cfg->idle_sleep_us * rte_get_tsc_hz() / 1000000;
+    const uint16_t nb_ports = params->app_cfg->port_config.nb_ports;
+    struct rte_power_monitor_cond pmc[MAX_PORTS];
+    struct rte_epoll_event events[MAX_PORTS];
+
+    if (threshold == 0 || ++params->empty_polls < threshold)
+        return;
+    if (params->empty_polls < 2 * threshold || params->sleep_mode == PMD_SLEEP_PAUSE) {
+        rte_pause();
+        return;
+    }
+
+    params->metrics->sleeps++;
+    switch (params->sleep_mode) {
+        case PMD_SLEEP_MONITOR:
+            // the monitored address is the next Rx descriptor, so it has to be re-read every time
+            for (int port_id = 0; port_id < nb_ports; port_id++) {
+                if (rte_eth_get_monitor_addr(port_id, params->queue_id, &pmc[port_id]) != 0) {
+                    rte_pause();
+                    return;
+                }
+            }
+            rte_power_monitor_multi(pmc, nb_ports, wakeup);
+            break;
+        case PMD_SLEEP_TPAUSE:
+            rte_power_pause(wakeup);
+            break;
+        case PMD_SLEEP_RX_INTR:
+            for (int port_id = 0; port_id < nb_ports; port_id++)
+                rte_eth_dev_rx_intr_enable(port_id, params->queue_id);
+            // epoll waits in whole milliseconds, so this sleeps 1 ms whatever idle_sleep_us
+            rte_epoll_wait(RTE_EPOLL_PER_THREAD, events, nb_ports, 1);
+            for (int port_id = 0; port_id < nb_ports; port_id++)
+                rte_eth_dev_rx_intr_disable(port_id, params->queue_id);
+            break;
+        default:
+            rte_pause();
+            break;
+    }
+}
+
+/*
+ * Check that a packet arrived on the lcore owning its connection, the first
+ * lcore which saw a packet of it in either direction
+ *
+ * @ipv4_hdr [in]: IPv4 header of the packet
+ * @tcp_hdr [in]: TCP header of the packet
+ * @params [in]: pmd parameters
+ */
+static void
+check_affinity(const struct rte_ipv4_hdr* ipv4_hdr,
+               const struct rte_tcp_hdr* tcp_hdr,
+               struct pmd_params_t* params)
+{
+    uint64_t src = (uint64_t)ipv4_hdr->src_addr << 16 | tcp_hdr->src_port;
+    uint64_t dst = (uint64_t)ipv4_hdr->dst_addr << 16 | tcp_hdr->dst_port;
+    uint32_t lcore_id = rte_lcore_id();
+
+    // order the endpoints so both directions of a connection hash alike
+    uint64_t hash = RTE_MIN(src, dst) * 0x9e3779b97f4a7c15ULL;
+    hash ^= RTE_MAX(src, dst) * 0xc2b2ae3d27d4eb4fULL;
+    hash ^= hash >> 31;
+
+    uint64_t* slot = &affinity_owner[hash & (AFFINITY_TABLE_SIZE - 1)];
+    uint64_t fingerprint = hash >> 32 | AFFINITY_OWNED;
+    uint64_t owner = __atomic_load_n(slot, __ATOMIC_RELAXED);
+
+    if (owner >> 32 != fingerprint) {
+        __atomic_store_n(slot, fingerprint << 32 | lcore_id, __ATOMIC_RELAXED);
+        return;
+    }
+    if ((uint32_t)owner != lcore_id) {
+        params->metrics->affinity_violations++;
+        DOCA_LOG_DBG("Connection %08x:%u <-> %08x:%u seen on lcores %u and %u",
+                     rte_be_to_cpu_32(ipv4_hdr->src_addr), rte_be_to_cpu_16(tcp_hdr->src_port),
+                     rte_be_to_cpu_32(ipv4_hdr->dst_addr), rte_be_to_cpu_16(tcp_hdr->dst_port),
+                     (uint32_t)owner, lcore_id);
+    }
+}
+
+/*
+ * Pick the egress port of a new flow among those of its ingress port, by
+ * weighted rendezvous hashing: every egress port scores the 5-tuple and the
+ * highest score wins. A flow always maps to the same port, and changing the
+ * weights or the ports only moves the flows which have to move.
+ *
+ * @cfg [in]: application configuration
+ * @port_id_in [in]: port the flow was received on
+ * @key [in]: 5-tuple of the flow
+ * @return: egress port
+ */
+uint8_t
+fwd_select_egress(const struct selective_fwd_cfg* cfg, int port_id_in, const struct flow_key* key)
+{
+    const struct fwd_rule* rule = &cfg->fwd_table[port_id_in];
+    const uint64_t flow_hash = flow_key_hash()(*key);
+    uint8_t best = rule->egress_port[0];
+    double best_score = 0;
+
+    if (rule->nb_egress == 1)
+        return best;
+    for (uint8_t i = 0; i < rule->nb_egress; i++) {
+        // splitmix64 finalizer of the flow hash salted with the port
+        uint64_t hash = flow_hash + (rule->egress_port[i] + 1) * 0x9e3779b97f4a7c15ULL;
+        hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+        hash ^= hash >> 31;
+        // uniform in (0, 1) exclusive, so the log is finite and negative
+        double u = ((hash >> 11) + 0.5) / (double)(1ULL << 53);
+        double score = -rule->weight[i] / log(u);
+        if (score > best_score) {
+            best_score = score;
+            best = rule->egress_port[i];
+        }
+    }
+    return best;
+}
+
+/*
+ * Forward the packet which got its flow offloaded
+ *
+ * @pkt [in]: packet, consumed
+ * @port_id_out [in]: egress port of the flow
+ * @params [in]: pmd parameters
+ */
+static void
+send_first_packet(struct rte_mbuf* pkt, int port_id_out, struct pmd_params_t* params)
+{
+    if (rte_eth_tx_burst(port_id_out, params->queue_id, &pkt, 1) != 1) {
+        DOCA_LOG_ERR("Failed to send packet");
+        params->metrics->drops++;
+        rte_pktmbuf_free(pkt);
+    } else {
+        params->metrics->tx_pkts++;
+    }
+}
+
+/*
+ * Offload the flow of a packet allowed on the software path and forward the
+ * packet to its egress port. Flows in a trusted aggregate are offloaded by the
+ * aggregate's rule rather than by an entry of their own, see aggregate.cpp.
+ * When the insertion budget of the pmd has nothing left for the class of the
+ * flow, or the hairpin table of its port is full, the packet is forwarded
+ * without offloading, and the next packet of the flow tries again.
+ *
+ * @pkt [in]: IPv4 TCP packet of the flow, consumed on success
+ * @port_id_in [in]: port the packet was received on
+ * @port_id_out [in]: port the flow is forwarded to, possibly port_id_in
+ * @meter_profile [in]: meter profile of the flow, 0 for none
+ * @first_pkt_tsc [in]: TSC of the first packet of the flow
+ * @params [in]: pmd parameters
+ * @return: DOCA_SUCCESS on success, DOCA_ERROR_AGAIN when the offload was held back, the
+ *          packet forwarded, and DOCA_ERROR otherwise, with the packet left to the caller
+ */
+doca_error_t
+offload_flow(struct rte_mbuf* pkt, int port_id_in, int port_id_out, uint8_t meter_profile, uint64_t first_pkt_tsc,
+             struct pmd_params_t* params)
+{
+    struct lcore_metrics* metrics = params->metrics;
+    struct rte_ether_hdr* eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr*);
+    struct rte_ipv4_hdr* ipv4_hdr = (struct rte_ipv4_hdr*)((char*)eth_hdr + sizeof(struct rte_ether_hdr));
+    struct rte_tcp_hdr* tcp_hdr = (struct rte_tcp_hdr*)((char*)ipv4_hdr + sizeof(struct rte_ipv4_hdr));
+    struct flow_key key = {ipv4_hdr->src_addr, ipv4_hdr->dst_addr, tcp_hdr->src_port, tcp_hdr->dst_port};
+    struct doca_flow_pipe_entry *entry = NULL;
+    struct hairpin_fwd fwd;
+
+    if (aggregate_count() > 0 && aggregate_offload(params, port_id_in, port_id_out, meter_profile, &key)) {
+        metrics->aggregated_flows++;
+        send_first_packet(pkt, port_id_out, params);
+        return DOCA_SUCCESS;
+    }
 
-    // Convert IP addresses to strings
-    inet_ntop(AF_INET, &ipv4_hdr->src_addr, src_ip_str, INET_ADDRSTRLEN);
-    inet_ntop(AF_INET, &ipv4_hdr->dst_addr, dst_ip_str, INET_ADDRSTRLEN);
+    // left to the eviction to make room, see evict.cpp
+    if (pipe_mgr.occupancy(port_id_in) >= hairpin_capacity()) {
+        metrics->insert_deferrals++;
+        send_first_packet(pkt, port_id_out, params);
+        return DOCA_ERROR_AGAIN;
+    }
+
+    if (!insert_budget_take(params, meter_profile != 0 || params->verdict != NULL ? INSERT_POLICY : INSERT_MICE)) {
+        metrics->insert_deferrals++;
+        send_first_packet(pkt, port_id_out, params);
+        return DOCA_ERROR_AGAIN;
+    }
+
+    struct flow_ctx *ctx = new flow_ctx();
+    ctx->owner = params;
+    ctx->first_pkt_tsc = first_pkt_tsc;
+    ctx->last_active_tsc = first_pkt_tsc;
+    ctx->key = key;
+    ctx->port_in = port_id_in;
+    ctx->port_out = port_id_out;
+    ctx->meter_profile = meter_profile;
+
+    uint64_t insert_start = rte_rdtsc();
+    doca_error_t result = hairpin_fwd_prepare(params->app_cfg, ctx, &fwd);
+    if (result == DOCA_SUCCESS)
+        result = add_hairpin_pipe_entry(
+            params->ports,
+            port_id_in,
+            &fwd,
+            params->hairpin_pipes[port_id_in],
+            ipv4_hdr->dst_addr,
+            ipv4_hdr->src_addr,
+            tcp_hdr->dst_port,
+            tcp_hdr->src_port,
+            params->queue_id,
+            &ctx->status,
+            &entry
+        );
+    uint64_t insert_cycles = rte_rdtsc() - insert_start;
+    metrics->insert_cycles += insert_cycles;
+    if (result != DOCA_SUCCESS) {
+        DOCA_LOG_ERR("Failed to add entry: %s", doca_error_get_descr(result));
+        metrics->insert_fails++;
+        // an entry whose completion is still pending is released by the callback
+        if (entry == NULL || ctx->status.nb_processed != 0)
+            flow_ctx_free(ctx);
+        else
+            ctx->orphaned = true;
+        return result;
+    }
+    metrics->inserts++;
+    latency_hist_record(&params->latency->insert, insert_cycles);
+    ctx->entry = entry;
+    if (params->nb_awaiting_hit < FIRST_HIT_TRACK_MAX) {
+        TAILQ_INSERT_TAIL(&params->awaiting_hit, ctx, hit_link);
+        params->nb_awaiting_hit++;
+        ctx->awaiting_hit = true;
+    }
+    pipe_mgr.add_entry(ctx);
 
-    std::ostringstream oss;
-    oss << "hairpin_"
-        << src_ip_str << ':' << ntohs(tcp_hdr->src_port)
-        << "->"
-        << dst_ip_str << ':' << ntohs(tcp_hdr->dst_port);
-    return oss.str();
+    send_first_packet(pkt, port_id_out, params);
+    return DOCA_SUCCESS;
 }
 
 void
 handle_packets(struct rte_mbuf* packets[],
                int nb_packets,
                int port_id_in,
+               uint64_t rx_tsc,
                struct pmd_params_t* params)
 {
+    struct lcore_metrics* metrics = params->metrics;
     struct rte_ether_hdr* eth_hdr;
     struct rte_ipv4_hdr* ipv4_hdr;
     struct rte_tcp_hdr* tcp_hdr;
@@ -56,39 +491,77 @@ handle_packets(struct rte_mbuf* packets[],
 
         if (eth_hdr->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4) ||
             ipv4_hdr->next_proto_id != IPPROTO_TCP) {
-            DOCA_LOG_INFO("Non-IPv4 TCP packet, skipping");
+            DOCA_LOG_DBG("Non-IPv4 TCP packet, skipping");
+            if (capture_enabled())
+                capture_packet(params, packets[packet_idx], port_id_in, NULL, rx_tsc, CAPTURE_PARSE_ERROR);
+            metrics->parse_errors++;
+            metrics->drops++;
+            rte_pktmbuf_free(packets[packet_idx]);
             continue;
         }
 
-        if (allow_offload(packets[packet_idx])) {
-            struct doca_flow_pipe_entry *entry;
-            struct entries_status status = {};
-
-            doca_error_t result = add_hairpin_pipe_entry(
-                params->ports,
-                port_id_in,
-                params->app_cfg->hairpin_queues[port_id_in][port_id_in^1],
-                params->app_cfg->hairpin_q_count,
-                params->hairpin_pipes[port_id_in],
-                ipv4_hdr->dst_addr,
-                ipv4_hdr->src_addr,
-                tcp_hdr->dst_port,
-                tcp_hdr->src_port,
-                params->queue_id,
-                &status,
-                &entry
-            );
-            if (result != DOCA_SUCCESS) {
-                DOCA_LOG_ERR("Failed to add entry: %s", doca_error_get_descr(result));
-                return;
+        if (params->verify_affinity)
+            check_affinity(ipv4_hdr, tcp_hdr, params);
+
+        struct flow_key key = {ipv4_hdr->src_addr, ipv4_hdr->dst_addr, tcp_hdr->src_port, tcp_hdr->dst_port};
+
+        if (params->emulated_hits) {
+            int port_id_out;
+            bool sampled;
+
+            // hairpinned by the simulated NIC, stands in for traffic which never reaches software
+            if (flow_backend->emulate_hit(port_id_in, &key, rte_pktmbuf_pkt_len(packets[packet_idx]), &port_id_out,
+                                          &sampled)) {
+                metrics->emulated_hits++;
+                if (sampled)
+                    sample_mirror(packets[packet_idx]);
+                if (port_id_out < 0) {
+                    metrics->emulated_drops++;
+                    metrics->drops++;
+                    rte_pktmbuf_free(packets[packet_idx]);
+                    continue;
+                }
+                if (rte_eth_tx_burst(port_id_out, params->queue_id, &packets[packet_idx], 1) != 1) {
+                    metrics->drops++;
+                    rte_pktmbuf_free(packets[packet_idx]);
+                }
+                continue;
             }
-            std::string entry_name = "hairpin" + tcp_hdr->dst_port + '_';
-            pipe_mgr.add_entry(create_entry_name(ipv4_hdr, tcp_hdr), entry);
+        }
+
+        if (params->verdict != NULL) {
+            if (capture_enabled())
+                capture_packet(params, packets[packet_idx], port_id_in, &key, rx_tsc, CAPTURE_HELD);
+            // the pmd keeps polling while the control thread decides
+            verdict_hold(params, packets[packet_idx], &key, port_id_in, rx_tsc);
+            continue;
+        }
+
+        if (allow_offload(packets[packet_idx])) {
+            int port_id_out = fwd_select_egress(params->fwd_cfg, port_id_in, &key);
+            // copied before the packet is sent, committed once the offload is known to have worked
+            struct rte_mbuf* copy =
+                capture_enabled() ? capture_copy(params, packets[packet_idx], port_id_in, &key, rx_tsc) : NULL;
+
+            doca_error_t result = offload_flow(packets[packet_idx], port_id_in, port_id_out,
+                                               params->fwd_cfg->default_meter, rx_tsc, params);
 
-            int nb_sent = rte_eth_tx_burst(port_id_in^1, 0, &packets[packet_idx], 1);
-            if (nb_sent != 1) {
-                DOCA_LOG_ERR("Failed to send packet");
+            if (result == DOCA_ERROR_AGAIN) {
+                capture_commit(params, copy, CAPTURE_DEFERRED);
+                continue;
+            }
+            if (result != DOCA_SUCCESS) {
+                // the flow stays on the software path, the next packet tries again
+                capture_commit(params, copy, CAPTURE_OFFLOAD_FAILED);
+                send_first_packet(packets[packet_idx], port_id_out, params);
+                continue;
             }
+            capture_commit(params, copy, CAPTURE_OFFLOADED);
+        } else {
+            if (capture_enabled())
+                capture_packet(params, packets[packet_idx], port_id_in, &key, rx_tsc, CAPTURE_DENIED);
+            metrics->drops++;
+            rte_pktmbuf_free(packets[packet_idx]);
         }
     }
 }
@@ -99,17 +572,69 @@ int start_pmd(void* pmd_params)
     struct rte_mbuf* packets[PACKET_BURST_SZ];
     int nb_packets;
 
-    while (1) {
-        for (int port_id_in = 0; port_id_in < NUM_PORTS; port_id_in++) {
+    const uint64_t first_hit_interval = FIRST_HIT_CHECK_INTERVAL_US * rte_get_tsc_hz() / 1000000;
+    const uint64_t aging_interval = AGING_HANDLE_INTERVAL_SEC * rte_get_tsc_hz();
+    uint64_t next_first_hit_check = 0, next_aging = 0, now;
+    int nb_rx;
+
+    params->metrics = &lcore_metrics[rte_lcore_id()];
+    params->latency = &lcore_latency[rte_lcore_id()];
+    params->emulated_hits = flow_backend->emulates_hits();
+    params->verify_affinity = params->fwd_cfg->verify_affinity;
+    params->budget.rate = params->fwd_cfg->insert_budget;
+    // enough for mice flows to get a token past the reserve
+    params->budget.burst = RTE_MAX(params->budget.rate * INSERT_BUDGET_BURST_MS / 1000, 4.0);
+    params->budget.tokens = params->budget.burst;
+    params->budget.last_tsc = rte_rdtsc();
+    init_idle_sleep(params);
+
+    while (!force_quit) {
+        now = rte_rdtsc();
+        nb_rx = 0;
+        for (int port_id_in = 0; port_id_in < params->app_cfg->port_config.nb_ports; port_id_in++) {
             nb_packets = rte_eth_rx_burst(port_id_in, params->queue_id, packets, PACKET_BURST_SZ);
             if (nb_packets == 0) {
                 continue;
             }
-            handle_packets(packets, nb_packets, port_id_in, params);
+            nb_rx += nb_packets;
+            params->metrics->rx_pkts += nb_packets;
+            for (int i = 0; i < nb_packets; i++)
+                params->metrics->rx_bytes += rte_pktmbuf_pkt_len(packets[i]);
+            handle_packets(packets, nb_packets, port_id_in, now, params);
+        }
+
+        if (params->verdict != NULL)
+            verdict_poll(params, now);
+        if (now >= next_first_hit_check) {
+            check_first_hits(params, now);
+            evict_pmd_poll(params);
+            next_first_hit_check = now + first_hit_interval;
+        }
+        if (now >= next_aging) {
+            handle_pipe_queue_aging(params->ports, params->app_cfg->port_config.nb_ports, params->queue_id);
+            next_aging = now + aging_interval;
+        }
+
+        params->metrics->polls++;
+        if (nb_rx > 0) {
+            params->empty_polls = 0;
+            params->metrics->busy_cycles += rte_rdtsc() - now;
+        } else {
+            params->metrics->empty_polls++;
+            pmd_idle(params, now);
+            params->metrics->idle_cycles += rte_rdtsc() - now;
         }
     }
+
+    if (params->verdict != NULL)
+        verdict_pmd_stop(params);
+    // collect the completions of removals still in flight on this queue
+    for (int port_id = 0; port_id < params->app_cfg->port_config.nb_ports; port_id++)
+        flow_backend->entries_process(params->ports[port_id], params->queue_id, DEFAULT_TIMEOUT_US, 0);
+    DOCA_LOG_INFO("PMD on lcore %u stopped", rte_lcore_id());
+    return 0;
 }
 
-void print_stats() {
-    pipe_mgr.print_stats();
+void print_stats(bool log) {
+    pipe_mgr.print_stats(log);
 }
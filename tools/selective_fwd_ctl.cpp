@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES, ALL RIGHTS RESERVED.
+ *
+ * This software product is a proprietary product of NVIDIA CORPORATION &
+ * AFFILIATES (the "Company") and all right, title, and interest in and to the
+ * software product, including all associated intellectual property rights, are
+ * and shall remain exclusively with the Company.
+ *
+ * This software product is governed by the End User License Agreement
+ * provided with the software product.
+ *
+ */
+
+/*
+ * Attaches as a DPDK secondary process to a doca-selective-fwd primary
+ * running with --multi-process, to print its stats, dump its flows or send it
+ * commands, see src/shm.cpp. Nothing here ever waits on the primary's pmds:
+ * counters are read word by word and the flows are copied under a sequence
+ * lock, retried when the primary publishes meanwhile.
+ */
+
+#include <rte_eal.h>
+#include <rte_errno.h>
+#include <rte_memzone.h>
+#include <rte_ring.h>
+
+#include "selective_fwd.h"
+
+// Longest wait for the primary to publish its flows
+#define PUBLISH_TIMEOUT_MS 2000
+#define PUBLISH_POLL_MS 10
+
+static const struct {
+    const char* name;
+    size_t offset;
+} counters[] = {
+    { "rx_pkts", offsetof(struct lcore_metrics, rx_pkts) },
+    { "tx_pkts", offsetof(struct lcore_metrics, tx_pkts) },
+    { "drops", offsetof(struct lcore_metrics, drops) },
+    { "parse_errors", offsetof(struct lcore_metrics, parse_errors) },
+    { "inserts", offsetof(struct lcore_metrics, inserts) },
+    { "insert_fails", offsetof(struct lcore_metrics, insert_fails) },
+    { "insert_deferrals", offsetof(struct lcore_metrics, insert_deferrals) },
+    { "evictions", offsetof(struct lcore_metrics, evictions) },
+    { "aggregated_flows", offsetof(struct lcore_metrics, aggregated_flows) },
+    { "verdict_timeouts", offsetof(struct lcore_metrics, verdict_timeouts) },
+};
+
+static volatile bool quit;
+
+/*
+ * Signal handler, stops printing rates
+ *
+ * @signum [in]: signal number
+ */
+static void
+signal_handler(int signum)
+{
+    (void)signum;
+    quit = true;
+}
+
+static void
+usage(const char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s [EAL options] -- <command>\n"
+            "  stats [interval_sec]  counters of all lcores, then rates every interval until the primary stops\n"
+            "  flows                 installed flows, at most %u of them\n"
+            "  reload-blocklist      reload the blocklist file of the primary\n"
+            "  stop                  stop the primary\n"
+            "EAL options must match the primary's, --file-prefix included; --proc-type=secondary is implied.\n",
+            prog, SHM_FLOWS_MAX);
+}
+
+/*
+ * Read a counter of an lcore of the primary
+ *
+ * @metrics [in]: shared counters
+ * @lcore_id [in]: lcore ID
+ * @offset [in]: offset of the counter within the per-lcore block
+ * @return: counter value
+ */
+static uint64_t
+counter_read(const struct shm_metrics* metrics, uint32_t lcore_id, size_t offset)
+{
+    return *(const volatile uint64_t*)((const char*)&metrics->lcores[lcore_id] + offset);
+}
+
+/*
+ * Sum of a counter over all lcores of the primary
+ *
+ * @metrics [in]: shared counters
+ * @offset [in]: offset of the counter within the per-lcore block
+ * @return: counter total
+ */
+static uint64_t
+counter_total(const struct shm_metrics* metrics, size_t offset)
+{
+    uint64_t total = 0;
+    // the control thread of the primary may join the lcores at any time
+    uint32_t nb_lcores = __atomic_load_n(&metrics->nb_lcores, __ATOMIC_ACQUIRE);
+
+    for (uint32_t i = 0; i < nb_lcores; i++)
+        total += counter_read(metrics, metrics->lcore_ids[i], offset);
+    return total;
+}
+
+/*
+ * Print the counter totals, then, with an interval, the rates and the load of
+ * every pmd lcore each interval
+ *
+ * @metrics [in]: shared counters
+ * @interval_sec [in]: seconds between rate prints, 0 to print the totals only
+ * @return: EXIT_SUCCESS
+ */
+static int
+show_stats(const struct shm_metrics* metrics, uint32_t interval_sec)
+{
+    uint64_t last[RTE_DIM(counters)];
+    uint64_t last_busy[RTE_MAX_LCORE] = {}, last_idle[RTE_MAX_LCORE] = {};
+
+    for (size_t i = 0; i < RTE_DIM(counters); i++) {
+        last[i] = counter_total(metrics, counters[i].offset);
+        printf("%s %lu\n", counters[i].name, last[i]);
+    }
+    if (interval_sec == 0)
+        return EXIT_SUCCESS;
+
+    while (!quit && metrics->running) {
+        char load[1024];
+        uint32_t nb_lcores;
+        int len = 0;
+
+        sleep(interval_sec);
+        for (size_t i = 0; i < RTE_DIM(counters); i++) {
+            uint64_t cur = counter_total(metrics, counters[i].offset);
+
+            printf("%s%s %.0f/s", i > 0 ? ", " : "", counters[i].name, (double)(cur - last[i]) / interval_sec);
+            last[i] = cur;
+        }
+        printf("\n");
+
+        nb_lcores = __atomic_load_n(&metrics->nb_lcores, __ATOMIC_ACQUIRE);
+        for (uint32_t i = 0; i < nb_lcores && len < (int)sizeof(load); i++) {
+            uint32_t lcore_id = metrics->lcore_ids[i];
+            uint64_t busy = counter_read(metrics, lcore_id, offsetof(struct lcore_metrics, busy_cycles));
+            uint64_t idle = counter_read(metrics, lcore_id, offsetof(struct lcore_metrics, idle_cycles));
+            uint64_t busy_delta = busy - last_busy[lcore_id];
+            uint64_t idle_delta = idle - last_idle[lcore_id];
+
+            if (lcore_id != metrics->control_lcore && busy_delta + idle_delta > 0)
+                len += snprintf(load + len, sizeof(load) - len, " lcore %u %lu%%", lcore_id,
+                                100 * busy_delta / (busy_delta + idle_delta));
+            last_busy[lcore_id] = busy;
+            last_idle[lcore_id] = idle;
+        }
+        printf("pmd busy:%s\n", len > 0 ? load : " idle");
+        fflush(stdout);
+    }
+    if (!metrics->running)
+        printf("Primary stopped\n");
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Ask the primary to publish its flows, wait for the publication and print a
+ * consistent copy of it
+ *
+ * @ring [in]: command ring of the primary
+ * @flows [in]: published flows
+ * @return: EXIT_SUCCESS on success and EXIT_FAILURE otherwise
+ */
+static int
+dump_flows(struct rte_ring* ring, const struct shm_flows* flows)
+{
+    std::vector<struct shm_flow> copy(SHM_FLOWS_MAX);
+    uint64_t generation = *(const volatile uint64_t*)&flows->generation;
+    uint32_t command = SHM_CMD_PUBLISH_FLOWS;
+    uint32_t nb_flows, nb_total, sn;
+    int waited_ms = 0;
+
+    if (rte_ring_mp_enqueue_elem(ring, &command, sizeof(command)) != 0) {
+        fprintf(stderr, "Command ring of the primary is full\n");
+        return EXIT_FAILURE;
+    }
+    while (*(const volatile uint64_t*)&flows->generation == generation) {
+        if (waited_ms >= PUBLISH_TIMEOUT_MS) {
+            fprintf(stderr, "Primary did not publish its flows within %d ms\n", PUBLISH_TIMEOUT_MS);
+            return EXIT_FAILURE;
+        }
+        usleep(PUBLISH_POLL_MS * 1000);
+        waited_ms += PUBLISH_POLL_MS;
+    }
+
+    do {
+        sn = rte_seqlock_read_begin(&flows->lock);
+        nb_flows = RTE_MIN(flows->nb_flows, (uint32_t)SHM_FLOWS_MAX);
+        nb_total = flows->nb_total;
+        memcpy(copy.data(), flows->flows, nb_flows * sizeof(struct shm_flow));
+    } while (rte_seqlock_read_retry(&flows->lock, sn));
+
+    for (uint32_t i = 0; i < nb_flows; i++) {
+        const struct shm_flow* flow = &copy[i];
+        char src_ip[INET_ADDRSTRLEN], dst_ip[INET_ADDRSTRLEN];
+
+        inet_ntop(AF_INET, &flow->src_ip, src_ip, sizeof(src_ip));
+        inet_ntop(AF_INET, &flow->dst_ip, dst_ip, sizeof(dst_ip));
+        printf("%s:%u -> %s:%u port %u -> %u, %lu packets, %lu bytes, idle %u s, meter profile %u%s\n", src_ip,
+               ntohs(flow->src_port), dst_ip, ntohs(flow->dst_port), flow->port_in, flow->port_out, flow->pkts,
+               flow->bytes, flow->idle_sec, flow->meter_profile, flow->provisioned ? ", provisioned" : "");
+    }
+    printf("%u of %u installed flows\n", nb_flows, nb_total);
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Send a command to the primary without waiting for it
+ *
+ * @ring [in]: command ring of the primary
+ * @command [in]: command
+ * @return: EXIT_SUCCESS on success and EXIT_FAILURE otherwise
+ */
+static int
+send_command(struct rte_ring* ring, uint32_t command)
+{
+    if (rte_ring_mp_enqueue_elem(ring, &command, sizeof(command)) != 0) {
+        fprintf(stderr, "Command ring of the primary is full\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int
+main(int argc, char** argv)
+{
+    static char proc_type[] = "--proc-type=secondary";
+    std::vector<char*> eal_argv(argv, argv + argc);
+    const struct rte_memzone *metrics_mz, *flows_mz;
+    struct rte_ring* ring;
+    const char* command;
+    int ret, exit_status;
+
+    eal_argv.insert(eal_argv.begin() + 1, proc_type);
+    ret = rte_eal_init(eal_argv.size(), eal_argv.data());
+    if (ret < 0) {
+        fprintf(stderr, "Failed to attach to the primary: %s\n", rte_strerror(rte_errno));
+        return EXIT_FAILURE;
+    }
+    // the program name is left in front of the arguments past the EAL options
+    argc = eal_argv.size() - ret;
+    argv = eal_argv.data() + ret;
+    if (argc < 2) {
+        usage(argv[0]);
+        rte_eal_cleanup();
+        return EXIT_FAILURE;
+    }
+    command = argv[1];
+
+    metrics_mz = rte_memzone_lookup(SHM_METRICS_MZ);
+    flows_mz = rte_memzone_lookup(SHM_FLOWS_MZ);
+    ring = rte_ring_lookup(SHM_CTRL_RING);
+    if (metrics_mz == NULL || flows_mz == NULL || ring == NULL) {
+        fprintf(stderr, "No primary running with --multi-process\n");
+        rte_eal_cleanup();
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    if (strcmp(command, "stats") == 0) {
+        exit_status = show_stats((const struct shm_metrics*)metrics_mz->addr,
+                                  argc > 2 ? strtoul(argv[2], NULL, 0) : 0);
+    } else if (strcmp(command, "flows") == 0) {
+        exit_status = dump_flows(ring, (const struct shm_flows*)flows_mz->addr);
+    } else if (strcmp(command, "reload-blocklist") == 0) {
+        exit_status = send_command(ring, SHM_CMD_RELOAD_BLOCKLIST);
+    } else if (strcmp(command, "stop") == 0) {
+        exit_status = send_command(ring, SHM_CMD_STOP);
+    } else {
+        usage(argv[0]);
+        exit_status = EXIT_FAILURE;
+    }
+
+    rte_eal_cleanup();
+    return exit_status;
+}